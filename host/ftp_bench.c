@@ -0,0 +1,449 @@
+/*
+ * ftp_bench.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+// Benchmark client for the host build. It logs in over the lwIP loopback
+// interface like any client would and times the NOOP round trip, STOR,
+// RETR and LIST.
+
+#include "ftp.h"
+#include "ftp_host.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// file the benchmark writes, reads and deletes
+#define FTP_BENCH_FILE			"bench.bin"
+
+// stack of a parallel client, a thread on the host
+#define FTP_BENCH_STACK_SIZE	4096
+
+// wait before a refused client tries again (ms)
+#define FTP_BENCH_RETRY_MS		20
+
+// directory of the listing benchmark and the subdirectories of each of
+// its directories
+#define FTP_BENCH_TREE			"benchtree"
+#define FTP_BENCH_TREE_FANOUT	20
+
+// small files read to time the 150 and 226 replies with and without Nagle
+#define FTP_BENCH_CTRL_FILE		"ctrl.bin"
+#define FTP_BENCH_CTRL_ROUNDS	50
+
+// directory of the lookup benchmark, and the lookups timed at each size
+#define FTP_BENCH_STAT_DIR		"benchstat"
+#define FTP_BENCH_STAT_ROUNDS	200
+
+// state of the parallel clients
+static const char *ftp_bench_par_cmd;
+static uint32_t ftp_bench_par_bytes;
+static volatile uint32_t ftp_bench_par_left;
+static volatile uint32_t ftp_bench_par_failed;
+
+// print a throughput line
+static void ftp_bench_print(const char *what, uint32_t bytes, uint32_t us) {
+	if (us == 0)
+		us = 1;
+	printf("%-5s %10lu bytes %8lu us %8lu kB/s\n", what, (unsigned long) bytes, (unsigned long) us,
+			(unsigned long) ((uint64_t) bytes * 1000000 / 1024 / us));
+}
+
+// NOOP round trips
+static int ftp_bench_noop(ftp_client_t *c, uint32_t rounds) {
+	uint32_t total = 0, worst = 0;
+
+	for (uint32_t i = 0; i < rounds; i++) {
+		uint32_t start = ftp_time_us();
+		if (ftp_client_cmd(c, "NOOP") != 200)
+			return -1;
+		uint32_t us = ftp_time_us() - start;
+		total += us;
+		if (us > worst)
+			worst = us;
+	}
+
+	if (rounds)
+		printf("NOOP  %10lu rounds  %8lu us avg %6lu us max\n", (unsigned long) rounds, (unsigned long) (total / rounds),
+				(unsigned long) worst);
+	return 0;
+}
+
+// command latency of a session with Nagle on the control connection and
+// of one without. A RETR answers with 150 and 226, the 226 is what Nagle
+// holds back until the 150 is acknowledged.
+static int ftp_bench_ctrl(uint32_t rounds) {
+	uint32_t bytes;
+	ftp_client_t c;
+	int ret = 0;
+
+	for (uint8_t nodelay = 0; nodelay <= 1 && ret == 0; nodelay++) {
+		// applies to sessions that start from now on
+		ftp_set_ctrl_nodelay(nodelay);
+
+		ret = ftp_client_open(&c);
+		if (ret == 0)
+			ret = ftp_client_stor(&c, FTP_BENCH_CTRL_FILE, 64);
+
+		uint32_t noop = 0, retr = 0;
+		for (uint32_t i = 0; i < rounds && ret == 0; i++) {
+			uint32_t start = ftp_time_us();
+			if (ftp_client_cmd(&c, "NOOP") != 200)
+				ret = -1;
+			noop += ftp_time_us() - start;
+		}
+		for (uint32_t i = 0; i < FTP_BENCH_CTRL_ROUNDS && ret == 0; i++) {
+			uint32_t start = ftp_time_us();
+			ret = ftp_client_get(&c, "RETR " FTP_BENCH_CTRL_FILE, &bytes);
+			retr += ftp_time_us() - start;
+		}
+
+		if (ret == 0)
+			printf("ctrl  %-7s  %8lu us NOOP %6lu us RETR\n", nodelay ? "nodelay" : "nagle",
+					(unsigned long) (rounds ? noop / rounds : 0), (unsigned long) (retr / FTP_BENCH_CTRL_ROUNDS));
+
+		ftp_client_cmd(&c, "DELE " FTP_BENCH_CTRL_FILE);
+		ftp_client_close(&c);
+	}
+
+	ftp_set_ctrl_nodelay(FTP_CTRL_NODELAY);
+	return ret;
+}
+
+// upload the benchmark file
+static int ftp_bench_stor(ftp_client_t *c, uint32_t bytes) {
+	uint32_t start = ftp_time_us();
+	if (ftp_client_stor(c, FTP_BENCH_FILE, bytes) != 0)
+		return -1;
+	ftp_bench_print("STOR", bytes, ftp_time_us() - start);
+	return 0;
+}
+
+// download a file or a listing
+static int ftp_bench_get(ftp_client_t *c, const char *what, const char *cmd) {
+	uint32_t bytes;
+	uint32_t start = ftp_time_us();
+	if (ftp_client_get(c, cmd, &bytes) != 0)
+		return -1;
+	ftp_bench_print(what, bytes, ftp_time_us() - start);
+	return 0;
+}
+
+// one of the parallel clients, runs ftp_bench_par_cmd on its own file
+static void ftp_bench_par_task(void *param) {
+	uint32_t id = (uintptr_t) param;
+	uint32_t bytes = 0;
+	ftp_client_t c;
+	char name[16];
+	int ret;
+
+	snprintf(name, sizeof(name), "par%lu.bin", (unsigned long) id);
+
+	// sessions are limited, wait for one
+	while ((ret = ftp_client_open(&c)) == -2) {
+		ftp_client_close(&c);
+		vTaskDelay(pdMS_TO_TICKS(FTP_BENCH_RETRY_MS));
+	}
+
+	if (ret == 0) {
+		if (!strcmp(ftp_bench_par_cmd, "STOR"))
+			ret = ftp_client_stor(&c, name, ftp_bench_par_bytes);
+		else {
+			char cmd[24];
+			snprintf(cmd, sizeof(cmd), "RETR %s", name);
+			ret = ftp_client_get(&c, cmd, &bytes);
+			ftp_client_cmd(&c, "DELE %s", name);
+		}
+	}
+	ftp_client_close(&c);
+
+	taskENTER_CRITICAL();
+	if (ret != 0)
+		ftp_bench_par_failed++;
+	ftp_bench_par_left--;
+	taskEXIT_CRITICAL();
+
+	vTaskDelete(NULL);
+}
+
+// run a command on n clients at the same time, print the combined rate
+static int ftp_bench_par_run(const char *cmd, uint32_t n, uint32_t bytes) {
+	char what[16];
+
+	ftp_bench_par_cmd = cmd;
+	ftp_bench_par_bytes = bytes;
+	ftp_bench_par_left = n;
+	ftp_bench_par_failed = 0;
+
+	uint32_t start = ftp_time_us();
+	for (uint32_t i = 0; i < n; i++) {
+		if (xTaskCreate(ftp_bench_par_task, "ftp_par", FTP_BENCH_STACK_SIZE, (void *) (uintptr_t) i, FTP_TASK_PRIORITY, NULL) != pdPASS) {
+			taskENTER_CRITICAL();
+			ftp_bench_par_failed++;
+			ftp_bench_par_left--;
+			taskEXIT_CRITICAL();
+		}
+	}
+
+	// wait for all
+	while (ftp_bench_par_left > 0)
+		vTaskDelay(1);
+
+	snprintf(what, sizeof(what), "%sx%lu", cmd, (unsigned long) n);
+	ftp_bench_print(what, n * bytes, ftp_time_us() - start);
+	return ftp_bench_par_failed ? -1 : 0;
+}
+
+// combined throughput of 2, 4 and 8 transfers at the same time
+static int ftp_bench_parallel(const ftp_bench_opts_t *opts) {
+	uint32_t bytes = opts->file_kb * 1024;
+
+	printf("parallel, %d sessions at a time\n", FTP_NBR_CLIENTS);
+	for (uint32_t n = 2; n <= 8; n *= 2) {
+		if (ftp_bench_par_run("STOR", n, bytes) != 0)
+			return -1;
+		if (ftp_bench_par_run("RETR", n, bytes) != 0)
+			return -1;
+	}
+
+#if FTP_IOSCHED == 1
+	uint32_t requests, runs, waits;
+	ftps_f_iosched_stats(&requests, &runs, &waits);
+	printf("io    %lu requests in %lu runs, %lu waited\n", (unsigned long) requests, (unsigned long) runs, (unsigned long) waits);
+#endif
+	return 0;
+}
+
+#if FTP_LIST_RECURSIVE == 1
+// CWD and LIST in every directory of the tree
+static int ftp_bench_tree_dirs(ftp_client_t *c, uint32_t dirs, uint32_t *bytes) {
+	uint32_t subs = dirs / FTP_BENCH_TREE_FANOUT > 1 ? dirs / FTP_BENCH_TREE_FANOUT - 1 : 0;
+	uint32_t got;
+
+	for (uint32_t top = 0; top < FTP_BENCH_TREE_FANOUT; top++) {
+		for (uint32_t sub = 0; sub <= subs; sub++) {
+			// the top directory itself first
+			if (sub == 0 && ftp_client_cmd(c, "CWD /" FTP_BENCH_TREE "/t%02lu", (unsigned long) top) != 250)
+				return -1;
+			if (sub > 0 && ftp_client_cmd(c, "CWD /" FTP_BENCH_TREE "/t%02lu/s%02lu", (unsigned long) top, (unsigned long) sub - 1) != 250)
+				return -1;
+			if (ftp_client_get(c, "LIST", &got) != 0)
+				return -1;
+			*bytes += got;
+		}
+	}
+	return 0;
+}
+
+// a tree listed the way mirroring tools do it, one data connection per
+// directory, then in a single LIST -R
+static int ftp_bench_tree(ftp_client_t *c, uint32_t dirs) {
+	uint32_t subs = dirs / FTP_BENCH_TREE_FANOUT > 1 ? dirs / FTP_BENCH_TREE_FANOUT - 1 : 0;
+	uint32_t bytes = 0;
+	int ret = -1;
+
+	printf("tree of %lu directories\n", (unsigned long) (FTP_BENCH_TREE_FANOUT * (subs + 1)));
+
+	// build it, not timed
+	if (ftp_client_cmd(c, "MKD /" FTP_BENCH_TREE) != 257)
+		return -1;
+	for (uint32_t top = 0; top < FTP_BENCH_TREE_FANOUT; top++) {
+		if (ftp_client_cmd(c, "MKD /" FTP_BENCH_TREE "/t%02lu", (unsigned long) top) != 257)
+			goto out;
+		for (uint32_t sub = 0; sub < subs; sub++)
+			if (ftp_client_cmd(c, "MKD /" FTP_BENCH_TREE "/t%02lu/s%02lu", (unsigned long) top, (unsigned long) sub) != 257)
+				goto out;
+	}
+
+	// one by one
+	uint32_t start = ftp_time_us();
+	if (ftp_bench_tree_dirs(c, dirs, &bytes) != 0)
+		goto out;
+	uint32_t us = ftp_time_us() - start;
+	ftp_bench_print("LISTx", bytes, us);
+
+	// in one go
+	if (ftp_client_cmd(c, "CWD /" FTP_BENCH_TREE) != 250)
+		goto out;
+	start = ftp_time_us();
+	if (ftp_client_get(c, "LIST -R", &bytes) != 0)
+		goto out;
+	uint32_t us_tree = ftp_time_us() - start;
+	ftp_bench_print("LIST-R", bytes, us_tree);
+	printf("LIST -R is %lu.%lu times faster\n", (unsigned long) (us / (us_tree ? us_tree : 1)),
+			(unsigned long) (us * 10 / (us_tree ? us_tree : 1) % 10));
+	ret = 0;
+
+out:
+	// clean up, deepest first
+	for (uint32_t top = 0; top < FTP_BENCH_TREE_FANOUT; top++) {
+		for (uint32_t sub = 0; sub < subs; sub++)
+			ftp_client_cmd(c, "RMD /" FTP_BENCH_TREE "/t%02lu/s%02lu", (unsigned long) top, (unsigned long) sub);
+		ftp_client_cmd(c, "RMD /" FTP_BENCH_TREE "/t%02lu", (unsigned long) top);
+	}
+	ftp_client_cmd(c, "RMD /" FTP_BENCH_TREE);
+	ftp_client_cmd(c, "CWD /");
+	return ret;
+}
+#endif
+
+// name of a file of the lookup benchmark, long like a log file so each
+// takes several directory entries
+static void ftp_bench_stat_name(char *buf, size_t size, uint32_t n) {
+	snprintf(buf, size, "/" FTP_BENCH_STAT_DIR "/log-%06lu-entry.txt", (unsigned long) n);
+}
+
+// average time of a stat of one of the first files, or of missing files,
+// -1 if a stat got the wrong answer
+static int ftp_bench_stat_avg(uint32_t files, uint8_t missing, uint32_t *seed, uint32_t *avg_us) {
+	char path[64];
+	FILINFO nfo;
+
+	uint32_t start = ftp_time_us();
+	for (uint32_t i = 0; i < FTP_BENCH_STAT_ROUNDS; i++) {
+		*seed = *seed * 1103515245 + 12345;
+		ftp_bench_stat_name(path, sizeof(path), (*seed >> 8) % files + (missing ? files : 0));
+		if ((ftps_f_stat(path, &nfo) == FR_OK) == missing)
+			return -1;
+	}
+	*avg_us = (ftp_time_us() - start) / FTP_BENCH_STAT_ROUNDS;
+	return 0;
+}
+
+// stat and SIZE in a directory that grows to the given number of files,
+// 10 times more at each step. The files are made on the volume directly,
+// FatFs scans the directory for every new name so that takes a while.
+static int ftp_bench_stat(ftp_client_t *c, uint32_t max) {
+	uint32_t files = 0, seed = 1;
+	char path[64];
+	ftp_file_t file;
+	FILINFO nfo;
+	int ret = -1;
+
+	if (ftps_f_mkdir("/" FTP_BENCH_STAT_DIR) != FR_OK)
+		return -1;
+
+	for (uint32_t size = 100; files < max; size *= 10) {
+		if (size > max)
+			size = max;
+
+		// not timed
+		for (; files < size; files++) {
+			ftp_bench_stat_name(path, sizeof(path), files);
+			if (ftps_f_open(&file, path, FA_CREATE_NEW | FA_WRITE) != FR_OK)
+				goto out;
+			ftps_f_close(&file);
+		}
+
+		// the first one in the directory builds its index
+		uint32_t start = ftp_time_us();
+		ftp_bench_stat_name(path, sizeof(path), files / 2);
+		if (ftps_f_stat(path, &nfo) != FR_OK)
+			goto out;
+		uint32_t first = ftp_time_us() - start;
+
+		uint32_t hit, miss;
+		if (ftp_bench_stat_avg(files, 0, &seed, &hit) != 0 || ftp_bench_stat_avg(files, 1, &seed, &miss) != 0)
+			goto out;
+
+		// what a client sees
+		start = ftp_time_us();
+		for (uint32_t i = 0; i < FTP_BENCH_STAT_ROUNDS; i++) {
+			seed = seed * 1103515245 + 12345;
+			ftp_bench_stat_name(path, sizeof(path), (seed >> 8) % files);
+			if (ftp_client_cmd(c, "SIZE %s", path) != 213)
+				goto out;
+		}
+		uint32_t size_us = (ftp_time_us() - start) / FTP_BENCH_STAT_ROUNDS;
+
+		printf("stat  %6lu files  %8lu us first %6lu us hit %6lu us miss %6lu us SIZE\n", (unsigned long) files,
+				(unsigned long) first, (unsigned long) hit, (unsigned long) miss, (unsigned long) size_us);
+	}
+	ret = 0;
+
+out:
+	// clean up
+	while (files > 0) {
+		ftp_bench_stat_name(path, sizeof(path), --files);
+		ftps_f_unlink(path);
+	}
+	ftps_f_unlink("/" FTP_BENCH_STAT_DIR);
+	return ret;
+}
+
+// STOR, RETR and LIST in the working directory
+static int ftp_bench_files(ftp_client_t *c, const ftp_bench_opts_t *opts) {
+	if (ftp_bench_stor(c, opts->file_kb * 1024) != 0)
+		return -1;
+	if (ftp_bench_get(c, "RETR", "RETR " FTP_BENCH_FILE) != 0)
+		return -1;
+	if (ftp_bench_get(c, "LIST", "LIST") != 0)
+		return -1;
+
+	// clean up
+	ftp_client_cmd(c, "DELE " FTP_BENCH_FILE);
+	return 0;
+}
+
+int ftp_bench_run(const ftp_bench_opts_t *opts) {
+	ftp_client_t c;
+	int ret = -1;
+
+	// the control connection with and without Nagle, in sessions of
+	// their own
+	if (ftp_bench_ctrl(opts->rounds) != 0) {
+		printf("control connection benchmark failed\n");
+		return -1;
+	}
+
+	// connect and log in
+	if (ftp_client_open(&c) != 0)
+		goto out;
+
+	// the measurements
+	if (ftp_bench_noop(&c, opts->rounds) != 0)
+		goto out;
+
+#if FTP_FS_BACKENDS == 1
+	// transfers on every backend
+	const ftp_fs_t *fs;
+	const char *prefix;
+	for (uint8_t i = 0; (prefix = ftp_fs_mount_get(i, &fs)) != NULL; i++) {
+		printf("%s on %s\n", fs->name, prefix);
+		if (ftp_client_cmd(&c, "CWD %s", prefix) != 250)
+			goto out;
+		if (ftp_bench_files(&c, opts) != 0)
+			goto out;
+	}
+#else
+	if (ftp_bench_files(&c, opts) != 0)
+		goto out;
+#endif
+
+#if FTP_LIST_RECURSIVE == 1
+	// listing a tree
+	if (opts->tree_dirs && ftp_bench_tree(&c, opts->tree_dirs) != 0)
+		goto out;
+#endif
+
+	// looking up names in a large directory
+	if (opts->stat_files && ftp_bench_stat(&c, opts->stat_files) != 0)
+		goto out;
+	ret = 0;
+
+out:
+	if (ret != 0)
+		printf("benchmark failed, last reply: %s", c.reply);
+	ftp_client_close(&c);
+
+	// transfers at the same time, with our session out of the way
+	if (ret == 0 && opts->parallel && ftp_bench_parallel(opts) != 0) {
+		printf("parallel benchmark failed\n");
+		ret = -1;
+	}
+	return ret;
+}
@@ -0,0 +1,209 @@
+/*
+ * ftp_client.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+// Minimal FTP client over netconn for the host benchmarks. All data
+// connections are passive.
+
+#include "ftp.h"
+#include "ftp_host.h"
+
+#include "lwip/api.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+// size of a block sent with STOR
+#define FTP_CLIENT_BLOCK		1460
+
+// read a reply, returns its code or -1 if the connection broke
+int ftp_client_reply(ftp_client_t *c) {
+	while (1) {
+		char *end;
+
+		// complete lines in the buffer?
+		while ((end = memchr(c->buf, '\n', c->len)) != NULL) {
+			uint16_t n = end - c->buf + 1;
+
+			// the last line of a reply has a space after the code
+			int code = (n >= 4 && c->buf[3] == ' ') ? atoi(c->buf) : 0;
+			if (code) {
+				uint16_t keep = n < sizeof(c->reply) ? n : sizeof(c->reply) - 1;
+				memcpy(c->reply, c->buf, keep);
+				c->reply[keep] = 0;
+			}
+
+			// drop the line
+			memmove(c->buf, c->buf + n, c->len - n);
+			c->len -= n;
+
+			if (code)
+				return code;
+		}
+
+		// line longer than the buffer? drop it
+		if (c->len == sizeof(c->buf))
+			c->len = 0;
+
+		// need more
+		struct netbuf *nb;
+		if (netconn_recv(c->conn, &nb) != ERR_OK)
+			return -1;
+		do {
+			void *data;
+			u16_t len;
+			netbuf_data(nb, &data, &len);
+			if (len > sizeof(c->buf) - c->len)
+				len = sizeof(c->buf) - c->len;
+			memcpy(c->buf + c->len, data, len);
+			c->len += len;
+		} while (netbuf_next(nb) >= 0);
+		netbuf_delete(nb);
+	}
+}
+
+// send a command and read the reply
+int ftp_client_cmd(ftp_client_t *c, const char *fmt, ...) {
+	char line[128];
+	va_list args;
+
+	va_start(args, fmt);
+	int len = vsnprintf(line, sizeof(line) - 2, fmt, args);
+	va_end(args);
+
+	// a command cut short would do something else, don't send it
+	if (len < 0 || len >= (int) sizeof(line) - 2)
+		return -1;
+	strcpy(line + len, "\r\n");
+
+	if (netconn_write(c->conn, line, len + 2, NETCONN_COPY) != ERR_OK)
+		return -1;
+	return ftp_client_reply(c);
+}
+
+// enter passive mode and connect to the data port
+struct netconn *ftp_client_pasv(ftp_client_t *c) {
+	unsigned h[4], p[2];
+	ip_addr_t addr;
+
+	if (ftp_client_cmd(c, "PASV") != 227)
+		return NULL;
+
+	// (h1,h2,h3,h4,p1,p2)
+	char *open = strchr(c->reply, '(');
+	if (open == NULL || sscanf(open, "(%u,%u,%u,%u,%u,%u)", &h[0], &h[1], &h[2], &h[3], &p[0], &p[1]) != 6)
+		return NULL;
+	IP_ADDR4(&addr, h[0], h[1], h[2], h[3]);
+
+	struct netconn *data = netconn_new(NETCONN_TCP);
+	if (data == NULL)
+		return NULL;
+	if (netconn_connect(data, &addr, p[0] << 8 | p[1]) != ERR_OK) {
+		netconn_delete(data);
+		return NULL;
+	}
+	return data;
+}
+
+// receive until the server closes, returns the byte count
+uint32_t ftp_client_drain(struct netconn *data) {
+	uint32_t total = 0;
+	struct pbuf *p;
+
+	while (netconn_recv_tcp_pbuf(data, &p) == ERR_OK) {
+		total += p->tot_len;
+		pbuf_free(p);
+	}
+	return total;
+}
+
+int ftp_client_open(ftp_client_t *c) {
+	ip_addr_t addr;
+
+	memset(c, 0, sizeof(*c));
+
+	// connect to the server
+	IP_ADDR4(&addr, 127, 0, 0, 1);
+	c->conn = netconn_new(NETCONN_TCP);
+	if (c->conn == NULL)
+		return -1;
+	if (netconn_connect(c->conn, &addr, FTP_SERVER_PORT) != ERR_OK)
+		return -1;
+
+	// welcome, or refused because the server is full
+	int code = ftp_client_reply(c);
+	if (code == 421)
+		return -2;
+	if (code != 220)
+		return -1;
+
+	// log in
+	if (ftp_client_cmd(c, "USER " FTP_USER_NAME_DEFAULT) != 331 || ftp_client_cmd(c, "PASS " FTP_USER_PASS_DEFAULT) != 230)
+		return -1;
+	if (ftp_client_cmd(c, "TYPE I") != 200)
+		return -1;
+
+	return 0;
+}
+
+void ftp_client_close(ftp_client_t *c) {
+	if (c->conn == NULL)
+		return;
+
+	// say goodbye, the reply doesn't matter
+	netconn_write(c->conn, "QUIT\r\n", 6, NETCONN_NOCOPY);
+	netconn_close(c->conn);
+	netconn_delete(c->conn);
+	c->conn = NULL;
+}
+
+int ftp_client_stor(ftp_client_t *c, const char *name, uint32_t bytes) {
+	// the content doesn't matter, shared by all clients
+	static const uint8_t block[FTP_CLIENT_BLOCK];
+	struct netconn *data = ftp_client_pasv(c);
+	if (data == NULL)
+		return -1;
+
+	if (ftp_client_cmd(c, "STOR %s", name) / 100 != 1) {
+		netconn_delete(data);
+		return -1;
+	}
+
+	// send the file
+	uint32_t left = bytes;
+	while (left > 0) {
+		uint32_t len = left < sizeof(block) ? left : sizeof(block);
+		if (netconn_write(data, block, len, NETCONN_NOCOPY) != ERR_OK)
+			break;
+		left -= len;
+	}
+	netconn_close(data);
+	netconn_delete(data);
+
+	// stored?
+	if (ftp_client_reply(c) / 100 != 2 || left > 0)
+		return -1;
+	return 0;
+}
+
+int ftp_client_get(ftp_client_t *c, const char *cmd, uint32_t *bytes) {
+	struct netconn *data = ftp_client_pasv(c);
+	if (data == NULL)
+		return -1;
+
+	if (ftp_client_cmd(c, "%s", cmd) / 100 != 1) {
+		netconn_delete(data);
+		return -1;
+	}
+
+	*bytes = ftp_client_drain(data);
+	netconn_delete(data);
+
+	if (ftp_client_reply(c) / 100 != 2)
+		return -1;
+	return 0;
+}
@@ -0,0 +1,311 @@
+/*
+ * ftp_diskio.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+// FatFs disk functions for the host build. The single drive is a disk
+// image, in a file or in memory, with the timing of a simulated card.
+
+#include "ftp.h"
+#include "ftp_host.h"
+
+#include "ff.h"
+#include "diskio.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// sector size of the image
+#define FTP_DISK_SECTOR_SIZE	512
+
+// built in card models
+static const ftp_disk_model_t ftp_disk_models[] = {
+	// image file as fast as the host allows
+	{ "none", 0, 0, 0, 0, 0, 0, 0 },
+	// UHS-I card on a 4 bit SDIO bus, 4 MB allocation units
+	{ "sdio", 100, 25, 50, 8192, 2000, 256, 20000 },
+	// card in SPI mode at 25 MHz, 128 kB erase blocks
+	{ "spi", 200, 200, 250, 256, 5000, 128, 50000 },
+	// cheap card with long garbage collection pauses
+	{ "slow", 500, 400, 800, 8192, 20000, 64, 250000 },
+};
+
+// open image
+static int ftp_disk_fd = -1;
+static uint8_t *ftp_disk_ram = NULL;
+static DWORD ftp_disk_sectors = 0;
+
+// selected timing and state of the simulation
+static const ftp_disk_model_t *ftp_disk_model = &ftp_disk_models[0];
+static DWORD ftp_disk_open_block = (DWORD) -1;
+static uint32_t ftp_disk_seed = 1;
+
+// request log and counters
+static FILE *ftp_disk_log = NULL;
+static uint32_t ftp_disk_reads, ftp_disk_writes, ftp_disk_syncs;
+static uint64_t ftp_disk_read_sectors, ftp_disk_write_sectors;
+static uint64_t ftp_disk_wait_us;
+static uint32_t ftp_disk_stalls, ftp_disk_gcs;
+
+int ftp_host_disk_open(const char *path, uint8_t in_ram) {
+	struct stat st;
+
+	// open read and write
+	ftp_disk_fd = open(path, O_RDWR);
+	if (ftp_disk_fd < 0)
+		return -1;
+
+	// size in sectors
+	if (fstat(ftp_disk_fd, &st) != 0)
+		goto fail;
+	ftp_disk_sectors = st.st_size / FTP_DISK_SECTOR_SIZE;
+
+	// load in memory?
+	if (in_ram) {
+		ftp_disk_ram = malloc(st.st_size);
+		if (ftp_disk_ram == NULL || pread(ftp_disk_fd, ftp_disk_ram, st.st_size, 0) != st.st_size)
+			goto fail;
+	}
+
+	return 0;
+
+fail:
+	free(ftp_disk_ram);
+	ftp_disk_ram = NULL;
+	close(ftp_disk_fd);
+	ftp_disk_fd = -1;
+	return -1;
+}
+
+int ftp_host_disk_model(const char *name) {
+	for (uint32_t i = 0; i < sizeof(ftp_disk_models) / sizeof(ftp_disk_models[0]); i++) {
+		if (!strcmp(name, ftp_disk_models[i].name)) {
+			ftp_disk_model = &ftp_disk_models[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void ftp_host_disk_models(void) {
+	for (uint32_t i = 0; i < sizeof(ftp_disk_models) / sizeof(ftp_disk_models[0]); i++)
+		printf(" %s", ftp_disk_models[i].name);
+	printf("\n");
+}
+
+int ftp_host_disk_trace(const char *path) {
+	ftp_disk_log = fopen(path, "w");
+	if (ftp_disk_log == NULL)
+		return -1;
+	fprintf(ftp_disk_log, "time_us,op,sector,count,latency_us\n");
+	return 0;
+}
+
+void ftp_host_disk_report(void) {
+	printf("disk  %lu reads %llu sectors, %lu writes %llu sectors, %lu syncs\n", (unsigned long) ftp_disk_reads,
+			(unsigned long long) ftp_disk_read_sectors, (unsigned long) ftp_disk_writes, (unsigned long long) ftp_disk_write_sectors,
+			(unsigned long) ftp_disk_syncs);
+	printf("disk  model %s, %llu us waited, %lu program stalls, %lu gc pauses\n", ftp_disk_model->name,
+			(unsigned long long) ftp_disk_wait_us, (unsigned long) ftp_disk_stalls, (unsigned long) ftp_disk_gcs);
+
+#if FTP_BCACHE == 1
+	ftp_bcache_stats_t stats;
+	ftp_bcache_get_stats(&stats);
+	printf("cache %lu of %lu reads hit, %lu of %lu sectors, %lu device reads (%lu read ahead), %u FAT/dir sectors held\n",
+			(unsigned long) stats.hits, (unsigned long) stats.reads, (unsigned long) stats.sectors_hit, (unsigned long) stats.sectors,
+			(unsigned long) stats.device_reads, (unsigned long) stats.readaheads, stats.meta_blocks);
+#endif
+	if (ftp_disk_log != NULL)
+		fflush(ftp_disk_log);
+}
+
+// wait like a card driver would, whole ticks block so other tasks run
+// like they would during DMA, the rest is polled
+static void ftp_disk_wait(uint32_t us) {
+	uint32_t start = ftp_time_us();
+	uint32_t tick_us = 1000000 / configTICK_RATE_HZ;
+
+	if (us >= tick_us)
+		vTaskDelay(us / tick_us);
+	while ((uint32_t) (ftp_time_us() - start) < us)
+		;
+}
+
+// pseudo random and repeatable, xorshift
+static uint32_t ftp_disk_random(void) {
+	ftp_disk_seed ^= ftp_disk_seed << 13;
+	ftp_disk_seed ^= ftp_disk_seed >> 17;
+	ftp_disk_seed ^= ftp_disk_seed << 5;
+	return ftp_disk_seed;
+}
+
+// latency of a write, counts the stalls
+static uint32_t ftp_disk_write_latency(DWORD sector, UINT count) {
+	const ftp_disk_model_t *m = ftp_disk_model;
+	uint32_t us = m->cmd_us + count * m->write_sector_us;
+
+	// programming of each erase block the write moves to
+	if (m->erase_block_sectors > 0) {
+		DWORD first = sector / m->erase_block_sectors;
+		DWORD last = (sector + count - 1) / m->erase_block_sectors;
+		for (DWORD block = first; block <= last; block++) {
+			if (block != ftp_disk_open_block) {
+				us += m->program_us;
+				ftp_disk_stalls++;
+			}
+		}
+		ftp_disk_open_block = last;
+	}
+
+	// garbage collection now and then
+	if (m->gc_every > 0 && ftp_disk_random() % m->gc_every == 0) {
+		us += m->gc_us;
+		ftp_disk_gcs++;
+	}
+
+	return us;
+}
+
+// log a request
+static void ftp_disk_record(char op, DWORD sector, UINT count, uint32_t us) {
+	ftp_disk_wait_us += us;
+	if (ftp_disk_log != NULL)
+		fprintf(ftp_disk_log, "%lu,%c,%lu,%u,%lu\n", (unsigned long) ftp_time_us(), op, (unsigned long) sector, count,
+				(unsigned long) us);
+}
+
+DSTATUS disk_status(BYTE pdrv) {
+	// only drive 0 and only with an image
+	if (pdrv != 0 || ftp_disk_fd < 0)
+		return STA_NOINIT | STA_NODISK;
+	return 0;
+}
+
+// the image, below the block cache
+static DRESULT ftp_disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+	if (disk_status(pdrv))
+		return RES_NOTRDY;
+
+	// out of range?
+	if (sector + count > ftp_disk_sectors)
+		return RES_PARERR;
+
+	size_t len = (size_t) count * FTP_DISK_SECTOR_SIZE;
+	off_t offset = (off_t) sector * FTP_DISK_SECTOR_SIZE;
+	if (ftp_disk_ram != NULL)
+		memcpy(buff, ftp_disk_ram + offset, len);
+	else if (pread(ftp_disk_fd, buff, len, offset) != (ssize_t) len)
+		return RES_ERROR;
+
+	// card timing
+	uint32_t us = ftp_disk_model->cmd_us + count * ftp_disk_model->read_sector_us;
+	ftp_disk_wait(us);
+
+	// count
+	ftp_disk_reads++;
+	ftp_disk_read_sectors += count;
+	ftp_disk_record('R', sector, count, us);
+
+	return RES_OK;
+}
+
+static DRESULT ftp_disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
+	if (disk_status(pdrv))
+		return RES_NOTRDY;
+
+	// out of range?
+	if (sector + count > ftp_disk_sectors)
+		return RES_PARERR;
+
+	size_t len = (size_t) count * FTP_DISK_SECTOR_SIZE;
+	off_t offset = (off_t) sector * FTP_DISK_SECTOR_SIZE;
+	if (ftp_disk_ram != NULL)
+		memcpy(ftp_disk_ram + offset, buff, len);
+	else if (pwrite(ftp_disk_fd, buff, len, offset) != (ssize_t) len)
+		return RES_ERROR;
+
+	// card timing
+	uint32_t us = ftp_disk_write_latency(sector, count);
+	ftp_disk_wait(us);
+
+	// count
+	ftp_disk_writes++;
+	ftp_disk_write_sectors += count;
+	ftp_disk_record('W', sector, count, us);
+
+	return RES_OK;
+}
+
+DSTATUS disk_initialize(BYTE pdrv) {
+	DSTATUS stat = disk_status(pdrv);
+
+#if FTP_BCACHE == 1
+	// the cache goes in front of the image
+	if (stat == 0 && ftp_bcache_init(pdrv, ftp_disk_read, ftp_disk_write) != 0)
+		return STA_NOINIT;
+#endif
+
+	return stat;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+#if FTP_BCACHE == 1
+	return ftp_bcache_read(pdrv, buff, sector, count);
+#else
+	return ftp_disk_read(pdrv, buff, sector, count);
+#endif
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
+#if FTP_BCACHE == 1
+	return ftp_bcache_write(pdrv, buff, sector, count);
+#else
+	return ftp_disk_write(pdrv, buff, sector, count);
+#endif
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+	if (disk_status(pdrv))
+		return RES_NOTRDY;
+
+	switch (cmd) {
+	case CTRL_SYNC:
+		// memory images are not saved
+		if (ftp_disk_ram == NULL && fsync(ftp_disk_fd) != 0)
+			return RES_ERROR;
+		ftp_disk_wait(ftp_disk_model->cmd_us);
+		ftp_disk_syncs++;
+		ftp_disk_record('S', 0, 0, ftp_disk_model->cmd_us);
+		return RES_OK;
+	case GET_SECTOR_COUNT:
+		*(DWORD *) buff = ftp_disk_sectors;
+		return RES_OK;
+	case GET_SECTOR_SIZE:
+		*(WORD *) buff = FTP_DISK_SECTOR_SIZE;
+		return RES_OK;
+	case GET_BLOCK_SIZE:
+		*(DWORD *) buff = ftp_disk_model->erase_block_sectors > 0 ? ftp_disk_model->erase_block_sectors : 1;
+		return RES_OK;
+	}
+
+	return RES_PARERR;
+}
+
+// time stamps of new files, packed the FatFs way
+DWORD get_fattime(void) {
+	time_t now = time(NULL);
+	struct tm tm;
+	localtime_r(&now, &tm);
+
+	return (DWORD) (tm.tm_year - 80) << 25 | (DWORD) (tm.tm_mon + 1) << 21 | (DWORD) tm.tm_mday << 16 | (DWORD) tm.tm_hour << 11
+			| (DWORD) tm.tm_min << 5 | (DWORD) tm.tm_sec >> 1;
+}
@@ -0,0 +1,287 @@
+/*
+ * ftp_fs_posix.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+// Storage backend on a directory of the host, for the host build with
+// FTP_FS_BACKENDS. The mount context is the directory.
+
+// FatFs has its own DIR, rename the one of the C library
+#define DIR posix_dir_t
+#include <dirent.h>
+#undef DIR
+
+#include "ftp.h"
+#include "ftp_host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#if FTP_FS_BACKENDS == 1
+
+// host path of a path on the mount
+#define FTP_POSIX_PATH_SIZE		1024
+
+// open directory, with its host path for stat
+typedef struct {
+	posix_dir_t *dir;
+	char path[FTP_POSIX_PATH_SIZE];
+} ftp_posix_dir_t;
+
+static const char *ftp_posix_path(void *ctx, const char *path, char *buf) {
+	snprintf(buf, FTP_POSIX_PATH_SIZE, "%s%s", (const char *) ctx, path);
+	return buf;
+}
+
+// FatFs code for errno
+static FRESULT ftp_posix_result(void) {
+	switch (errno) {
+	case ENOENT:
+		return FR_NO_FILE;
+	case ENOTDIR:
+		return FR_NO_PATH;
+	case EEXIST:
+	case ENOTEMPTY:
+		return FR_EXIST;
+	case EACCES:
+	case EPERM:
+		return FR_DENIED;
+	case EROFS:
+		return FR_WRITE_PROTECTED;
+	case ENAMETOOLONG:
+		return FR_INVALID_NAME;
+	case ENOMEM:
+		return FR_NOT_ENOUGH_CORE;
+	case EMFILE:
+	case ENFILE:
+		return FR_TOO_MANY_OPEN_FILES;
+	default:
+		return FR_DISK_ERR;
+	}
+}
+
+// fill a FILINFO, dates packed the FatFs way
+static void ftp_posix_info(const char *name, const struct stat *st, FILINFO *nfo) {
+	struct tm tm;
+	localtime_r(&st->st_mtime, &tm);
+
+	snprintf(nfo->fname, sizeof(nfo->fname), "%s", name);
+	nfo->fsize = S_ISDIR(st->st_mode) ? 0 : st->st_size;
+	nfo->fdate = (tm.tm_year - 80) << 9 | (tm.tm_mon + 1) << 5 | tm.tm_mday;
+	nfo->ftime = tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec >> 1;
+	nfo->fattrib = S_ISDIR(st->st_mode) ? AM_DIR : AM_ARC;
+	if (!(st->st_mode & S_IWUSR))
+		nfo->fattrib |= AM_RDO;
+}
+
+static FRESULT ftp_posix_stat(void *ctx, const char *path, FILINFO *nfo) {
+	char buf[FTP_POSIX_PATH_SIZE];
+	struct stat st;
+
+	if (stat(ftp_posix_path(ctx, path, buf), &st) != 0)
+		return ftp_posix_result();
+
+	const char *name = strrchr(path, '/');
+	ftp_posix_info(name ? name + 1 : path, &st, nfo);
+	return FR_OK;
+}
+
+static FRESULT ftp_posix_opendir(void *ctx, ftp_dir_t *dir, const char *path) {
+	ftp_posix_dir_t *d = malloc(sizeof(ftp_posix_dir_t));
+	if (d == NULL)
+		return FR_NOT_ENOUGH_CORE;
+
+	ftp_posix_path(ctx, path, d->path);
+	d->dir = opendir(d->path);
+	if (d->dir == NULL) {
+		FRESULT res = ftp_posix_result();
+		free(d);
+		return res;
+	}
+
+	dir->handle = d;
+	return FR_OK;
+}
+
+static FRESULT ftp_posix_readdir(ftp_dir_t *dir, FILINFO *nfo) {
+	ftp_posix_dir_t *d = dir->handle;
+	char buf[FTP_POSIX_PATH_SIZE + 256];
+	struct dirent *e;
+	struct stat st;
+
+	while ((e = readdir(d->dir)) != NULL) {
+		// FatFs has no . and ..
+		if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+			continue;
+
+		snprintf(buf, sizeof(buf), "%s/%s", d->path, e->d_name);
+		if (stat(buf, &st) != 0)
+			continue;
+
+		ftp_posix_info(e->d_name, &st, nfo);
+		return FR_OK;
+	}
+
+	// end of the directory, like FatFs
+	nfo->fname[0] = 0;
+	return FR_OK;
+}
+
+static FRESULT ftp_posix_closedir(ftp_dir_t *dir) {
+	ftp_posix_dir_t *d = dir->handle;
+	closedir(d->dir);
+	free(d);
+	dir->handle = NULL;
+	return FR_OK;
+}
+
+static FRESULT ftp_posix_unlink(void *ctx, const char *path) {
+	char buf[FTP_POSIX_PATH_SIZE];
+	struct stat st;
+
+	// FatFs removes files and empty directories alike
+	ftp_posix_path(ctx, path, buf);
+	if (stat(buf, &st) != 0)
+		return ftp_posix_result();
+	if ((S_ISDIR(st.st_mode) ? rmdir(buf) : unlink(buf)) != 0)
+		return ftp_posix_result();
+	return FR_OK;
+}
+
+static FRESULT ftp_posix_open(void *ctx, ftp_file_t *file, const char *path, uint8_t mode) {
+	char buf[FTP_POSIX_PATH_SIZE];
+	int flags;
+
+	// FatFs modes
+	if ((mode & (FA_READ | FA_WRITE)) == (FA_READ | FA_WRITE))
+		flags = O_RDWR;
+	else if (mode & FA_WRITE)
+		flags = O_WRONLY;
+	else
+		flags = O_RDONLY;
+	if (mode & FA_CREATE_ALWAYS)
+		flags |= O_CREAT | O_TRUNC;
+	else if (mode & FA_CREATE_NEW)
+		flags |= O_CREAT | O_EXCL;
+	else if (mode & FA_OPEN_ALWAYS)
+		flags |= O_CREAT;
+
+	int fd = open(ftp_posix_path(ctx, path, buf), flags, 0644);
+	if (fd < 0)
+		return ftp_posix_result();
+
+	file->handle = (void *) (intptr_t) fd;
+	return FR_OK;
+}
+
+static FSIZE_t ftp_posix_size(ftp_file_t *file) {
+	struct stat st;
+	if (fstat((int) (intptr_t) file->handle, &st) != 0)
+		return 0;
+	return st.st_size;
+}
+
+static FRESULT ftp_posix_close(ftp_file_t *file) {
+	return close((int) (intptr_t) file->handle) == 0 ? FR_OK : ftp_posix_result();
+}
+
+static FRESULT ftp_posix_read(ftp_file_t *file, void *buffer, uint32_t len, uint32_t *got) {
+	ssize_t n = read((int) (intptr_t) file->handle, buffer, len);
+	if (n < 0) {
+		*got = 0;
+		return ftp_posix_result();
+	}
+	*got = n;
+	return FR_OK;
+}
+
+static FRESULT ftp_posix_write(ftp_file_t *file, const void *buffer, uint32_t len, uint32_t *written) {
+	ssize_t n = write((int) (intptr_t) file->handle, buffer, len);
+	if (n < 0) {
+		*written = 0;
+		return ftp_posix_result();
+	}
+	*written = n;
+	return FR_OK;
+}
+
+static FRESULT ftp_posix_lseek(ftp_file_t *file, FSIZE_t ofs) {
+	return lseek((int) (intptr_t) file->handle, ofs, SEEK_SET) < 0 ? ftp_posix_result() : FR_OK;
+}
+
+static FRESULT ftp_posix_mkdir(void *ctx, const char *path) {
+	char buf[FTP_POSIX_PATH_SIZE];
+	return mkdir(ftp_posix_path(ctx, path, buf), 0755) == 0 ? FR_OK : ftp_posix_result();
+}
+
+static FRESULT ftp_posix_rename(void *ctx, const char *from, const char *to) {
+	char buf_from[FTP_POSIX_PATH_SIZE], buf_to[FTP_POSIX_PATH_SIZE];
+	struct stat st;
+
+	// FatFs doesn't overwrite
+	ftp_posix_path(ctx, to, buf_to);
+	if (stat(buf_to, &st) == 0)
+		return FR_EXIST;
+
+	return rename(ftp_posix_path(ctx, from, buf_from), buf_to) == 0 ? FR_OK : ftp_posix_result();
+}
+
+static FRESULT ftp_posix_utime(void *ctx, const char *path, const FILINFO *nfo) {
+	char buf[FTP_POSIX_PATH_SIZE];
+	struct tm tm = { 0 };
+	struct timespec times[2];
+
+	// unpack the FatFs date
+	tm.tm_year = (nfo->fdate >> 9) + 80;
+	tm.tm_mon = ((nfo->fdate >> 5) & 0x0F) - 1;
+	tm.tm_mday = nfo->fdate & 0x1F;
+	tm.tm_hour = nfo->ftime >> 11;
+	tm.tm_min = (nfo->ftime >> 5) & 0x3F;
+	tm.tm_sec = (nfo->ftime & 0x1F) << 1;
+	tm.tm_isdst = -1;
+	times[0].tv_sec = times[1].tv_sec = mktime(&tm);
+	times[0].tv_nsec = times[1].tv_nsec = 0;
+
+	return utimensat(AT_FDCWD, ftp_posix_path(ctx, path, buf), times, 0) == 0 ? FR_OK : ftp_posix_result();
+}
+
+static FRESULT ftp_posix_getfree(void *ctx, const char *path, uint64_t *free, uint64_t *total, uint32_t *unit) {
+	char buf[FTP_POSIX_PATH_SIZE];
+	struct statvfs vfs;
+
+	if (statvfs(ftp_posix_path(ctx, path, buf), &vfs) != 0)
+		return ftp_posix_result();
+	*free = (uint64_t) vfs.f_bavail * vfs.f_frsize;
+	*total = (uint64_t) vfs.f_blocks * vfs.f_frsize;
+	*unit = vfs.f_bsize;
+	return FR_OK;
+}
+
+const ftp_fs_t ftp_fs_posix = {
+	.name = "posix",
+	.stat = ftp_posix_stat,
+	.opendir = ftp_posix_opendir,
+	.readdir = ftp_posix_readdir,
+	.closedir = ftp_posix_closedir,
+	.unlink = ftp_posix_unlink,
+	.open = ftp_posix_open,
+	.size = ftp_posix_size,
+	.close = ftp_posix_close,
+	.read = ftp_posix_read,
+	.write = ftp_posix_write,
+	.lseek = ftp_posix_lseek,
+	.mkdir = ftp_posix_mkdir,
+	.rename = ftp_posix_rename,
+	.utime = ftp_posix_utime,
+	.getfree = ftp_posix_getfree,
+};
+
+#endif
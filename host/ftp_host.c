@@ -0,0 +1,203 @@
+/*
+ * ftp_host.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+// Runs the FTP server as a Linux process. Build all src/ and host/ files
+// with -DFTP_HOST against the FreeRTOS POSIX port, the lwIP core with the
+// FreeRTOS sys_arch and FatFs. lwIP only brings up its loopback interface
+// (LWIP_HAVE_LOOPIF), so the server and the benchmark client talk over
+// 127.0.0.1 inside the process and no host network is touched.
+
+#include "ftp.h"
+#include "ftp_host.h"
+
+#include "lwip/tcpip.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// stack of the host tasks, these are threads so be generous
+#define FTP_HOST_STACK_SIZE		4096
+
+// defaults of the benchmark
+#define FTP_HOST_BENCH_KB		4096
+#define FTP_HOST_BENCH_ROUNDS	1000
+
+// default run time of the soak test (s)
+#define FTP_HOST_SOAK_SECONDS	60
+
+// where -P mounts the host directory
+#define FTP_HOST_POSIX_MOUNT	"/host"
+
+static FATFS ftp_host_fs;
+static ftp_bench_opts_t ftp_host_bench = { FTP_HOST_BENCH_KB, FTP_HOST_BENCH_ROUNDS, 0, 0, 0 };
+static uint8_t ftp_host_bench_run = 0;
+static ftp_soak_opts_t ftp_host_soak = { 0, FTP_HOST_SOAK_SECONDS };
+#if FTP_FS_BACKENDS == 1
+static const char *ftp_host_posix_dir = NULL;
+#endif
+
+// time source for latency measurements, replaces the tick based one
+uint32_t ftp_time_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// runs the server, returns only if the listening socket fails
+static void ftp_host_server_task(void *param) {
+	(void) param;
+
+	ftp_server();
+	vTaskDelete(NULL);
+}
+
+// runs the benchmark or the soak test and ends the process
+static void ftp_host_bench_task(void *param) {
+	(void) param;
+
+	int ret = ftp_host_soak.sessions > 0 ? ftp_soak_run(&ftp_host_soak) : ftp_bench_run(&ftp_host_bench);
+	ftp_host_disk_report();
+	exit(ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// brings up lwIP and FatFs once the scheduler runs
+static void ftp_host_start_task(void *param) {
+	(void) param;
+
+	// start lwIP, the loopback interface is part of this
+	tcpip_init(NULL, NULL);
+
+	// mount the image
+	FRESULT res = f_mount(&ftp_host_fs, "", 1);
+	if (res != FR_OK) {
+		printf("mount failed (%d), does the image hold a FAT file system?\n", res);
+		exit(EXIT_FAILURE);
+	}
+
+#if FTP_BCACHE == 1
+	// FAT sectors are kept before file data
+	ftp_bcache_set_data_start(0, ftp_host_fs.database);
+#endif
+
+#if FTP_FS_BACKENDS == 1
+	// a host directory next to the image
+	if (ftp_host_posix_dir != NULL) {
+		ftp_fs_mount("/", &ftp_fs_fatfs, NULL);
+		ftp_fs_mount(FTP_HOST_POSIX_MOUNT, &ftp_fs_posix, (void *) ftp_host_posix_dir);
+	}
+#endif
+
+	// server
+	if (xTaskCreate(ftp_host_server_task, "ftp_server", FTP_HOST_STACK_SIZE, NULL, FTP_TASK_PRIORITY, NULL) != pdPASS) {
+		printf("ftp_server not started\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// benchmark client, same priority as a session
+	if ((ftp_host_bench_run || ftp_host_soak.sessions > 0) && xTaskCreate(ftp_host_bench_task, "ftp_bench", FTP_HOST_STACK_SIZE, NULL, FTP_TASK_PRIORITY, NULL) != pdPASS) {
+		printf("ftp_bench not started\n");
+		exit(EXIT_FAILURE);
+	}
+
+	vTaskDelete(NULL);
+}
+
+static void ftp_host_usage(const char *name) {
+	printf("usage: %s [-b] [-s kB] [-n rounds] [-S clients] [-d s] [-m model] [-r] [-t trace.csv] [-P dir] [-p] [-R dirs] [-I files] image\n", name);
+	printf("  -b         run the benchmark client and exit\n");
+	printf("  -p         benchmark 2, 4 and 8 transfers at the same time too\n");
+#if FTP_LIST_RECURSIVE == 1
+	printf("  -R dirs    list a tree of this many directories one by one and with LIST -R\n");
+#endif
+	printf("  -I files   time stat in a directory growing to this many files\n");
+	printf("  -s kB      size of the benchmark file (%d)\n", FTP_HOST_BENCH_KB);
+	printf("  -n rounds  NOOP round trips (%d)\n", FTP_HOST_BENCH_ROUNDS);
+	printf("  -S clients run the soak test with this many clients and exit\n");
+	printf("  -d s       run time of the soak test (%d)\n", FTP_HOST_SOAK_SECONDS);
+	printf("  -m model   timing of the simulated card:");
+	ftp_host_disk_models();
+	printf("  -r         keep the image in memory, changes are not saved\n");
+	printf("  -t file    record every disk request to a CSV file\n");
+#if FTP_FS_BACKENDS == 1
+	printf("  -P dir     serve a host directory at %s\n", FTP_HOST_POSIX_MOUNT);
+#endif
+}
+
+int main(int argc, char **argv) {
+	const char *image = NULL;
+	const char *trace = NULL;
+	uint8_t in_ram = 0;
+
+	// parse the command line
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-b"))
+			ftp_host_bench_run = 1;
+		else if (!strcmp(argv[i], "-p"))
+			ftp_host_bench_run = ftp_host_bench.parallel = 1;
+#if FTP_LIST_RECURSIVE == 1
+		else if (!strcmp(argv[i], "-R") && i + 1 < argc) {
+			ftp_host_bench.tree_dirs = strtoul(argv[++i], NULL, 10);
+			ftp_host_bench_run = 1;
+		}
+#endif
+		else if (!strcmp(argv[i], "-I") && i + 1 < argc) {
+			ftp_host_bench.stat_files = strtoul(argv[++i], NULL, 10);
+			ftp_host_bench_run = 1;
+		}
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			ftp_host_bench.file_kb = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			ftp_host_bench.rounds = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "-S") && i + 1 < argc)
+			ftp_host_soak.sessions = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+			ftp_host_soak.seconds = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "-m") && i + 1 < argc && ftp_host_disk_model(argv[i + 1]) == 0)
+			i++;
+		else if (!strcmp(argv[i], "-r"))
+			in_ram = 1;
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+			trace = argv[++i];
+#if FTP_FS_BACKENDS == 1
+		else if (!strcmp(argv[i], "-P") && i + 1 < argc)
+			ftp_host_posix_dir = argv[++i];
+#endif
+		else if (argv[i][0] != '-' && image == NULL)
+			image = argv[i];
+		else {
+			ftp_host_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// an image is required
+	if (image == NULL) {
+		ftp_host_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (ftp_host_disk_open(image, in_ram) != 0) {
+		printf("can't open %s\n", image);
+		return EXIT_FAILURE;
+	}
+
+	// record the disk requests?
+	if (trace != NULL && ftp_host_disk_trace(trace) != 0) {
+		printf("can't create %s\n", trace);
+		return EXIT_FAILURE;
+	}
+
+	// everything else happens in tasks
+	xTaskCreate(ftp_host_start_task, "ftp_start", FTP_HOST_STACK_SIZE, NULL, FTP_TASK_PRIORITY + 1, NULL);
+	vTaskStartScheduler();
+
+	// only when the scheduler could not start
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,213 @@
+/*
+ * ftp_host.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_HOST_H_
+#define _FTP_HOST_H_
+
+#include <stdint.h>
+#include "lwip/api.h"
+#include "ftp_file.h"
+
+// timing of a simulated card, all zero is a plain image file
+typedef struct {
+	// name used on the command line
+	const char *name;
+
+	// overhead of every read, write or sync command (us)
+	uint32_t cmd_us;
+
+	// transfer time of one sector (us)
+	uint32_t read_sector_us;
+	uint32_t write_sector_us;
+
+	// a write that leaves the erase block written last stalls while the
+	// card programs it, 0 sectors disables this
+	uint32_t erase_block_sectors;
+	uint32_t program_us;
+
+	// one in gc_every writes pauses for garbage collection, 0 disables
+	uint32_t gc_every;
+	uint32_t gc_us;
+} ftp_disk_model_t;
+
+// control connection of the client
+typedef struct {
+	struct netconn *conn;
+
+	// received and not yet used
+	char buf[256];
+	uint16_t len;
+
+	// last reply line
+	char reply[128];
+} ftp_client_t;
+
+// benchmark settings
+typedef struct {
+	// size of the file sent with STOR and read back with RETR (kB)
+	uint32_t file_kb;
+
+	// number of NOOP round trips for the command latency
+	uint32_t rounds;
+
+	// also run 2, 4 and 8 transfers at the same time
+	uint8_t parallel;
+
+	// directories of the tree that is listed one by one and with
+	// LIST -R, 0 skips it
+	uint32_t tree_dirs;
+
+	// files of the directory stat is timed in, 0 skips it
+	uint32_t stat_files;
+} ftp_bench_opts_t;
+
+// soak settings
+typedef struct {
+	// clients running at the same time
+	uint32_t sessions;
+
+	// run time (s)
+	uint32_t seconds;
+} ftp_soak_opts_t;
+
+/**
+ * Open the disk image FatFs works on. The image must already hold a
+ * FAT file system, e.g. made with mkfs.vfat -C image.img 65536.
+ *
+ * @param path Image file name
+ * @param in_ram Load the image in memory, writes are then not saved
+ * @return 0 on success, -1 if the image could not be opened
+ */
+extern int ftp_host_disk_open(const char *path, uint8_t in_ram);
+
+/**
+ * Select the timing of the simulated card.
+ *
+ * @param name Name of a built in model, see ftp_host_disk_models
+ * @return 0 on success, -1 if there is no such model
+ */
+extern int ftp_host_disk_model(const char *name);
+
+/**
+ * Print the names of the built in card models.
+ */
+extern void ftp_host_disk_models(void);
+
+/**
+ * Record every disk request to a CSV file: time, operation, sector,
+ * count and the latency that was injected.
+ *
+ * @param path File name
+ * @return 0 on success, -1 if the file could not be created
+ */
+extern int ftp_host_disk_trace(const char *path);
+
+/**
+ * Print the disk request counters.
+ */
+extern void ftp_host_disk_report(void);
+
+#if FTP_FS_BACKENDS == 1
+// backend on a directory of the host, the mount context is the directory
+extern const ftp_fs_t ftp_fs_posix;
+#endif
+
+/**
+ * Run the benchmark client against the server on 127.0.0.1. It measures
+ * the command latency with and without Nagle on the control connection,
+ * the NOOP round trip, STOR and RETR throughput and the LIST time, the
+ * transfers once on every mounted backend. With opts->parallel it also
+ * measures the combined throughput of 2, 4 and 8 clients that transfer
+ * at the same time. With opts->tree_dirs it times listing a tree one
+ * directory at a time like a mirroring tool, and with one LIST -R.
+ *
+ * @param opts Benchmark settings
+ * @return 0 on success, -1 if a step failed
+ */
+extern int ftp_bench_run(const ftp_bench_opts_t *opts);
+
+/**
+ * Run scripted clients against the server at the same time: small file
+ * sync, large RETR, STOR, LIST polling and connect/disconnect churn.
+ * Prints command latency percentiles, throughput, refused connections
+ * and the memory use of the server.
+ *
+ * @param opts Soak settings
+ * @return 0 if no client saw an error, -1 otherwise
+ */
+extern int ftp_soak_run(const ftp_soak_opts_t *opts);
+
+/**
+ * Connect to the server on 127.0.0.1, log in and select binary mode.
+ *
+ * @param c Client state
+ * @return 0 on success, -2 if the server refused the connection with
+ *         421, -1 on other errors. Call ftp_client_close in all cases.
+ */
+extern int ftp_client_open(ftp_client_t *c);
+
+/**
+ * Send QUIT and close the control connection.
+ *
+ * @param c Client state
+ */
+extern void ftp_client_close(ftp_client_t *c);
+
+/**
+ * Read a reply, the last line is kept in c->reply.
+ *
+ * @param c Client state
+ * @return The reply code or -1 if the connection broke
+ */
+extern int ftp_client_reply(ftp_client_t *c);
+
+/**
+ * Send a command and read the reply.
+ *
+ * @param c Client state
+ * @param fmt Command format, without line end
+ * @return The reply code or -1 if the connection broke
+ */
+extern int ftp_client_cmd(ftp_client_t *c, const char *fmt, ...);
+
+/**
+ * Enter passive mode and connect to the data port.
+ *
+ * @param c Client state
+ * @return The data connection or NULL
+ */
+extern struct netconn *ftp_client_pasv(ftp_client_t *c);
+
+/**
+ * Receive on a data connection until the server closes it.
+ *
+ * @param data Data connection
+ * @return Bytes received
+ */
+extern uint32_t ftp_client_drain(struct netconn *data);
+
+/**
+ * Upload a file of zeros.
+ *
+ * @param c Client state
+ * @param name File name
+ * @param bytes File size
+ * @return 0 on success, -1 on failure
+ */
+extern int ftp_client_stor(ftp_client_t *c, const char *name, uint32_t bytes);
+
+/**
+ * Run RETR, LIST or another download command over a passive data
+ * connection.
+ *
+ * @param c Client state
+ * @param cmd The command with its parameters
+ * @param bytes Bytes received
+ * @return 0 on success, -1 on failure
+ */
+extern int ftp_client_get(ftp_client_t *c, const char *cmd, uint32_t *bytes);
+
+#endif /* _FTP_HOST_H_ */
@@ -0,0 +1,228 @@
+/*
+ * ftp_micro.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+// Microbenchmarks of the per-command CPU work in ftp_server.c: parsing,
+// path building, the command lookup and the date and listing formatters.
+// The server file is included so the static functions are reachable,
+// build this as its own program against the host ports, without
+// src/ftp_server.c. It prints ns/op and the bytes handled per op.
+
+#include "ftp_server.c"
+
+#include "lwip/tcpip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// operations per benchmark
+#define FTP_MICRO_OPS			200000
+
+// command lines as real clients send them
+static const char * const ftp_micro_lines[] = {
+	"USER anonymous\r\n",
+	"PASS guest@example.com\r\n",
+	"SYST\r\n",
+	"FEAT\r\n",
+	"PWD\r\n",
+	"TYPE I\r\n",
+	"PASV\r\n",
+	"MLSD\r\n",
+	"LIST -al\r\n",
+	"CWD /sdcard/logs/2026-10\r\n",
+	"SIZE firmware_v2.3.1.bin\r\n",
+	"MDTM 20261018093000 report.csv\r\n",
+	"RETR /data/measurements/2026/10/18/sensor_03.csv\r\n",
+	"STOR upload/image 0001.jpg\r\n",
+	"RNFR old name.txt\r\n",
+	"RNTO new name.txt\r\n",
+	"DELE tmp/~lock.file\r\n",
+	"NOOP\r\n",
+	"CDUP\r\n",
+	"QUIT\r\n",
+};
+
+// working directory and parameter pairs for path_build
+static const char * const ftp_micro_paths[][2] = {
+	{ "/", "logs" },
+	{ "/logs", "2026" },
+	{ "/logs/2026", ".." },
+	{ "/", "/data/measurements/2026/10/18" },
+	{ "/data/measurements/2026/10/18", "sensor_03.csv" },
+	{ "/a/b/c", "/" },
+	{ "/upload", "image 0001.jpg" },
+	{ "/sdcard/logs/2026-10", "boot.log" },
+};
+
+// MDTM parameters
+static const char * const ftp_micro_dates[] = {
+	"20261018093000 report.csv",
+	"19991231235958 old.txt",
+	"20200229120000 leap day.dat",
+	"2026 no date.txt",
+};
+
+// directory entries for the listing formatters
+static const struct {
+	const char *name;
+	uint32_t size;
+	uint16_t date, time;
+	uint8_t attrib;
+} ftp_micro_entries[] = {
+	{ "boot.log", 18342, 0x5B52, 0x4BC0, AM_ARC },
+	{ "logs", 0, 0x5B52, 0x4800, AM_DIR },
+	{ "firmware_v2.3.1.bin", 491520, 0x5A21, 0x7A3C, AM_ARC },
+	{ "sensor_03.csv", 1048576, 0x5B52, 0x5C1E, AM_ARC },
+	{ "System Volume Information", 0, 0, 0, AM_DIR | AM_HID | AM_SYS },
+	{ "image 0001.jpg", 2457600, 0x5B4F, 0x9E73, AM_ARC },
+};
+
+#define FTP_MICRO_COUNT(a)		(sizeof(a) / sizeof((a)[0]))
+
+// state the benchmarks work on
+static ftp_data_t ftp_micro_ftp;
+static ftp_xfer_t ftp_micro_xfer;
+static uint8_t ftp_micro_buf[FTP_DATA_BUF_SIZE];
+static volatile uint32_t ftp_micro_sink;
+
+static uint64_t ftp_micro_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// one operation on corpus entry i, returns the bytes it handled
+typedef uint32_t (*ftp_micro_fn_t)(uint32_t i);
+
+// the netbuf alone, subtracted from the parser
+static uint32_t ftp_micro_netbuf(uint32_t i) {
+	const char *line = ftp_micro_lines[i % FTP_MICRO_COUNT(ftp_micro_lines)];
+	struct netbuf *nb = netbuf_new();
+	netbuf_ref(nb, line, strlen(line));
+	netbuf_delete(nb);
+	return 0;
+}
+
+static uint32_t ftp_micro_parse(uint32_t i) {
+	const char *line = ftp_micro_lines[i % FTP_MICRO_COUNT(ftp_micro_lines)];
+	uint16_t len = strlen(line);
+	ftp_micro_ftp.inbuf = netbuf_new();
+	netbuf_ref(ftp_micro_ftp.inbuf, line, len);
+	ftp_micro_sink += ftp_parse_command(&ftp_micro_ftp);
+	return len;
+}
+
+static uint32_t ftp_micro_lookup(uint32_t i) {
+	const char *line = ftp_micro_lines[i % FTP_MICRO_COUNT(ftp_micro_lines)];
+	memset(ftp_micro_ftp.command, 0, FTP_CMD_SIZE);
+	memcpy(ftp_micro_ftp.command, line, 4);
+	if (!isalpha((unsigned char) ftp_micro_ftp.command[3]))
+		ftp_micro_ftp.command[3] = 0;
+
+	// the lookup of ftp_process_command
+	ftp_micro_sink += ftp_find_command(ftp_micro_ftp.command) - ftpd_commands;
+	return 4;
+}
+
+static uint32_t ftp_micro_path(uint32_t i) {
+	const char * const *pair = ftp_micro_paths[i % FTP_MICRO_COUNT(ftp_micro_paths)];
+	strcpy(ftp_micro_ftp.path, pair[0]);
+	strcpy(ftp_micro_ftp.parameters, pair[1]);
+	ftp_micro_sink += path_build(ftp_micro_ftp.path, ftp_micro_ftp.parameters);
+	path_up_a_level(ftp_micro_ftp.path);
+	return strlen(pair[0]) + strlen(pair[1]);
+}
+
+static uint32_t ftp_micro_date_get(uint32_t i) {
+	const char *date = ftp_micro_dates[i % FTP_MICRO_COUNT(ftp_micro_dates)];
+	uint16_t d, t;
+	strcpy(ftp_micro_ftp.parameters, date);
+	ftp_micro_sink += date_time_get(ftp_micro_ftp.parameters, &d, &t);
+	return strlen(date);
+}
+
+static uint32_t ftp_micro_date_str(uint32_t i) {
+	char str[16];
+	uint32_t e = i % FTP_MICRO_COUNT(ftp_micro_entries);
+	data_time_to_str(str, ftp_micro_entries[e].date, ftp_micro_entries[e].time);
+	ftp_micro_sink += str[13];
+	return 14;
+}
+
+// fill finfo and keep the buffer from being sent
+static void ftp_micro_entry(uint32_t i) {
+	uint32_t e = i % FTP_MICRO_COUNT(ftp_micro_entries);
+	strcpy(ftp_micro_xfer.finfo.fname, ftp_micro_entries[e].name);
+	ftp_micro_xfer.finfo.fsize = ftp_micro_entries[e].size;
+	ftp_micro_xfer.finfo.fdate = ftp_micro_entries[e].date;
+	ftp_micro_xfer.finfo.ftime = ftp_micro_entries[e].time;
+	ftp_micro_xfer.finfo.fattrib = ftp_micro_entries[e].attrib;
+	if (ftp_micro_xfer.fill > FTP_DATA_BUF_SIZE / 2)
+		ftp_micro_xfer.fill = 0;
+}
+
+static uint32_t ftp_micro_list(uint32_t i) {
+	ftp_micro_entry(i);
+	uint16_t fill = ftp_micro_xfer.fill;
+	data_con_list_line(&ftp_micro_ftp, &ftp_micro_xfer, &ftp_micro_xfer.finfo, ftp_micro_xfer.finfo.fname, 1);
+	return ftp_micro_xfer.fill - fill;
+}
+
+static uint32_t ftp_micro_mlsd(uint32_t i) {
+	ftp_micro_entry(i);
+	uint16_t fill = ftp_micro_xfer.fill;
+	data_con_mlsd_line(&ftp_micro_ftp, &ftp_micro_xfer, &ftp_micro_xfer.finfo, ftp_micro_xfer.finfo.fname);
+	return ftp_micro_xfer.fill - fill;
+}
+
+// run one benchmark, returns its ns/op
+static uint64_t ftp_micro_run(const char *name, ftp_micro_fn_t fn, uint64_t base_ns) {
+	uint64_t bytes = 0;
+
+	// warm up
+	for (uint32_t i = 0; i < FTP_MICRO_OPS / 10; i++)
+		fn(i);
+
+	uint64_t start = ftp_micro_ns();
+	for (uint32_t i = 0; i < FTP_MICRO_OPS; i++)
+		bytes += fn(i);
+	uint64_t ns = (ftp_micro_ns() - start) / FTP_MICRO_OPS;
+
+	// the overhead measured separately
+	ns = ns > base_ns ? ns - base_ns : 0;
+
+	if (name != NULL)
+		printf("%-12s %8llu ns/op %6llu bytes/op\n", name, (unsigned long long) ns, (unsigned long long) (bytes / FTP_MICRO_OPS));
+	return ns;
+}
+
+static void ftp_micro_task(void *param) {
+	(void) param;
+
+	// a logged in session in the root
+	ftp_micro_ftp.user = FTP_USER_USER_LOGGED_IN;
+	strcpy(ftp_micro_ftp.path, "/");
+	ftp_micro_xfer.buf[0] = ftp_micro_buf;
+
+	uint64_t netbuf_ns = ftp_micro_run(NULL, ftp_micro_netbuf, 0);
+	ftp_micro_run("parse", ftp_micro_parse, netbuf_ns);
+	ftp_micro_run("lookup", ftp_micro_lookup, 0);
+	ftp_micro_run("path", ftp_micro_path, 0);
+	ftp_micro_run("date_get", ftp_micro_date_get, 0);
+	ftp_micro_run("date_str", ftp_micro_date_str, 0);
+	ftp_micro_run("list_line", ftp_micro_list, 0);
+	ftp_micro_run("mlsd_line", ftp_micro_mlsd, 0);
+
+	exit(EXIT_SUCCESS);
+}
+
+int main(void) {
+	// lwIP for the netbufs, the benchmarks run in a task
+	tcpip_init(NULL, NULL);
+	xTaskCreate(ftp_micro_task, "ftp_micro", 4096, NULL, FTP_TASK_PRIORITY, NULL);
+	vTaskStartScheduler();
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,326 @@
+/*
+ * ftp_soak.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+// Soak test for the host build. A number of clients run scripted
+// workloads against the server at the same time, to find where
+// FTP_NBR_CLIENTS stops scaling.
+
+#include "ftp.h"
+#include "ftp_host.h"
+
+#include "lwip/stats.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// command latencies kept for the percentiles, the oldest are overwritten
+#define FTP_SOAK_SAMPLES		65536
+
+// stack of a client task
+#define FTP_SOAK_STACK_SIZE		4096
+
+// file sizes of the workloads
+#define FTP_SOAK_SMALL_BYTES	4096
+#define FTP_SOAK_SMALL_FILES	8
+#define FTP_SOAK_LARGE_BYTES	(1024 * 1024)
+#define FTP_SOAK_STOR_BYTES		(256 * 1024)
+
+// interval of the LIST polling client (ms)
+#define FTP_SOAK_POLL_MS		100
+
+// time a refused client waits before it tries again (ms)
+#define FTP_SOAK_RETRY_MS		100
+
+// time the clients get to finish after the end, a client still running
+// then hangs (s)
+#define FTP_SOAK_GRACE_S		30
+
+// file all RETR clients read
+#define FTP_SOAK_LARGE_FILE		"soak_large.bin"
+
+// workloads, client n runs workload n % FTP_SOAK_WORKLOADS
+typedef enum {
+	FTP_SOAK_SYNC,
+	FTP_SOAK_RETR,
+	FTP_SOAK_STOR,
+	FTP_SOAK_LIST,
+	FTP_SOAK_CHURN,
+#if FTP_TREE == 1
+	FTP_SOAK_COPY,
+#endif
+	FTP_SOAK_WORKLOADS
+} ftp_soak_workload_t;
+
+static const char * const ftp_soak_names[FTP_SOAK_WORKLOADS] = { "sync", "retr", "stor", "list", "churn",
+#if FTP_TREE == 1
+		"copy",
+#endif
+};
+
+// results, shared by the clients
+static uint32_t ftp_soak_lat[FTP_SOAK_SAMPLES];
+static uint32_t ftp_soak_nlat;
+static uint64_t ftp_soak_bytes;
+static uint32_t ftp_soak_connects, ftp_soak_rejected, ftp_soak_errors;
+static uint32_t ftp_soak_rounds[FTP_SOAK_WORKLOADS];
+static volatile uint32_t ftp_soak_running;
+static TickType_t ftp_soak_deadline;
+
+// keep a command latency
+static void ftp_soak_sample(uint32_t us) {
+	taskENTER_CRITICAL();
+	ftp_soak_lat[ftp_soak_nlat++ % FTP_SOAK_SAMPLES] = us;
+	taskEXIT_CRITICAL();
+}
+
+// count transferred bytes
+static void ftp_soak_count(uint32_t bytes) {
+	taskENTER_CRITICAL();
+	ftp_soak_bytes += bytes;
+	taskEXIT_CRITICAL();
+}
+
+// a timed command, true when the reply has the expected class
+#define FTP_SOAK_CMD(c, class, ...) ({ \
+	uint32_t _start = ftp_time_us(); \
+	int _code = ftp_client_cmd((c), __VA_ARGS__); \
+	ftp_soak_sample(ftp_time_us() - _start); \
+	_code / 100 == (class); \
+})
+
+static uint8_t ftp_soak_done(void) {
+	return (int32_t) (xTaskGetTickCount() - ftp_soak_deadline) >= 0;
+}
+
+// connect until the server lets us in or the time is up
+static int ftp_soak_connect(ftp_client_t *c) {
+	while (!ftp_soak_done()) {
+		uint32_t start = ftp_time_us();
+		int ret = ftp_client_open(c);
+		if (ret == 0) {
+			ftp_soak_sample(ftp_time_us() - start);
+			taskENTER_CRITICAL();
+			ftp_soak_connects++;
+			taskEXIT_CRITICAL();
+			return 0;
+		}
+		ftp_client_close(c);
+
+		// refused? wait a bit
+		if (ret == -2) {
+			taskENTER_CRITICAL();
+			ftp_soak_rejected++;
+			taskEXIT_CRITICAL();
+			vTaskDelay(pdMS_TO_TICKS(FTP_SOAK_RETRY_MS));
+		} else {
+			return -1;
+		}
+	}
+	return -1;
+}
+
+// store a few small files, list, check and read them back, delete them
+static int ftp_soak_sync(ftp_client_t *c, uint32_t id) {
+	uint32_t bytes;
+
+	for (uint32_t k = 0; k < FTP_SOAK_SMALL_FILES; k++) {
+		char name[32];
+		snprintf(name, sizeof(name), "soak_%lu_%lu.txt", (unsigned long) id, (unsigned long) k);
+		if (ftp_client_stor(c, name, FTP_SOAK_SMALL_BYTES) != 0)
+			return -1;
+		ftp_soak_count(FTP_SOAK_SMALL_BYTES);
+	}
+
+	if (ftp_client_get(c, "LIST", &bytes) != 0)
+		return -1;
+	ftp_soak_count(bytes);
+
+	for (uint32_t k = 0; k < FTP_SOAK_SMALL_FILES; k++) {
+		char cmd[40];
+		snprintf(cmd, sizeof(cmd), "RETR soak_%lu_%lu.txt", (unsigned long) id, (unsigned long) k);
+		if (!FTP_SOAK_CMD(c, 2, "SIZE %s", cmd + 5) || ftp_client_get(c, cmd, &bytes) != 0)
+			return -1;
+		ftp_soak_count(bytes);
+		if (!FTP_SOAK_CMD(c, 2, "DELE %s", cmd + 5))
+			return -1;
+	}
+
+	return 0;
+}
+
+// one round of a workload
+static int ftp_soak_round(ftp_client_t *c, ftp_soak_workload_t work, uint32_t id) {
+	uint32_t bytes;
+
+	switch (work) {
+	case FTP_SOAK_SYNC:
+		return ftp_soak_sync(c, id);
+	case FTP_SOAK_RETR:
+		if (ftp_client_get(c, "RETR " FTP_SOAK_LARGE_FILE, &bytes) != 0)
+			return -1;
+		ftp_soak_count(bytes);
+		return 0;
+	case FTP_SOAK_STOR: {
+		char name[32];
+		snprintf(name, sizeof(name), "soak_%lu.bin", (unsigned long) id);
+		if (ftp_client_stor(c, name, FTP_SOAK_STOR_BYTES) != 0)
+			return -1;
+		ftp_soak_count(FTP_SOAK_STOR_BYTES);
+		return FTP_SOAK_CMD(c, 2, "DELE %s", name) ? 0 : -1;
+	}
+	case FTP_SOAK_LIST:
+		if (ftp_client_get(c, "LIST", &bytes) != 0)
+			return -1;
+		ftp_soak_count(bytes);
+		vTaskDelay(pdMS_TO_TICKS(FTP_SOAK_POLL_MS));
+		return FTP_SOAK_CMD(c, 2, "NOOP") ? 0 : -1;
+	case FTP_SOAK_CHURN:
+		// log in again every round
+		if (!FTP_SOAK_CMD(c, 2, "PWD"))
+			return -1;
+		ftp_client_close(c);
+		return ftp_soak_connect(c);
+#if FTP_TREE == 1
+	case FTP_SOAK_COPY: {
+		// one task reads and writes two files on the device, the
+		// request queue of FTP_IOSCHED must not keep it waiting on itself
+		char name[32];
+		snprintf(name, sizeof(name), "soak_copy_%lu.bin", (unsigned long) id);
+		if (!FTP_SOAK_CMD(c, 3, "SITE CPFR " FTP_SOAK_LARGE_FILE))
+			return -1;
+
+		// progress comes in preliminary replies
+		uint32_t start = ftp_time_us();
+		int code = ftp_client_cmd(c, "SITE CPTO %s", name);
+		while (code / 100 == 1)
+			code = ftp_client_reply(c);
+		ftp_soak_sample(ftp_time_us() - start);
+		if (code / 100 != 2)
+			return -1;
+		ftp_soak_count(FTP_SOAK_LARGE_BYTES);
+		return FTP_SOAK_CMD(c, 2, "DELE %s", name) ? 0 : -1;
+	}
+#endif
+	default:
+		return -1;
+	}
+}
+
+// client task, runs its workload until the time is up
+static void ftp_soak_task(void *param) {
+	uint32_t id = (uint32_t) (uintptr_t) param;
+	ftp_soak_workload_t work = id % FTP_SOAK_WORKLOADS;
+	ftp_client_t c;
+
+	while (ftp_soak_connect(&c) == 0) {
+		// rounds until an error or the end
+		while (!ftp_soak_done() && ftp_soak_round(&c, work, id) == 0) {
+			taskENTER_CRITICAL();
+			ftp_soak_rounds[work]++;
+			taskEXIT_CRITICAL();
+		}
+		ftp_client_close(&c);
+
+		// stopped by an error?
+		if (ftp_soak_done())
+			break;
+		taskENTER_CRITICAL();
+		ftp_soak_errors++;
+		taskEXIT_CRITICAL();
+	}
+
+	taskENTER_CRITICAL();
+	ftp_soak_running--;
+	taskEXIT_CRITICAL();
+	vTaskDelete(NULL);
+}
+
+static int ftp_soak_compare(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+	return x < y ? -1 : x > y;
+}
+
+// print everything that was measured
+static void ftp_soak_report(const ftp_soak_opts_t *opts) {
+	ftp_admission_stats_t adm;
+	ftp_resources_t res;
+
+	// latency percentiles
+	uint32_t n = ftp_soak_nlat < FTP_SOAK_SAMPLES ? ftp_soak_nlat : FTP_SOAK_SAMPLES;
+	qsort(ftp_soak_lat, n, sizeof(ftp_soak_lat[0]), ftp_soak_compare);
+	printf("soak  %lu clients %lu s, %lu connects, %lu refused, %lu errors\n", (unsigned long) opts->sessions,
+			(unsigned long) opts->seconds, (unsigned long) ftp_soak_connects, (unsigned long) ftp_soak_rejected,
+			(unsigned long) ftp_soak_errors);
+	if (n > 0)
+		printf("cmd   %lu samples p50 %lu us p99 %lu us max %lu us\n", (unsigned long) n, (unsigned long) ftp_soak_lat[n / 2],
+				(unsigned long) ftp_soak_lat[n * 99 / 100], (unsigned long) ftp_soak_lat[n - 1]);
+	printf("data  %llu bytes %llu kB/s\n", (unsigned long long) ftp_soak_bytes,
+			(unsigned long long) (ftp_soak_bytes / 1024 / (opts->seconds ? opts->seconds : 1)));
+	for (uint8_t w = 0; w < FTP_SOAK_WORKLOADS; w++)
+		printf("      %-5s %lu rounds\n", ftp_soak_names[w], (unsigned long) ftp_soak_rounds[w]);
+
+	// what the server saw
+	ftp_get_admission_stats(&adm);
+	printf("srv   admitted %lu queued %lu evicted %lu rejected %lu\n", (unsigned long) adm.admitted, (unsigned long) adm.queued,
+			(unsigned long) adm.evicted, (unsigned long) adm.rejected);
+	ftp_get_resources(&res);
+	printf("heap  free %lu min %lu\n", (unsigned long) res.heap_free, (unsigned long) res.heap_min_free);
+	for (uint8_t i = 0; i < FTP_NBR_CLIENTS; i++)
+		printf("stack ftp_task_%d min free %lu of %d words\n", i, (unsigned long) res.stack_min_free[i], FTP_TASK_STACK_SIZE);
+
+#if LWIP_STATS && MEMP_STATS
+	for (uint16_t i = 0; i < MEMP_MAX; i++) {
+		const struct stats_mem *memp = lwip_stats.memp[i];
+		if (memp == NULL || (memp->max == 0 && memp->err == 0))
+			continue;
+		printf("memp  %-16s max %u of %u err %u\n", memp->name, memp->max, memp->avail, memp->err);
+	}
+#endif
+}
+
+int ftp_soak_run(const ftp_soak_opts_t *opts) {
+	ftp_client_t c;
+
+	// the file the RETR clients read
+	if (ftp_client_open(&c) != 0 || ftp_client_stor(&c, FTP_SOAK_LARGE_FILE, FTP_SOAK_LARGE_BYTES) != 0) {
+		printf("soak setup failed, last reply: %s", c.reply);
+		ftp_client_close(&c);
+		return -1;
+	}
+	ftp_client_close(&c);
+
+	// start the clients
+	ftp_soak_deadline = xTaskGetTickCount() + pdMS_TO_TICKS(opts->seconds * 1000);
+	for (uint32_t i = 0; i < opts->sessions; i++) {
+		char name[16];
+		snprintf(name, sizeof(name), "soak_%lu", (unsigned long) i);
+
+		taskENTER_CRITICAL();
+		ftp_soak_running++;
+		taskEXIT_CRITICAL();
+		if (xTaskCreate(ftp_soak_task, name, FTP_SOAK_STACK_SIZE, (void *) (uintptr_t) i, FTP_TASK_PRIORITY, NULL) != pdPASS) {
+			taskENTER_CRITICAL();
+			ftp_soak_running--;
+			taskEXIT_CRITICAL();
+			printf("%s not started\n", name);
+		}
+	}
+
+	// wait for all of them, a client that doesn't finish hangs
+	TickType_t grace = ftp_soak_deadline + pdMS_TO_TICKS(FTP_SOAK_GRACE_S * 1000);
+	while (ftp_soak_running > 0 && (int32_t) (xTaskGetTickCount() - grace) < 0)
+		vTaskDelay(pdMS_TO_TICKS(100));
+
+	ftp_soak_report(opts);
+	if (ftp_soak_running > 0) {
+		printf("soak  %lu clients hang\n", (unsigned long) ftp_soak_running);
+		return -1;
+	}
+	return ftp_soak_errors == 0 ? 0 : -1;
+}
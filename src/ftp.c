@@ -36,9 +36,44 @@ __weak void ftp_connected_callback(void) {
 __weak void ftp_disconnected_callback(void) {
 }
 
+// painting needs to know where the stack is
+#if FTP_STATS_STACK_PAINT == 1 && FTP_TASK_STATIC != 1
+#error "FTP_STATS_STACK_PAINT needs FTP_TASK_STATIC"
+#endif
+
+// time source, tick resolution unless the application overrides it
+__weak uint32_t ftp_time_us(void) {
+	return xTaskGetTickCount() * (1000000 / configTICK_RATE_HZ);
+}
+
+// client waiting in the accept queue
+typedef struct {
+	struct netconn *conn;
+	TickType_t deadline;
+} ftp_waiting_t;
+
 // static variables
 static const char *no_conn_allowed = "421 No more connections allowed\r\n";
 static server_stru_t ftp_links[FTP_NBR_CLIENTS];
+static ftp_waiting_t ftp_queue[FTP_ACCEPT_QUEUE_SIZE];
+static uint8_t ftp_queue_head = 0;
+static uint8_t ftp_queue_count = 0;
+static ftp_admission_stats_t ftp_admission;
+
+// least free stack each session task had, in words
+static UBaseType_t ftp_stack_min_free[FTP_NBR_CLIENTS];
+
+// scheduling probe results
+static volatile uint32_t ftp_probe_worst_us = 0;
+static volatile uint32_t ftp_probe_samples = 0;
+static uint32_t ftp_probe_period_ms;
+
+// keep the least free stack of a session task
+static void ftp_stack_note(uint8_t index, TaskHandle_t task) {
+	UBaseType_t free = uxTaskGetStackHighWaterMark(task);
+	if (ftp_stack_min_free[index] == 0 || free < ftp_stack_min_free[index])
+		ftp_stack_min_free[index] = free;
+}
 
 // single ftp connection loop
 static void ftp_task(void *param) {
@@ -49,9 +84,18 @@ static void ftp_task(void *param) {
 	// parse parameter
 	server_stru_t *ftp = (server_stru_t*) param;
 
+	// xTaskCreateStatic only returns the handle once this task may
+	// already have run, so the task stores it itself
+	ftp->task_handle = xTaskGetCurrentTaskHandle();
+
 	// save the instance number
 	ftp->ftp_data.ftp_con_num = ftp->number;
 
+#if FTP_STATS_STACK_PAINT == 1
+	// the stack commands are measured on
+	ftp->ftp_data.stack = ftp->task_stack;
+#endif
+
 	// callback
 	ftp_connected_callback();
 
@@ -64,20 +108,19 @@ static void ftp_task(void *param) {
 	// delete the connection.
 	netconn_delete(ftp->ftp_connection);
 
-	// reset the socket to be sure
-	ftp->ftp_connection = NULL;
-
 	// feedback
 	log_print("FTP %d disconnected\r\n", ftp->number);
 
 	// callback
 	ftp_disconnected_callback();
 
-	// delete this task
-	vTaskDelete(NULL);
+	// the stack this session needed at most
+	ftp_stack_note(ftp->number, NULL);
 
-	// clear handle
-	ftp->task_handle = NULL;
+	// the server deletes this task and hands out the slot again once it is
+	// suspended, the stack is in use until then
+	ftp->task_done = 1;
+	vTaskSuspend(NULL);
 }
 
 static void ftp_start_task(server_stru_t *data, uint8_t index) {
@@ -90,8 +133,7 @@ static void ftp_start_task(server_stru_t *data, uint8_t index) {
 
 	// start task with parameter
 #if FTP_TASK_STATIC == 1
-	data->task_handle == xTaskCreateStatic(ftp_task, name, FTP_TASK_STACK_SIZE, data, 5, data->task_stack, &data->task_static);
-	if (data->task_handle == NULL) {
+	if (xTaskCreateStatic(ftp_task, name, FTP_TASK_STACK_SIZE, data, FTP_TASK_PRIORITY, data->task_stack, &data->task_static) == NULL) {
 		// if creation of the task fails, close and clean up the connection
 		netconn_close(data->ftp_connection);
 		netconn_delete(data->ftp_connection);
@@ -101,11 +143,12 @@ static void ftp_start_task(server_stru_t *data, uint8_t index) {
 		log_print("%s not started\r\n", name);
 	}
 #else
-	if (xTaskCreate(ftp_task, name, FTP_TASK_STACK_SIZE, data, 2, data->task_handle) != pdPASS) {
+	if (xTaskCreate(ftp_task, name, FTP_TASK_STACK_SIZE, data, FTP_TASK_PRIORITY, &data->task_handle) != pdPASS) {
 		// if creation of the task fails, close and clean up the connection
 		netconn_close(data->ftp_connection);
 		netconn_delete(data->ftp_connection);
 		data->ftp_connection = NULL;
+		data->task_handle = NULL;
 
 		// feedback to CMS log
 		log_print("%s not started\r\n", name);
@@ -117,6 +160,137 @@ static void ftp_start_task(server_stru_t *data, uint8_t index) {
 	}
 }
 
+// refuse a client connection
+static void ftp_refuse(struct netconn *conn) {
+	// tell that no connections are allowed
+	netconn_write(conn, no_conn_allowed, strlen(no_conn_allowed), NETCONN_COPY);
+
+	// close and delete the connection.
+	netconn_close(conn);
+	netconn_delete(conn);
+
+	// count
+	ftp_admission.rejected++;
+
+	// feedback
+	log_print("FTP connection denied, all connections in use\r\n");
+}
+
+// delete the tasks of sessions that are done. A task deleted by another
+// task is gone at once, its stack and slot can be used again. Needs
+// INCLUDE_vTaskSuspend and INCLUDE_eTaskGetState.
+static void ftp_reap(void) {
+	for (uint8_t i = 0; i < FTP_NBR_CLIENTS; i++) {
+		server_stru_t *link = &ftp_links[i];
+
+		if (!link->task_done || eTaskGetState(link->task_handle) != eSuspended)
+			continue;
+
+		vTaskDelete(link->task_handle);
+		link->task_handle = NULL;
+		link->ftp_connection = NULL;
+		link->task_done = 0;
+	}
+}
+
+// look for the first unused connection, returns FTP_NBR_CLIENTS if there is none
+static uint8_t ftp_free_slot(void) {
+	uint8_t index;
+
+	// slots of sessions that ended
+	ftp_reap();
+
+	for (index = 0; index < FTP_NBR_CLIENTS; index++) {
+		if (ftp_links[index].ftp_connection == NULL && ftp_links[index].task_handle == NULL)
+			break;
+	}
+
+	return index;
+}
+
+// hand a client connection to a free slot
+static void ftp_admit(struct netconn *conn, uint8_t index) {
+	// copy client connection
+	ftp_links[index].ftp_connection = conn;
+
+	// fresh session, not evicted
+	ftp_links[index].ftp_data.evict = 0;
+
+	// count
+	ftp_admission.admitted++;
+
+	// try and start the FTP task for this connection
+	ftp_start_task(&ftp_links[index], index);
+}
+
+// ask the longest idle session to close, as long as there are more
+// waiting clients than sessions that are already closing
+static void ftp_evict_idle(void) {
+#if FTP_EVICT_IDLE_S > 0
+	TickType_t now = xTaskGetTickCount();
+	TickType_t longest = pdMS_TO_TICKS(FTP_EVICT_IDLE_S * 1000);
+	uint8_t closing = 0;
+	int8_t victim = -1;
+
+	for (uint8_t i = 0; i < FTP_NBR_CLIENTS; i++) {
+		ftp_data_t *ftp = &ftp_links[i].ftp_data;
+
+		// slot not in use?
+		if (ftp_links[i].ftp_connection == NULL)
+			continue;
+
+		// already on its way out?
+		if (ftp->evict || ftp_links[i].task_done) {
+			closing++;
+			continue;
+		}
+
+		// idle at the prompt for longer than all others?
+		if (ftp->at_prompt && (TickType_t) (now - ftp->last_activity) > longest) {
+			longest = now - ftp->last_activity;
+			victim = i;
+		}
+	}
+
+	// enough sessions closing already or nobody idle long enough?
+	if (closing >= ftp_queue_count || victim < 0)
+		return;
+
+	// the session sees this the next time its receive times out
+	ftp_links[victim].ftp_data.evict = 1;
+
+	// count
+	ftp_admission.evicted++;
+
+	// feedback
+	log_print("FTP %d evicted, idle at the prompt\r\n", victim);
+#endif
+}
+
+// admit waiting clients to free slots and refuse those that waited too long
+static void ftp_queue_service(void) {
+	TickType_t now = xTaskGetTickCount();
+	uint8_t index;
+
+	// admit from the front of the queue while there is room
+	while (ftp_queue_count > 0 && (index = ftp_free_slot()) < FTP_NBR_CLIENTS) {
+		ftp_admit(ftp_queue[ftp_queue_head].conn, index);
+		ftp_queue_head = (ftp_queue_head + 1) % FTP_ACCEPT_QUEUE_SIZE;
+		ftp_queue_count--;
+	}
+
+	// refuse clients whose deadline passed, the oldest are in front
+	while (ftp_queue_count > 0 && (int32_t) (now - ftp_queue[ftp_queue_head].deadline) >= 0) {
+		ftp_refuse(ftp_queue[ftp_queue_head].conn);
+		ftp_queue_head = (ftp_queue_head + 1) % FTP_ACCEPT_QUEUE_SIZE;
+		ftp_queue_count--;
+	}
+
+	// still clients waiting? try to make room
+	if (ftp_queue_count > 0)
+		ftp_evict_idle();
+}
+
 // ftp server task
 void ftp_server(void) {
 	struct netconn *ftp_srv_conn;
@@ -141,46 +315,132 @@ void ftp_server(void) {
 	// put the connection into LISTEN state
 	netconn_listen(ftp_srv_conn);
 
+#if FTP_LOG_LEVEL > FTP_LOG_NONE
+	// format the session traces in the background
+	ftp_log_start(FTP_LOG_PRIORITY);
+#endif
+
+#if FTP_SPACE == 1
+	// count the free space in the background, SITE FREE never waits for it
+	ftp_space_start();
+#endif
+
+#if FTP_JOURNAL == 1
+	// pick up the changes recorded before a restart
+	ftp_journal_start();
+#endif
+
+	// don't block forever on accept, waiting clients need service
+	netconn_set_recvtimeout(ftp_srv_conn, FTP_ACCEPT_POLL_MS);
+
 	while (1) {
 		// Wait for incoming connections
 		if (netconn_accept(ftp_srv_conn, &ftp_client_conn) == ERR_OK) {
-			// Look for the first unused connection
-			for (index = 0; index < FTP_NBR_CLIENTS; index++) {
-				if (ftp_links[index].ftp_connection == NULL && ftp_links[index].task_handle == NULL)
-					break;
+			// nobody waiting and a connection free? admit straight away
+			if (ftp_queue_count == 0 && (index = ftp_free_slot()) < FTP_NBR_CLIENTS) {
+				ftp_admit(ftp_client_conn, index);
 			}
+			// room in the accept queue?
+			else if (ftp_queue_count < FTP_ACCEPT_QUEUE_SIZE) {
+				// add to the back of the queue
+				ftp_waiting_t *w = &ftp_queue[(ftp_queue_head + ftp_queue_count) % FTP_ACCEPT_QUEUE_SIZE];
+				w->conn = ftp_client_conn;
+				w->deadline = xTaskGetTickCount() + pdMS_TO_TICKS(FTP_ACCEPT_QUEUE_WAIT_MS);
+				ftp_queue_count++;
 
-			// all connections in use?
-			if (index >= FTP_NBR_CLIENTS) {
-				// tell that no connections are allowed
-				netconn_write(ftp_client_conn, no_conn_allowed, strlen(no_conn_allowed), NETCONN_COPY);
-
-				// delete the connection.
-				netconn_delete(ftp_client_conn);
-
-				// reset the socket to be sure
-				ftp_client_conn = NULL;
+				// count
+				ftp_admission.queued++;
 
 				// feedback
-				log_print("FTP connection denied, all connections in use\r\n");
-
-				// wait a while
-				vTaskDelay(500);
+				log_print("FTP connection queued, %d waiting\r\n", ftp_queue_count);
 			}
-			// not all connections in use
+			// queue is full
 			else {
-				// copy client connection
-				ftp_links[index].ftp_connection = ftp_client_conn;
-
-				// zero out client connection
-				ftp_client_conn = NULL;
-
-				// try and start the FTP task for this connection
-				ftp_start_task(&ftp_links[index], index);
+				ftp_refuse(ftp_client_conn);
 			}
+
+			// reset the socket to be sure
+			ftp_client_conn = NULL;
 		}
+
+		// admit, evict or refuse waiting clients
+		ftp_queue_service();
 	}
 
 	// delete the connection.
 	netconn_delete(ftp_srv_conn);
 }
+
+void ftp_get_admission_stats(ftp_admission_stats_t *stats) {
+	if (stats == NULL)
+		return;
+	*stats = ftp_admission;
+}
+
+void ftp_get_resources(ftp_resources_t *res) {
+	if (res == NULL)
+		return;
+
+	// heap
+	res->heap_free = xPortGetFreeHeapSize();
+	res->heap_min_free = xPortGetMinimumEverFreeHeapSize();
+
+	// running sessions, their tasks can't go away while the scheduler
+	// is suspended
+	res->sessions = 0;
+	vTaskSuspendAll();
+	for (uint8_t i = 0; i < FTP_NBR_CLIENTS; i++) {
+		if (ftp_links[i].task_handle != NULL) {
+			ftp_stack_note(i, ftp_links[i].task_handle);
+			res->sessions++;
+		}
+		res->stack_min_free[i] = ftp_stack_min_free[i];
+	}
+	xTaskResumeAll();
+}
+
+// scheduling probe task
+static void ftp_sched_probe_task(void *param) {
+	uint32_t period_us = ftp_probe_period_ms * 1000;
+
+	(void) param;
+
+	while (1) {
+		// sleep and see how much later than asked we are back
+		uint32_t start = ftp_time_us();
+		vTaskDelay(pdMS_TO_TICKS(ftp_probe_period_ms));
+		uint32_t slept = ftp_time_us() - start;
+
+		// keep the worst
+		uint32_t late = slept > period_us ? slept - period_us : 0;
+		if (late > ftp_probe_worst_us)
+			ftp_probe_worst_us = late;
+		ftp_probe_samples++;
+	}
+}
+
+void ftp_sched_probe_start(UBaseType_t priority, uint32_t period_ms) {
+	static TaskHandle_t probe = NULL;
+
+	// only one probe
+	if (probe != NULL)
+		return;
+
+	// at least one tick
+	ftp_probe_period_ms = period_ms > 0 ? period_ms : 1;
+
+	// start the probe
+	if (xTaskCreate(ftp_sched_probe_task, "ftp_probe", configMINIMAL_STACK_SIZE, NULL, priority, &probe) != pdPASS)
+		log_print("ftp_probe not started\r\n");
+}
+
+void ftp_sched_probe_get(uint32_t *worst_us, uint32_t *samples, uint8_t reset) {
+	if (worst_us != NULL)
+		*worst_us = ftp_probe_worst_us;
+	if (samples != NULL)
+		*samples = ftp_probe_samples;
+	if (reset) {
+		ftp_probe_worst_us = 0;
+		ftp_probe_samples = 0;
+	}
+}
@@ -20,7 +20,7 @@
 #ifndef _FTPS_H_
 #define _FTPS_H_
 
-#include "lwip.h"
+#include "ftp_port.h"
 #include "ftp_server.h"
 
 // static task allocation?
@@ -29,20 +29,64 @@
 // stack size for ftp task
 #define FTP_TASK_STACK_SIZE		1536
 
+// priority of a session task while it handles commands
+#define FTP_TASK_PRIORITY		3
+
+// priority of a session task while it moves data, keep it below the
+// application tasks so a bulk transfer only uses spare CPU time
+#define FTP_TASK_PRIORITY_BULK	1
+
+// a transfer gives the CPU away after this many bytes or milliseconds,
+// whichever comes first, 0 disables the check
+#define FTP_YIELD_BYTES			16384
+#define FTP_YIELD_MS			10
+
+// ticks a transfer sleeps when it gives the CPU away, 0 only yields
+// to tasks of the same priority
+#define FTP_YIELD_TICKS			1
+
 // initial FTP port
 #define FTP_SERVER_PORT			21
 
-// Data port in passive mode
+// First data port in passive mode
 #define FTP_DATA_PORT			55600
 
+// Number of data ports in passive mode, starting at FTP_DATA_PORT
+#define FTP_DATA_PORT_COUNT		64
+
+// Time a released data port rests before it is handed out again (ms).
+// Without SO_REUSE this has to cover TIME_WAIT (2 * TCP_MSL in lwIP).
+#if SO_REUSE
+#define FTP_DATA_PORT_COOLDOWN_MS	1000
+#else
+#define FTP_DATA_PORT_COOLDOWN_MS	(2 * 60000)
+#endif
+
 // number of clients we want to serve simultaneously, same as netbuf limit
 #define FTP_NBR_CLIENTS			2
 
+// number of clients that may wait for a free connection
+#define FTP_ACCEPT_QUEUE_SIZE	4
+
+// maximum time a client waits in the accept queue before it is refused (ms)
+#define FTP_ACCEPT_QUEUE_WAIT_MS	10000
+
+// interval at which the server services the accept queue (ms)
+#define FTP_ACCEPT_POLL_MS		100
+
+// a session idle at the prompt for longer than this may be evicted
+// when a new client is waiting (s), 0 disables eviction
+#define FTP_EVICT_IDLE_S		20
+
 // define a structure of parameters for a ftp thread
 typedef struct {
 	uint8_t number;
 	struct netconn *ftp_connection;
-	TaskHandle_t *task_handle;
+	TaskHandle_t task_handle;
+
+	// set by the task when it is done, the server deletes it and frees
+	// the slot once it is suspended
+	volatile uint8_t task_done;
 #if FTP_TASK_STATIC == 1
 	StackType_t task_stack[FTP_TASK_STACK_SIZE];
 	StaticTask_t task_static;
@@ -50,6 +94,35 @@ typedef struct {
 	ftp_data_t ftp_data;
 } server_stru_t;
 
+// admission counters of the FTP server
+typedef struct {
+	// clients that got a connection
+	uint32_t admitted;
+
+	// clients that had to wait in the accept queue
+	uint32_t queued;
+
+	// idle sessions closed to make room for a waiting client
+	uint32_t evicted;
+
+	// clients refused because the queue was full or they waited too long
+	uint32_t rejected;
+} ftp_admission_stats_t;
+
+// memory use of the FTP server
+typedef struct {
+	// free heap now and the least there ever was (bytes)
+	uint32_t heap_free;
+	uint32_t heap_min_free;
+
+	// least free stack each session task had so far (words), 0 if
+	// the slot never ran
+	uint32_t stack_min_free[FTP_NBR_CLIENTS];
+
+	// sessions running now
+	uint8_t sessions;
+} ftp_resources_t;
+
 /**
  * Start the FTP server.
  *
@@ -63,11 +136,57 @@ typedef struct {
  * The FTP commands. When the client disconnects the task is
  * stopped.
  *
+ * When all connections are in use an incoming client is put in a
+ * small accept queue until a connection frees up. While clients are
+ * waiting, sessions that sit idle at the prompt for longer than
+ * FTP_EVICT_IDLE_S are closed to make room.
+ *
  * An incoming connection is denied when:
  * - The memory on the CMS is not available
- * - The maximum number of clients is connected
- * - The application is running
+ * - The accept queue is full
+ * - No connection freed up within FTP_ACCEPT_QUEUE_WAIT_MS
  */
 void ftp_server(void);
 
+/**
+ * Get a copy of the admission counters of the FTP server.
+ *
+ * @param stats Structure the counters are copied to
+ */
+void ftp_get_admission_stats(ftp_admission_stats_t *stats);
+
+/**
+ * Get the memory use of the FTP server. The stack figures show how
+ * close FTP_TASK_STACK_SIZE is to its limit.
+ *
+ * @param res Structure the figures are copied to
+ */
+void ftp_get_resources(ftp_resources_t *res);
+
+/**
+ * Free running time in microseconds, used for latency measurements.
+ * The default implementation has tick resolution, override it with
+ * a cycle counter or hardware timer for finer results.
+ */
+uint32_t ftp_time_us(void);
+
+/**
+ * Start a task that measures how late it wakes up, to find out how
+ * much an FTP transfer delays the application. Run it at the priority
+ * of the task you want to protect.
+ *
+ * @param priority Priority of the probe task
+ * @param period_ms Time the probe sleeps between measurements
+ */
+void ftp_sched_probe_start(UBaseType_t priority, uint32_t period_ms);
+
+/**
+ * Get the worst wake up delay the probe measured so far.
+ *
+ * @param worst_us Worst delay in microseconds
+ * @param samples Number of measurements
+ * @param reset Start a new measurement after reading
+ */
+void ftp_sched_probe_get(uint32_t *worst_us, uint32_t *samples, uint8_t reset);
+
 #endif // _FTPS_H_
@@ -0,0 +1,276 @@
+/*
+ * ftp_bcache.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ftp.h"
+#include "ftp_bcache.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include <string.h>
+
+#if FTP_BCACHE == 1
+
+#if _MAX_SS != _MIN_SS
+#error "the block cache needs a fixed sector size"
+#endif
+
+// a cached sector
+typedef struct {
+	uint8_t used;
+
+	// FAT or directory, evicted after the file data
+	uint8_t meta;
+
+	DWORD sector;
+
+	// cache clock of the last use, for LRU
+	uint32_t last_used;
+
+	BYTE data[_MAX_SS];
+} ftp_bcache_block_t;
+
+// state of a drive, each drive has its own sectors and lock so drives
+// work in parallel
+typedef struct {
+	ftp_bcache_read_t read;
+	ftp_bcache_write_t write;
+
+	// held during every request, also while the device works. FatFs
+	// already serializes the requests of a volume, this covers the
+	// other users of the drive.
+	SemaphoreHandle_t lock;
+
+	ftp_bcache_block_t blocks[FTP_BCACHE_BLOCKS];
+	uint32_t clock;
+	ftp_bcache_stats_t stats;
+
+	// first sector of the data area, 0 if not known
+	DWORD data_start;
+
+	// where the last read ended and how many reads followed each other
+	DWORD last_end;
+	uint16_t run;
+
+#if FTP_BCACHE_READAHEAD > 0
+	// sectors read ahead, ra_count 0 when empty
+	DWORD ra_start;
+	UINT ra_count;
+	BYTE ra[FTP_BCACHE_READAHEAD * _MAX_SS];
+#endif
+} ftp_bcache_drive_t;
+
+static ftp_bcache_drive_t ftp_bcache_drives[FTP_BCACHE_DRIVES];
+
+// find a cached sector
+static ftp_bcache_block_t *ftp_bcache_find(ftp_bcache_drive_t *d, DWORD sector) {
+	for (uint16_t i = 0; i < FTP_BCACHE_BLOCKS; i++) {
+		ftp_bcache_block_t *b = &d->blocks[i];
+		if (b->used && b->sector == sector)
+			return b;
+	}
+	return NULL;
+}
+
+// block to reuse: a free one, else the least recently used file data,
+// else the least recently used FAT or directory sector
+static ftp_bcache_block_t *ftp_bcache_victim(ftp_bcache_drive_t *d) {
+	ftp_bcache_block_t *victim = NULL;
+
+	for (uint16_t i = 0; i < FTP_BCACHE_BLOCKS; i++) {
+		ftp_bcache_block_t *b = &d->blocks[i];
+		if (!b->used)
+			return b;
+		if (victim == NULL || (b->meta < victim->meta) || (b->meta == victim->meta && b->last_used < victim->last_used))
+			victim = b;
+	}
+
+	if (victim->meta)
+		d->stats.meta_blocks--;
+	return victim;
+}
+
+// keep a sector that was read
+static void ftp_bcache_insert(ftp_bcache_drive_t *d, DWORD sector, const BYTE *data, uint8_t meta) {
+	ftp_bcache_block_t *b = ftp_bcache_victim(d);
+
+	b->used = 1;
+	b->sector = sector;
+	b->meta = meta;
+	b->last_used = ++d->clock;
+	memcpy(b->data, data, _MAX_SS);
+
+	if (meta)
+		d->stats.meta_blocks++;
+}
+
+int ftp_bcache_init(BYTE pdrv, ftp_bcache_read_t read, ftp_bcache_write_t write) {
+	if (pdrv >= FTP_BCACHE_DRIVES)
+		return -1;
+
+	ftp_bcache_drive_t *d = &ftp_bcache_drives[pdrv];
+
+	// first time creates the lock
+	if (d->lock == NULL) {
+		d->lock = xSemaphoreCreateMutex();
+		if (d->lock == NULL)
+			return -1;
+	}
+
+	d->read = read;
+	d->write = write;
+
+	// start empty, the card may be another one
+	ftp_bcache_invalidate(pdrv);
+	return 0;
+}
+
+void ftp_bcache_set_data_start(BYTE pdrv, DWORD sector) {
+	if (pdrv < FTP_BCACHE_DRIVES)
+		ftp_bcache_drives[pdrv].data_start = sector;
+}
+
+DRESULT ftp_bcache_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+	ftp_bcache_block_t *b;
+	DRESULT res = RES_OK;
+
+	if (pdrv >= FTP_BCACHE_DRIVES || ftp_bcache_drives[pdrv].read == NULL)
+		return RES_NOTRDY;
+	ftp_bcache_drive_t *d = &ftp_bcache_drives[pdrv];
+
+	xSemaphoreTake(d->lock, portMAX_DELAY);
+
+	// follows the previous read?
+	uint8_t seq = (sector == d->last_end);
+	d->run = seq ? d->run + 1 : 0;
+	d->last_end = sector + count;
+
+	d->stats.reads++;
+	d->stats.sectors += count;
+
+	// a cached sector?
+	if (count == 1 && (b = ftp_bcache_find(d, sector)) != NULL) {
+		memcpy(buff, b->data, _MAX_SS);
+		b->last_used = ++d->clock;
+		goto hit;
+	}
+
+#if FTP_BCACHE_READAHEAD > 0
+	// read ahead already?
+	if (d->ra_count > 0 && sector >= d->ra_start && sector + count <= d->ra_start + d->ra_count) {
+		memcpy(buff, d->ra + (sector - d->ra_start) * _MAX_SS, count * _MAX_SS);
+		goto hit;
+	}
+
+	// front to back for a while and a small request? read ahead
+	if (seq && d->run >= FTP_BCACHE_SEQ_MIN && count < FTP_BCACHE_READAHEAD) {
+		d->ra_count = 0;
+		d->stats.device_reads++;
+		if (d->read(pdrv, d->ra, sector, FTP_BCACHE_READAHEAD) == RES_OK) {
+			d->ra_start = sector;
+			d->ra_count = FTP_BCACHE_READAHEAD;
+			d->stats.readaheads++;
+			memcpy(buff, d->ra, count * _MAX_SS);
+			goto out;
+		}
+		// e.g. past the end of the drive, just read what was asked
+	}
+#endif
+
+	// from the device
+	d->stats.device_reads++;
+	res = d->read(pdrv, buff, sector, count);
+
+	// keep single sectors, those that don't belong to a file read front
+	// to back are taken as FAT or directory
+	if (res == RES_OK && count == 1)
+		ftp_bcache_insert(d, sector, buff, sector < d->data_start || !seq);
+	goto out;
+
+hit:
+	d->stats.hits++;
+	d->stats.sectors_hit += count;
+
+out:
+	xSemaphoreGive(d->lock);
+	return res;
+}
+
+DRESULT ftp_bcache_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
+	DRESULT res;
+
+	if (pdrv >= FTP_BCACHE_DRIVES || ftp_bcache_drives[pdrv].write == NULL)
+		return RES_NOTRDY;
+	ftp_bcache_drive_t *d = &ftp_bcache_drives[pdrv];
+
+	xSemaphoreTake(d->lock, portMAX_DELAY);
+
+	res = d->write(pdrv, buff, sector, count);
+
+	// update what is cached of these sectors, forget it if the write
+	// failed as the device may have some of it
+	for (uint16_t i = 0; i < FTP_BCACHE_BLOCKS; i++) {
+		ftp_bcache_block_t *b = &d->blocks[i];
+		if (!b->used || b->sector < sector || b->sector >= sector + count)
+			continue;
+		if (res == RES_OK) {
+			memcpy(b->data, buff + (b->sector - sector) * _MAX_SS, _MAX_SS);
+		} else {
+			b->used = 0;
+			if (b->meta)
+				d->stats.meta_blocks--;
+		}
+	}
+
+#if FTP_BCACHE_READAHEAD > 0
+	// the read ahead sectors are simply dropped
+	if (d->ra_count > 0 && sector < d->ra_start + d->ra_count && sector + count > d->ra_start)
+		d->ra_count = 0;
+#endif
+
+	xSemaphoreGive(d->lock);
+	return res;
+}
+
+void ftp_bcache_invalidate(BYTE pdrv) {
+	if (pdrv >= FTP_BCACHE_DRIVES || ftp_bcache_drives[pdrv].lock == NULL)
+		return;
+	ftp_bcache_drive_t *d = &ftp_bcache_drives[pdrv];
+
+	xSemaphoreTake(d->lock, portMAX_DELAY);
+
+	for (uint16_t i = 0; i < FTP_BCACHE_BLOCKS; i++)
+		d->blocks[i].used = 0;
+	d->stats.meta_blocks = 0;
+	d->last_end = 0;
+	d->run = 0;
+#if FTP_BCACHE_READAHEAD > 0
+	d->ra_count = 0;
+#endif
+
+	xSemaphoreGive(d->lock);
+}
+
+void ftp_bcache_get_stats(ftp_bcache_stats_t *stats) {
+	memset(stats, 0, sizeof(ftp_bcache_stats_t));
+
+	// all drives added up
+	vTaskSuspendAll();
+	for (uint8_t i = 0; i < FTP_BCACHE_DRIVES; i++) {
+		const ftp_bcache_stats_t *s = &ftp_bcache_drives[i].stats;
+		stats->reads += s->reads;
+		stats->hits += s->hits;
+		stats->sectors += s->sectors;
+		stats->sectors_hit += s->sectors_hit;
+		stats->device_reads += s->device_reads;
+		stats->readaheads += s->readaheads;
+		stats->meta_blocks += s->meta_blocks;
+	}
+	xTaskResumeAll();
+}
+
+#endif
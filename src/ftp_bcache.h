@@ -0,0 +1,107 @@
+/*
+ * ftp_bcache.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_BCACHE_H_
+#define _FTP_BCACHE_H_
+
+#include <stdint.h>
+#include "ftp_port.h"
+#include "diskio.h"
+
+// sector cache below FatFs, shared by all files and sessions, 0 compiles
+// it out. The disk driver hands its reads and writes to it, see
+// ftp_bcache_init.
+#ifndef FTP_BCACHE
+#define FTP_BCACHE					0
+#endif
+
+// drives the cache serves, numbered like FatFs does. Every volume FatFs
+// knows by default, a drive past this is not ready, and each one takes
+// its own FTP_BCACHE_BLOCKS and read ahead in RAM.
+#define FTP_BCACHE_DRIVES			_VOLUMES
+
+// single sectors kept per drive, these are mostly FAT and directory
+// sectors and the sector windows of open files
+#define FTP_BCACHE_BLOCKS			32
+
+// sectors read at once when a drive is read front to back, 0 disables
+// read ahead
+#define FTP_BCACHE_READAHEAD		8
+
+// sequential reads that have to follow each other before read ahead
+// starts
+#define FTP_BCACHE_SEQ_MIN			2
+
+// reads and writes of the disk driver
+typedef DRESULT (*ftp_bcache_read_t)(BYTE pdrv, BYTE *buff, DWORD sector, UINT count);
+typedef DRESULT (*ftp_bcache_write_t)(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count);
+
+// cache counters
+typedef struct {
+	// read requests from FatFs and those served without the device
+	uint32_t reads;
+	uint32_t hits;
+
+	// sectors FatFs asked for and those that came from the cache
+	uint32_t sectors;
+	uint32_t sectors_hit;
+
+	// read requests sent to the device, of them read ahead
+	uint32_t device_reads;
+	uint32_t readaheads;
+
+	// sectors held now that belong to FAT and directories
+	uint16_t meta_blocks;
+} ftp_bcache_stats_t;
+
+/**
+ * Put the cache in front of a drive. Call it from disk_initialize,
+ * before FatFs mounts the drive, then call ftp_bcache_read and
+ * ftp_bcache_write from disk_read and disk_write. Writes go through to
+ * the device at once, the cache never holds changed sectors.
+ *
+ * @param pdrv Drive number
+ * @param read Device read
+ * @param write Device write
+ * @return 0 on success, -1 if the drive number is too large
+ */
+extern int ftp_bcache_init(BYTE pdrv, ftp_bcache_read_t read, ftp_bcache_write_t write);
+
+/**
+ * Tell where the data area of a drive starts, after f_mount this is
+ * database of the FATFS. Sectors before it are FAT (and the FAT12/16
+ * root directory) and are kept in preference to file data.
+ *
+ * @param pdrv Drive number
+ * @param sector First sector of the data area
+ */
+extern void ftp_bcache_set_data_start(BYTE pdrv, DWORD sector);
+
+/**
+ * Read through the cache, for disk_read.
+ */
+extern DRESULT ftp_bcache_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count);
+
+/**
+ * Write through the cache, for disk_write.
+ */
+extern DRESULT ftp_bcache_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count);
+
+/**
+ * Forget everything cached of a drive, e.g. when the card was swapped.
+ *
+ * @param pdrv Drive number
+ */
+extern void ftp_bcache_invalidate(BYTE pdrv);
+
+/**
+ * Get a copy of the cache counters.
+ *
+ * @param stats Structure the counters are copied to
+ */
+extern void ftp_bcache_get_stats(ftp_bcache_stats_t *stats);
+
+#endif /* _FTP_BCACHE_H_ */
@@ -0,0 +1,235 @@
+/*
+ * ftp_cache.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ftp.h"
+#include "ftp_cache.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <string.h>
+
+#if FTP_CACHE == 1
+
+// the cached files, NULL is a free slot
+static ftp_cache_entry_t *ftp_cache_slots[FTP_CACHE_ENTRIES];
+
+// ticks once per hit, orders the entries for LRU
+static uint32_t ftp_cache_clock = 0;
+
+// counters, bytes_used includes entries being filled
+static ftp_cache_stats_t ftp_cache_stats;
+
+// The table is only touched with the scheduler suspended, the sessions
+// run at the same priority so this is short and never waits on a lock.
+
+// drop the entry in a slot, call with the scheduler suspended
+static void ftp_cache_drop(uint8_t slot) {
+	ftp_cache_entry_t *entry = ftp_cache_slots[slot];
+
+	// still sending? the last user frees it
+	if (entry->users > 0) {
+		entry->stale = 1;
+		return;
+	}
+
+	ftp_cache_stats.bytes_used -= entry->size;
+	ftp_cache_stats.entries--;
+	ftp_cache_slots[slot] = NULL;
+	vPortFree(entry);
+}
+
+// slot of an entry
+static int ftp_cache_slot(const ftp_cache_entry_t *entry) {
+	for (uint8_t i = 0; i < FTP_CACHE_ENTRIES; i++)
+		if (ftp_cache_slots[i] == entry)
+			return i;
+	return -1;
+}
+
+// compare the first len bytes of two paths like FatFs compares names,
+// without case. FatFs folds bytes above ASCII with its code page, those
+// only have to be equal for a lookup. For an invalidation they match
+// anything, so no other spelling of a changed file stays behind.
+static uint8_t ftp_cache_same(const char *a, const char *b, size_t len, uint8_t loose) {
+	for (size_t i = 0; i < len; i++) {
+		char ca = a[i], cb = b[i];
+		if (loose && (uint8_t) ca >= 0x80 && (uint8_t) cb >= 0x80)
+			continue;
+		if (ca >= 'A' && ca <= 'Z')
+			ca += 'a' - 'A';
+		if (cb >= 'A' && cb <= 'Z')
+			cb += 'a' - 'A';
+		if (ca != cb)
+			return 0;
+	}
+	return 1;
+}
+
+// is the entry for this path?
+static uint8_t ftp_cache_is(const ftp_cache_entry_t *entry, const char *path) {
+	size_t len = strlen(path);
+	return strlen(entry->path) == len && ftp_cache_same(entry->path, path, len, 0);
+}
+
+// does the path name the file or something below the directory?
+static uint8_t ftp_cache_below(const char *entry_path, const char *path, size_t len) {
+	return strlen(entry_path) >= len && ftp_cache_same(entry_path, path, len, 1)
+			&& (entry_path[len] == 0 || entry_path[len] == '/' || (len == 1 && path[0] == '/'));
+}
+
+ftp_cache_entry_t *ftp_cache_get(const char *path, const FILINFO *nfo) {
+	ftp_cache_entry_t *hit = NULL;
+
+	vTaskSuspendAll();
+	for (uint8_t i = 0; i < FTP_CACHE_ENTRIES; i++) {
+		ftp_cache_entry_t *entry = ftp_cache_slots[i];
+		if (entry == NULL || entry->filling || entry->stale || !ftp_cache_is(entry, path))
+			continue;
+
+		// same file and not changed since?
+		if (entry->size == nfo->fsize && entry->fdate == nfo->fdate && entry->ftime == nfo->ftime) {
+			entry->users++;
+			entry->last_used = ++ftp_cache_clock;
+			hit = entry;
+		} else {
+			// an older version
+			ftp_cache_stats.invalidations++;
+			ftp_cache_drop(i);
+		}
+		break;
+	}
+
+	// count it
+	if (hit != NULL) {
+		ftp_cache_stats.hits++;
+		ftp_cache_stats.bytes_served += hit->size;
+	} else
+		ftp_cache_stats.misses++;
+	xTaskResumeAll();
+
+	return hit;
+}
+
+void ftp_cache_release(ftp_cache_entry_t *entry) {
+	vTaskSuspendAll();
+	entry->users--;
+
+	// dropped while we were sending?
+	if (entry->stale && entry->users == 0) {
+		int slot = ftp_cache_slot(entry);
+		if (slot >= 0)
+			ftp_cache_drop(slot);
+	}
+	xTaskResumeAll();
+}
+
+ftp_cache_entry_t *ftp_cache_fill_begin(const char *path, const FILINFO *nfo) {
+	ftp_cache_entry_t *entry = NULL;
+	size_t path_len = strlen(path) + 1;
+	int free_slot;
+
+	// worth it?
+	if (nfo->fsize == 0 || nfo->fsize > FTP_CACHE_FILE_MAX)
+		return NULL;
+
+	// a short name alias, a change through the long name wouldn't find it
+	if (strchr(path, '~') != NULL)
+		return NULL;
+
+	vTaskSuspendAll();
+	for (;;) {
+		// a free slot and enough bytes left?
+		free_slot = ftp_cache_slot(NULL);
+		if (free_slot >= 0 && ftp_cache_stats.bytes_used + nfo->fsize <= FTP_CACHE_BYTES)
+			break;
+
+		// drop the least recently used entry nobody is sending from
+		int lru = -1;
+		for (uint8_t i = 0; i < FTP_CACHE_ENTRIES; i++) {
+			ftp_cache_entry_t *e = ftp_cache_slots[i];
+			if (e != NULL && e->users == 0 && (lru < 0 || e->last_used < ftp_cache_slots[lru]->last_used))
+				lru = i;
+		}
+
+		// everything busy, no room
+		if (lru < 0)
+			goto out;
+
+		ftp_cache_stats.evictions++;
+		ftp_cache_drop(lru);
+	}
+
+	// structure, path and content in one block
+	entry = pvPortMalloc(sizeof(ftp_cache_entry_t) + path_len + nfo->fsize);
+	if (entry == NULL)
+		goto out;
+
+	entry->path = (char *) (entry + 1);
+	memcpy(entry->path, path, path_len);
+	entry->data = (uint8_t *) entry->path + path_len;
+	entry->size = nfo->fsize;
+	entry->fdate = nfo->fdate;
+	entry->ftime = nfo->ftime;
+	entry->users = 1;
+	entry->filling = 1;
+	entry->stale = 0;
+	entry->last_used = ftp_cache_clock;
+
+	// reserve the room
+	ftp_cache_slots[free_slot] = entry;
+	ftp_cache_stats.bytes_used += entry->size;
+	ftp_cache_stats.entries++;
+
+out:
+	xTaskResumeAll();
+	return entry;
+}
+
+void ftp_cache_fill_end(ftp_cache_entry_t *entry, uint8_t ok) {
+	vTaskSuspendAll();
+	entry->filling = 0;
+
+	// another session may have cached the file first
+	for (uint8_t i = 0; ok && i < FTP_CACHE_ENTRIES; i++) {
+		ftp_cache_entry_t *e = ftp_cache_slots[i];
+		if (e != NULL && e != entry && !e->filling && !e->stale && ftp_cache_is(e, entry->path))
+			ok = 0;
+	}
+
+	if (ok && !entry->stale)
+		ftp_cache_stats.fills++;
+	else
+		entry->stale = 1;
+	xTaskResumeAll();
+
+	// drops it if stale
+	ftp_cache_release(entry);
+}
+
+void ftp_cache_invalidate(const char *path) {
+	size_t len = strlen(path);
+
+	vTaskSuspendAll();
+	for (uint8_t i = 0; i < FTP_CACHE_ENTRIES; i++) {
+		ftp_cache_entry_t *entry = ftp_cache_slots[i];
+		if (entry == NULL || entry->stale || !ftp_cache_below(entry->path, path, len))
+			continue;
+
+		// a fill in progress is dropped when it ends
+		ftp_cache_stats.invalidations++;
+		ftp_cache_drop(i);
+	}
+	xTaskResumeAll();
+}
+
+void ftp_cache_get_stats(ftp_cache_stats_t *stats) {
+	vTaskSuspendAll();
+	*stats = ftp_cache_stats;
+	xTaskResumeAll();
+}
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * ftp_cache.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_CACHE_H_
+#define _FTP_CACHE_H_
+
+#include <stdint.h>
+#include "ftp_port.h"
+
+// keep often downloaded files in RAM, 0 compiles it out
+#ifndef FTP_CACHE
+#define FTP_CACHE					0
+#endif
+
+// heap the cached files may use together (bytes)
+#define FTP_CACHE_BYTES				65536
+
+// number of files in the cache
+#define FTP_CACHE_ENTRIES			8
+
+// larger files are never cached (bytes)
+#define FTP_CACHE_FILE_MAX			(FTP_CACHE_BYTES / 2)
+
+// TCP sends a cached file straight from the cache and holds on to it
+// until the client acknowledged it. A data connection that takes longer
+// than this after the last byte is aborted. (ms)
+#define FTP_CACHE_ACK_WAIT_MS		10000
+
+/**
+ * A cached file. The path, the size and the time stamp are the key, the
+ * content follows the structure in the same allocation.
+ */
+typedef struct {
+	// full path and file time stamp as FatFs has it
+	char *path;
+	uint16_t fdate;
+	uint16_t ftime;
+
+	// content
+	uint8_t *data;
+	uint32_t size;
+
+	// sessions sending from this entry, it is freed when the last one
+	// is done
+	uint8_t users;
+
+	// still being filled, not found by ftp_cache_get yet
+	uint8_t filling;
+
+	// file changed, drop the entry when the last user is done
+	uint8_t stale;
+
+	// cache clock of the last hit, for LRU
+	uint32_t last_used;
+} ftp_cache_entry_t;
+
+// cache counters
+typedef struct {
+	uint32_t hits;
+	uint32_t misses;
+
+	// files that were added, dropped for room or dropped because they
+	// changed
+	uint32_t fills;
+	uint32_t evictions;
+	uint32_t invalidations;
+
+	// bytes sent from RAM
+	uint32_t bytes_served;
+
+	// what the cache holds now
+	uint32_t bytes_used;
+	uint8_t entries;
+} ftp_cache_stats_t;
+
+#if FTP_CACHE == 1
+#define FTP_CACHE_INVALIDATE(path)	ftp_cache_invalidate(path)
+#else
+#define FTP_CACHE_INVALIDATE(path)
+#endif
+
+/**
+ * Look up a file. The entry must match the path, size and time stamp in
+ * nfo, an entry of an older version of the file is dropped. A hit is
+ * held until ftp_cache_release.
+ *
+ * @param path Full path of the file
+ * @param nfo Current file information
+ * @return The entry, NULL on a miss
+ */
+extern ftp_cache_entry_t *ftp_cache_get(const char *path, const FILINFO *nfo);
+
+/**
+ * Done sending from an entry.
+ *
+ * @param entry Entry from ftp_cache_get or ftp_cache_fill_begin
+ */
+extern void ftp_cache_release(ftp_cache_entry_t *entry);
+
+/**
+ * Make room for a file, least recently used files are dropped for it.
+ * Fill entry->data and hand it to ftp_cache_fill_end.
+ *
+ * @param path Full path of the file
+ * @param nfo File information, the size is reserved
+ * @return The entry, NULL when the file is too large or there is no room
+ */
+extern ftp_cache_entry_t *ftp_cache_fill_begin(const char *path, const FILINFO *nfo);
+
+/**
+ * Finish a fill. The entry becomes visible if the whole file was read
+ * and the file did not change in the meantime, else it is dropped.
+ *
+ * @param entry Entry from ftp_cache_fill_begin
+ * @param ok The whole file was read
+ */
+extern void ftp_cache_fill_end(ftp_cache_entry_t *entry, uint8_t ok);
+
+/**
+ * Drop a file, or everything below a directory, because it changes.
+ * The file functions call this for every write, delete, rename and
+ * time stamp change.
+ *
+ * @param path Full path
+ */
+extern void ftp_cache_invalidate(const char *path);
+
+/**
+ * Get a copy of the cache counters.
+ *
+ * @param stats Structure the counters are copied to
+ */
+extern void ftp_cache_get_stats(ftp_cache_stats_t *stats);
+
+#endif /* _FTP_CACHE_H_ */
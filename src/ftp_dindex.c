@@ -0,0 +1,597 @@
+/*
+ * ftp_dindex.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ftp.h"
+#include "ftp_dindex.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if FTP_DINDEX == 1
+
+// A directory index is a hash table of the names in the directory with
+// their file information. The key is a 64 bit hash of the name, folded
+// to lower case like FatFs compares names, so a name that isn't in a
+// complete index doesn't exist. Paths FatFs could resolve another way,
+// short name aliases and non ASCII names, are left to FatFs.
+
+// an entry of a table, empty when the key is 0
+typedef struct {
+	uint32_t key[2];
+	FSIZE_t fsize;
+	uint16_t fdate;
+	uint16_t ftime;
+	uint8_t fattrib;
+	uint8_t flags;
+} ftp_dindex_entry_t;
+
+// the entry changed, the file system has the file information
+#define FTP_DINDEX_STALE			0x01
+
+// removed, the probe goes on past it
+#define FTP_DINDEX_DELETED			0x02
+
+// state of a directory slot
+#define FTP_DINDEX_FREE				0
+#define FTP_DINDEX_BUILDING			1
+#define FTP_DINDEX_READY			2
+
+// too few names to be worth it, or too many for the budget. The
+// directory is left to the file system without reading it again.
+#define FTP_DINDEX_SMALL			3
+#define FTP_DINDEX_LARGE			4
+
+// an indexed directory
+typedef struct {
+	uint8_t state;
+
+	// changed while it was read, the index is thrown away
+	uint8_t dirty;
+
+	char dir[FTP_DINDEX_PATH_SIZE];
+	uint32_t dir_key[2];
+
+	// counts every change, a refresh only applies to the version it was
+	// asked for
+	uint32_t version;
+	uint32_t last_used;
+
+	// table of size entries, a power of 2. used counts the deleted ones
+	// too, the probe needs empty entries to end.
+	ftp_dindex_entry_t *table;
+	uint32_t size;
+	uint32_t count;
+	uint32_t used;
+
+	// changes since a small directory was read
+	uint32_t changes;
+} ftp_dindex_dir_t;
+
+// a file open for writing, its entry changes when it is closed
+typedef struct {
+	const void *file;
+
+	// keys of the directory and the name, all 0 for a path the index
+	// can't follow
+	uint32_t dir_key[2];
+	uint32_t key[2];
+} ftp_dindex_writer_t;
+
+// state of a directory read, on the heap
+typedef struct {
+	ftp_dir_t dir;
+	FILINFO nfo;
+} ftp_dindex_scan_t;
+
+static ftp_dindex_dir_t ftp_dindex_dirs[FTP_DINDEX_DIRS];
+static ftp_dindex_writer_t ftp_dindex_writers[FTP_DINDEX_WRITERS];
+
+// orders the slots for LRU and numbers the versions
+static uint32_t ftp_dindex_clock = 0;
+
+// counters, bytes_used includes tables being filled
+static ftp_dindex_stats_t ftp_dindex_stats;
+
+// key of a removed entry
+static const uint32_t ftp_dindex_none[2] = { 0, 0 };
+
+// more files were open for writing than can be followed, off for good
+static uint8_t ftp_dindex_off = 0;
+
+// Everything is only touched with the scheduler suspended, like the file
+// cache, and never for longer than a few probes. Directories are read
+// with the scheduler running.
+
+static inline char ftp_dindex_fold(char c) {
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// FNV-1a 64 of a name folded to lower case, never 0
+static void ftp_dindex_hash(const char *s, size_t len, uint32_t *key) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < len; i++) {
+		h ^= (uint8_t) ftp_dindex_fold(s[i]);
+		h *= 0x100000001b3ULL;
+	}
+
+	key[0] = (uint32_t) h;
+	key[1] = (uint32_t) (h >> 32);
+	if (key[0] == 0 && key[1] == 0)
+		key[0] = 1;
+}
+
+// can the index follow the path? FatFs also finds names by their short
+// alias, folds non ASCII letters with its code page and ignores trailing
+// dots and spaces, those go to FatFs.
+static uint8_t ftp_dindex_plain(const char *path) {
+	const char *p;
+
+	for (p = path; *p != 0; p++) {
+		if ((uint8_t) *p >= 0x80 || *p == '~')
+			return 0;
+		if (*p == '/' && p > path && (p[-1] == '/' || p[-1] == '.' || p[-1] == ' '))
+			return 0;
+	}
+
+	// the last name
+	return p == path || (p[-1] != '.' && p[-1] != ' ');
+}
+
+// split a path into its directory and name, 0 if the index can't take it
+static uint8_t ftp_dindex_split(const char *path, size_t *dir_len, const char **name) {
+	const char *slash = strrchr(path, '/');
+
+	if (slash == NULL || slash[1] == 0 || !ftp_dindex_plain(path))
+		return 0;
+
+	// the root keeps its '/'
+	*dir_len = slash == path ? 1 : (size_t) (slash - path);
+	*name = slash + 1;
+	return *dir_len < FTP_DINDEX_PATH_SIZE;
+}
+
+static uint8_t ftp_dindex_same(const char *a, const char *b, size_t len) {
+	for (size_t i = 0; i < len; i++)
+		if (ftp_dindex_fold(a[i]) != ftp_dindex_fold(b[i]))
+			return 0;
+	return 1;
+}
+
+// slot of a directory, call with the scheduler suspended
+static ftp_dindex_dir_t *ftp_dindex_dir_find(const char *dir, size_t len) {
+	for (uint8_t i = 0; i < FTP_DINDEX_DIRS; i++) {
+		ftp_dindex_dir_t *d = &ftp_dindex_dirs[i];
+		if (d->state != FTP_DINDEX_FREE && d->dir[len] == 0 && ftp_dindex_same(d->dir, dir, len))
+			return d;
+	}
+	return NULL;
+}
+
+static ftp_dindex_dir_t *ftp_dindex_dir_by_key(const uint32_t *key) {
+	for (uint8_t i = 0; i < FTP_DINDEX_DIRS; i++) {
+		ftp_dindex_dir_t *d = &ftp_dindex_dirs[i];
+		if (d->state != FTP_DINDEX_FREE && d->dir_key[0] == key[0] && d->dir_key[1] == key[1])
+			return d;
+	}
+	return NULL;
+}
+
+// free the table of a slot, a slot being read is freed by its reader
+static void ftp_dindex_release(ftp_dindex_dir_t *d) {
+	if (d->state == FTP_DINDEX_BUILDING) {
+		d->dirty = 1;
+		return;
+	}
+
+	if (d->table != NULL) {
+		ftp_dindex_stats.bytes_used -= d->size * sizeof(ftp_dindex_entry_t);
+		ftp_dindex_stats.drops++;
+		vPortFree(d->table);
+		d->table = NULL;
+	}
+	d->state = FTP_DINDEX_FREE;
+}
+
+static void ftp_dindex_release_all(void) {
+	for (uint8_t i = 0; i < FTP_DINDEX_DIRS; i++)
+		if (ftp_dindex_dirs[i].state != FTP_DINDEX_FREE)
+			ftp_dindex_release(&ftp_dindex_dirs[i]);
+}
+
+// a free slot or the least recently used one that isn't being read
+static ftp_dindex_dir_t *ftp_dindex_lru(const ftp_dindex_dir_t *except, uint8_t with_table) {
+	ftp_dindex_dir_t *lru = NULL;
+
+	for (uint8_t i = 0; i < FTP_DINDEX_DIRS; i++) {
+		ftp_dindex_dir_t *d = &ftp_dindex_dirs[i];
+		if (d == except || d->state == FTP_DINDEX_BUILDING || (with_table && d->table == NULL))
+			continue;
+		if (d->state == FTP_DINDEX_FREE)
+			return d;
+		if (lru == NULL || d->last_used < lru->last_used)
+			lru = d;
+	}
+	return lru;
+}
+
+// reserve bytes of the budget, older indexes are dropped for them. Call
+// with the scheduler suspended.
+static uint8_t ftp_dindex_reserve(const ftp_dindex_dir_t *self, uint32_t bytes) {
+	while (ftp_dindex_stats.bytes_used + bytes > FTP_DINDEX_BYTES) {
+		ftp_dindex_dir_t *d = ftp_dindex_lru(self, 1);
+		if (d == NULL)
+			return 0;
+		ftp_dindex_release(d);
+	}
+
+	ftp_dindex_stats.bytes_used += bytes;
+	return 1;
+}
+
+// entry of a key, NULL if the name isn't there
+static ftp_dindex_entry_t *ftp_dindex_find(ftp_dindex_entry_t *table, uint32_t size, const uint32_t *key) {
+	for (uint32_t i = key[0] & (size - 1);; i = (i + 1) & (size - 1)) {
+		ftp_dindex_entry_t *e = &table[i];
+		if (e->key[0] == key[0] && e->key[1] == key[1])
+			return e;
+		if (e->key[0] == 0 && e->key[1] == 0 && !(e->flags & FTP_DINDEX_DELETED))
+			return NULL;
+	}
+}
+
+// first unused entry for a key that isn't in the table
+static ftp_dindex_entry_t *ftp_dindex_slot(ftp_dindex_entry_t *table, uint32_t size, const uint32_t *key) {
+	uint32_t i = key[0] & (size - 1);
+
+	while (table[i].key[0] != 0 || table[i].key[1] != 0)
+		i = (i + 1) & (size - 1);
+	return &table[i];
+}
+
+static void ftp_dindex_set(ftp_dindex_entry_t *e, const uint32_t *key, const FILINFO *nfo, uint8_t flags) {
+	e->key[0] = key[0];
+	e->key[1] = key[1];
+	e->fsize = nfo != NULL ? nfo->fsize : 0;
+	e->fdate = nfo != NULL ? nfo->fdate : 0;
+	e->ftime = nfo != NULL ? nfo->ftime : 0;
+	e->fattrib = nfo != NULL ? nfo->fattrib : 0;
+	e->flags = flags;
+}
+
+// double a table being read, within the budget
+static ftp_dindex_entry_t *ftp_dindex_grow(ftp_dindex_dir_t *d, ftp_dindex_entry_t *table, uint32_t *size) {
+	uint32_t new_size = *size ? *size * 2 : 256;
+	uint32_t more = (new_size - *size) * sizeof(ftp_dindex_entry_t);
+
+	vTaskSuspendAll();
+	uint8_t room = ftp_dindex_reserve(d, more);
+	xTaskResumeAll();
+	if (!room)
+		return NULL;
+
+	ftp_dindex_entry_t *grown = pvPortMalloc(new_size * sizeof(ftp_dindex_entry_t));
+	if (grown == NULL) {
+		vTaskSuspendAll();
+		ftp_dindex_stats.bytes_used -= more;
+		xTaskResumeAll();
+		return NULL;
+	}
+
+	memset(grown, 0, new_size * sizeof(ftp_dindex_entry_t));
+	for (uint32_t i = 0; i < *size; i++)
+		if (table[i].key[0] != 0 || table[i].key[1] != 0)
+			*ftp_dindex_slot(grown, new_size, table[i].key) = table[i];
+
+	if (table != NULL)
+		vPortFree(table);
+	*size = new_size;
+	return grown;
+}
+
+// read a directory into a slot in FTP_DINDEX_BUILDING
+static void ftp_dindex_build(ftp_dindex_dir_t *d) {
+	ftp_dindex_entry_t *table = NULL;
+	uint32_t size = 0, count = 0, key[2];
+	uint8_t state = FTP_DINDEX_FREE;
+	FRESULT res;
+
+	ftp_dindex_scan_t *scan = pvPortMalloc(sizeof(ftp_dindex_scan_t));
+	if (scan != NULL && ftps_f_opendir(&scan->dir, d->dir) == FR_OK) {
+		state = FTP_DINDEX_READY;
+
+		while ((res = ftps_f_readdir(&scan->dir, &scan->nfo)) == FR_OK && scan->nfo.fname[0] != 0) {
+			// three quarters full at most, probes stay short
+			if ((count + 1) * 4 > size * 3) {
+				ftp_dindex_entry_t *grown = ftp_dindex_grow(d, table, &size);
+				if (grown == NULL) {
+					state = FTP_DINDEX_LARGE;
+					break;
+				}
+				table = grown;
+			}
+
+			ftp_dindex_hash(scan->nfo.fname, strlen(scan->nfo.fname), key);
+			ftp_dindex_set(ftp_dindex_slot(table, size, key), key, &scan->nfo, 0);
+			count++;
+		}
+		ftps_f_closedir(&scan->dir);
+
+		// a read error leaves the index incomplete
+		if (state == FTP_DINDEX_READY && res != FR_OK)
+			state = FTP_DINDEX_FREE;
+
+		if (state == FTP_DINDEX_READY && count < FTP_DINDEX_MIN_ENTRIES)
+			state = FTP_DINDEX_SMALL;
+	}
+	if (scan != NULL)
+		vPortFree(scan);
+
+	vTaskSuspendAll();
+	// changed while it was read, read it again next time
+	if (d->dirty)
+		state = FTP_DINDEX_FREE;
+
+	// only a complete index is kept
+	if (state != FTP_DINDEX_READY && table != NULL) {
+		ftp_dindex_stats.bytes_used -= size * sizeof(ftp_dindex_entry_t);
+		vPortFree(table);
+		table = NULL;
+		size = 0;
+	}
+
+	d->table = table;
+	d->size = size;
+	d->count = count;
+	d->used = count;
+	d->changes = 0;
+	d->version = ++ftp_dindex_clock;
+	d->last_used = ftp_dindex_clock;
+	d->state = state;
+	if (state == FTP_DINDEX_READY)
+		ftp_dindex_stats.builds++;
+	xTaskResumeAll();
+}
+
+int ftp_dindex_lookup(const char *path, FILINFO *nfo, FRESULT *res, uint32_t *token) {
+	const char *name;
+	size_t dir_len;
+	uint32_t key[2];
+	int answered = 0;
+
+	*token = 0;
+	if (ftp_dindex_off || !ftp_dindex_split(path, &dir_len, &name))
+		return 0;
+	ftp_dindex_hash(name, strlen(name), key);
+
+	vTaskSuspendAll();
+	ftp_dindex_dir_t *d = ftp_dindex_dir_find(path, dir_len);
+
+	// first time in this directory, read it
+	if (d == NULL && (d = ftp_dindex_lru(NULL, 0)) != NULL) {
+		ftp_dindex_release(d);
+		memcpy(d->dir, path, dir_len);
+		d->dir[dir_len] = 0;
+		ftp_dindex_hash(d->dir, dir_len, d->dir_key);
+		d->state = FTP_DINDEX_BUILDING;
+		d->dirty = 0;
+		xTaskResumeAll();
+
+		ftp_dindex_build(d);
+
+		// the slot may have gone to another directory meanwhile
+		vTaskSuspendAll();
+		d = ftp_dindex_dir_find(path, dir_len);
+	}
+
+	if (d != NULL && d->state == FTP_DINDEX_READY) {
+		d->last_used = ++ftp_dindex_clock;
+
+		ftp_dindex_entry_t *e = ftp_dindex_find(d->table, d->size, key);
+		if (e == NULL) {
+			*res = FR_NO_FILE;
+			answered = 1;
+		} else if (!(e->flags & FTP_DINDEX_STALE)) {
+			nfo->fsize = e->fsize;
+			nfo->fdate = e->fdate;
+			nfo->ftime = e->ftime;
+			nfo->fattrib = e->fattrib;
+			*res = FR_OK;
+			answered = 1;
+		} else {
+			*token = d->version;
+		}
+	}
+
+	if (answered)
+		ftp_dindex_stats.hits++;
+	else
+		ftp_dindex_stats.misses++;
+	xTaskResumeAll();
+
+	// the name as it was asked for, FatFs would give the stored case
+	if (answered && *res == FR_OK)
+		snprintf(nfo->fname, sizeof(nfo->fname), "%s", name);
+	return answered;
+}
+
+void ftp_dindex_refresh(const char *path, uint32_t token, FRESULT res, const FILINFO *nfo) {
+	const char *name;
+	size_t dir_len;
+	uint32_t key[2];
+
+	if (!ftp_dindex_split(path, &dir_len, &name))
+		return;
+	ftp_dindex_hash(name, strlen(name), key);
+
+	vTaskSuspendAll();
+	ftp_dindex_dir_t *d = ftp_dindex_dir_find(path, dir_len);
+	if (d != NULL && d->state == FTP_DINDEX_READY && d->version == token) {
+		ftp_dindex_entry_t *e = ftp_dindex_find(d->table, d->size, key);
+		if (e != NULL && res == FR_OK) {
+			ftp_dindex_set(e, key, nfo, 0);
+		} else if (e != NULL && res == FR_NO_FILE) {
+			ftp_dindex_set(e, ftp_dindex_none, NULL, FTP_DINDEX_DELETED);
+			d->count--;
+		}
+	}
+	xTaskResumeAll();
+}
+
+// a name of an indexed directory changed, call with the scheduler
+// suspended
+static void ftp_dindex_touch(ftp_dindex_dir_t *d, const uint32_t *key, uint8_t add) {
+	if (d->state == FTP_DINDEX_BUILDING) {
+		d->dirty = 1;
+		return;
+	}
+
+	// a small directory that grows is read again
+	if (d->state == FTP_DINDEX_SMALL && ++d->changes >= FTP_DINDEX_MIN_ENTRIES)
+		ftp_dindex_release(d);
+	if (d->state != FTP_DINDEX_READY)
+		return;
+
+	d->version = ++ftp_dindex_clock;
+	ftp_dindex_entry_t *e = ftp_dindex_find(d->table, d->size, key);
+	if (e != NULL) {
+		e->flags |= FTP_DINDEX_STALE;
+	} else if (add) {
+		// full, read it again next time into a larger table
+		if ((d->used + 1) * 4 > d->size * 3) {
+			ftp_dindex_release(d);
+			return;
+		}
+
+		// the file system has the information, the name is enough
+		e = ftp_dindex_slot(d->table, d->size, key);
+		if (!(e->flags & FTP_DINDEX_DELETED))
+			d->used++;
+		ftp_dindex_set(e, key, NULL, FTP_DINDEX_STALE);
+		d->count++;
+	}
+}
+
+void ftp_dindex_change(const char *path) {
+	const char *name;
+	size_t dir_len;
+	uint32_t key[2];
+
+	vTaskSuspendAll();
+	if (!ftp_dindex_split(path, &dir_len, &name)) {
+		// a path the index can't follow may name anything
+		ftp_dindex_release_all();
+	} else {
+		ftp_dindex_hash(name, strlen(name), key);
+
+		ftp_dindex_dir_t *d = ftp_dindex_dir_find(path, dir_len);
+		if (d != NULL)
+			ftp_dindex_touch(d, key, 1);
+	}
+	xTaskResumeAll();
+}
+
+void ftp_dindex_remove(const char *path) {
+	const char *name;
+	size_t dir_len, len = strlen(path);
+	uint32_t key[2];
+
+	vTaskSuspendAll();
+	if (!ftp_dindex_split(path, &dir_len, &name)) {
+		ftp_dindex_release_all();
+	} else {
+		ftp_dindex_hash(name, strlen(name), key);
+
+		ftp_dindex_dir_t *d = ftp_dindex_dir_find(path, dir_len);
+		if (d != NULL && d->state == FTP_DINDEX_READY) {
+			d->version = ++ftp_dindex_clock;
+			ftp_dindex_entry_t *e = ftp_dindex_find(d->table, d->size, key);
+			if (e != NULL) {
+				ftp_dindex_set(e, ftp_dindex_none, NULL, FTP_DINDEX_DELETED);
+				d->count--;
+			}
+		} else if (d != NULL) {
+			ftp_dindex_touch(d, key, 0);
+		}
+
+		// indexes of the directory and below it are gone with it
+		for (uint8_t i = 0; i < FTP_DINDEX_DIRS && len < FTP_DINDEX_PATH_SIZE; i++) {
+			d = &ftp_dindex_dirs[i];
+			if (d->state != FTP_DINDEX_FREE && ftp_dindex_same(d->dir, path, len) && (d->dir[len] == 0 || d->dir[len] == '/'))
+				ftp_dindex_release(d);
+		}
+	}
+	xTaskResumeAll();
+}
+
+void ftp_dindex_open(const void *file, const char *path) {
+	const char *name;
+	size_t dir_len;
+	ftp_dindex_writer_t *w = NULL;
+
+	// a new file or a new size
+	ftp_dindex_change(path);
+
+	vTaskSuspendAll();
+	for (uint8_t i = 0; i < FTP_DINDEX_WRITERS && w == NULL; i++)
+		if (ftp_dindex_writers[i].file == NULL)
+			w = &ftp_dindex_writers[i];
+
+	if (w == NULL) {
+		// a size that changes unseen could be read into an index
+		ftp_dindex_off = 1;
+		ftp_dindex_release_all();
+	} else if (!ftp_dindex_split(path, &dir_len, &name)) {
+		// anything could change when it's closed
+		memset(w, 0, sizeof(ftp_dindex_writer_t));
+		w->file = file;
+	} else {
+		w->file = file;
+		ftp_dindex_hash(path, dir_len, w->dir_key);
+		ftp_dindex_hash(name, strlen(name), w->key);
+	}
+	xTaskResumeAll();
+
+	if (w == NULL)
+		log_print("ftp_dindex off, more than %d files written\r\n", FTP_DINDEX_WRITERS);
+}
+
+void ftp_dindex_close(const void *file) {
+	vTaskSuspendAll();
+	for (uint8_t i = 0; i < FTP_DINDEX_WRITERS; i++) {
+		ftp_dindex_writer_t *w = &ftp_dindex_writers[i];
+		if (w->file != file)
+			continue;
+
+		// the size and time are on the card now
+		if (w->dir_key[0] == 0 && w->dir_key[1] == 0) {
+			ftp_dindex_release_all();
+		} else {
+			ftp_dindex_dir_t *d = ftp_dindex_dir_by_key(w->dir_key);
+			if (d != NULL)
+				ftp_dindex_touch(d, w->key, 0);
+		}
+
+		w->file = NULL;
+		break;
+	}
+	xTaskResumeAll();
+}
+
+void ftp_dindex_get_stats(ftp_dindex_stats_t *stats) {
+	vTaskSuspendAll();
+	*stats = ftp_dindex_stats;
+	stats->dirs = 0;
+	for (uint8_t i = 0; i < FTP_DINDEX_DIRS; i++)
+		if (ftp_dindex_dirs[i].state == FTP_DINDEX_READY)
+			stats->dirs++;
+	xTaskResumeAll();
+}
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * ftp_dindex.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_DINDEX_H_
+#define _FTP_DINDEX_H_
+
+#include <stdint.h>
+#include "ftp_port.h"
+
+// look up names in large FatFs directories in RAM instead of scanning
+// the directory on the card, 0 compiles it out. The index only sees the
+// changes made through the ftps_* file functions. Code that changes the
+// volume with FatFs directly has to call ftp_dindex_change or
+// ftp_dindex_remove afterwards, else stat may answer with what was there
+// before.
+#ifndef FTP_DINDEX
+#define FTP_DINDEX					0
+#endif
+
+// heap the indexes may use together, a name takes 27 to 53 bytes. The
+// default holds directories of about 1200 to 2400 names, a directory of
+// 20000 names needs 640 kB and is left to FatFs unless this is raised,
+// on a device with the RAM for it. (bytes)
+#ifndef FTP_DINDEX_BYTES
+#define FTP_DINDEX_BYTES			65536
+#endif
+
+// directories indexed at the same time, least recently used goes first
+#define FTP_DINDEX_DIRS				4
+
+// smaller directories are scanned like before
+#define FTP_DINDEX_MIN_ENTRIES		64
+
+// files open for writing at the same time, one per session plus the
+// journal and a trace
+#define FTP_DINDEX_WRITERS			(FTP_NBR_CLIENTS + 2)
+
+// longest directory path, FTP_CWD_SIZE
+#define FTP_DINDEX_PATH_SIZE		(_MAX_LFN + 8)
+
+// index counters
+typedef struct {
+	// stat answered from RAM, and handed to the file system
+	uint32_t hits;
+	uint32_t misses;
+
+	// directories read into an index, and indexes dropped for room or
+	// because they could not be kept up to date
+	uint32_t builds;
+	uint32_t drops;
+
+	// what the indexes hold now
+	uint32_t bytes_used;
+	uint8_t dirs;
+} ftp_dindex_stats_t;
+
+#if FTP_DINDEX == 1
+#define FTP_DINDEX_CLOSE(file)		ftp_dindex_close(file)
+#else
+#define FTP_DINDEX_CLOSE(file)
+#endif
+
+/**
+ * Look up a path in the index of its directory. The directory is read
+ * into an index the first time. Called by ftps_f_stat for paths on FatFs.
+ *
+ * @param path Full path
+ * @param nfo File information, set when the name was found
+ * @param res FR_OK or FR_NO_FILE when answered
+ * @param token Set when the entry is known but changed, hand it to
+ * ftp_dindex_refresh with the result of the file system
+ * @return 1 if answered, 0 if the file system has to be asked
+ */
+extern int ftp_dindex_lookup(const char *path, FILINFO *nfo, FRESULT *res, uint32_t *token);
+
+/**
+ * Update an entry that changed with what the file system reported. It
+ * is ignored if the directory changed again in the meantime.
+ *
+ * @param path Full path
+ * @param token Token from ftp_dindex_lookup
+ * @param res Result of the file system
+ * @param nfo File information of the file system
+ */
+extern void ftp_dindex_refresh(const char *path, uint32_t token, FRESULT res, const FILINFO *nfo);
+
+/**
+ * A file or a directory is gone, with everything below it. The ftps_*
+ * functions call this, code that uses FatFs directly has to as well.
+ *
+ * @param path Full path
+ */
+extern void ftp_dindex_remove(const char *path);
+
+/**
+ * A file or a directory was created or changed. The ftps_* functions
+ * call this, code that uses FatFs directly has to as well, after it
+ * closed a file it wrote.
+ *
+ * @param path Full path
+ */
+extern void ftp_dindex_change(const char *path);
+
+/**
+ * A file was opened for writing, its entry is looked up again when it
+ * is closed.
+ *
+ * @param file The open file
+ * @param path Full path
+ */
+extern void ftp_dindex_open(const void *file, const char *path);
+
+/**
+ * A file was closed.
+ *
+ * @param file The file
+ */
+extern void ftp_dindex_close(const void *file);
+
+/**
+ * Get a copy of the index counters.
+ *
+ * @param stats Structure the counters are copied to
+ */
+extern void ftp_dindex_get_stats(ftp_dindex_stats_t *stats);
+
+#endif /* _FTP_DINDEX_H_ */
@@ -7,56 +7,675 @@
 
 #include "ftp.h"
 #include "ftp_file.h"
-#include "fatfs.h"
+#include "ftp_span.h"
+#include "ftp_cache.h"
+#include "ftp_dindex.h"
+#include "ftp_port.h"
 
-FRESULT ftps_f_stat(const char *path, FILINFO *nfo) {
+#include <stdio.h>
+#include <string.h>
+
+// free space of a FatFs drive in bytes, the unit is the cluster
+static FRESULT ftp_fat_getfree(const TCHAR *path, uint64_t *free, uint64_t *total, uint32_t *unit) {
+	FATFS *fs;
+	DWORD nclst;
+
+	FRESULT res = f_getfree(path, &nclst, &fs);
+	if (res != FR_OK)
+		return res;
+
+	// cluster size
+#if _MAX_SS != _MIN_SS
+	uint32_t csize = fs->csize * fs->ssize;
+#else
+	uint32_t csize = fs->csize * _MAX_SS;
+#endif
+
+	*free = (uint64_t) nclst * csize;
+	*total = (uint64_t) (fs->n_fatent - 2) * csize;
+	*unit = csize;
+	return FR_OK;
+}
+
+#if FTP_FS_BACKENDS == 1
+
+// =========================================================
+//
+//                     FatFs backend
+//
+// =========================================================
+
+// room for a drive in front of a path
+#define FTP_FAT_PATH_SIZE		(FTP_CWD_SIZE + 4)
+
+// put the drive of the mount in front of the path
+static const char *ftp_fat_path(void *ctx, const char *path, char *buf) {
+	// default drive?
+	if (ctx == NULL)
+		return path;
+
+	snprintf(buf, FTP_FAT_PATH_SIZE, "%s%s", (const char *) ctx, path);
+	return buf;
+}
+
+static FRESULT ftp_fat_stat(void *ctx, const char *path, FILINFO *nfo) {
+	char buf[FTP_FAT_PATH_SIZE];
+	return f_stat(ftp_fat_path(ctx, path, buf), nfo);
+}
+
+static FRESULT ftp_fat_opendir(void *ctx, ftp_dir_t *dir, const char *path) {
+	char buf[FTP_FAT_PATH_SIZE];
+	return f_opendir(&dir->fat, ftp_fat_path(ctx, path, buf));
+}
+
+static FRESULT ftp_fat_readdir(ftp_dir_t *dir, FILINFO *nfo) {
+	return f_readdir(&dir->fat, nfo);
+}
+
+static FRESULT ftp_fat_closedir(ftp_dir_t *dir) {
+	return f_closedir(&dir->fat);
+}
+
+static FRESULT ftp_fat_unlink(void *ctx, const char *path) {
+	char buf[FTP_FAT_PATH_SIZE];
+	return f_unlink(ftp_fat_path(ctx, path, buf));
+}
+
+static FRESULT ftp_fat_open(void *ctx, ftp_file_t *file, const char *path, uint8_t mode) {
+	char buf[FTP_FAT_PATH_SIZE];
+	return f_open(&file->fat, ftp_fat_path(ctx, path, buf), mode);
+}
+
+static FSIZE_t ftp_fat_size(ftp_file_t *file) {
+	return f_size(&file->fat);
+}
+
+static FRESULT ftp_fat_close(ftp_file_t *file) {
+	return f_close(&file->fat);
+}
+
+static FRESULT ftp_fat_read(ftp_file_t *file, void *buffer, uint32_t len, uint32_t *read) {
+	return f_read(&file->fat, buffer, len, (UINT *) read);
+}
+
+static FRESULT ftp_fat_write(ftp_file_t *file, const void *buffer, uint32_t len, uint32_t *written) {
+	return f_write(&file->fat, buffer, len, (UINT *) written);
+}
+
+static FRESULT ftp_fat_lseek(ftp_file_t *file, FSIZE_t ofs) {
+	return f_lseek(&file->fat, ofs);
+}
+
+static FRESULT ftp_fat_mkdir(void *ctx, const char *path) {
+	char buf[FTP_FAT_PATH_SIZE];
+	return f_mkdir(ftp_fat_path(ctx, path, buf));
+}
+
+static FRESULT ftp_fat_rename(void *ctx, const char *from, const char *to) {
+	// FatFs takes the drive from the old name only
+	char buf[FTP_FAT_PATH_SIZE];
+	return f_rename(ftp_fat_path(ctx, from, buf), to);
+}
+
+static FRESULT ftp_fat_utime(void *ctx, const char *path, const FILINFO *nfo) {
+	char buf[FTP_FAT_PATH_SIZE];
+	return f_utime(ftp_fat_path(ctx, path, buf), nfo);
+}
+
+static FRESULT ftp_fat_getfree_ctx(void *ctx, const char *path, uint64_t *free, uint64_t *total, uint32_t *unit) {
+	char buf[FTP_FAT_PATH_SIZE];
+	return ftp_fat_getfree(ftp_fat_path(ctx, path, buf), free, total, unit);
+}
+
+const ftp_fs_t ftp_fs_fatfs = {
+	.name = "fatfs",
+	.stat = ftp_fat_stat,
+	.opendir = ftp_fat_opendir,
+	.readdir = ftp_fat_readdir,
+	.closedir = ftp_fat_closedir,
+	.unlink = ftp_fat_unlink,
+	.open = ftp_fat_open,
+	.size = ftp_fat_size,
+	.close = ftp_fat_close,
+	.read = ftp_fat_read,
+	.write = ftp_fat_write,
+	.lseek = ftp_fat_lseek,
+	.mkdir = ftp_fat_mkdir,
+	.rename = ftp_fat_rename,
+	.utime = ftp_fat_utime,
+	.getfree = ftp_fat_getfree_ctx,
+};
+
+// =========================================================
+//
+//                       Mount points
+//
+// =========================================================
+
+// mount point
+typedef struct {
+	const char *prefix;
+	uint8_t len;
+	const ftp_fs_t *fs;
+	void *ctx;
+} ftp_mount_t;
+
+// mounts are made before the server starts, afterwards they are only read
+static ftp_mount_t ftp_mounts[FTP_FS_MOUNTS];
+static uint8_t ftp_mount_count = 0;
+
+// used while nothing is mounted
+static const ftp_mount_t ftp_mount_default = { "/", 0, &ftp_fs_fatfs, NULL };
+
+#if FTP_IOSCHED == 1
+// request queue of each mount
+static ftp_iosched_t ftp_mount_sched[FTP_FS_MOUNTS];
+
+static inline ftp_iosched_t *ftp_fs_sched(ftp_file_t *file) {
+	return file->sched;
+}
+#endif
+
+int ftp_fs_mount(const char *prefix, const ftp_fs_t *fs, void *ctx) {
+	if (ftp_mount_count >= FTP_FS_MOUNTS || prefix == NULL || fs == NULL)
+		return -1;
+
+	ftp_mount_t *m = &ftp_mounts[ftp_mount_count++];
+	m->prefix = prefix;
+	m->fs = fs;
+	m->ctx = ctx;
+
+	// the root matches every path with nothing to strip
+	m->len = strcmp(prefix, "/") ? strlen(prefix) : 0;
+
+	return 0;
+}
+
+const char *ftp_fs_mount_get(uint8_t index, const ftp_fs_t **fs) {
+	const ftp_mount_t *m;
+
+	// the default mount counts as one while nothing is mounted
+	if (ftp_mount_count == 0 && index == 0)
+		m = &ftp_mount_default;
+	else if (index < ftp_mount_count)
+		m = &ftp_mounts[index];
+	else
+		return NULL;
+
+	if (fs != NULL)
+		*fs = m->fs;
+	return m->prefix;
+}
+
+// does a path hold a "." or ".." name? FatFs keeps those in the volume,
+// other backends could leave their directory with them.
+static uint8_t ftp_fs_dots(const char *path) {
+	for (const char *p = path; *p != 0; p++) {
+		if (*p == '.' && (p == path || p[-1] == '/')
+				&& (p[1] == 0 || p[1] == '/' || (p[1] == '.' && (p[2] == 0 || p[2] == '/'))))
+			return 1;
+	}
+	return 0;
+}
+
+// find the mount of a path, rel gets the path on the mount
+static const ftp_mount_t *ftp_fs_find(const char *path, const char **rel) {
+	const ftp_mount_t *best = NULL;
+
+	// nothing mounted, all FatFs
+	if (ftp_mount_count == 0) {
+		*rel = path;
+		return &ftp_mount_default;
+	}
+
+	// longest prefix that ends at a path separator
+	for (uint8_t i = 0; i < ftp_mount_count; i++) {
+		const ftp_mount_t *m = &ftp_mounts[i];
+		if (strncmp(path, m->prefix, m->len) == 0 && (path[m->len] == 0 || path[m->len] == '/') && (best == NULL || m->len > best->len))
+			best = m;
+	}
+
+	if (best != NULL) {
+		*rel = path[best->len] ? path + best->len : "/";
+
+		// no way out of the mount
+		if (best->fs != &ftp_fs_fatfs && ftp_fs_dots(*rel))
+			return NULL;
+	}
+	return best;
+}
+
+int ftp_fs_mount_index(const char *path) {
+	const char *rel;
+	const ftp_mount_t *m = ftp_fs_find(path, &rel);
+
+	if (m == NULL)
+		return -1;
+	return m == &ftp_mount_default ? 0 : m - ftp_mounts;
+}
+
+#if FTP_FS_MOUNTS > 8
+#error "a directory keeps its mount points in 8 bits"
+#endif
+
+// mount points directly below a directory, a bit per mount. A volume
+// mounted at /sd shows up as directory sd in the root, even when
+// nothing is mounted at the root itself.
+static uint8_t ftp_fs_children(const char *path) {
+	size_t len = strcmp(path, "/") ? strlen(path) : 0;
+	uint8_t mask = 0;
+
+	for (uint8_t i = 0; i < ftp_mount_count; i++) {
+		const ftp_mount_t *m = &ftp_mounts[i];
+		if (m->len > len && strncmp(m->prefix, path, len) == 0 && m->prefix[len] == '/' && strchr(m->prefix + len + 1, '/') == NULL)
+			mask |= 1 << i;
+	}
+
+	return mask;
+}
+
+// file information of a mount point or a directory that only holds
+// mount points
+static FRESULT ftp_fs_stat_virt(const char *path, FILINFO *nfo) {
+	const char *name = strrchr(path, '/');
+	snprintf(nfo->fname, sizeof(nfo->fname), "%s", name ? name + 1 : path);
+	nfo->fsize = 0;
+	nfo->fdate = 0;
+	nfo->ftime = 0;
+	nfo->fattrib = AM_DIR;
+	return FR_OK;
+}
+
+#if FTP_DINDEX == 1
+// is the path a name in a FatFs directory? Other backends find names
+// their own way, mount points have no directory.
+static uint8_t ftp_fs_indexed(const char *path) {
+	const char *rel;
+	const ftp_mount_t *m = ftp_fs_find(path, &rel);
+	return m != NULL && m->fs == &ftp_fs_fatfs && strcmp(rel, "/");
+}
+#endif
+
+// the helpers below hand a call to the backend of the path or handle
+
+static inline FRESULT ftp_fs_stat(const char *path, FILINFO *nfo) {
+	const char *rel;
+	const ftp_mount_t *m = ftp_fs_find(path, &rel);
+
+	// the root of a mount, backends may not have a name for it
+	if ((m != NULL && m->len > 0 && path[m->len] == 0) || (m == NULL && ftp_fs_children(path)))
+		return ftp_fs_stat_virt(path, nfo);
+
+	return m != NULL ? m->fs->stat(m->ctx, rel, nfo) : FR_NO_PATH;
+}
+
+static inline FRESULT ftp_fs_opendir(ftp_dir_t *dir, const char *path) {
+	const char *rel;
+	const ftp_mount_t *m = ftp_fs_find(path, &rel);
+
+	// mount points are listed after the entries of the backend
+	dir->mounts = ftp_fs_children(path);
+	dir->virt = (m == NULL);
+	if (m == NULL)
+		return dir->mounts ? FR_OK : FR_NO_PATH;
+
+	dir->fs = m->fs;
+	return m->fs->opendir(m->ctx, dir, rel);
+}
+
+static inline FRESULT ftp_fs_readdir(ftp_dir_t *dir, FILINFO *nfo) {
+	// entries of the backend first
+	if (!dir->virt) {
+		FRESULT res = dir->fs->readdir(dir, nfo);
+		if (res != FR_OK || nfo->fname[0] != 0)
+			return res;
+	}
+
+	// then the mount points
+	for (uint8_t i = 0; dir->mounts != 0; i++) {
+		if (dir->mounts & (1 << i)) {
+			dir->mounts &= ~(1 << i);
+			return ftp_fs_stat_virt(ftp_mounts[i].prefix, nfo);
+		}
+	}
+
+	// end of the directory
+	nfo->fname[0] = 0;
+	return FR_OK;
+}
+
+static inline FRESULT ftp_fs_closedir(ftp_dir_t *dir) {
+	return dir->virt ? FR_OK : dir->fs->closedir(dir);
+}
+
+static inline FRESULT ftp_fs_unlink(const char *path) {
+	const char *rel;
+	const ftp_mount_t *m = ftp_fs_find(path, &rel);
+	return m != NULL ? m->fs->unlink(m->ctx, rel) : FR_NO_PATH;
+}
+
+static inline FRESULT ftp_fs_open(ftp_file_t *file, const char *path, uint8_t mode) {
+	const char *rel;
+	const ftp_mount_t *m = ftp_fs_find(path, &rel);
+	if (m == NULL)
+		return FR_NO_PATH;
+	file->fs = m->fs;
+#if FTP_IOSCHED == 1
+	// each mount is a volume, the default mount uses the first queue
+	file->sched = &ftp_mount_sched[m == &ftp_mount_default ? 0 : m - ftp_mounts];
+#endif
+	return m->fs->open(m->ctx, file, rel, mode);
+}
+
+static inline FSIZE_t ftp_fs_size(ftp_file_t *file) {
+	return file->fs->size(file);
+}
+
+static inline FRESULT ftp_fs_close(ftp_file_t *file) {
+	return file->fs->close(file);
+}
+
+static inline FRESULT ftp_fs_read(ftp_file_t *file, void *buffer, uint32_t len, uint32_t *read) {
+	return file->fs->read(file, buffer, len, read);
+}
+
+static inline FRESULT ftp_fs_write(ftp_file_t *file, const void *buffer, uint32_t len, uint32_t *written) {
+	return file->fs->write(file, buffer, len, written);
+}
+
+static inline FRESULT ftp_fs_lseek(ftp_file_t *file, FSIZE_t ofs) {
+	return file->fs->lseek(file, ofs);
+}
+
+static inline FRESULT ftp_fs_mkdir(const char *path) {
+	const char *rel;
+	const ftp_mount_t *m = ftp_fs_find(path, &rel);
+	return m != NULL ? m->fs->mkdir(m->ctx, rel) : FR_NO_PATH;
+}
+
+static inline FRESULT ftp_fs_rename(const char *from, const char *to) {
+	const char *rel_from, *rel_to;
+	const ftp_mount_t *m = ftp_fs_find(from, &rel_from);
+	if (m == NULL)
+		return FR_NO_PATH;
+
+	// no moving between mounts
+	if (ftp_fs_find(to, &rel_to) != m)
+		return FR_DENIED;
+	return m->fs->rename(m->ctx, rel_from, rel_to);
+}
+
+static inline FRESULT ftp_fs_utime(const char *path, const FILINFO *nfo) {
+	const char *rel;
+	const ftp_mount_t *m = ftp_fs_find(path, &rel);
+	return m != NULL ? m->fs->utime(m->ctx, rel, nfo) : FR_NO_PATH;
+}
+
+static inline FRESULT ftp_fs_getfree(const char *path, uint64_t *free, uint64_t *total, uint32_t *unit) {
+	const char *rel;
+	const ftp_mount_t *m = ftp_fs_find(path, &rel);
+	return m != NULL ? m->fs->getfree(m->ctx, rel, free, total, unit) : FR_NO_PATH;
+}
+
+#else
+
+// only FatFs, straight calls
+
+#if FTP_DINDEX == 1
+// every path but the root is a name in a directory
+static uint8_t ftp_fs_indexed(const char *path) {
+	return strcmp(path, "/") != 0;
+}
+#endif
+
+static inline FRESULT ftp_fs_stat(const char *path, FILINFO *nfo) {
 	return f_stat(path, nfo);
 }
 
-FRESULT ftps_f_opendir(DIR *dir_p, const char *path) {
-	return f_opendir(dir_p, path);
+static inline FRESULT ftp_fs_opendir(ftp_dir_t *dir, const char *path) {
+	return f_opendir(dir, path);
+}
+
+static inline FRESULT ftp_fs_readdir(ftp_dir_t *dir, FILINFO *nfo) {
+	return f_readdir(dir, nfo);
 }
 
-FRESULT ftps_f_readdir(DIR *dp, FILINFO *fno) {
-	return f_readdir(dp, fno);
+static inline FRESULT ftp_fs_closedir(ftp_dir_t *dir) {
+	return f_closedir(dir);
+}
+
+static inline FRESULT ftp_fs_unlink(const char *path) {
+	return f_unlink(path);
+}
+
+#if FTP_IOSCHED == 1
+// request queue of the card
+static ftp_iosched_t ftp_volume_sched;
+
+static inline ftp_iosched_t *ftp_fs_sched(ftp_file_t *file) {
+	(void) file;
+	return &ftp_volume_sched;
+}
+#endif
+
+static inline FRESULT ftp_fs_open(ftp_file_t *file, const char *path, uint8_t mode) {
+	return f_open(file, path, mode);
+}
+
+static inline FSIZE_t ftp_fs_size(ftp_file_t *file) {
+	return f_size(file);
+}
+
+static inline FRESULT ftp_fs_close(ftp_file_t *file) {
+	return f_close(file);
+}
+
+static inline FRESULT ftp_fs_read(ftp_file_t *file, void *buffer, uint32_t len, uint32_t *read) {
+	return f_read(file, buffer, len, (UINT *) read);
+}
+
+static inline FRESULT ftp_fs_write(ftp_file_t *file, const void *buffer, uint32_t len, uint32_t *written) {
+	return f_write(file, buffer, len, (UINT *) written);
+}
+
+static inline FRESULT ftp_fs_lseek(ftp_file_t *file, FSIZE_t ofs) {
+	return f_lseek(file, ofs);
+}
+
+static inline FRESULT ftp_fs_mkdir(const char *path) {
+	return f_mkdir(path);
+}
+
+static inline FRESULT ftp_fs_rename(const char *from, const char *to) {
+	return f_rename(from, to);
+}
+
+static inline FRESULT ftp_fs_utime(const char *path, const FILINFO *nfo) {
+	return f_utime(path, nfo);
+}
+
+static inline FRESULT ftp_fs_getfree(const char *path, uint64_t *free, uint64_t *total, uint32_t *unit) {
+	return ftp_fat_getfree(path, free, total, unit);
+}
+
+#endif
+
+// =========================================================
+//
+//              File functions of the server
+//
+// =========================================================
+
+FRESULT ftps_f_stat(const char *path, FILINFO *nfo) {
+	FRESULT res;
+
+	FTP_SPAN_BEGIN(span);
+#if FTP_DINDEX == 1
+	// a name in a large directory is found in RAM
+	uint32_t token = 0;
+	if (!ftp_fs_indexed(path) || !ftp_dindex_lookup(path, nfo, &res, &token)) {
+		res = ftp_fs_stat(path, nfo);
+
+		// the entry changed, keep what the file system says
+		if (token != 0)
+			ftp_dindex_refresh(path, token, res, nfo);
+	}
+#else
+	res = ftp_fs_stat(path, nfo);
+#endif
+	FTP_SPAN_END(span, FTP_SPAN_STAT, 0);
+	return res;
+}
+
+FRESULT ftps_f_opendir(ftp_dir_t *dir_p, const char *path) {
+	FTP_SPAN_BEGIN(span);
+	FRESULT res = ftp_fs_opendir(dir_p, path);
+	FTP_SPAN_END(span, FTP_SPAN_OPENDIR, 0);
+	return res;
+}
+
+FRESULT ftps_f_readdir(ftp_dir_t *dp, FILINFO *fno) {
+	FTP_SPAN_BEGIN(span);
+	FRESULT res = ftp_fs_readdir(dp, fno);
+	FTP_SPAN_END(span, FTP_SPAN_READDIR, 0);
+	return res;
+}
+
+FRESULT ftps_f_closedir(ftp_dir_t *dp) {
+	return ftp_fs_closedir(dp);
 }
 
 FRESULT ftps_f_unlink(const char *path) {
-	return f_remove(path);
+	FTP_CACHE_INVALIDATE(path);
+	FRESULT res = ftp_fs_unlink(path);
+
+#if FTP_DINDEX == 1
+	if (res == FR_OK && ftp_fs_indexed(path))
+		ftp_dindex_remove(path);
+#endif
+	return res;
 }
 
-FRESULT ftps_f_open(FIL *file_p, const char *path, uint8_t mode) {
-	return f_open(file_p, path, mode);
+FRESULT ftps_f_open(ftp_file_t *file_p, const char *path, uint8_t mode) {
+#if FTP_CACHE == 1
+	// the cached copy goes stale when the file is written
+	if (mode & FA_WRITE)
+		ftp_cache_invalidate(path);
+#endif
+
+	FTP_SPAN_BEGIN(span);
+	FRESULT res = ftp_fs_open(file_p, path, mode);
+	FTP_SPAN_END(span, FTP_SPAN_OPEN, mode);
+
+#if FTP_DINDEX == 1
+	// a new file, or a size and time that change until it is closed
+	if (res == FR_OK && (mode & (FA_WRITE | FA_CREATE_NEW | FA_CREATE_ALWAYS | FA_OPEN_ALWAYS)) && ftp_fs_indexed(path))
+		ftp_dindex_open(file_p, path);
+#endif
+	return res;
 }
 
-FSIZE_t ftps_f_size(FIL *file_p) {
-	return f_size(file_p);
+FSIZE_t ftps_f_size(ftp_file_t *file_p) {
+	return ftp_fs_size(file_p);
 }
 
-FRESULT ftps_f_close(FIL *file_p) {
-	return f_close(file_p);
+FRESULT ftps_f_close(ftp_file_t *file_p) {
+	FTP_IOSCHED_CLOSE(ftp_fs_sched(file_p), file_p);
+
+	FTP_SPAN_BEGIN(span);
+	FRESULT res = ftp_fs_close(file_p);
+	FTP_SPAN_END(span, FTP_SPAN_CLOSE, 0);
+
+	// the directory entry is written now
+	FTP_DINDEX_CLOSE(file_p);
+	return res;
+}
+
+FRESULT ftps_f_write(ftp_file_t *file_p, const void *buffer, uint32_t len, uint32_t *written) {
+	// wait for the turn of this file on the volume
+	FTP_IOSCHED_BEGIN(ftp_fs_sched(file_p), file_p);
+
+	FTP_SPAN_BEGIN(span);
+	FRESULT res = ftp_fs_write(file_p, buffer, len, written);
+	FTP_SPAN_END(span, FTP_SPAN_WRITE, len);
+
+	FTP_IOSCHED_END(ftp_fs_sched(file_p), file_p);
+	return res;
 }
 
-FRESULT ftps_f_write(FIL *file_p, const void *buffer, uint32_t len, uint32_t *written) {
-	return f_write(file_p, buffer, len, written);
+FRESULT ftps_f_read(ftp_file_t *file_p, void *buffer, uint32_t len, uint32_t *read) {
+	// wait for the turn of this file on the volume
+	FTP_IOSCHED_BEGIN(ftp_fs_sched(file_p), file_p);
+
+	FTP_SPAN_BEGIN(span);
+	FRESULT res = ftp_fs_read(file_p, buffer, len, read);
+	FTP_SPAN_END(span, FTP_SPAN_READ, len);
+
+	FTP_IOSCHED_END(ftp_fs_sched(file_p), file_p);
+	return res;
 }
 
-FRESULT ftps_f_read(FIL *file_p, const void *buffer, uint32_t len, uint32_t *read) {
-	return f_read(file_p, buffer, len, read);
+FRESULT ftps_f_lseek(ftp_file_t *file_p, FSIZE_t ofs) {
+	return ftp_fs_lseek(file_p, ofs);
 }
 
 FRESULT ftps_f_mkdir(const char *path) {
-	return f_mkdir(path);
+	FRESULT res = ftp_fs_mkdir(path);
+
+#if FTP_DINDEX == 1
+	if (res == FR_OK && ftp_fs_indexed(path))
+		ftp_dindex_change(path);
+#endif
+	return res;
 }
 
 FRESULT ftps_f_rename(const char *from, const char *to) {
-	return f_rename(from, to);
+	FTP_CACHE_INVALIDATE(from);
+	FTP_CACHE_INVALIDATE(to);
+	FRESULT res = ftp_fs_rename(from, to);
+
+#if FTP_DINDEX == 1
+	// both are on the same mount
+	if (res == FR_OK && ftp_fs_indexed(from)) {
+		ftp_dindex_remove(from);
+		ftp_dindex_change(to);
+	}
+#endif
+	return res;
 }
 
 FRESULT ftps_f_utime(const TCHAR *path, const FILINFO *fno) {
-	return f_utime(path, fno);
+	FTP_CACHE_INVALIDATE(path);
+	FRESULT res = ftp_fs_utime(path, fno);
+
+#if FTP_DINDEX == 1
+	if (res == FR_OK && ftp_fs_indexed(path))
+		ftp_dindex_change(path);
+#endif
+	return res;
 }
 
-FRESULT ftps_f_getfree(const TCHAR *path, DWORD *nclst, FATFS **fatfs) {
-	return f_getfree(path, nclst, fatfs);
+FRESULT ftps_f_getfree(const TCHAR *path, uint64_t *free, uint64_t *total, uint32_t *unit) {
+	return ftp_fs_getfree(path, free, total, unit);
+}
+
+#if FTP_IOSCHED == 1
+void ftps_f_iosched_stats(uint32_t *requests, uint32_t *runs, uint32_t *waits) {
+#if FTP_FS_BACKENDS == 1
+	const ftp_iosched_t *scheds = ftp_mount_sched;
+	uint8_t count = FTP_FS_MOUNTS;
+#else
+	const ftp_iosched_t *scheds = &ftp_volume_sched;
+	uint8_t count = 1;
+#endif
+
+	*requests = *runs = *waits = 0;
+	taskENTER_CRITICAL();
+	for (uint8_t i = 0; i < count; i++) {
+		*requests += scheds[i].requests;
+		*runs += scheds[i].runs;
+		*waits += scheds[i].waits;
+	}
+	taskEXIT_CRITICAL();
 }
+#endif
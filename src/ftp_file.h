@@ -9,7 +9,112 @@
 #define ETH_FTP_FTP_FILE_H_
 
 #include <stdint.h>
-#include "fatfs.h"
+#include "ftp_port.h"
+#include "ftp_iosched.h"
+
+// storage backends behind the file functions. 0 calls FatFs directly,
+// for builds with only the card. 1 hands every call to the backend
+// mounted at the path, see ftp_fs_mount. The host build sets it.
+#ifndef FTP_FS_BACKENDS
+#define FTP_FS_BACKENDS			0
+#endif
+
+// number of mount points, at most 8
+#define FTP_FS_MOUNTS			4
+
+#if FTP_FS_BACKENDS == 1
+
+struct ftp_fs;
+
+// open file, the backend keeps its state in the union
+typedef struct {
+	const struct ftp_fs *fs;
+#if FTP_IOSCHED == 1
+	// request queue of the volume
+	ftp_iosched_t *sched;
+#endif
+	union {
+		FIL fat;
+		void *handle;
+	};
+} ftp_file_t;
+
+// open directory
+typedef struct {
+	const struct ftp_fs *fs;
+
+	// mount points below the directory still to list, a bit per mount
+	uint8_t mounts;
+
+	// only mount points, no backend holds the directory
+	uint8_t virt;
+
+	union {
+		DIR fat;
+		void *handle;
+	};
+} ftp_dir_t;
+
+// Storage backend. Results are FatFs codes and file information is a
+// FILINFO, whatever the backend. Paths are relative to the mount point
+// and start with a '/'. ctx is the context given to ftp_fs_mount.
+typedef struct ftp_fs {
+	const char *name;
+	FRESULT (*stat)(void *ctx, const char *path, FILINFO *nfo);
+	FRESULT (*opendir)(void *ctx, ftp_dir_t *dir, const char *path);
+	FRESULT (*readdir)(ftp_dir_t *dir, FILINFO *nfo);
+	FRESULT (*closedir)(ftp_dir_t *dir);
+	FRESULT (*unlink)(void *ctx, const char *path);
+	FRESULT (*open)(void *ctx, ftp_file_t *file, const char *path, uint8_t mode);
+	FSIZE_t (*size)(ftp_file_t *file);
+	FRESULT (*close)(ftp_file_t *file);
+	FRESULT (*read)(ftp_file_t *file, void *buffer, uint32_t len, uint32_t *read);
+	FRESULT (*write)(ftp_file_t *file, const void *buffer, uint32_t len, uint32_t *written);
+	FRESULT (*lseek)(ftp_file_t *file, FSIZE_t ofs);
+	FRESULT (*mkdir)(void *ctx, const char *path);
+	FRESULT (*rename)(void *ctx, const char *from, const char *to);
+	FRESULT (*utime)(void *ctx, const char *path, const FILINFO *nfo);
+	FRESULT (*getfree)(void *ctx, const char *path, uint64_t *free, uint64_t *total, uint32_t *unit);
+} ftp_fs_t;
+
+// FatFs backend, ctx is the drive ("1:") or NULL for the default drive
+extern const ftp_fs_t ftp_fs_fatfs;
+
+/**
+ * Mount a backend. A path goes to the mount with the longest prefix
+ * that matches it. Without any mount, FatFs serves the whole tree.
+ *
+ * @param prefix Mount point, "/" or a path like "/rom" without a trailing '/'
+ * @param fs The backend
+ * @param ctx Passed to the backend, e.g. the FatFs drive
+ * @return 0 on success, -1 if all mount points are in use
+ */
+extern int ftp_fs_mount(const char *prefix, const ftp_fs_t *fs, void *ctx);
+
+/**
+ * Get a mount point.
+ *
+ * @param index Index of the mount, from 0
+ * @param fs Backend of the mount, may be NULL
+ * @return The mount point, or NULL if index is past the last mount
+ */
+extern const char *ftp_fs_mount_get(uint8_t index, const ftp_fs_t **fs);
+
+/**
+ * Get the mount that serves a path.
+ *
+ * @param path Full path
+ * @return Index of the mount, -1 if the path is above every mount
+ */
+extern int ftp_fs_mount_index(const char *path);
+
+#else
+
+// only FatFs, the types are its own
+typedef FIL ftp_file_t;
+typedef DIR ftp_dir_t;
+
+#endif
 
 /**
  * wrapper functions for file access from FTP server.
@@ -17,21 +122,25 @@
 
 extern FRESULT ftps_f_stat(const char* path, FILINFO* nfo);
 
-extern FRESULT ftps_f_opendir(DIR* dir_p, const char* path);
+extern FRESULT ftps_f_opendir(ftp_dir_t* dir_p, const char* path);
 
-extern FRESULT ftps_f_readdir(DIR* dp, FILINFO* fno);
+extern FRESULT ftps_f_readdir(ftp_dir_t* dp, FILINFO* fno);
+
+extern FRESULT ftps_f_closedir(ftp_dir_t* dp);
 
 extern FRESULT ftps_f_unlink(const char* path);
 
-extern FRESULT ftps_f_open(FIL* file_p, const char* path, uint8_t mode);
+extern FRESULT ftps_f_open(ftp_file_t* file_p, const char* path, uint8_t mode);
+
+extern FSIZE_t ftps_f_size(ftp_file_t* file_p);
 
-extern FSIZE_t ftps_f_size(FIL* file_p);
+extern FRESULT ftps_f_close(ftp_file_t* file_p);
 
-extern FRESULT ftps_f_close(FIL* file_p);
+extern FRESULT ftps_f_write(ftp_file_t* file_p, const void* buffer, uint32_t len, uint32_t* written);
 
-extern FRESULT ftps_f_write(FIL* file_p, const void* buffer, uint32_t len, uint32_t* written);
+extern FRESULT ftps_f_read(ftp_file_t* file_p, void* buffer, uint32_t len, uint32_t* read);
 
-extern FRESULT ftps_f_read(FIL* file_p, const void* buffer, uint32_t len, uint32_t* read);
+extern FRESULT ftps_f_lseek(ftp_file_t* file_p, FSIZE_t ofs);
 
 extern FRESULT ftps_f_mkdir(const char* path);
 
@@ -39,6 +148,14 @@ extern FRESULT ftps_f_rename(const char* from, const char* to);
 
 extern FRESULT ftps_f_utime(const TCHAR* path, const FILINFO* fno);
 
-extern FRESULT ftps_f_getfree(const TCHAR* path, DWORD* nclst, FATFS** fatfs);
+extern FRESULT ftps_f_getfree(const TCHAR* path, uint64_t* free, uint64_t* total, uint32_t* unit);
+
+#if FTP_IOSCHED == 1
+/**
+ * Get the counters of the volume request queues added up: requests,
+ * runs of requests of one file and requests that had to wait.
+ */
+extern void ftps_f_iosched_stats(uint32_t *requests, uint32_t *runs, uint32_t *waits);
+#endif
 
 #endif /* ETH_FTP_FTP_FILE_H_ */
@@ -0,0 +1,120 @@
+/*
+ * ftp_iosched.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ftp.h"
+#include "ftp_iosched.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <string.h>
+
+#if FTP_IOSCHED == 1
+
+// ticks of the reservation, at least one
+#define FTP_IOSCHED_ANTICIPATE_TICKS	(pdMS_TO_TICKS(FTP_IOSCHED_ANTICIPATE_MS) > 0 ? pdMS_TO_TICKS(FTP_IOSCHED_ANTICIPATE_MS) : 1)
+
+// is the reservation of the owner over? call in a critical section
+static uint8_t ftp_iosched_expired(const ftp_iosched_t *sched, TickType_t now) {
+	return sched->owner == NULL || sched->burst >= FTP_IOSCHED_BURST || (int32_t) (now - sched->reserved_until) >= 0;
+}
+
+// position of a task in the queue, -1 if not in it
+static int ftp_iosched_find(const ftp_iosched_t *sched, TaskHandle_t task) {
+	for (uint8_t i = 0; i < sched->waiting; i++)
+		if (sched->wait_task[i] == task)
+			return i;
+	return -1;
+}
+
+// take a task from the queue, call in a critical section
+static void ftp_iosched_dequeue(ftp_iosched_t *sched, int pos) {
+	sched->waiting--;
+	memmove(&sched->wait_task[pos], &sched->wait_task[pos + 1], (sched->waiting - pos) * sizeof(TaskHandle_t));
+}
+
+void ftp_iosched_begin(ftp_iosched_t *sched, const void *stream) {
+	TaskHandle_t self = xTaskGetCurrentTaskHandle();
+	TickType_t wait;
+
+	for (;;) {
+		taskENTER_CRITICAL();
+		TickType_t now = xTaskGetTickCount();
+		int pos = ftp_iosched_find(sched, self);
+
+		if (!sched->busy) {
+			// the owner continues its run, also with another transfer
+			// of the same task, unless it had its share and others wait
+			if ((stream == sched->owner || (sched->owner != NULL && self == sched->owner_task))
+					&& (sched->burst < FTP_IOSCHED_BURST || sched->waiting == 0)) {
+				sched->owner = stream;
+				break;
+			}
+
+			// a new run, in the order the tasks came
+			if (ftp_iosched_expired(sched, now) && (sched->waiting == 0 || pos == 0)) {
+				sched->owner = stream;
+				sched->owner_task = self;
+				sched->burst = 0;
+				sched->runs++;
+				break;
+			}
+		}
+
+		// queue up, a full queue only polls
+		if (pos < 0 && sched->waiting < FTP_IOSCHED_WAITERS) {
+			sched->wait_task[sched->waiting++] = self;
+			sched->waits++;
+			pos = sched->waiting - 1;
+		}
+
+		// sleep until woken, or until the reservation ends if that is
+		// all we wait for
+		if (!sched->busy && pos == 0)
+			wait = sched->reserved_until - now;
+		else
+			wait = pos < 0 && sched->waiting >= FTP_IOSCHED_WAITERS ? 1 : portMAX_DELAY;
+		taskEXIT_CRITICAL();
+
+		ulTaskNotifyTake(pdTRUE, wait);
+	}
+
+	// our turn
+	int pos = ftp_iosched_find(sched, self);
+	if (pos >= 0)
+		ftp_iosched_dequeue(sched, pos);
+	sched->busy = 1;
+	sched->burst++;
+	sched->requests++;
+	taskEXIT_CRITICAL();
+}
+
+void ftp_iosched_end(ftp_iosched_t *sched, const void *stream) {
+	(void) stream;
+
+	taskENTER_CRITICAL();
+	sched->busy = 0;
+	sched->reserved_until = xTaskGetTickCount() + FTP_IOSCHED_ANTICIPATE_TICKS;
+
+	// the first in the queue looks again, it sleeps on for the rest of
+	// the reservation
+	if (sched->waiting > 0)
+		xTaskNotifyGive(sched->wait_task[0]);
+	taskEXIT_CRITICAL();
+}
+
+void ftp_iosched_close(ftp_iosched_t *sched, const void *stream) {
+	taskENTER_CRITICAL();
+	if (sched->owner == stream) {
+		sched->owner = NULL;
+		sched->owner_task = NULL;
+		if (!sched->busy && sched->waiting > 0)
+			xTaskNotifyGive(sched->wait_task[0]);
+	}
+	taskEXIT_CRITICAL();
+}
+
+#endif
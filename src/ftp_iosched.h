@@ -0,0 +1,97 @@
+/*
+ * ftp_iosched.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_IOSCHED_H_
+#define _FTP_IOSCHED_H_
+
+#include <stdint.h>
+#include "ftp_port.h"
+
+// order the file reads and writes of concurrent transfers per volume,
+// 0 compiles it out
+#ifndef FTP_IOSCHED
+#define FTP_IOSCHED					0
+#endif
+
+// requests a transfer may issue in a row while others wait. A run of
+// requests of one file is sequential for the card, interleaved runs of
+// two files are not.
+#define FTP_IOSCHED_BURST			32
+
+// after a request the volume stays reserved this long for the transfer
+// that made it, so its next request continues the run (ms)
+#define FTP_IOSCHED_ANTICIPATE_MS	2
+
+// tasks that can wait for a volume at the same time
+#define FTP_IOSCHED_WAITERS			8
+
+/**
+ * Request queue of a volume. One request runs at a time. When it ends
+ * the volume is kept for the same transfer for a moment, until it made
+ * FTP_IOSCHED_BURST requests, then the transfer that waited longest is
+ * next.
+ */
+typedef struct {
+	// transfer that runs or ran last and its task, NULL if none. The
+	// task may go on with another transfer of its own in the same run,
+	// like a copy that reads one file and writes another.
+	const void *owner;
+	TaskHandle_t owner_task;
+
+	// a request runs
+	uint8_t busy;
+
+	// requests of the owner in this run
+	uint16_t burst;
+
+	// end of the reservation of the owner
+	TickType_t reserved_until;
+
+	// waiting tasks, oldest first
+	TaskHandle_t wait_task[FTP_IOSCHED_WAITERS];
+	uint8_t waiting;
+
+	// requests, runs and requests that had to wait
+	uint32_t requests;
+	uint32_t runs;
+	uint32_t waits;
+} ftp_iosched_t;
+
+#if FTP_IOSCHED == 1
+#define FTP_IOSCHED_BEGIN(sched, stream)	ftp_iosched_begin((sched), (stream))
+#define FTP_IOSCHED_END(sched, stream)		ftp_iosched_end((sched), (stream))
+#define FTP_IOSCHED_CLOSE(sched, stream)	ftp_iosched_close((sched), (stream))
+#else
+#define FTP_IOSCHED_BEGIN(sched, stream)
+#define FTP_IOSCHED_END(sched, stream)
+#define FTP_IOSCHED_CLOSE(sched, stream)
+#endif
+
+/**
+ * Wait for the turn of a transfer on a volume.
+ *
+ * @param sched Queue of the volume
+ * @param stream The transfer, e.g. its open file
+ */
+extern void ftp_iosched_begin(ftp_iosched_t *sched, const void *stream);
+
+/**
+ * A request of a transfer is done.
+ *
+ * @param sched Queue of the volume
+ * @param stream The transfer
+ */
+extern void ftp_iosched_end(ftp_iosched_t *sched, const void *stream);
+
+/**
+ * A transfer has no more requests, end its reservation.
+ *
+ * @param sched Queue of the volume
+ * @param stream The transfer
+ */
+extern void ftp_iosched_close(ftp_iosched_t *sched, const void *stream);
+
+#endif /* _FTP_IOSCHED_H_ */
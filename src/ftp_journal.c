@@ -0,0 +1,444 @@
+/*
+ * ftp_journal.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ftp.h"
+#include "ftp_journal.h"
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+#include <string.h>
+
+#if FTP_JOURNAL == 1
+
+// a record is a header and the path, in RAM and in the file alike
+#define FTP_JOURNAL_HEADER			7
+
+// the file starts with a magic and the epoch
+#define FTP_JOURNAL_MAGIC			0x4a505446
+#define FTP_JOURNAL_FILE_HEADER		8
+
+#if FTP_JOURNAL_BYTES < 4 * (FTP_JOURNAL_HEADER + FTP_JOURNAL_PATH_SIZE)
+#error "FTP_JOURNAL_BYTES has to hold a few renames of long paths"
+#endif
+
+// the newest records, oldest first
+static uint8_t ftp_journal_buf[FTP_JOURNAL_BYTES];
+static size_t ftp_journal_used = 0;
+
+// epoch of the records and sequence number of the next record. The
+// epoch changes whenever records may be missing, a token of another
+// epoch gets a resync.
+static uint32_t ftp_journal_epoch = 0;
+static uint32_t ftp_journal_seq = 1;
+
+// guards the records and the file
+static SemaphoreHandle_t ftp_journal_lock = NULL;
+
+#if FTP_JOURNAL_PERSIST == 1
+// the file, it is only touched with the lock taken
+static ftp_file_t ftp_journal_file;
+static uint8_t ftp_journal_persist = 0;
+
+// the file lacks records RAM has, it is written anew with the next one
+static uint8_t ftp_journal_dirty = 0;
+#endif
+
+static const char *const ftp_journal_ops[] = { "", "STOR", "DELE", "RNTO", "MKD", "RMD", "MDTM", "CPTO", "RMDIR" };
+
+const char *ftp_journal_op_name(uint8_t op) {
+	return op < sizeof(ftp_journal_ops) / sizeof(ftp_journal_ops[0]) ? ftp_journal_ops[op] : "";
+}
+
+// fields of the header of the record at an offset
+static uint32_t ftp_journal_rec_seq(size_t off) {
+	uint32_t seq;
+	memcpy(&seq, ftp_journal_buf + off, sizeof(seq));
+	return seq;
+}
+
+static size_t ftp_journal_rec_size(size_t off) {
+	uint16_t len;
+	memcpy(&len, ftp_journal_buf + off + 5, sizeof(len));
+	return FTP_JOURNAL_HEADER + len;
+}
+
+// fill in a record header
+static void ftp_journal_header(uint8_t *hdr, uint32_t seq, uint8_t op, uint16_t len) {
+	memcpy(hdr, &seq, sizeof(seq));
+	hdr[4] = op;
+	memcpy(hdr + 5, &len, sizeof(len));
+}
+
+// a new epoch, not the last one. The time and the uptime make it differ
+// from the epoch of an earlier start too.
+static uint32_t ftp_journal_new_epoch(void) {
+	uint32_t epoch = (ftp_journal_epoch + 1) ^ get_fattime() ^ xTaskGetTickCount();
+#ifdef LWIP_RAND
+	epoch ^= LWIP_RAND();
+#endif
+	return epoch != ftp_journal_epoch ? epoch : epoch + 1;
+}
+
+// append a record to RAM, the oldest ones make room. The path has len
+// bytes, a rename adds a 0 and the new path. Call with the lock taken.
+static void ftp_journal_keep(const uint8_t *hdr, const char *path, size_t len, const char *to) {
+	size_t to_len = to != NULL ? strlen(to) : 0;
+	size_t size = FTP_JOURNAL_HEADER + len + (to != NULL ? 1 + to_len : 0);
+
+	// make room, a quarter at least so this doesn't happen every time
+	if (ftp_journal_used + size > FTP_JOURNAL_BYTES) {
+		size_t need = size > FTP_JOURNAL_BYTES / 4 ? size : FTP_JOURNAL_BYTES / 4;
+		size_t drop = 0;
+
+		while (drop < ftp_journal_used && drop < need - (FTP_JOURNAL_BYTES - ftp_journal_used))
+			drop += ftp_journal_rec_size(drop);
+
+		ftp_journal_used -= drop;
+		memmove(ftp_journal_buf, ftp_journal_buf + drop, ftp_journal_used);
+	}
+
+	uint8_t *rec = ftp_journal_buf + ftp_journal_used;
+	memcpy(rec, hdr, FTP_JOURNAL_HEADER);
+	memcpy(rec + FTP_JOURNAL_HEADER, path, len);
+	if (to != NULL) {
+		rec[FTP_JOURNAL_HEADER + len] = 0;
+		memcpy(rec + FTP_JOURNAL_HEADER + len + 1, to, to_len);
+	}
+	ftp_journal_used += size;
+}
+
+#if FTP_JOURNAL_PERSIST == 1
+// write the epoch and what RAM holds as the new file. A file that can't
+// be written is removed, so a restart doesn't take it for complete.
+static void ftp_journal_rewrite(void) {
+	uint32_t hdr[2] = { FTP_JOURNAL_MAGIC, ftp_journal_epoch };
+	uint32_t written;
+	FRESULT res;
+
+	res = ftps_f_open(&ftp_journal_file, FTP_JOURNAL_FILE, FA_CREATE_ALWAYS | FA_WRITE);
+	if (res == FR_OK) {
+		res = ftps_f_write(&ftp_journal_file, hdr, FTP_JOURNAL_FILE_HEADER, &written);
+		if (res == FR_OK && written == FTP_JOURNAL_FILE_HEADER)
+			res = ftps_f_write(&ftp_journal_file, ftp_journal_buf, ftp_journal_used, &written);
+		if (res == FR_OK && written != ftp_journal_used)
+			res = FR_DENIED;
+		if (ftps_f_close(&ftp_journal_file) != FR_OK && res == FR_OK)
+			res = FR_DISK_ERR;
+	}
+
+	ftp_journal_dirty = (res != FR_OK);
+	if (ftp_journal_dirty)
+		ftps_f_unlink(FTP_JOURNAL_FILE);
+}
+
+// append the newest record, size bytes at the end of RAM, to the file.
+// Call with the lock taken.
+static void ftp_journal_save(size_t size) {
+	uint32_t written;
+	FSIZE_t file_size = 0;
+	FRESULT res;
+
+	// a write failed before, the whole file is written again
+	if (ftp_journal_dirty) {
+		ftp_journal_rewrite();
+		return;
+	}
+
+	res = ftps_f_open(&ftp_journal_file, FTP_JOURNAL_FILE, FA_OPEN_ALWAYS | FA_WRITE);
+	if (res == FR_OK) {
+		res = ftps_f_lseek(&ftp_journal_file, ftps_f_size(&ftp_journal_file));
+		if (res == FR_OK)
+			res = ftps_f_write(&ftp_journal_file, ftp_journal_buf + ftp_journal_used - size, size, &written);
+		if (res == FR_OK && written != size)
+			res = FR_DENIED;
+		file_size = ftps_f_size(&ftp_journal_file);
+		if (ftps_f_close(&ftp_journal_file) != FR_OK && res == FR_OK)
+			res = FR_DISK_ERR;
+	}
+
+	// the record didn't make it to the file, or the file is too large,
+	// RAM has the newest records
+	if (res != FR_OK || file_size > FTP_JOURNAL_FILE_BYTES)
+		ftp_journal_rewrite();
+}
+
+// read the file into RAM, what doesn't fit drops out the front
+static void ftp_journal_load(void) {
+	uint8_t hdr[FTP_JOURNAL_HEADER];
+	uint32_t file_hdr[2];
+	uint32_t got, seq, last = 0;
+	uint16_t len;
+	uint8_t bad = 1;
+
+	// the path of one record at a time, on the heap
+	char *path = pvPortMalloc(FTP_JOURNAL_PATH_SIZE);
+
+	if (path != NULL && ftps_f_open(&ftp_journal_file, FTP_JOURNAL_FILE, FA_READ) == FR_OK) {
+		// the records go on in the epoch of the file
+		if (ftps_f_read(&ftp_journal_file, file_hdr, FTP_JOURNAL_FILE_HEADER, &got) == FR_OK && got == FTP_JOURNAL_FILE_HEADER
+				&& file_hdr[0] == FTP_JOURNAL_MAGIC) {
+			ftp_journal_epoch = file_hdr[1];
+			bad = 0;
+		}
+
+		while (!bad && ftps_f_read(&ftp_journal_file, hdr, sizeof(hdr), &got) == FR_OK && got == sizeof(hdr)) {
+			memcpy(&seq, hdr, sizeof(seq));
+			memcpy(&len, hdr + 5, sizeof(len));
+
+			// a record cut short or garbage ends the journal
+			if (seq <= last || hdr[4] == 0 || hdr[4] > FTP_JOURNAL_RMTREE || len >= FTP_JOURNAL_PATH_SIZE
+					|| ftps_f_read(&ftp_journal_file, path, len, &got) != FR_OK || got != len) {
+				bad = 1;
+				break;
+			}
+
+			ftp_journal_keep(hdr, path, len, NULL);
+			last = seq;
+		}
+		ftps_f_close(&ftp_journal_file);
+	}
+	if (path != NULL)
+		vPortFree(path);
+
+	// go on after the last record
+	ftp_journal_seq = last + 1;
+
+	// no file, or a record was lost on the way to it. Its number comes
+	// again, so tokens from before are of no use. Leave a clean file.
+	if (bad) {
+		ftp_journal_epoch = ftp_journal_new_epoch();
+		ftp_journal_rewrite();
+	}
+}
+#endif
+
+// Records were lost, start a new epoch without them. Call with the lock
+// taken.
+static void ftp_journal_lost(void) {
+	ftp_journal_epoch = ftp_journal_new_epoch();
+	ftp_journal_used = 0;
+
+#if FTP_JOURNAL_PERSIST == 1
+	if (ftp_journal_persist)
+		ftp_journal_rewrite();
+#endif
+}
+
+void ftp_journal_start(void) {
+	if (ftp_journal_lock != NULL)
+		return;
+
+	ftp_journal_lock = xSemaphoreCreateMutex();
+	if (ftp_journal_lock == NULL) {
+		log_print("ftp_journal not started\r\n");
+		return;
+	}
+
+#if FTP_JOURNAL_PERSIST == 1
+	// records from before the restart
+	ftp_journal_load();
+	ftp_journal_persist = 1;
+#else
+	// tokens from before the restart are of no use
+	ftp_journal_epoch = ftp_journal_new_epoch();
+#endif
+}
+
+void ftp_journal_add(uint8_t op, const char *path, const char *to) {
+	uint8_t hdr[FTP_JOURNAL_HEADER];
+	size_t len = strlen(path);
+
+	// a rename keeps both paths in one record
+	size_t size = len + (to != NULL ? 1 + strlen(to) : 0);
+
+	// not started
+	if (ftp_journal_lock == NULL)
+		return;
+
+	xSemaphoreTake(ftp_journal_lock, portMAX_DELAY);
+
+	if (size >= FTP_JOURNAL_PATH_SIZE) {
+		// can't be kept, clients find the change with a resync
+		ftp_journal_lost();
+	} else {
+		ftp_journal_header(hdr, ftp_journal_seq++, op, size);
+		ftp_journal_keep(hdr, path, len, to);
+
+#if FTP_JOURNAL_PERSIST == 1
+		if (ftp_journal_persist)
+			ftp_journal_save(FTP_JOURNAL_HEADER + size);
+#endif
+	}
+
+	xSemaphoreGive(ftp_journal_lock);
+}
+
+void ftp_journal_token(ftp_journal_token_t *token) {
+	token->epoch = 0;
+	token->seq = 0;
+
+	if (ftp_journal_lock == NULL)
+		return;
+
+	xSemaphoreTake(ftp_journal_lock, portMAX_DELAY);
+	token->epoch = ftp_journal_epoch;
+	token->seq = ftp_journal_seq - 1;
+	xSemaphoreGive(ftp_journal_lock);
+}
+
+int ftp_journal_next(const ftp_journal_token_t *after, ftp_journal_entry_t *entry) {
+	int ret = 0;
+
+	if (ftp_journal_lock == NULL)
+		return -1;
+
+	xSemaphoreTake(ftp_journal_lock, portMAX_DELAY);
+
+	// the first record RAM holds, records before it are gone
+	uint32_t oldest = ftp_journal_used > 0 ? ftp_journal_rec_seq(0) : ftp_journal_seq;
+
+	if (after->epoch != ftp_journal_epoch || after->seq >= ftp_journal_seq || after->seq + 1 < oldest) {
+		// a token of another epoch or from the future is from a journal
+		// that was lost
+		ret = -1;
+	} else if (after->seq + 1 < ftp_journal_seq) {
+		// the records are numbered without gaps, skip to the one after
+		size_t off = 0;
+		for (uint32_t n = after->seq + 1 - oldest; n > 0; n--)
+			off += ftp_journal_rec_size(off);
+
+		size_t len = ftp_journal_rec_size(off) - FTP_JOURNAL_HEADER;
+		entry->seq = ftp_journal_rec_seq(off);
+		entry->op = ftp_journal_buf[off + 4];
+		memcpy(entry->path, ftp_journal_buf + off + FTP_JOURNAL_HEADER, len);
+		entry->path[len] = 0;
+		ret = 1;
+	}
+
+	xSemaphoreGive(ftp_journal_lock);
+	return ret;
+}
+
+#if FTP_JOURNAL_PERSIST == 1
+// Name before *end in a path the way FatFs resolves it: empty names, "."
+// and the names a ".." takes back are skipped, trailing dots and blanks
+// don't count. Returns NULL at the start of the path.
+static const char *ftp_journal_name(const char *path, const char **end, size_t *len) {
+	uint16_t up = 0;
+
+	while (*end > path) {
+		const char *name = *end;
+		while (name > path && name[-1] != '/' && name[-1] != '\\')
+			name--;
+
+		size_t n = *end - name;
+		*end = name > path ? name - 1 : path;
+
+		if (n == 0 || (n == 1 && name[0] == '.'))
+			continue;
+		if (n == 2 && name[0] == '.' && name[1] == '.') {
+			up++;
+			continue;
+		}
+		if (up > 0) {
+			up--;
+			continue;
+		}
+
+		while (n > 0 && (name[n - 1] == '.' || name[n - 1] == ' '))
+			n--;
+		*len = n;
+		return name;
+	}
+	return NULL;
+}
+
+// same name? ASCII letters in any case like FatFs does
+static uint8_t ftp_journal_same(const char *a, size_t a_len, const char *b, size_t b_len) {
+	if (a_len != b_len)
+		return 0;
+
+	for (size_t i = 0; i < a_len; i++) {
+		char ca = a[i], cb = b[i];
+		if (ca >= 'A' && ca <= 'Z')
+			ca += 'a' - 'A';
+		if (cb >= 'A' && cb <= 'Z')
+			cb += 'a' - 'A';
+		if (ca != cb)
+			return 0;
+	}
+	return 1;
+}
+
+// Is the directory before dir_end the one of the journal file? Compared
+// name by name from the back.
+static uint8_t ftp_journal_is_dir(const char *dir, const char *dir_end) {
+	const char *b_end = FTP_JOURNAL_FILE + strlen(FTP_JOURNAL_FILE);
+	const char *a, *b;
+	size_t a_len = 0, b_len = 0;
+
+	// past the name of the file
+	ftp_journal_name(FTP_JOURNAL_FILE, &b_end, &b_len);
+
+	while (1) {
+		a = ftp_journal_name(dir, &dir_end, &a_len);
+		b = ftp_journal_name(FTP_JOURNAL_FILE, &b_end, &b_len);
+		if (a == NULL || b == NULL)
+			return a == b;
+		if (!ftp_journal_same(a, a_len, b, b_len))
+			return 0;
+	}
+}
+
+// name of the journal file in its directory
+static const char *ftp_journal_file_name(size_t *len) {
+	const char *end = FTP_JOURNAL_FILE + strlen(FTP_JOURNAL_FILE);
+	return ftp_journal_name(FTP_JOURNAL_FILE, &end, len);
+}
+#endif
+
+uint8_t ftp_journal_is_file(const char *path) {
+#if FTP_JOURNAL_PERSIST == 1
+	const char *end = path + strlen(path);
+	const char *name, *file;
+	size_t len = 0, file_len = 0;
+
+	name = ftp_journal_name(path, &end, &len);
+	file = ftp_journal_file_name(&file_len);
+	if (name == NULL)
+		return 0;
+
+	if (!ftp_journal_same(name, len, file, file_len)) {
+		// FatFs also finds the file by its short name, ask it for the
+		// long one
+		FILINFO nfo;
+		if (memchr(name, '~', len) == NULL || ftps_f_stat(path, &nfo) != FR_OK
+				|| !ftp_journal_same(nfo.fname, strlen(nfo.fname), file, file_len))
+			return 0;
+	}
+
+	return ftp_journal_is_dir(path, end);
+#else
+	(void) path;
+	return 0;
+#endif
+}
+
+uint8_t ftp_journal_is_entry(const char *dir, const char *name) {
+#if FTP_JOURNAL_PERSIST == 1
+	size_t file_len = 0;
+	const char *file = ftp_journal_file_name(&file_len);
+
+	return ftp_journal_same(name, strlen(name), file, file_len) && ftp_journal_is_dir(dir, dir + strlen(dir));
+#else
+	(void) dir;
+	(void) name;
+	return 0;
+#endif
+}
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * ftp_journal.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_JOURNAL_H_
+#define _FTP_JOURNAL_H_
+
+#include <stdint.h>
+#include "ftp_port.h"
+
+// record every change the server makes with a sequence number, so a
+// client can ask what changed since its last poll, 0 compiles it out
+#ifndef FTP_JOURNAL
+#define FTP_JOURNAL					0
+#endif
+
+// RAM for the newest records, older ones are dropped (bytes)
+#define FTP_JOURNAL_BYTES			4096
+
+// keep the journal in a file so it survives a restart, 0 keeps it in
+// RAM only
+#define FTP_JOURNAL_PERSIST			1
+
+// the file, on the volume at the root. Clients can't list, read, write
+// or remove it.
+#define FTP_JOURNAL_FILE			"/.ftp_journal"
+
+// the file is cut back to what RAM holds when it grows past this (bytes)
+#define FTP_JOURNAL_FILE_BYTES		(4 * FTP_JOURNAL_BYTES)
+
+// changes in one SITE CHANGES reply, the client asks again for more
+#define FTP_JOURNAL_REPLY_MAX		100
+
+// room for the two paths of a rename, FTP_CWD_SIZE each
+#define FTP_JOURNAL_PATH_SIZE		(2 * (_MAX_LFN + 8))
+
+// what changed
+#define FTP_JOURNAL_STOR			1
+#define FTP_JOURNAL_DELE			2
+#define FTP_JOURNAL_RENAME			3
+#define FTP_JOURNAL_MKD				4
+#define FTP_JOURNAL_RMD				5
+#define FTP_JOURNAL_MDTM			6
+#define FTP_JOURNAL_COPY			7
+#define FTP_JOURNAL_RMTREE			8
+
+// what a client holds, the last change it saw. Tokens of another epoch
+// are from records that were lost.
+typedef struct {
+	uint32_t epoch;
+	uint32_t seq;
+} ftp_journal_token_t;
+
+// a record as it is read back
+typedef struct {
+	uint32_t seq;
+	uint8_t op;
+
+	// full path, for a rename the old path, a 0 and the new path
+	char path[FTP_JOURNAL_PATH_SIZE];
+} ftp_journal_entry_t;
+
+#if FTP_JOURNAL == 1
+#define FTP_JOURNAL_ADD(op, path, to)	ftp_journal_add((op), (path), (to))
+#else
+#define FTP_JOURNAL_ADD(op, path, to)
+#endif
+
+/**
+ * Load the journal file and start recording. Call when the volumes are
+ * mounted.
+ */
+void ftp_journal_start(void);
+
+/**
+ * Record a change. A change that can't be recorded starts a new epoch,
+ * so clients resync.
+ *
+ * @param op One of FTP_JOURNAL_*. COPY and RMTREE stand for a tree that
+ * was copied to or removed at the path.
+ * @param path Full path
+ * @param to New path of a rename, else NULL
+ */
+void ftp_journal_add(uint8_t op, const char *path, const char *to);
+
+/**
+ * Epoch and sequence number of the last change, the token a client
+ * keeps.
+ *
+ * @param token Structure the token is copied to
+ */
+void ftp_journal_token(ftp_journal_token_t *token);
+
+/**
+ * Get the first change after a token.
+ *
+ * @param after Token of the client
+ * @param entry Structure the change is copied to
+ * @return 1 if there is one, 0 if nothing changed since, -1 if changes
+ * after the token were dropped or the token is from another journal, the
+ * client has to list everything again
+ */
+int ftp_journal_next(const ftp_journal_token_t *after, ftp_journal_entry_t *entry);
+
+/**
+ * Name of a change as the client sees it.
+ */
+const char *ftp_journal_op_name(uint8_t op);
+
+/**
+ * Does a path name the journal file? FatFs finds it also in another
+ * case, through ".." or by its short name.
+ *
+ * @param path Full path
+ * @return 1 if it does, the server keeps clients away from it
+ */
+uint8_t ftp_journal_is_file(const char *path);
+
+/**
+ * Is an entry of a directory listing the journal file?
+ *
+ * @param dir Full path of the directory
+ * @param name Name the directory was read with
+ * @return 1 if it is, listings leave it out
+ */
+uint8_t ftp_journal_is_entry(const char *dir, const char *name);
+
+#endif // _FTP_JOURNAL_H_
@@ -0,0 +1,160 @@
+/*
+ * ftp_log.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ftp.h"
+#include "ftp_log.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdio.h>
+
+// single producer, single consumer ring of trace records. The session
+// task only writes head, the drain task only writes tail.
+typedef struct {
+	ftp_log_rec_t rec[FTP_LOG_RING_SIZE];
+	volatile uint16_t head;
+	volatile uint16_t tail;
+	volatile uint32_t dropped;
+
+	// drops already reported, only used by the drain task
+	uint32_t reported;
+} ftp_log_ring_t;
+
+static ftp_log_ring_t ftp_log_rings[FTP_LOG_RINGS];
+
+// text for each event, the arguments are printed as numbers
+static const char * const ftp_log_text[FTP_EV_COUNT] = {
+		[FTP_EV_CONNECT] = "Client connected from %lu.%lu.%lu.%lu",
+		[FTP_EV_DISCONNECT] = "Client disconnected",
+		[FTP_EV_COMMAND] = "Incomming: %.4s, %lu bytes of parameters",
+		[FTP_EV_REPLY] = "Reply %lu, %lu bytes",
+		[FTP_EV_SEND_ERROR] = "Error sending reply %ld",
+		[FTP_EV_NO_MEMORY] = "Error allocating %lu bytes",
+		[FTP_EV_PASV] = "Data port set to %lu",
+		[FTP_EV_PASV_ERROR] = "Error in opening listening con, step %lu, error %ld",
+		[FTP_EV_PORT] = "Data IP set to %lu.%lu.%lu.%lu:%lu",
+		[FTP_EV_DATA_OPEN] = "Data conn in mode %lu",
+		[FTP_EV_DATA_ERROR] = "Error in data conn, step %lu",
+		[FTP_EV_RETR] = "Sending %lu bytes",
+		[FTP_EV_RETR_DONE] = "Sent %lu bytes, result %ld",
+		[FTP_EV_STOR] = "Receiving",
+		[FTP_EV_STOR_DONE] = "Received %lu bytes, error %ld", };
+
+void ftp_log_write(uint8_t con, uint8_t level, uint16_t event, uint32_t a0, uint32_t a1) {
+	// unknown ring?
+	if (con >= FTP_LOG_RINGS)
+		return;
+
+	ftp_log_ring_t *ring = &ftp_log_rings[con];
+	uint16_t head = ring->head;
+
+	// full? drop, the drain task reports it
+	if ((uint16_t) (head - ring->tail) >= FTP_LOG_RING_SIZE) {
+		ring->dropped++;
+		return;
+	}
+
+	// fill the record
+	ftp_log_rec_t *rec = &ring->rec[head & (FTP_LOG_RING_SIZE - 1)];
+	rec->tick = xTaskGetTickCount();
+	rec->event = event;
+	rec->level = level;
+	rec->arg[0] = a0;
+	rec->arg[1] = a1;
+
+	// the record has to be complete before it is published
+	__sync_synchronize();
+	ring->head = head + 1;
+}
+
+// format one record
+static void ftp_log_print(uint8_t con, const ftp_log_rec_t *rec) {
+	char line[96];
+	unsigned long a0 = rec->arg[0];
+	unsigned long a1 = rec->arg[1];
+
+	// prefix with connection, tick and level
+	int len = snprintf(line, sizeof(line), "[%d] %lu %s ", con, (unsigned long) rec->tick, rec->level == FTP_LOG_ERROR ? "E" : "I");
+
+	// unknown event?
+	if (rec->event >= FTP_EV_COUNT) {
+		log_print("%sevent %u\r\n", line, rec->event);
+		return;
+	}
+
+	// events which need their arguments taken apart
+	switch (rec->event) {
+	case FTP_EV_CONNECT:
+		snprintf(line + len, sizeof(line) - len, ftp_log_text[rec->event], a0 & 0xFF, (a0 >> 8) & 0xFF, (a0 >> 16) & 0xFF, (a0 >> 24) & 0xFF);
+		break;
+	case FTP_EV_PORT:
+		snprintf(line + len, sizeof(line) - len, ftp_log_text[rec->event], a0 & 0xFF, (a0 >> 8) & 0xFF, (a0 >> 16) & 0xFF, (a0 >> 24) & 0xFF, a1);
+		break;
+	case FTP_EV_COMMAND:
+		// the command characters are stored as they are in memory
+		snprintf(line + len, sizeof(line) - len, ftp_log_text[rec->event], (const char *) &rec->arg[0], a1);
+		break;
+	case FTP_EV_SEND_ERROR:
+		// lwIP errors are negative
+		snprintf(line + len, sizeof(line) - len, ftp_log_text[rec->event], (long) (int32_t) rec->arg[0]);
+		break;
+	case FTP_EV_PASV_ERROR:
+	case FTP_EV_RETR_DONE:
+	case FTP_EV_STOR_DONE:
+		snprintf(line + len, sizeof(line) - len, ftp_log_text[rec->event], a0, (long) (int32_t) rec->arg[1]);
+		break;
+	default:
+		snprintf(line + len, sizeof(line) - len, ftp_log_text[rec->event], a0, a1);
+		break;
+	}
+
+	log_print("%s\r\n", line);
+}
+
+void ftp_log_drain(void) {
+	for (uint8_t con = 0; con < FTP_LOG_RINGS; con++) {
+		ftp_log_ring_t *ring = &ftp_log_rings[con];
+		uint16_t tail = ring->tail;
+
+		// format all published records
+		while (tail != ring->head) {
+			ftp_log_print(con, &ring->rec[tail & (FTP_LOG_RING_SIZE - 1)]);
+
+			// done with the record, hand the place back to the session
+			__sync_synchronize();
+			ring->tail = ++tail;
+		}
+
+		// report new drops
+		uint32_t dropped = ring->dropped;
+		if (dropped != ring->reported) {
+			log_print("[%d] %lu trace records dropped\r\n", con, dropped - ring->reported);
+			ring->reported = dropped;
+		}
+	}
+}
+
+// drain task
+static void ftp_log_task(void *param) {
+	(void) param;
+
+	while (1) {
+		vTaskDelay(pdMS_TO_TICKS(FTP_LOG_DRAIN_MS));
+		ftp_log_drain();
+	}
+}
+
+void ftp_log_start(UBaseType_t priority) {
+	static TaskHandle_t drain = NULL;
+
+	// only one drain task
+	if (drain != NULL)
+		return;
+
+	if (xTaskCreate(ftp_log_task, "ftp_log", configMINIMAL_STACK_SIZE * 2, NULL, priority, &drain) != pdPASS)
+		log_print("ftp_log not started\r\n");
+}
@@ -0,0 +1,103 @@
+/*
+ * ftp_log.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_LOG_H_
+#define _FTP_LOG_H_
+
+#include <stdint.h>
+#include "ftp_port.h"
+
+// log levels
+#define FTP_LOG_NONE			0
+#define FTP_LOG_ERROR			1
+#define FTP_LOG_INFO			2
+#define FTP_LOG_DEBUG			3
+
+// events up to this level are logged, everything above is compiled out.
+// FTP_LOG_DEBUG adds formatted messages which are printed synchronously.
+#ifndef FTP_LOG_LEVEL
+#define FTP_LOG_LEVEL			FTP_LOG_INFO
+#endif
+
+// records per session ring, must be a power of two
+#define FTP_LOG_RING_SIZE		32
+
+// number of rings, one per session
+#define FTP_LOG_RINGS			FTP_NBR_CLIENTS
+
+// interval at which the drain task formats the records (ms)
+#define FTP_LOG_DRAIN_MS		100
+
+// priority of the drain task, started by ftp_server()
+#define FTP_LOG_PRIORITY		(tskIDLE_PRIORITY + 1)
+
+// trace events, the arguments are described next to each event
+typedef enum {
+	FTP_EV_CONNECT,			// peer ip, -
+	FTP_EV_DISCONNECT,		// -, -
+	FTP_EV_COMMAND,			// command characters, parameter length
+	FTP_EV_REPLY,			// reply code, reply length
+	FTP_EV_SEND_ERROR,		// lwIP error, -
+	FTP_EV_NO_MEMORY,		// bytes requested, -
+	FTP_EV_PASV,			// data port, -
+	FTP_EV_PASV_ERROR,		// step (0 no port, 1 new, 2 bind, 3 listen), lwIP error
+	FTP_EV_PORT,			// client ip, data port
+	FTP_EV_DATA_OPEN,		// mode (dcm_type), -
+	FTP_EV_DATA_ERROR,		// step (0 no mode, 1 accept, 2 new, 3 bind, 4 connect), -
+	FTP_EV_RETR,			// file size, -
+	FTP_EV_RETR_DONE,		// bytes sent, result
+	FTP_EV_STOR,			// -, -
+	FTP_EV_STOR_DONE,		// bytes received, lwIP error
+	FTP_EV_COUNT
+} ftp_event_t;
+
+// binary trace record, formatted later by the drain task
+typedef struct {
+	TickType_t tick;
+	uint16_t event;
+	uint16_t level;
+	uint32_t arg[2];
+} ftp_log_rec_t;
+
+#if FTP_LOG_LEVEL >= FTP_LOG_ERROR
+#define FTP_TRACE_ERROR(con, ev, a0, a1)	ftp_log_write((con), FTP_LOG_ERROR, (ev), (uint32_t) (a0), (uint32_t) (a1))
+#else
+#define FTP_TRACE_ERROR(con, ev, a0, a1)	do { } while (0)
+#endif
+
+#if FTP_LOG_LEVEL >= FTP_LOG_INFO
+#define FTP_TRACE_INFO(con, ev, a0, a1)		ftp_log_write((con), FTP_LOG_INFO, (ev), (uint32_t) (a0), (uint32_t) (a1))
+#else
+#define FTP_TRACE_INFO(con, ev, a0, a1)		do { } while (0)
+#endif
+
+/**
+ * Store a trace record in the ring of a session. This only stores a
+ * few words, the formatting is done by the drain task. When the ring
+ * is full the record is dropped and counted.
+ *
+ * @param con Connection number of the session
+ * @param level Log level of the event
+ * @param event The event
+ * @param a0 First argument
+ * @param a1 Second argument
+ */
+extern void ftp_log_write(uint8_t con, uint8_t level, uint16_t event, uint32_t a0, uint32_t a1);
+
+/**
+ * Format and print all pending trace records.
+ */
+extern void ftp_log_drain(void);
+
+/**
+ * Start the task which drains the trace rings every FTP_LOG_DRAIN_MS.
+ * Run it at a low priority, it only uses spare CPU time.
+ *
+ * @param priority Priority of the drain task
+ */
+extern void ftp_log_start(UBaseType_t priority);
+
+#endif /* _FTP_LOG_H_ */
@@ -0,0 +1,39 @@
+/*
+ * ftp_port.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_PORT_H_
+#define _FTP_PORT_H_
+
+// The server is written against the STM32Cube middleware headers. A host
+// build defines FTP_HOST and uses the lwIP unix port, the FreeRTOS POSIX
+// port and FatFs on a disk image instead, see host/ftp_host.c.
+#if defined(FTP_HOST)
+
+#include <stdio.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "lwip/opt.h"
+#include "lwip/api.h"
+#include "ff.h"
+
+// weak default implementations, the CMSIS headers define this on target
+#ifndef __weak
+#define __weak					__attribute__((weak))
+#endif
+
+// log output, the application provides this on target
+#ifndef log_print
+#define log_print(...)			printf(__VA_ARGS__)
+#endif
+
+#else
+
+#include "lwip.h"
+#include "fatfs.h"
+
+#endif
+
+#endif /* _FTP_PORT_H_ */
@@ -0,0 +1,112 @@
+/*
+ * ftp_rate.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ftp_rate.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+// bucket shared by all sessions
+static ftp_bucket_t ftp_rate_global = { FTP_RATE_GLOBAL_DEFAULT, 0, 0, 0 };
+
+// rate a new session starts with
+static uint32_t ftp_rate_session_default = FTP_RATE_SESSION_DEFAULT;
+
+// bucket depth in bytes
+static int32_t ftp_rate_burst(uint32_t rate) {
+	return (int32_t) (((uint64_t) rate * FTP_RATE_BURST_MS) / 1000);
+}
+
+// add the tokens earned since the last refill
+static void ftp_rate_refill(ftp_bucket_t *bucket, TickType_t now) {
+	TickType_t elapsed = now - bucket->last;
+	uint64_t earned;
+
+	// same tick, nothing earned
+	if (elapsed == 0)
+		return;
+
+	// bytes earned, keep the remainder for the next refill
+	earned = (uint64_t) bucket->rate * elapsed + bucket->frac;
+	bucket->frac = earned % configTICK_RATE_HZ;
+	earned /= configTICK_RATE_HZ;
+	bucket->last = now;
+
+	// never more than the bucket depth
+	if (earned >= (uint64_t) (ftp_rate_burst(bucket->rate) - bucket->tokens))
+		bucket->tokens = ftp_rate_burst(bucket->rate);
+	else
+		bucket->tokens += (int32_t) earned;
+}
+
+// take tokens, returns the ticks to wait until the bucket is out of debt
+static TickType_t ftp_rate_consume(ftp_bucket_t *bucket, uint32_t bytes, TickType_t now) {
+	// unlimited?
+	if (bucket->rate == 0)
+		return 0;
+
+	// refill and take
+	ftp_rate_refill(bucket, now);
+	bucket->tokens -= (int32_t) bytes;
+
+	// not in debt?
+	if (bucket->tokens >= 0)
+		return 0;
+
+	// time to earn back the debt, rounded up
+	return (TickType_t) (((uint64_t) -bucket->tokens * configTICK_RATE_HZ + bucket->rate - 1) / bucket->rate);
+}
+
+void ftp_rate_set(ftp_bucket_t *bucket, uint32_t rate) {
+	taskENTER_CRITICAL();
+	bucket->rate = rate;
+	bucket->tokens = ftp_rate_burst(rate);
+	bucket->frac = 0;
+	bucket->last = xTaskGetTickCount();
+	taskEXIT_CRITICAL();
+}
+
+void ftp_rate_take(ftp_bucket_t *bucket, uint32_t bytes) {
+	TickType_t now = xTaskGetTickCount();
+	TickType_t wait;
+	TickType_t wait_global = 0;
+
+	// nothing limited? this is the only cost when shaping is off
+	if (bucket->rate == 0 && ftp_rate_global.rate == 0)
+		return;
+
+	// the session bucket is only used by its own task
+	wait = ftp_rate_consume(bucket, bytes, now);
+
+	// the global bucket is shared by all sessions
+	if (ftp_rate_global.rate != 0) {
+		taskENTER_CRITICAL();
+		wait_global = ftp_rate_consume(&ftp_rate_global, bytes, now);
+		taskEXIT_CRITICAL();
+	}
+
+	// wait for the slowest bucket
+	if (wait_global > wait)
+		wait = wait_global;
+	if (wait > 0)
+		vTaskDelay(wait);
+}
+
+void ftp_rate_set_global(uint32_t rate) {
+	ftp_rate_set(&ftp_rate_global, rate);
+}
+
+uint32_t ftp_rate_get_global(void) {
+	return ftp_rate_global.rate;
+}
+
+void ftp_rate_set_session_default(uint32_t rate) {
+	ftp_rate_session_default = rate;
+}
+
+uint32_t ftp_rate_get_session_default(void) {
+	return ftp_rate_session_default;
+}
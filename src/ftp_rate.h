@@ -0,0 +1,80 @@
+/*
+ * ftp_rate.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_RATE_H_
+#define _FTP_RATE_H_
+
+#include <stdint.h>
+#include "ftp_port.h"
+
+// bandwidth shaping of the data connections, 0 compiles it out
+#ifndef FTP_RATE_LIMIT
+#define FTP_RATE_LIMIT				1
+#endif
+
+// rate of a new session in bytes per second, 0 is unlimited
+#define FTP_RATE_SESSION_DEFAULT	0
+
+// rate of all sessions together in bytes per second, 0 is unlimited
+#define FTP_RATE_GLOBAL_DEFAULT		0
+
+// bucket depth expressed in milliseconds of traffic at the set rate.
+// A shallow bucket keeps the traffic smooth instead of sending a
+// second worth of data at once.
+#define FTP_RATE_BURST_MS			20
+
+/**
+ * Token bucket. Tokens are bytes, they are refilled at the set rate
+ * up to FTP_RATE_BURST_MS worth of traffic. A transfer may take more
+ * tokens than there are, the debt is waited for before it continues.
+ */
+typedef struct {
+	// bytes per second, 0 is unlimited
+	uint32_t rate;
+
+	// bytes that may be sent right now, negative when in debt
+	int32_t tokens;
+
+	// remainder of the last refill, keeps low rates exact
+	uint32_t frac;
+
+	// tick of the last refill
+	TickType_t last;
+} ftp_bucket_t;
+
+#if FTP_RATE_LIMIT == 1
+#define FTP_RATE_TAKE(bucket, bytes)	ftp_rate_take((bucket), (bytes))
+#else
+#define FTP_RATE_TAKE(bucket, bytes)
+#endif
+
+/**
+ * Set the rate of a bucket, this also refills it.
+ *
+ * @param bucket The bucket
+ * @param rate Bytes per second, 0 is unlimited
+ */
+extern void ftp_rate_set(ftp_bucket_t *bucket, uint32_t rate);
+
+/**
+ * Take tokens from a session bucket and from the global bucket. Blocks
+ * the calling task until both buckets are out of debt.
+ *
+ * @param bucket The session bucket
+ * @param bytes Number of bytes that were transferred
+ */
+extern void ftp_rate_take(ftp_bucket_t *bucket, uint32_t bytes);
+
+/**
+ * Setter and getter functions for the rate of all sessions together
+ * and for the rate a new session starts with, in bytes per second.
+ */
+extern void ftp_rate_set_global(uint32_t rate);
+extern uint32_t ftp_rate_get_global(void);
+extern void ftp_rate_set_session_default(uint32_t rate);
+extern uint32_t ftp_rate_get_session_default(void);
+
+#endif /* _FTP_RATE_H_ */
@@ -27,18 +27,35 @@
 #include <stdarg.h>
 
 #include "api.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "lwip/stats.h"
+#include "FreeRTOS.h"
 
 static char *ftp_user_name = FTP_USER_NAME_DEFAULT;
 static char *ftp_user_pass = FTP_USER_PASS_DEFAULT;
+static uint8_t ftp_ctrl_nodelay = FTP_CTRL_NODELAY;
 
+// passive data port allocator, shared by all sessions
+static uint8_t ftp_port_used[FTP_DATA_PORT_COUNT];
+static TickType_t ftp_port_free_at[FTP_DATA_PORT_COUNT];
+static uint16_t ftp_port_next = 0;
+
+// formatted messages, printed synchronously, only at debug level. The
+// hot paths use the binary FTP_TRACE_* records instead.
+#if FTP_LOG_LEVEL >= FTP_LOG_DEBUG
 #define DEBUG_PRINT(ftp, f, ...)	log_print("[%d] "f, ftp->ftp_con_num, ##__VA_ARGS__)
+#else
+#define DEBUG_PRINT(ftp, f, ...)
+#endif
 
 #define FTP_USER_NAME_OK(name)		(!strcmp(name, ftp_user_name))
 #define FTP_USER_PASS_OK(pass)		(!strcmp(pass, ftp_user_pass))
 #define FTP_IS_LOGGED_IN(p_ftp)		(p_ftp->user == FTP_USER_USER_LOGGED_IN)
 
-//
+// link state, override to close sessions when the cable is pulled
 __weak uint8_t ftp_eth_is_connected(void) {
+	return 1;
 }
 
 // =========================================================
@@ -62,10 +79,13 @@ static void ftp_send(ftp_data_t *ftp, const char *fmt, ...) {
 	va_end(args);
 
 	// send to endpoint
-	if (netconn_write(ftp->ctrlconn, send_buffer, strlen(send_buffer), NETCONN_COPY) != ERR_OK)
-		DEBUG_PRINT(ftp, "Error sending command!\r\n");
+	size_t len = strlen(send_buffer);
+	err_t err = netconn_write(ftp->ctrlconn, send_buffer, len, NETCONN_COPY);
+	if (err != ERR_OK)
+		FTP_TRACE_ERROR(ftp->ftp_con_num, FTP_EV_SEND_ERROR, err, 0);
 
-	// debugging
+	// trace the reply code, the text is only printed at debug level
+	FTP_TRACE_INFO(ftp->ftp_con_num, FTP_EV_REPLY, (send_buffer[0] - '0') * 100 + (send_buffer[1] - '0') * 10 + (send_buffer[2] - '0'), len);
 	DEBUG_PRINT(ftp, "%s", send_buffer);
 }
 
@@ -77,8 +97,24 @@ static void ftp_send(ftp_data_t *ftp, const char *fmt, ...) {
 // return:
 //    pointer to string
 
+// two digits of a date or time field
+static inline char *data_time_put2(char *str, uint8_t value) {
+	str[0] = '0' + value / 10;
+	str[1] = '0' + value % 10;
+	return str + 2;
+}
+
 static char * data_time_to_str(char *str, uint16_t date, uint16_t time) {
-	snprintf(str, 25, "%04d%02d%02d%02d%02d%02d", ((date & 0xFE00) >> 9) + 1980, (date & 0x01E0) >> 5, date & 0x001F, (time & 0xF800) >> 11, (time & 0x07E0) >> 5, (time & 0x001F) << 1);
+	// this runs for every MLSD line, so no snprintf
+	uint16_t year = ((date & 0xFE00) >> 9) + 1980;
+	char *p = data_time_put2(str, year / 100);
+	p = data_time_put2(p, year % 100);
+	p = data_time_put2(p, (date & 0x01E0) >> 5);
+	p = data_time_put2(p, date & 0x001F);
+	p = data_time_put2(p, (time & 0xF800) >> 11);
+	p = data_time_put2(p, (time & 0x07E0) >> 5);
+	p = data_time_put2(p, (time & 0x001F) << 1);
+	*p = 0;
 	return str;
 }
 
@@ -93,25 +129,26 @@ static char * data_time_to_str(char *str, uint16_t date, uint16_t time) {
 
 static int8_t date_time_get(char *parameters, uint16_t * pdate, uint16_t * ptime) {
 	// Date/time are expressed as a 14 digits long string
-	//   terminated by a space and followed by name of file
-	if (strlen(parameters) < 15 || parameters[14] != ' ')
-		return 0;
+	//   terminated by a space and followed by name of file,
+	//   the digit test stops at the end of a shorter string
 	for (uint8_t i = 0; i < 14; i++)
-		if (!isdigit(parameters[i]))
+		if (!isdigit((unsigned char) parameters[i]))
 			return 0;
+	if (parameters[14] != ' ')
+		return 0;
 
+	// two digit fields, straight from the characters
+#define DATE_TIME_2(p)	(((p)[0] - '0') * 10 + (p)[1] - '0')
+	*ptime = DATE_TIME_2(parameters + 12) >> 1;   // seconds
+	*ptime |= DATE_TIME_2(parameters + 10) << 5;  // minutes
+	*ptime |= DATE_TIME_2(parameters + 8) << 11;  // hours
+	*pdate = DATE_TIME_2(parameters + 6);         // days
+	*pdate |= DATE_TIME_2(parameters + 4) << 5;   // months
+	*pdate |= (DATE_TIME_2(parameters) * 100 + DATE_TIME_2(parameters + 2) - 1980) << 9;       // years
+#undef DATE_TIME_2
+
+	// only the date/time is left in the parameters
 	parameters[14] = 0;
-	*ptime = atoi(parameters + 12) >> 1;   // seconds
-	parameters[12] = 0;
-	*ptime |= atoi(parameters + 10) << 5;  // minutes
-	parameters[10] = 0;
-	*ptime |= atoi(parameters + 8) << 11;  // hours
-	parameters[8] = 0;
-	*pdate = atoi(parameters + 6);         // days
-	parameters[6] = 0;
-	*pdate |= atoi(parameters + 4) << 5;   // months
-	parameters[4] = 0;
-	*pdate |= (atoi(parameters) - 1980) << 9;       // years
 
 	return 15;
 }
@@ -123,13 +160,24 @@ static int8_t date_time_get(char *parameters, uint16_t * pdate, uint16_t * ptime
 // =========================================================
 
 static int ftp_read_command(ftp_data_t *ftp) {
+	// waiting at the prompt, the server may evict us from here on
+	ftp->last_activity = xTaskGetTickCount();
+	ftp->at_prompt = 1;
+
 	// loop and check for packet every second
 	for (uint32_t i = 0; i < FTP_TIME_OUT_S; i++) {
+		// did the server reclaim this connection for a new client?
+		if (ftp->evict) {
+			ftp_send(ftp, "421 Idle too long, connection closed\r\n");
+			break;
+		}
+
 		// receive data
 		int8_t net_err = netconn_recv(ftp->ctrlconn, &ftp->inbuf);
 
 		// reception was ok?
 		if (net_err == ERR_OK) {
+			ftp->at_prompt = 0;
 			return 0;
 		}
 
@@ -159,14 +207,16 @@ static int ftp_parse_command(ftp_data_t *ftp) {
 	char * pbuf;
 	uint16_t buflen;
 	int ret = 0;
-	int8_t i;
+	uint16_t i;
+	uint32_t cmd_word;
 
 	// get data from recieved packet
 	netbuf_data(ftp->inbuf, (void **) &pbuf, &buflen);
 
-	// zero the command and parameter buffers
+	// zero the command, it is compared as a whole. The parameters
+	// only need a terminator.
 	memset(ftp->command, 0, FTP_CMD_SIZE);
-	memset(ftp->parameters, 0, FTP_PARAM_SIZE);
+	ftp->parameters[0] = 0;
 
 	// no data?
 	if (buflen == 0)
@@ -178,7 +228,7 @@ static int ftp_parse_command(ftp_data_t *ftp) {
 	// copy command loop
 	do {
 		// command may only contain characters, not the case?
-		if (!isalpha(pbuf[i]))
+		if (!isalpha((unsigned char) pbuf[i]))
 			break;
 
 		// copy character
@@ -191,18 +241,18 @@ static int ftp_parse_command(ftp_data_t *ftp) {
 	// When the command contains parameters, the character after the
 	// command is a space. If this character is not a space, we only
 	// received a command.
-	if (pbuf[i] != ' ')
+	if (i >= buflen || pbuf[i] != ' ')
 		goto deletebuf;
 
 	// remove leading spaces for parameters
-	while (pbuf[i] == ' ')
+	while (i < buflen && pbuf[i] == ' ')
 		i++;
 
 	// set return variable to zero, it will contain the string length
 	ret = 0;
 
 	// search for the end of the parameter string
-	while (pbuf[i + ret] != '\n' && pbuf[i + ret] != '\r' && (i + ret) < buflen)
+	while ((i + ret) < buflen && pbuf[i + ret] != '\n' && pbuf[i + ret] != '\r')
 		ret++;
 
 	// will the parameter data fit the given buffer?
@@ -215,12 +265,15 @@ static int ftp_parse_command(ftp_data_t *ftp) {
 	}
 
 	// copy parameters from the pbuf
-	strncpy(ftp->parameters, pbuf + i, ret);
+	memcpy(ftp->parameters, pbuf + i, ret);
+	ftp->parameters[ret] = 0;
 
 	// delete buf tag
 	deletebuf:
 
-	// feedback
+	// feedback, the command characters are stored as one word
+	memcpy(&cmd_word, ftp->command, sizeof(cmd_word));
+	FTP_TRACE_INFO(ftp->ftp_con_num, FTP_EV_COMMAND, cmd_word, ret);
 	DEBUG_PRINT(ftp, "Incomming: %s %s\r\n", ftp->command, ftp->parameters);
 
 	// delete buffer
@@ -236,46 +289,172 @@ static int ftp_parse_command(ftp_data_t *ftp) {
 //
 // =========================================================
 
+// Move the session to bulk priority for a data transfer, or back to
+// the normal priority for command handling
+static void data_con_bulk(ftp_data_t *ftp, uint8_t bulk) {
+	vTaskPrioritySet(NULL, bulk ? FTP_TASK_PRIORITY_BULK : FTP_TASK_PRIORITY);
+
+	// fresh budget for the transfer
+	ftp->budget_bytes = 0;
+	ftp->budget_start = xTaskGetTickCount();
+}
+
+// Account work done by a transfer, gives the CPU away once the
+// session used its budget of FTP_YIELD_BYTES or FTP_YIELD_MS
+static void data_con_budget(ftp_data_t *ftp, uint32_t bytes) {
+#if FTP_YIELD_BYTES > 0 || FTP_YIELD_MS > 0
+	ftp->budget_bytes += bytes;
+
+	// budget left?
+	if ((FTP_YIELD_BYTES == 0 || ftp->budget_bytes < FTP_YIELD_BYTES)
+			&& (FTP_YIELD_MS == 0 || (TickType_t) (xTaskGetTickCount() - ftp->budget_start) < pdMS_TO_TICKS(FTP_YIELD_MS)))
+		return;
+
+	// let other tasks run
+#if FTP_YIELD_TICKS > 0
+	vTaskDelay(FTP_YIELD_TICKS);
+#else
+	taskYIELD();
+#endif
+
+	// new budget
+	ftp->budget_bytes = 0;
+	ftp->budget_start = xTaskGetTickCount();
+#endif
+}
+
+// Take a passive data port which is not in use and not cooling down
+//
+// return:
+//    port number, 0 if all ports are taken
+static uint16_t data_port_alloc(void) {
+	TickType_t now = xTaskGetTickCount();
+	uint16_t port = 0;
+
+	taskENTER_CRITICAL();
+
+	// round robin, so a released port gets the longest possible rest
+	for (uint16_t n = 0; n < FTP_DATA_PORT_COUNT; n++) {
+		uint16_t i = (ftp_port_next + n) % FTP_DATA_PORT_COUNT;
+
+		// in use or still cooling down?
+		if (ftp_port_used[i] || (int32_t) (now - ftp_port_free_at[i]) < 0)
+			continue;
+
+		// take it
+		ftp_port_used[i] = 1;
+		ftp_port_next = (i + 1) % FTP_DATA_PORT_COUNT;
+		port = FTP_DATA_PORT + i;
+		break;
+	}
+
+	taskEXIT_CRITICAL();
+
+	return port;
+}
+
+// Give a passive data port back, it can be reused after the cooldown
+static void data_port_release(uint16_t port) {
+	// not one of ours?
+	if (port < FTP_DATA_PORT || port >= FTP_DATA_PORT + FTP_DATA_PORT_COUNT)
+		return;
+
+	taskENTER_CRITICAL();
+	ftp_port_used[port - FTP_DATA_PORT] = 0;
+	ftp_port_free_at[port - FTP_DATA_PORT] = xTaskGetTickCount() + pdMS_TO_TICKS(FTP_DATA_PORT_COOLDOWN_MS);
+	taskEXIT_CRITICAL();
+}
+
+// the options of a pcb belong to the tcpip thread, run a function on the
+// pcb of a connection there. Without core locking it is queued in front of
+// the next netconn call of this task.
+static void pcb_call(struct netconn *conn, tcpip_callback_fn fn) {
+#if LWIP_TCPIP_CORE_LOCKING
+	LOCK_TCPIP_CORE();
+	fn(conn->pcb.tcp);
+	UNLOCK_TCPIP_CORE();
+#else
+	tcpip_callback(fn, conn->pcb.tcp);
+#endif
+}
+
+#if SO_REUSE
+static void pcb_set_reuse(void *arg) {
+	ip_set_option((struct tcp_pcb*) arg, SOF_REUSEADDR);
+}
+#endif
+
+static void pcb_set_nodelay(void *arg) {
+	tcp_nagle_disable((struct tcp_pcb*) arg);
+}
+
+static void pasv_con_close(ftp_data_t *ftp);
+
 static int pasv_con_open(ftp_data_t *ftp) {
-	// If this is not already done, create the TCP connection handle
-	// to listen to client to open data connection
+	// The listening connection is kept for the whole session and
+	// reused for every PASV command, nothing to do if it exists
 	if (ftp->listdataconn != NULL)
 		return 0;
 
-	// create new socket
-	ftp->listdataconn = netconn_new(NETCONN_TCP);
+	// try a few ports, one may still be held by a connection in TIME_WAIT
+	for (uint8_t attempt = 0; attempt < 3; attempt++) {
+		// get a port from the allocator
+		ftp->pasv_port = data_port_alloc();
+		if (ftp->pasv_port == 0) {
+			FTP_TRACE_ERROR(ftp->ftp_con_num, FTP_EV_PASV_ERROR, 0, 0);
+			return -1;
+		}
 
-	// create was ok?
-	if (ftp->listdataconn == NULL) {
-		DEBUG_PRINT(ftp, "Error in opening listening con, creation failed\r\n");
-		return -1;
-	}
+		// create new socket
+		ftp->listdataconn = netconn_new(NETCONN_TCP);
 
-	// Bind listdataconn to port (FTP_DATA_PORT + num) with default IP address
-	int8_t err = netconn_bind(ftp->listdataconn, IP_ADDR_ANY, ftp->data_port);
-	if (err != ERR_OK) {
-		DEBUG_PRINT(ftp, "Error in opening listening con, bind failed %d\r\n", err);
-		return -1;
-	}
+		// create was ok?
+		if (ftp->listdataconn == NULL) {
+			FTP_TRACE_ERROR(ftp->ftp_con_num, FTP_EV_PASV_ERROR, 1, 0);
+			pasv_con_close(ftp);
+			return -1;
+		}
 
-	//
-	netconn_set_recvtimeout(ftp->listdataconn, 5000);
+#if SO_REUSE
+		// allow binding while old connections on this port are in TIME_WAIT
+		pcb_call(ftp->listdataconn, pcb_set_reuse);
+#endif
 
-	// Put the connection into LISTEN state
-	err = netconn_listen(ftp->listdataconn);
-	if (err != ERR_OK) {
-		DEBUG_PRINT(ftp, "Error in opening listening con, listen failed %d\r\n", err);
-		return -1;
+		// Bind listdataconn to the allocated port with default IP address
+		int8_t err = netconn_bind(ftp->listdataconn, IP_ADDR_ANY, ftp->pasv_port);
+		if (err != ERR_OK) {
+			FTP_TRACE_ERROR(ftp->ftp_con_num, FTP_EV_PASV_ERROR, 2, err);
+			pasv_con_close(ftp);
+			continue;
+		}
+
+		//
+		netconn_set_recvtimeout(ftp->listdataconn, 5000);
+
+		// Put the connection into LISTEN state
+		err = netconn_listen(ftp->listdataconn);
+		if (err != ERR_OK) {
+			FTP_TRACE_ERROR(ftp->ftp_con_num, FTP_EV_PASV_ERROR, 3, err);
+			pasv_con_close(ftp);
+			return -1;
+		}
+
+		// all good
+		return 0;
 	}
 
-	// all good
-	return 0;
+	// no port could be bound
+	return -1;
 }
 
 static void pasv_con_close(ftp_data_t *ftp) {
 	// reset datacon mode
 	ftp->data_conn_mode = DCM_NOT_SET;
 
+	// give the port back to the allocator
+	data_port_release(ftp->pasv_port);
+	ftp->pasv_port = 0;
+
 	// delete listdataconn socket
 	if (ftp->listdataconn == NULL)
 		return;
@@ -293,12 +472,12 @@ static void pasv_con_close(ftp_data_t *ftp) {
 static int data_con_open(ftp_data_t *ftp) {
 	// no connection mode set?
 	if (ftp->data_conn_mode == DCM_NOT_SET) {
-		DEBUG_PRINT(ftp, "No connecting mode defined\r\n");
+		FTP_TRACE_ERROR(ftp->ftp_con_num, FTP_EV_DATA_ERROR, 0, 0);
 		return -1;
 	}
 
 	// feedback
-	DEBUG_PRINT(ftp, "Data conn in %s mode\r\n", (ftp->data_conn_mode == DCM_PASSIVE ? "passive" : "active"));
+	FTP_TRACE_INFO(ftp->ftp_con_num, FTP_EV_DATA_OPEN, ftp->data_conn_mode, 0);
 
 	// are we in passive mode?
 	if (ftp->data_conn_mode == DCM_PASSIVE) {
@@ -312,8 +491,11 @@ static int data_con_open(ftp_data_t *ftp) {
 		netconn_set_recvtimeout(ftp->listdataconn, 500);
 
 		// accept connection
-		if (netconn_accept(ftp->listdataconn, &ftp->dataconn) != ERR_OK) {
-			DEBUG_PRINT(ftp, "Error in data conn: netconn_accept\r\n");
+		FTP_SPAN_BEGIN(span);
+		err_t err = netconn_accept(ftp->listdataconn, &ftp->dataconn);
+		FTP_SPAN_END(span, FTP_SPAN_DATA_ACCEPT, err);
+		if (err != ERR_OK) {
+			FTP_TRACE_ERROR(ftp->ftp_con_num, FTP_EV_DATA_ERROR, 1, 0);
 			return -1;
 		}
 	}
@@ -324,27 +506,33 @@ static int data_con_open(ftp_data_t *ftp) {
 
 		// was creation succesfull?
 		if (ftp->dataconn == NULL) {
-			DEBUG_PRINT(ftp, "Error in data conn: netconn_new\r\n");
+			FTP_TRACE_ERROR(ftp->ftp_con_num, FTP_EV_DATA_ERROR, 2, 0);
 			return -1;
 		}
 
 		//  Connect to data port with client IP address
 		if (netconn_bind(ftp->dataconn, IP_ADDR_ANY, 0) != ERR_OK) {
-			DEBUG_PRINT(ftp, "Error in data conn: netconn_bind\r\n");
+			FTP_TRACE_ERROR(ftp->ftp_con_num, FTP_EV_DATA_ERROR, 3, 0);
 			netconn_delete(ftp->dataconn);
 			ftp->dataconn = NULL;
 			return -1;
 		}
 
 		// did connection fail?
-		if (netconn_connect(ftp->dataconn, &ftp->ipclient, ftp->data_port) != ERR_OK) {
-			DEBUG_PRINT(ftp, "Error in data conn: netconn_connect\r\n");
+		FTP_SPAN_BEGIN(span);
+		err_t err = netconn_connect(ftp->dataconn, &ftp->ipclient, ftp->data_port);
+		FTP_SPAN_END(span, FTP_SPAN_DATA_CONNECT, err);
+		if (err != ERR_OK) {
+			FTP_TRACE_ERROR(ftp->ftp_con_num, FTP_EV_DATA_ERROR, 4, 0);
 			netconn_delete(ftp->dataconn);
 			ftp->dataconn = NULL;
 			return -1;
 		}
 	}
 
+	// the transfer runs at bulk priority
+	data_con_bulk(ftp, 1);
+
 	// all good
 	return 0;
 }
@@ -357,16 +545,586 @@ static void data_con_close(ftp_data_t *ftp) {
 	if (ftp->dataconn == NULL)
 		return;
 
+	// back to normal priority for command handling
+	data_con_bulk(ftp, 0);
+
 	// close socket
+	FTP_SPAN_BEGIN(span);
 	netconn_close(ftp->dataconn);
 
 	// delete socket
 	netconn_delete(ftp->dataconn);
+	FTP_SPAN_END(span, FTP_SPAN_DATA_CLOSE, 0);
 
 	// set to null, to be sure
 	ftp->dataconn = NULL;
 }
 
+// Open the file in path for reading, the file information must be in
+// finfo. A file in the RAM cache is not opened at all, other files are
+// copied to the cache while they are read if they fit. Large files are
+// read through a stream while another session reads them too.
+static FRESULT data_file_open(ftp_data_t *ftp, ftp_xfer_t *xfer) {
+#if FTP_SHARE == 1
+	xfer->share.path = NULL;
+#endif
+
+#if FTP_CACHE == 1
+	// in RAM?
+	xfer->cache = ftp_cache_get(ftp->path, &xfer->finfo);
+	xfer->cache_hit = (xfer->cache != NULL);
+	xfer->cache_fill = 0;
+	if (xfer->cache_hit)
+		return FR_OK;
+#endif
+
+	FRESULT res = ftps_f_open(&xfer->file, ftp->path, FA_READ);
+
+#if FTP_CACHE == 1
+	// keep a copy while reading?
+	if (res == FR_OK)
+		xfer->cache = ftp_cache_fill_begin(ftp->path, &xfer->finfo);
+#endif
+
+#if FTP_SHARE == 1
+	// read together with other sessions? our own file is read while
+	// there are none
+	if (res == FR_OK)
+		ftp_share_begin(&xfer->share, ftp->path, &xfer->finfo);
+#endif
+
+	return res;
+}
+
+// Close the file of data_file_open, done tells the whole file was read
+static void data_file_close(ftp_data_t *ftp, ftp_xfer_t *xfer, uint8_t done) {
+	(void) ftp;
+	(void) done;
+
+#if FTP_SHARE == 1
+	ftp_share_end(&xfer->share);
+#endif
+
+#if FTP_CACHE == 1
+	if (xfer->cache != NULL) {
+		if (xfer->cache_hit)
+			ftp_cache_release(xfer->cache);
+		else
+			ftp_cache_fill_end(xfer->cache, done && xfer->cache_fill == xfer->cache->size);
+		xfer->cache = NULL;
+
+		// nothing was opened
+		if (xfer->cache_hit)
+			return;
+	}
+#endif
+
+	ftps_f_close(&xfer->file);
+}
+
+// Size of the file of data_file_open
+static uint32_t data_file_size(ftp_xfer_t *xfer) {
+#if FTP_CACHE == 1
+	if (xfer->cache_hit)
+		return xfer->cache->size;
+#endif
+	return ftps_f_size(&xfer->file);
+}
+
+// Read from the file of a transfer, timed for the statistics. The
+// blocks are FTP_DATA_BUF_SIZE, so they line up with a shared stream.
+static FRESULT data_file_read(ftp_data_t *ftp, ftp_xfer_t *xfer, void *buf, uint32_t len, uint32_t *read) {
+	FRESULT res;
+	uint8_t done = 0;
+
+#if FTP_STATS == 1
+	uint32_t start = ftp_time_us();
+#else
+	(void) ftp;
+#endif
+
+#if FTP_SHARE == 1
+	// with other sessions reading it while they are close
+	if (xfer->share.path != NULL) {
+		res = ftp_share_read(&xfer->share, &xfer->file, buf, read);
+		done = 1;
+	}
+#endif
+
+	if (!done)
+		res = ftps_f_read(&xfer->file, buf, len, read);
+
+#if FTP_STATS == 1
+	FTP_STATS_HIST(&ftp->stats.fs_read, ftp_time_us() - start);
+#endif
+
+#if FTP_CACHE == 1
+	// copy to the cache, a file that grew is not kept
+	if (res == FR_OK && xfer->cache != NULL && !xfer->cache_hit) {
+		if (xfer->cache_fill + *read <= xfer->cache->size)
+			memcpy(xfer->cache->data + xfer->cache_fill, buf, *read);
+		xfer->cache_fill += *read;
+	}
+#endif
+
+	return res;
+}
+
+// Write to the file of a transfer, timed for the statistics
+static FRESULT data_file_write(ftp_data_t *ftp, ftp_xfer_t *xfer, const void *buf, uint32_t len, uint32_t *written) {
+#if FTP_STATS == 1
+	uint32_t start = ftp_time_us();
+	FRESULT res = ftps_f_write(&xfer->file, buf, len, written);
+	FTP_STATS_HIST(&ftp->stats.fs_write, ftp_time_us() - start);
+	return res;
+#else
+	(void) ftp;
+	return ftps_f_write(&xfer->file, buf, len, written);
+#endif
+}
+
+// Blocking write on the data connection, timed for the statistics
+static err_t data_con_write_flags(ftp_data_t *ftp, const void *buf, uint32_t len, uint8_t flags) {
+	FTP_SPAN_BEGIN(span);
+#if FTP_STATS == 1
+	uint32_t start = ftp_time_us();
+	err_t err = netconn_write(ftp->dataconn, buf, len, flags | NETCONN_MORE);
+	FTP_STATS_HIST(&ftp->stats.net_write, ftp_time_us() - start);
+#else
+	err_t err = netconn_write(ftp->dataconn, buf, len, flags | NETCONN_MORE);
+#endif
+	FTP_SPAN_END(span, FTP_SPAN_NET_WRITE, len);
+	return err;
+}
+
+static err_t data_con_write(ftp_data_t *ftp, const void *buf, uint32_t len) {
+	return data_con_write_flags(ftp, buf, len, NETCONN_COPY);
+}
+
+#if FTP_CACHE == 1 || FTP_LIST_RECURSIVE == 1
+// what TCP still holds of a connection, asked in the tcpip thread
+typedef struct {
+	struct tcpip_api_call_data call;
+	struct netconn *conn;
+	uint8_t abort;
+	uint16_t queued;
+} pcb_queued_t;
+
+static err_t pcb_get_queued(struct tcpip_api_call_data *call) {
+	pcb_queued_t *q = (pcb_queued_t*) call;
+
+	// a reset connection has no pcb and holds nothing
+	q->queued = 0;
+	if (q->conn->pcb.tcp == NULL)
+		return ERR_OK;
+
+	// aborting frees the queue as well
+	if (q->abort)
+		tcp_abort(q->conn->pcb.tcp);
+	else
+		q->queued = tcp_sndqueuelen(q->conn->pcb.tcp);
+	return ERR_OK;
+}
+#endif
+
+#if FTP_LIST_RECURSIVE == 1
+// Drop the data connection with a reset, so the client doesn't take
+// what it got for all of it
+static void data_con_abort(ftp_data_t *ftp) {
+	pcb_queued_t q;
+
+	q.conn = ftp->dataconn;
+	q.abort = 1;
+	tcpip_api_call(pcb_get_queued, &q.call);
+
+	data_con_close(ftp);
+}
+#endif
+
+#if FTP_CACHE == 1
+// Wait until the client acknowledged everything sent on the data
+// connection. Data written with NETCONN_NOCOPY is used by TCP until
+// then, also for retransmissions. A connection that doesn't get there
+// in time is aborted.
+static err_t data_con_wait_acked(ftp_data_t *ftp, uint8_t abort) {
+	pcb_queued_t q;
+	TickType_t start = xTaskGetTickCount();
+
+	q.conn = ftp->dataconn;
+	q.abort = abort;
+
+	while (1) {
+		tcpip_api_call(pcb_get_queued, &q.call);
+		if (q.queued == 0)
+			return q.abort ? ERR_ABRT : ERR_OK;
+
+		// give up after a while
+		if ((TickType_t) (xTaskGetTickCount() - start) >= pdMS_TO_TICKS(FTP_CACHE_ACK_WAIT_MS))
+			q.abort = 1;
+		else
+			vTaskDelay(1);
+	}
+}
+
+// Send a file from the RAM cache. TCP sends straight from the cache
+// without a copy, the entry is held until the client acknowledged all
+// of it.
+static int data_con_send_cached(ftp_data_t *ftp, ftp_xfer_t *xfer, uint32_t *sent) {
+	const uint8_t *data = xfer->cache->data;
+	uint32_t left = xfer->cache->size;
+	err_t err;
+
+	// nothing sent yet
+	*sent = 0;
+
+	while (left > 0) {
+		// the same steps as from disk for the rate limit and the CPU
+		// budget, no buffer is filled for them
+		uint32_t len = left < FTP_DATA_BUF_SIZE ? left : FTP_DATA_BUF_SIZE;
+		err = data_con_write_flags(ftp, data, len, NETCONN_NOCOPY);
+		if (err != ERR_OK) {
+			// TCP may still hold what was sent, drop it
+			data_con_wait_acked(ftp, 1);
+			return err;
+		}
+
+		// increment counters
+		data += len;
+		left -= len;
+		*sent += len;
+
+		// keep to the bandwidth limit and the CPU budget
+		FTP_RATE_TAKE(&ftp->rate, len);
+		data_con_budget(ftp, len);
+	}
+
+	// the entry may only be released when TCP is done with it
+	return data_con_wait_acked(ftp, 0);
+}
+#endif
+
+// Send an open file over the data connection. The blocks are handed
+// to TCP without blocking as long as there is room in the send buffer.
+// When TCP is full the next block is read from the file first, so the
+// disk works while TCP drains. Only when that block is ready as well
+// the task blocks until TCP takes the rest.
+//
+// return:
+//    0 when the whole file is sent, -1 on a file error, else the connection error
+static int data_con_send_file(ftp_data_t *ftp, ftp_xfer_t *xfer, uint32_t *sent) {
+	uint32_t len[2] = { 0, 0 };
+	uint32_t off = 0;
+	uint8_t cur = 0;
+	uint8_t eof = 0;
+	size_t written;
+	err_t err;
+
+#if FTP_CACHE == 1
+	// in RAM?
+	if (xfer->cache_hit)
+		return data_con_send_cached(ftp, xfer, sent);
+#endif
+
+	// nothing sent yet
+	*sent = 0;
+
+	// fill the first block
+	if (data_file_read(ftp, xfer, xfer->buf[cur], FTP_DATA_BUF_SIZE, &len[cur]) != FR_OK)
+		return -1;
+
+	// loop while there is data in the current block
+	while (len[cur] > 0) {
+		// hand TCP as much as fits in the send buffer right now
+		written = 0;
+		FTP_SPAN_BEGIN(span);
+		err = netconn_write_partly(ftp->dataconn, xfer->buf[cur] + off, len[cur] - off, NETCONN_COPY | NETCONN_MORE | NETCONN_DONTBLOCK, &written);
+		FTP_SPAN_END(span, FTP_SPAN_NET_WRITE, written);
+		if (err != ERR_OK && err != ERR_WOULDBLOCK)
+			return err;
+
+		// increment counters
+		off += written;
+		*sent += written;
+
+		// keep to the bandwidth limit and the CPU budget
+		FTP_RATE_TAKE(&ftp->rate, written);
+		data_con_budget(ftp, written);
+
+		// send buffer full before the block was done?
+		if (off < len[cur]) {
+			// read ahead while TCP drains
+			if (!eof && len[!cur] == 0) {
+				if (data_file_read(ftp, xfer, xfer->buf[!cur], FTP_DATA_BUF_SIZE, &len[!cur]) != FR_OK)
+					return -1;
+				eof = (len[!cur] == 0);
+				continue;
+			}
+
+			// nothing left to overlap, wait until TCP takes the rest
+			err = data_con_write(ftp, xfer->buf[cur] + off, len[cur] - off);
+			if (err != ERR_OK)
+				return err;
+			*sent += len[cur] - off;
+
+			// keep to the bandwidth limit and the CPU budget
+			FTP_RATE_TAKE(&ftp->rate, len[cur] - off);
+			data_con_budget(ftp, len[cur] - off);
+		}
+
+		// block done, continue with the read ahead block
+		len[cur] = 0;
+		off = 0;
+		cur = !cur;
+
+		// no read ahead block? read it now
+		if (!eof && len[cur] == 0) {
+			if (data_file_read(ftp, xfer, xfer->buf[cur], FTP_DATA_BUF_SIZE, &len[cur]) != FR_OK)
+				return -1;
+			eof = (len[cur] == 0);
+		}
+	}
+
+	// all good
+	return 0;
+}
+
+// Send the listing data queued in buf[0]
+static err_t data_con_flush(ftp_data_t *ftp, ftp_xfer_t *xfer) {
+	err_t err = ERR_OK;
+
+	// anything queued?
+	if (xfer->fill > 0) {
+		err = data_con_write(ftp, xfer->buf[0], xfer->fill);
+
+#if FTP_STATS == 1
+		// count the listing data
+		ftp->stats.bytes_out += xfer->fill;
+#endif
+
+		// keep to the bandwidth limit and the CPU budget
+		FTP_RATE_TAKE(&ftp->rate, xfer->fill);
+		data_con_budget(ftp, xfer->fill);
+	}
+
+	// buffer is empty again
+	xfer->fill = 0;
+
+	return err;
+}
+
+// Queue a formatted listing line, the lines are sent in blocks of
+// FTP_DATA_BUF_SIZE instead of one TCP write per line
+static err_t data_con_printf(ftp_data_t *ftp, ftp_xfer_t *xfer, const char *fmt, ...) {
+	va_list args;
+	int len;
+
+	// format straight into the free part of the buffer
+	va_start(args, fmt);
+	len = vsnprintf((char *) xfer->buf[0] + xfer->fill, FTP_DATA_BUF_SIZE - xfer->fill, fmt, args);
+	va_end(args);
+
+	// formatting error?
+	if (len < 0)
+		return ERR_VAL;
+
+	// didn't fit? send what we have and format again in the empty buffer
+	if (len >= FTP_DATA_BUF_SIZE - xfer->fill) {
+		err_t err = data_con_flush(ftp, xfer);
+		if (err != ERR_OK)
+			return err;
+
+		va_start(args, fmt);
+		len = vsnprintf((char *) xfer->buf[0], FTP_DATA_BUF_SIZE, fmt, args);
+		va_end(args);
+
+		// a single line longer than the buffer is cut off
+		if (len >= FTP_DATA_BUF_SIZE)
+			len = FTP_DATA_BUF_SIZE - 1;
+		if (len < 0)
+			return ERR_VAL;
+	}
+
+	// keep the line
+	xfer->fill += len;
+
+	return ERR_OK;
+}
+
+// Queue the LIST line of an entry, or only the name for NLST. The name
+// is the file name, or the path below the listed directory for -R.
+static err_t data_con_list_line(ftp_data_t *ftp, ftp_xfer_t *xfer, const FILINFO *nfo, const char *name, uint8_t list) {
+	// only the name?
+	if (!list)
+		return data_con_printf(ftp, xfer, "%s\r\n", name);
+
+	// is it a directory?
+	if (nfo->fattrib & AM_DIR)
+		return data_con_printf(ftp, xfer, "+/,\t%s\r\n", name);
+
+	// just a file
+	return data_con_printf(ftp, xfer, "+r,s%lu,\t%s\r\n", (unsigned long) nfo->fsize, name);
+}
+
+// Queue the MLSD line of an entry
+static err_t data_con_mlsd_line(ftp_data_t *ftp, ftp_xfer_t *xfer, const FILINFO *nfo, const char *name) {
+	const char *type = nfo->fattrib & AM_DIR ? "dir" : "file";
+
+	// file has no date
+	if (nfo->fdate == 0)
+		return data_con_printf(ftp, xfer, "Type=%s;Size=%lu; %s\r\n", type, (unsigned long) nfo->fsize, name);
+
+	// with date
+	char date_str[16];
+	return data_con_printf(ftp, xfer, "Type=%s;Size=%lu;Modify=%s; %s\r\n", type, (unsigned long) nfo->fsize,
+			data_time_to_str(date_str, nfo->fdate, nfo->ftime), name);
+}
+
+#if FTP_LIST_RECURSIVE == 1
+// state of a recursive listing
+typedef struct {
+	ftp_data_t *ftp;
+	ftp_xfer_t *xfer;
+
+	// the names are the paths from here on
+	size_t rel;
+
+	// levels to list, 1 is only the directory itself
+	uint8_t depth;
+
+	// LIST, NLST or MLSD
+	uint8_t list;
+	uint8_t mlsd;
+
+	uint16_t count;
+	err_t err;
+} data_con_tree_t;
+
+// Queue the line of an entry the walk came across
+static int data_con_tree_line(void *arg, const char *path, const FILINFO *nfo, uint8_t depth) {
+	data_con_tree_t *tree = arg;
+
+	// nothing to do when a directory is left
+	if (nfo == NULL)
+		return FTP_WALK_CONTINUE;
+
+	// hidden, don't list it nor what it holds
+	if (nfo->fname[0] == '.')
+		return FTP_WALK_SKIP;
+
+#if FTP_JOURNAL == 1
+	// the server's own
+	if (ftp_journal_is_file(path))
+		return FTP_WALK_SKIP;
+#endif
+
+	if (tree->mlsd)
+		tree->err = data_con_mlsd_line(tree->ftp, tree->xfer, nfo, path + tree->rel);
+	else
+		tree->err = data_con_list_line(tree->ftp, tree->xfer, nfo, path + tree->rel, tree->list);
+
+	// connection lost?
+	if (tree->err != ERR_OK)
+		return FTP_WALK_STOP;
+	tree->count++;
+
+	// deep enough?
+	return depth + 1 < tree->depth ? FTP_WALK_CONTINUE : FTP_WALK_SKIP;
+}
+
+// Queue the listing of the tree below ftp->path, one directory open per
+// level. Returns the result of ftp_walk, FTP_WALK_ERROR when a directory
+// could not be read and the listing ended early.
+static int data_con_tree(ftp_data_t *ftp, ftp_xfer_t *xfer, uint8_t depth, uint8_t list, uint8_t mlsd, uint16_t *count, err_t *err) {
+	data_con_tree_t tree = { ftp, xfer, strcmp(ftp->path, "/") ? strlen(ftp->path) + 1 : 1, depth, list, mlsd, 0, ERR_OK };
+
+	int walk = ftp_walk(ftp->path, data_con_tree_line, &tree);
+
+	if (count != NULL)
+		*count = tree.count;
+	*err = tree.err;
+	return walk;
+}
+
+// Levels a LIST or MLSD asks for: options like "-la" list the directory,
+// "-R" the whole tree and "-R3" three levels
+static uint8_t data_con_depth(const char *param) {
+	// options?
+	if (param[0] != '-')
+		return 1;
+
+	// recursive?
+	const char *r = strchr(param, 'R');
+	const char *end = strchr(param, ' ');
+	if (r == NULL || (end != NULL && r > end))
+		return 1;
+
+	// limited?
+	int depth = atoi(r + 1);
+	return depth > 0 && depth < FTP_WALK_DEPTH ? depth : FTP_WALK_DEPTH;
+}
+#endif
+
+// =========================================================
+//
+//            Functions for file system state
+//
+// =========================================================
+
+// get the file system state of a command with bufs data connection
+// buffers, 0 for commands that don't transfer data
+static ftp_xfer_t *ftp_xfer_get(ftp_data_t *ftp, uint8_t bufs) {
+	size_t size = sizeof(ftp_xfer_t) + bufs * FTP_DATA_BUF_SIZE;
+
+	// already allocated for this command?
+	if (ftp->xfer != NULL)
+		return ftp->xfer;
+
+	// allocate the file system state and the buffers in one go
+	ftp->xfer = pvPortMalloc(size);
+
+	// allocation failed? tell the client
+	if (ftp->xfer == NULL) {
+		FTP_TRACE_ERROR(ftp->ftp_con_num, FTP_EV_NO_MEMORY, size, 0);
+		ftp_send(ftp, "451 Not enough memory\r\n");
+		return NULL;
+	}
+
+	// the buffers follow the structure
+	ftp->xfer->buf[0] = bufs > 0 ? (uint8_t*) (ftp->xfer + 1) : NULL;
+	ftp->xfer->buf[1] = bufs > 1 ? ftp->xfer->buf[0] + FTP_DATA_BUF_SIZE : NULL;
+
+	// no long file name yet, no listing data queued
+	ftp->xfer->finfo.fname[0] = 0;
+	ftp->xfer->fill = 0;
+
+	// all good
+	return ftp->xfer;
+}
+
+static void ftp_xfer_release(ftp_data_t *ftp) {
+	// nothing allocated?
+	if (ftp->xfer == NULL)
+		return;
+
+	// free the file system state
+	vPortFree(ftp->xfer);
+
+	// set to null, to be sure
+	ftp->xfer = NULL;
+}
+
+static void ftp_rename_release(ftp_data_t *ftp) {
+	// no rename pending?
+	if (ftp->path_rename == NULL)
+		return;
+
+	// free the rename path
+	vPortFree(ftp->path_rename);
+
+	// set to null, to be sure
+	ftp->path_rename = NULL;
+}
+
 // =========================================================
 //
 //                  Functions on files
@@ -374,25 +1132,18 @@ static void data_con_close(ftp_data_t *ftp) {
 // =========================================================
 
 static void path_up_a_level(char *path) {
-	// is there a dash in the string?
-	if (strchr(path, '/')) {
-		// get position
-		uint32_t pos = strlen(path) - 1;
-
-		// go up a folder
-		while (path[pos] != '/') {
-			// clear character
-			path[pos] = 0;
-
-			// update position
-			pos = strlen(path) - 1;
-		}
+	// find the last dash
+	char *dash = strrchr(path, '/');
 
-		// remove the dash on which the wile loop exits, but only
-		// when we are not root
-		if (strlen(path) > 1)
-			path[pos] = 0;
-	}
+	// no dash in the string?
+	if (dash == NULL)
+		return;
+
+	// cut the string at the dash, but keep it when it is the root
+	if (dash == path)
+		dash[1] = 0;
+	else
+		dash[0] = 0;
 }
 
 // Make complete path/name from cwdName and parameters
@@ -407,43 +1158,78 @@ static void path_up_a_level(char *path) {
 //   true, if done
 
 static uint8_t path_build(char *current_path, char *ftp_param) {
+	FTP_SPAN_BEGIN(span);
+
+	// lengths are taken once, the path is left alone when the result
+	// would not fit
+	size_t cur = strlen(current_path);
+	size_t len = strlen(ftp_param);
+	uint8_t ok = 1;
+
 	// Should we go to the root directory or is the parameter buffer empty?
-	if (!strcmp(ftp_param, "/") || strlen(ftp_param) == 0) {
+	if (len == 0 || (len == 1 && ftp_param[0] == '/')) {
 		// go to root directory
-		strncpy(current_path, "/", FTP_CWD_SIZE);
+		current_path[0] = '/';
+		current_path[1] = 0;
+		cur = 1;
 	}
 	// should we go up a directory?
-	else if (strcmp(ftp_param, "..") == 0) {
+	else if (len == 2 && ftp_param[0] == '.' && ftp_param[1] == '.') {
 		// remove characters until '/' is found
 		path_up_a_level(current_path);
+		cur = strlen(current_path);
 	}
 	// The incoming parameter doesn't contain a slash? this means that
 	// the parameter is only the folder name and it should be appended
 	else if (ftp_param[0] != '/') {
 		// should we concatinate '/'?
-		if (current_path[strlen(current_path) - 1] != '/')
-			strncat(current_path, "/", FTP_CWD_SIZE);
-
-		// concatinate parameter to string
-		strncat(current_path, ftp_param, FTP_CWD_SIZE);
+		uint8_t dash = cur == 0 || current_path[cur - 1] != '/';
+
+		// does the string fit?
+		if (cur + dash + len >= FTP_CWD_SIZE) {
+			ok = 0;
+		} else {
+			// concatinate parameter to string
+			if (dash)
+				current_path[cur++] = '/';
+			memcpy(current_path + cur, ftp_param, len + 1);
+			cur += len;
+		}
 	}
 	// The incoming parameter starts with a slash. This means that
 	// the parameter is the whole path.
-	else {
-		strncpy(current_path, ftp_param, FTP_CWD_SIZE);
+	else if (len >= FTP_CWD_SIZE) {
+		ok = 0;
+	} else {
+		memcpy(current_path, ftp_param, len + 1);
+		cur = len;
 	}
 
-	// If the string is longer than 1 character and ends with '/', remove it
-	uint16_t strl = strlen(current_path) - 1;
-	if (current_path[strl] == '/' && strl > 1)
-		current_path[strl] = 0;
+	// If the string is longer than 2 characters and ends with '/', remove it
+	if (ok && cur > 2 && current_path[cur - 1] == '/')
+		current_path[cur - 1] = 0;
 
-	// does the string fit? success
-	if (strlen(current_path) < FTP_CWD_SIZE)
-		return 1;
+	FTP_SPAN_END(span, FTP_SPAN_PATH_BUILD, ok);
+	return ok;
+}
 
-	// failed
-	return 0;
+// path_build for the parameter of a command, the client got the error
+// when it returns 0. The journal file is the server's own.
+static uint8_t path_build_param(ftp_data_t *ftp, char *path, char *param) {
+	if (!path_build(path, param)) {
+		ftp_send(ftp, "500 Command line too long\r\n");
+		return 0;
+	}
+
+#if FTP_JOURNAL == 1
+	if (ftp_journal_is_file(path)) {
+		path_up_a_level(path);
+		ftp_send(ftp, "550 Permission denied\r\n");
+		return 0;
+	}
+#endif
+
+	return 1;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -473,14 +1259,18 @@ static void ftp_cmd_cwd(ftp_data_t *ftp) {
 		return;
 	}
 
+	// get file system state
+	ftp_xfer_t *xfer = ftp_xfer_get(ftp, 0);
+	if (xfer == NULL)
+		return;
+
 	// can we build a path from the parameters?
-	if (!path_build(ftp->path, ftp->parameters)) {
-		ftp_send(ftp, "500 Command line too long\r\n");
+	if (!path_build_param(ftp, ftp->path, ftp->parameters)) {
 		return;
 	}
 
 	// is this not the root path and doesn't the path exist?
-	if (strcmp(ftp->path, "/") != 0 && ftps_f_stat(ftp->path, &ftp->finfo) != FR_OK) {
+	if (strcmp(ftp->path, "/") != 0 && ftps_f_stat(ftp->path, &xfer->finfo) != FR_OK) {
 		ftp_send(ftp, "550 Failed to change directory to %s\r\n", ftp->path);
 		return;
 	}
@@ -545,20 +1335,20 @@ static void ftp_cmd_pasv(ftp_data_t *ftp) {
 		return;
 
 #if USE_PASSIVE_MODE == 1
-	// set data port
-	ftp->data_port = FTP_DATA_PORT + ftp->data_port_incremented + (ftp->ftp_con_num * PORT_INCREMENT_OFFSET);
-
 	// open connection ok?
 	if (pasv_con_open(ftp) == 0) {
 		// close data connection, just to be sure
 		data_con_close(ftp);
 
+		// set data port to the port of our listener
+		ftp->data_port = ftp->pasv_port;
+
 		// reply that we are entering passive mode
 		ftp_send(ftp, "227 Entering Passive Mode (%d,%d,%d,%d,%d,%d).\r\n", ftp->ipserver.addr & 0xFF, (ftp->ipserver.addr >> 8) & 0xFF, (ftp->ipserver.addr >> 16) & 0xFF,
 				(ftp->ipserver.addr >> 24) & 0xFF, ftp->data_port >> 8, ftp->data_port & 255);
 
 		// feedback
-		DEBUG_PRINT(ftp, "Data port set to %u\r\n", ftp->data_port);
+		FTP_TRACE_INFO(ftp->ftp_con_num, FTP_EV_PASV, ftp->data_port, 0);
 
 		// set state
 		ftp->data_conn_mode = DCM_PASSIVE;
@@ -643,8 +1433,7 @@ static void ftp_cmd_port(ftp_data_t *ftp) {
 	ftp_send(ftp, "200 PORT command successful\r\n");
 
 	// feedback
-	DEBUG_PRINT(ftp, "Data IP set to %u:%u:%u:%u\r\n", ip[0], ip[1], ip[2], ip[3]);
-	DEBUG_PRINT(ftp, "Data port set to %u\r\n", ftp->data_port);
+	FTP_TRACE_INFO(ftp->ftp_con_num, FTP_EV_PORT, ftp->ipclient.addr, ftp->data_port);
 
 	// set data connection mode
 	ftp->data_conn_mode = DCM_ACTIVE;
@@ -655,16 +1444,26 @@ static void ftp_cmd_list(ftp_data_t *ftp) {
 	if (!FTP_IS_LOGGED_IN(ftp))
 		return;
 
-	DIR dir;
+	err_t err = ERR_OK;
+
+#if FTP_LIST_RECURSIVE == 1
+	int walk = FTP_WALK_DONE;
+#endif
+
+	// get file system state
+	ftp_xfer_t *xfer = ftp_xfer_get(ftp, 1);
+	if (xfer == NULL)
+		return;
 
 	// can we open the directory?
-	if (ftps_f_opendir(&dir, ftp->path) != FR_OK) {
+	if (ftps_f_opendir(&xfer->dir, ftp->path) != FR_OK) {
 		ftp_send(ftp, "550 Can't open directory %s\r\n", ftp->parameters);
 		return;
 	}
 
 	// open data connection
 	if (data_con_open(ftp) != 0) {
+		ftps_f_closedir(&xfer->dir);
 		ftp_send(ftp, "425 Can't create connection\r\n");
 		return;
 	}
@@ -672,32 +1471,54 @@ static void ftp_cmd_list(ftp_data_t *ftp) {
 	// accept the command
 	ftp_send(ftp, "150 Accepted data connection\r\n");
 
-	// working buffer
-	char dir_name_buf[FTP_BUF_SIZE];
-
+#if FTP_LIST_RECURSIVE == 1
+	// LIST -R, the whole tree in this data connection
+	uint8_t depth = data_con_depth(ftp->parameters);
+	if (depth > 1) {
+		walk = data_con_tree(ftp, xfer, depth, !strcmp(ftp->command, "LIST"), 0, NULL, &err);
+	} else
+#endif
 	// loop until errors occur
-	while (ftps_f_readdir(&dir, &ftp->finfo) == FR_OK) {
+	while (ftps_f_readdir(&xfer->dir, &xfer->finfo) == FR_OK) {
 		// last entry read?
-		if (ftp->finfo.fname[0] == 0)
+		if (xfer->finfo.fname[0] == 0)
 			break;
 
 		// file name is not valid?
-		if (ftp->finfo.fname[0] == '.')
+		if (xfer->finfo.fname[0] == '.')
 			continue;
 
-		// list command given? (to give support for NLST)
-		if (strcmp(ftp->command, "LIST"))
-			snprintf(dir_name_buf, FTP_BUF_SIZE, "%s\r\n", ftp->lfn[0] == 0 ? ftp->finfo.fname : ftp->lfn);
-		// is it a directory?
-		else if (ftp->finfo.fattrib & AM_DIR)
-			snprintf(dir_name_buf, FTP_BUF_SIZE, "+/,\t%s\r\n", ftp->lfn[0] == 0 ? ftp->finfo.fname : ftp->lfn);
-		// just a file
-		else
-			snprintf(dir_name_buf, FTP_BUF_SIZE, "+r,s%d,\t%s\r\n", ftp->finfo.fsize, ftp->lfn[0] == 0 ? ftp->finfo.fname : ftp->lfn);
+#if FTP_JOURNAL == 1
+		// the server's own
+		if (ftp_journal_is_entry(ftp->path, xfer->finfo.fname))
+			continue;
+#endif
+
+		// queue the line, only names for NLST
+		err = data_con_list_line(ftp, xfer, &xfer->finfo, xfer->finfo.fname, !strcmp(ftp->command, "LIST"));
 
-		// write data to endpoint
-		netconn_write(ftp->dataconn, dir_name_buf, strlen(dir_name_buf), NETCONN_COPY);
+		// connection lost?
+		if (err != ERR_OK)
+			break;
+	}
+
+#if FTP_LIST_RECURSIVE == 1
+	// a directory of the tree could not be read, a listing cut short
+	// is no success
+	if (walk == FTP_WALK_ERROR) {
+		ftps_f_closedir(&xfer->dir);
+		data_con_abort(ftp);
+		ftp_send(ftp, "451 Can't read the whole tree\r\n");
+		return;
 	}
+#endif
+
+	// send the rest of the listing
+	if (err == ERR_OK)
+		data_con_flush(ftp, xfer);
+
+	// done with the directory
+	ftps_f_closedir(&xfer->dir);
 
 	// close data connection
 	data_con_close(ftp);
@@ -711,17 +1532,28 @@ static void ftp_cmd_mlsd(ftp_data_t *ftp) {
 	if (!FTP_IS_LOGGED_IN(ftp))
 		return;
 
-	DIR dir;
 	uint16_t nm = 0;
 
+	err_t err = ERR_OK;
+
+#if FTP_LIST_RECURSIVE == 1
+	int walk = FTP_WALK_DONE;
+#endif
+
+	// get file system state
+	ftp_xfer_t *xfer = ftp_xfer_get(ftp, 1);
+	if (xfer == NULL)
+		return;
+
 	// can we open the directory?
-	if (ftps_f_opendir(&dir, ftp->path) != FR_OK) {
+	if (ftps_f_opendir(&xfer->dir, ftp->path) != FR_OK) {
 		ftp_send(ftp, "550 Can't open directory %s\r\n", ftp->parameters);
 		return;
 	}
 
 	// open data connection
 	if (data_con_open(ftp) != 0) {
+		ftps_f_closedir(&xfer->dir);
 		ftp_send(ftp, "425 Can't create connection\r\n");
 		return;
 	}
@@ -729,37 +1561,58 @@ static void ftp_cmd_mlsd(ftp_data_t *ftp) {
 	// all good
 	ftp_send(ftp, "150 Accepted data connection\r\n");
 
-	// working buffer
-	char buf[FTP_BUF_SIZE];
-
+#if FTP_LIST_RECURSIVE == 1
+	// MLSD -R, the whole tree in this data connection
+	uint8_t depth = data_con_depth(ftp->parameters);
+	if (depth > 1) {
+		walk = data_con_tree(ftp, xfer, depth, 0, 1, &nm, &err);
+	} else
+#endif
 	// loop while we read without errors
-	while (ftps_f_readdir(&dir, &ftp->finfo) == FR_OK) {
+	while (ftps_f_readdir(&xfer->dir, &xfer->finfo) == FR_OK) {
 		// end of directory found?
-		if (ftp->finfo.fname[0] == 0)
+		if (xfer->finfo.fname[0] == 0)
 			break;
 
 		// entry valid?
-		if (ftp->finfo.fname[0] == '.')
+		if (xfer->finfo.fname[0] == '.')
 			continue;
 
-		// does the file have a date?
-		if (ftp->finfo.fdate != 0) {
-			char date_str[64];
-			snprintf(buf, FTP_BUF_SIZE, "Type=%s;Size=%d;Modify=%s; %s\r\n", ftp->finfo.fattrib & AM_DIR ? "dir" : "file", ftp->finfo.fsize,
-					data_time_to_str(date_str, ftp->finfo.fdate, ftp->finfo.ftime), ftp->lfn[0] == 0 ? ftp->finfo.fname : ftp->lfn);
-		}
-		// file has no date
-		else {
-			snprintf(buf, FTP_BUF_SIZE, "Type=%s;Size=%d; %s\r\n", ftp->finfo.fattrib & AM_DIR ? "dir" : "file", ftp->finfo.fsize, ftp->lfn[0] == 0 ? ftp->finfo.fname : ftp->lfn);
-		}
+#if FTP_JOURNAL == 1
+		// the server's own
+		if (ftp_journal_is_entry(ftp->path, xfer->finfo.fname))
+			continue;
+#endif
 
-		// write the data
-		netconn_write(ftp->dataconn, buf, strlen(buf), NETCONN_COPY);
+		// queue the line
+		err = data_con_mlsd_line(ftp, xfer, &xfer->finfo, xfer->finfo.fname);
+
+		// connection lost?
+		if (err != ERR_OK)
+			break;
 
 		// increment variable
 		nm++;
 	}
 
+#if FTP_LIST_RECURSIVE == 1
+	// a directory of the tree could not be read, a listing cut short
+	// is no success
+	if (walk == FTP_WALK_ERROR) {
+		ftps_f_closedir(&xfer->dir);
+		data_con_abort(ftp);
+		ftp_send(ftp, "451 Can't read the whole tree\r\n");
+		return;
+	}
+#endif
+
+	// send the rest of the listing
+	if (err == ERR_OK)
+		data_con_flush(ftp, xfer);
+
+	// done with the directory
+	ftps_f_closedir(&xfer->dir);
+
 	// close data connection
 	data_con_close(ftp);
 
@@ -778,14 +1631,18 @@ static void ftp_cmd_dele(ftp_data_t *ftp) {
 		return;
 	}
 
+	// get file system state
+	ftp_xfer_t *xfer = ftp_xfer_get(ftp, 0);
+	if (xfer == NULL)
+		return;
+
 	// can we build a valid path?
-	if (!path_build(ftp->path, ftp->parameters)) {
-		ftp_send(ftp, "500 Command line too long\r\n");
+	if (!path_build_param(ftp, ftp->path, ftp->parameters)) {
 		return;
 	}
 
 	// does the file exist?
-	if (ftps_f_stat(ftp->path, &ftp->finfo) != FR_OK) {
+	if (ftps_f_stat(ftp->path, &xfer->finfo) != FR_OK) {
 		// go up a level again
 		path_up_a_level(ftp->path);
 
@@ -808,6 +1665,10 @@ static void ftp_cmd_dele(ftp_data_t *ftp) {
 		return;
 	}
 
+	// the space of the file is free again
+	FTP_SPACE_FILE(ftp->path, xfer->finfo.fsize, 0);
+	FTP_JOURNAL_ADD(FTP_JOURNAL_DELE, ftp->path, NULL);
+
 	// all good
 	ftp_send(ftp, "250 Deleted %s\r\n", ftp->parameters);
 
@@ -835,14 +1696,18 @@ static void ftp_cmd_retr(ftp_data_t *ftp) {
 		return;
 	}
 
+	// get file system state
+	ftp_xfer_t *xfer = ftp_xfer_get(ftp, 2);
+	if (xfer == NULL)
+		return;
+
 	// can we create a valid path from the parameter?
-	if (!path_build(ftp->path, ftp->parameters)) {
-		ftp_send(ftp, "500 Command line too long\r\n");
+	if (!path_build_param(ftp, ftp->path, ftp->parameters)) {
 		return;
 	}
 
 	// does the chosen file exists?
-	if (ftps_f_stat(ftp->path, &ftp->finfo) != FR_OK) {
+	if (ftps_f_stat(ftp->path, &xfer->finfo) != FR_OK) {
 		// go up a level again
 		path_up_a_level(ftp->path);
 
@@ -854,7 +1719,7 @@ static void ftp_cmd_retr(ftp_data_t *ftp) {
 	}
 
 	// can we open the file?
-	if (ftps_f_open(&ftp->file, ftp->path, FA_READ) != FR_OK) {
+	if (data_file_open(ftp, xfer) != FR_OK) {
 		// go up a level again
 		path_up_a_level(ftp->path);
 
@@ -874,51 +1739,39 @@ static void ftp_cmd_retr(ftp_data_t *ftp) {
 		ftp_send(ftp, "425 Can't create connection\r\n");
 
 		// close file
-		ftps_f_close(&ftp->file);
+		data_file_close(ftp, xfer, 0);
 
 		// go back
 		return;
 	}
 
 	// feedback
+	FTP_TRACE_INFO(ftp->ftp_con_num, FTP_EV_RETR, data_file_size(xfer), 0);
 	DEBUG_PRINT(ftp, "Sending %s\r\n", ftp->parameters);
 
 	// send accept to client
-	ftp_send(ftp, "150 Connected to port %u, %lu bytes to download\r\n", ftp->data_port, ftps_f_size(&ftp->file));
-
-	// variables used in loop
-	int bytes_transfered = 0;
-	uint32_t bytes_read = 1;
-	uint8_t buf[FTP_BUF_SIZE];
+	ftp_send(ftp, "150 Connected to port %u, %lu bytes to download\r\n", ftp->data_port, (unsigned long) data_file_size(xfer));
 
-	// loop while reading is OK
-	while (1) {
-		// read from file ok?
-		if (ftps_f_read(&ftp->file, buf, FTP_BUF_SIZE, (UINT *) &bytes_read) != FR_OK) {
-			ftp_send(ftp, "451 Communication error during transfer\r\n");
-			break;
-		}
-
-		// check
-		if (bytes_read == 0)
-			break;
-
-		// write data to socket
-		err_t con_err = netconn_write(ftp->dataconn, buf, bytes_read, NETCONN_COPY);
-		if (con_err != ERR_OK) {
-			ftp_send(ftp, "426 Error during file transfer: %d\r\n", con_err);
-			break;
-		}
-
-		// increment variable
-		bytes_transfered += bytes_read;
-	}
+	// send the file
+	uint32_t bytes_transfered = 0;
+	uint32_t start = ftp_time_us();
+	int result = data_con_send_file(ftp, xfer, &bytes_transfered);
+
+#if FTP_STATS == 1
+	// count the transfer
+	ftp->stats.bytes_out += bytes_transfered;
+	ftp->stats.xfer_out_us += ftp_time_us() - start;
+	if (result == 0)
+		ftp->stats.xfers_out++;
+#else
+	(void) start;
+#endif
 
 	// feedback
-	DEBUG_PRINT(ftp, "Sent %u bytes\r\n", bytes_transfered);
+	FTP_TRACE_INFO(ftp->ftp_con_num, FTP_EV_RETR_DONE, bytes_transfered, result);
 
 	// close file
-	ftps_f_close(&ftp->file);
+	data_file_close(ftp, xfer, result == 0);
 
 	// go up a level again
 	path_up_a_level(ftp->path);
@@ -926,8 +1779,13 @@ static void ftp_cmd_retr(ftp_data_t *ftp) {
 	// close data socket
 	data_con_close(ftp);
 
-	// stop transfer
-	ftp_send(ftp, "226 File successfully transferred\r\n");
+	// reply how the transfer went
+	if (result == 0)
+		ftp_send(ftp, "226 File successfully transferred\r\n");
+	else if (result == -1)
+		ftp_send(ftp, "451 Communication error during transfer\r\n");
+	else
+		ftp_send(ftp, "426 Error during file transfer: %d\r\n", result);
 }
 
 static void ftp_cmd_stor(ftp_data_t *ftp) {
@@ -941,14 +1799,23 @@ static void ftp_cmd_stor(ftp_data_t *ftp) {
 		return;
 	}
 
+	// get file system state
+	ftp_xfer_t *xfer = ftp_xfer_get(ftp, 1);
+	if (xfer == NULL)
+		return;
+
 	// is the path valid?
-	if (!path_build(ftp->path, ftp->parameters)) {
-		ftp_send(ftp, "500 Command line too long\r\n");
+	if (!path_build_param(ftp, ftp->path, ftp->parameters)) {
 		return;
 	}
 
+#if FTP_SPACE == 1
+	// size of the file we replace, for the free space
+	FSIZE_t old_size = ftps_f_stat(ftp->path, &xfer->finfo) == FR_OK ? xfer->finfo.fsize : 0;
+#endif
+
 	// does the path exist?
-	if (ftps_f_open(&ftp->file, ftp->path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+	if (ftps_f_open(&xfer->file, ftp->path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
 		// go up a level again
 		path_up_a_level(ftp->path);
 
@@ -967,14 +1834,16 @@ static void ftp_cmd_stor(ftp_data_t *ftp) {
 		// send error to client
 		ftp_send(ftp, "425 Can't create connection\r\n");
 
-		// close file
-		ftps_f_close(&ftp->file);
+		// close file, opening it truncated it
+		ftps_f_close(&xfer->file);
+		FTP_SPACE_FILE(ftp->path, old_size, 0);
 
 		// go back
 		return;
 	}
 
 	// feedback
+	FTP_TRACE_INFO(ftp->ftp_con_num, FTP_EV_STOR, 0, 0);
 	DEBUG_PRINT(ftp, "Receiving %s\r\n", ftp->parameters);
 
 	// reply to ftp client that we are ready
@@ -982,7 +1851,8 @@ static void ftp_cmd_stor(ftp_data_t *ftp) {
 
 	//
 	struct pbuf * rcvbuf = NULL;
-	void * prcvbuf;
+	struct pbuf * q;
+	uint8_t * prcvbuf;
 	uint16_t buflen = 0;
 	uint16_t offset = 0;
 	uint16_t copylen = 0;
@@ -990,7 +1860,8 @@ static void ftp_cmd_stor(ftp_data_t *ftp) {
 	int8_t con_err = 0;
 	uint32_t bytes_written = 0;
 	uint32_t bytes_transfered = 0;
-	uint8_t buf[FTP_BUF_SIZE];
+	uint8_t *buf = xfer->buf[0];
+	uint32_t start = ftp_time_us();
 
 	while (1) {
 		// receive data from ftp client ok?
@@ -1005,45 +1876,53 @@ static void ftp_cmd_stor(ftp_data_t *ftp) {
 			break;
 		}
 
-		// housekeeping
-		prcvbuf = rcvbuf->payload;
-		buflen = rcvbuf->tot_len;
-
-		// loop until all data is written
-		while (buflen > 0) {
-			// copy complete buffer or part of it?
-			if (buflen <= FTP_BUF_SIZE - offset)
-				copylen = buflen;
-			else
-				copylen = FTP_BUF_SIZE - offset;
-
-			// decrement buffer
-			buflen -= copylen;
-
-			// copy data to local buffer
-			memcpy(buf + offset, prcvbuf, copylen);
-
-			// increment counters
-			prcvbuf += copylen;
-			offset += copylen;
-
-			// offset ok?
-			if (offset == FTP_BUF_SIZE) {
-				// write data to file
-				file_err = ftps_f_write(&ftp->file, buf, FTP_BUF_SIZE, (UINT *) &bytes_written);
-
-				// write ok?
-				if (file_err != 0)
-					break;
-
-				// reset offset
-				offset = 0;
+		// walk all pbufs in the chain
+		for (q = rcvbuf; q != NULL && file_err == 0; q = q->next) {
+			// housekeeping
+			prcvbuf = q->payload;
+			buflen = q->len;
+
+			// loop until all data is written
+			while (buflen > 0) {
+				// copy complete buffer or part of it?
+				if (buflen <= FTP_DATA_BUF_SIZE - offset)
+					copylen = buflen;
+				else
+					copylen = FTP_DATA_BUF_SIZE - offset;
+
+				// decrement buffer
+				buflen -= copylen;
+
+				// copy data to local buffer
+				memcpy(buf + offset, prcvbuf, copylen);
+
+				// increment counters
+				prcvbuf += copylen;
+				offset += copylen;
+
+				// offset ok?
+				if (offset == FTP_DATA_BUF_SIZE) {
+					// write data to file
+					file_err = data_file_write(ftp, xfer, buf, FTP_DATA_BUF_SIZE, &bytes_written);
+
+					// write ok?
+					if (file_err != 0)
+						break;
+
+					// reset offset
+					offset = 0;
+				}
+
+				// increment counter
+				bytes_transfered += copylen;
 			}
-
-			// increment counter
-			bytes_transfered += copylen;
 		}
 
+		// keep to the bandwidth limit and the CPU budget, while we
+		// wait the receive window closes and the client slows down
+		FTP_RATE_TAKE(&ftp->rate, rcvbuf->tot_len);
+		data_con_budget(ftp, rcvbuf->tot_len);
+
 		// free pbuf
 		pbuf_free(rcvbuf);
 
@@ -1056,14 +1935,28 @@ static void ftp_cmd_stor(ftp_data_t *ftp) {
 
 	// write the remaining data to file
 	if (offset > 0 && file_err == 0) {
-		file_err = ftps_f_write(&ftp->file, buf, offset, (UINT *) &bytes_written);
+		file_err = data_file_write(ftp, xfer, buf, offset, &bytes_written);
 	}
 
+#if FTP_STATS == 1
+	// count the transfer
+	ftp->stats.bytes_in += bytes_transfered;
+	ftp->stats.xfer_in_us += ftp_time_us() - start;
+	if (con_err == ERR_CLSD && file_err == 0)
+		ftp->stats.xfers_in++;
+#else
+	(void) start;
+#endif
+
 	// feedback
-	DEBUG_PRINT(ftp, "Received %u bytes\r\n", bytes_transfered);
+	FTP_TRACE_INFO(ftp->ftp_con_num, FTP_EV_STOR_DONE, bytes_transfered, con_err == ERR_CLSD ? 0 : con_err);
+
+	// the file replaced the old one
+	FTP_SPACE_FILE(ftp->path, old_size, ftps_f_size(&xfer->file));
 
 	// close file
-	ftps_f_close(&ftp->file);
+	ftps_f_close(&xfer->file);
+	FTP_JOURNAL_ADD(FTP_JOURNAL_STOR, ftp->path, NULL);
 
 	// go up a level again
 	path_up_a_level(ftp->path);
@@ -1086,14 +1979,18 @@ static void ftp_cmd_mkd(ftp_data_t *ftp) {
 		return;
 	}
 
+	// get file system state
+	ftp_xfer_t *xfer = ftp_xfer_get(ftp, 0);
+	if (xfer == NULL)
+		return;
+
 	// can we build a path?
-	if (!path_build(ftp->path, ftp->parameters)) {
-		ftp_send(ftp, "500 Command line too long\r\n");
+	if (!path_build_param(ftp, ftp->path, ftp->parameters)) {
 		return;
 	}
 
 	// does the path not exist already?
-	if (ftps_f_stat(ftp->path, &ftp->finfo) == FR_OK) {
+	if (ftps_f_stat(ftp->path, &xfer->finfo) == FR_OK) {
 		// go up a level again
 		path_up_a_level(ftp->path);
 
@@ -1116,6 +2013,10 @@ static void ftp_cmd_mkd(ftp_data_t *ftp) {
 		return;
 	}
 
+	// the directory takes a unit
+	FTP_SPACE_DIR(ftp->path, 1);
+	FTP_JOURNAL_ADD(FTP_JOURNAL_MKD, ftp->path, NULL);
+
 	// feedback
 	DEBUG_PRINT(ftp, "Creating directory %s\r\n", ftp->parameters);
 
@@ -1135,9 +2036,13 @@ void ftp_cmd_rmd(ftp_data_t *ftp) {
 		return;
 	}
 
+	// get file system state
+	ftp_xfer_t *xfer = ftp_xfer_get(ftp, 0);
+	if (xfer == NULL)
+		return;
+
 	// Can we build path?
-	if (!path_build(ftp->path, ftp->parameters)) {
-		ftp_send(ftp, "500 Command line too long\r\n");
+	if (!path_build_param(ftp, ftp->path, ftp->parameters)) {
 		return;
 	}
 
@@ -1145,7 +2050,7 @@ void ftp_cmd_rmd(ftp_data_t *ftp) {
 	DEBUG_PRINT(ftp, "Deleting %s\r\n", ftp->path);
 
 	// file does exist?
-	if (ftps_f_stat(ftp->path, &ftp->finfo) != FR_OK) {
+	if (ftps_f_stat(ftp->path, &xfer->finfo) != FR_OK) {
 		// go up a level again
 		path_up_a_level(ftp->path);
 
@@ -1159,16 +2064,143 @@ void ftp_cmd_rmd(ftp_data_t *ftp) {
 		// go up a level again
 		path_up_a_level(ftp->path);
 
-		// send error to client
-		ftp_send(ftp, "501 Can't delete \"%s\"\r\n", ftp->parameters);
-		return;
+		// send error to client
+		ftp_send(ftp, "501 Can't delete \"%s\"\r\n", ftp->parameters);
+		return;
+	}
+
+	// the unit of the directory is free again
+	FTP_SPACE_DIR(ftp->path, -1);
+	FTP_JOURNAL_ADD(FTP_JOURNAL_RMD, ftp->path, NULL);
+
+	// all good
+	ftp_send(ftp, "250 \"%s\" removed\r\n", ftp->parameters);
+
+	// go up a level again
+	path_up_a_level(ftp->path);
+}
+
+#if FTP_TREE == 1
+// progress of a copy, removal or move on the device
+typedef struct {
+	ftp_data_t *ftp;
+	const char *what;
+
+	// tick of the last progress line, one was sent
+	TickType_t last;
+	uint8_t started;
+} ftp_tree_reply_t;
+
+static void ftp_tree_reply_init(ftp_data_t *ftp, ftp_tree_reply_t *reply, const char *what) {
+	reply->ftp = ftp;
+	reply->what = what;
+	reply->last = xTaskGetTickCount();
+	reply->started = 0;
+}
+
+// Called as a tree operation goes, gives the CPU away like a transfer
+// and keeps the client from timing out with preliminary replies, so the
+// final reply is still free to tell an error
+static void ftp_tree_progress(void *arg, const ftp_tree_stats_t *stats, uint32_t bytes) {
+	ftp_tree_reply_t *reply = arg;
+	TickType_t now = xTaskGetTickCount();
+
+	// keep to the CPU budget
+	data_con_budget(reply->ftp, bytes);
+
+	// time for a line?
+	if ((TickType_t) (now - reply->last) < pdMS_TO_TICKS(FTP_TREE_PROGRESS_MS))
+		return;
+
+	ftp_send(reply->ftp, "150 %s %lu files, %lu directories, %lu KB so far\r\n", reply->what, (unsigned long) stats->files,
+			(unsigned long) stats->dirs, (unsigned long) (stats->bytes >> 10));
+	reply->last = now;
+	reply->started = 1;
+}
+
+// Final reply of a tree operation, the code tells how it ended also
+// after progress lines
+static void ftp_tree_done(ftp_tree_reply_t *reply, FRESULT res, const ftp_tree_stats_t *stats) {
+	const char *err;
+	int code = 550;
+
+	switch (res) {
+	case FR_OK:
+		ftp_send(reply->ftp, "250 %s %lu files, %lu directories, %lu KB\r\n", reply->what, (unsigned long) stats->files,
+				(unsigned long) stats->dirs, (unsigned long) (stats->bytes >> 10));
+		return;
+	case FR_NO_FILE:
+	case FR_NO_PATH:
+		err = "No such file or directory";
+		break;
+	case FR_EXIST:
+		err = "Destination already exists";
+		code = 553;
+		break;
+	case FR_DENIED:
+		err = "Not allowed or volume full";
+		break;
+	case FR_LOCKED:
+		err = "File in use";
+		code = 450;
+		break;
+	case FR_INVALID_NAME:
+		err = "Path too long";
+		break;
+	case FR_NOT_ENOUGH_CORE:
+		err = "Not enough memory";
+		code = 451;
+		break;
+	default:
+		err = "File system error";
+		code = 451;
+		break;
+	}
+
+	if (reply->started)
+		ftp_send(reply->ftp, "%d %s stopped after %lu files: %s\r\n", code, reply->what, (unsigned long) stats->files, err);
+	else
+		ftp_send(reply->ftp, "%d %s\r\n", code, err);
+}
+#endif
+
+// Keep the origin of a rename or a copy in path_rename
+//
+// return:
+//    1 if the origin exists, 0 if not, the client got the error
+static uint8_t ftp_origin_set(ftp_data_t *ftp, char *name) {
+	// get file system state
+	ftp_xfer_t *xfer = ftp_xfer_get(ftp, 0);
+	if (xfer == NULL)
+		return 0;
+
+	// allocate the rename path, unless a previous RNFR left one behind
+	if (ftp->path_rename == NULL)
+		ftp->path_rename = pvPortMalloc(FTP_CWD_SIZE);
+
+	// allocation failed?
+	if (ftp->path_rename == NULL) {
+		ftp_send(ftp, "451 Not enough memory\r\n");
+		return 0;
+	}
+
+	// copy path to path_rename since this will be used
+	memcpy(ftp->path_rename, ftp->path, FTP_CWD_SIZE);
+
+	// can we build a path with the specified file name?
+	if (!path_build_param(ftp, ftp->path_rename, name)) {
+		ftp_rename_release(ftp);
+		return 0;
 	}
 
-	// all good
-	ftp_send(ftp, "250 \"%s\" removed\r\n", ftp->parameters);
+	// does the file exist?
+	if (ftps_f_stat(ftp->path_rename, &xfer->finfo) != FR_OK) {
+		ftp_rename_release(ftp);
+		ftp_send(ftp, "550 file \"%s\" not found\r\n", name);
+		return 0;
+	}
 
-	// go up a level again
-	path_up_a_level(ftp->path);
+	return 1;
 }
 
 static void ftp_cmd_rnfr(ftp_data_t *ftp) {
@@ -1182,20 +2214,9 @@ static void ftp_cmd_rnfr(ftp_data_t *ftp) {
 		return;
 	}
 
-	// copy path to path_rename since this will be used
-	memcpy(ftp->path_rename, ftp->path, FTP_CWD_SIZE);
-
-	// can we build a path with the specified file name?
-	if (!path_build(ftp->path_rename, ftp->parameters)) {
-		ftp_send(ftp, "500 Command line too long\r\n");
-		return;
-	}
-
-	// does the file exist?
-	if (ftps_f_stat(ftp->path_rename, &ftp->finfo) != FR_OK) {
-		ftp_send(ftp, "550 file \"%s\" not found\r\n", ftp->parameters);
+	// does the origin exist?
+	if (!ftp_origin_set(ftp, ftp->parameters))
 		return;
-	}
 
 	// feedback
 	DEBUG_PRINT(ftp, "Renaming %s\r\n", ftp->path_rename);
@@ -1216,19 +2237,23 @@ static void ftp_cmd_rnto(ftp_data_t *ftp) {
 	}
 
 	// is the rnfr already specified?
-	if (!strlen(ftp->path_rename)) {
+	if (ftp->path_rename == NULL) {
 		ftp_send(ftp, "503 Need RNFR before RNTO\r\n");
 		return;
 	}
 
+	// get file system state
+	ftp_xfer_t *xfer = ftp_xfer_get(ftp, 0);
+	if (xfer == NULL)
+		return;
+
 	// can we build a path with the specified file name?
-	if (!path_build(ftp->path, ftp->parameters)) {
-		ftp_send(ftp, "500 Command line too long\r\n");
+	if (!path_build_param(ftp, ftp->path, ftp->parameters)) {
 		return;
 	}
 
 	// does the file exist?
-	if (ftps_f_stat(ftp->path, &ftp->finfo) == FR_OK) {
+	if (ftps_f_stat(ftp->path, &xfer->finfo) == FR_OK) {
 		ftp_send(ftp, "553 \"%s\" already exists\r\n", ftp->parameters);
 
 		// remove file name from path
@@ -1241,25 +2266,76 @@ static void ftp_cmd_rnto(ftp_data_t *ftp) {
 	// feedback
 	DEBUG_PRINT(ftp, "Renaming %s to %s\r\n", ftp->path_rename, ftp->path);
 
+#if FTP_TREE == 1
+	ftp_tree_reply_t reply;
+	ftp_tree_stats_t stats;
+
+	// between two volumes this is a copy, that takes a while
+	ftp_tree_reply_init(ftp, &reply, "Moved");
+	data_con_bulk(ftp, 1);
+	FRESULT res = ftp_tree_move(ftp->path_rename, ftp->path, ftp_tree_progress, &reply, &stats);
+	data_con_bulk(ftp, 0);
+
+#if FTP_JOURNAL == 1
+	if (res == FR_OK) {
+		ftp_journal_add(FTP_JOURNAL_RENAME, ftp->path_rename, ftp->path);
+	} else if (stats.files > 0 || stats.dirs > 0) {
+		// a move between volumes stopped half way, both trees changed
+		ftp_journal_add(FTP_JOURNAL_COPY, ftp->path, NULL);
+		ftp_journal_add(FTP_JOURNAL_RMTREE, ftp->path_rename, NULL);
+	}
+#endif
+
+	if (res == FR_OK && !reply.started)
+		ftp_send(ftp, "250 File successfully renamed or moved\r\n");
+	else
+		ftp_tree_done(&reply, res, &stats);
+#else
+#if FTP_SPACE == 1
+	// what is moved, the directory usage follows it
+	if (ftps_f_stat(ftp->path_rename, &xfer->finfo) != FR_OK)
+		xfer->finfo.fattrib = AM_DIR;
+#endif
+
 	// rename went ok?
 	if (ftps_f_rename(ftp->path_rename, ftp->path) != FR_OK) {
 		ftp_send(ftp, "451 Rename/move failure\r\n");
 	}
 	else {
+#if FTP_SPACE == 1
+		ftp_space_rename(ftp->path_rename, ftp->path, &xfer->finfo);
+#endif
+		FTP_JOURNAL_ADD(FTP_JOURNAL_RENAME, ftp->path_rename, ftp->path);
 		ftp_send(ftp, "250 File successfully renamed or moved\r\n");
 	}
+#endif
+
+	// rename is done, free the origin path
+	ftp_rename_release(ftp);
 
 	// remove file name from path
 	path_up_a_level(ftp->path);
 }
 
+// features that are compiled in
+#if FTP_RATE_LIMIT == 1
+#define FTP_FEAT_RATE			" SITE RATE\r\n"
+#else
+#define FTP_FEAT_RATE			""
+#endif
+#if FTP_STATS == 1
+#define FTP_FEAT_STATS			" SITE STATS\r\n"
+#else
+#define FTP_FEAT_STATS			""
+#endif
+
 static void ftp_cmd_feat(ftp_data_t *ftp) {
 	// are we not yet logged in?
 	if (!FTP_IS_LOGGED_IN(ftp))
 		return;
 
 	// print features
-	ftp_send(ftp, "211 Extensions supported:\r\n MDTM\r\n MLSD\r\n SIZE\r\n SITE FREE\r\n211 End.\r\n");
+	ftp_send(ftp, "211 Extensions supported:\r\n MDTM\r\n MLSD\r\n SIZE\r\n SITE FREE\r\n" FTP_FEAT_RATE FTP_FEAT_STATS "211 End.\r\n");
 }
 
 static void ftp_cmd_syst(ftp_data_t *ftp) {
@@ -1287,12 +2363,16 @@ static void ftp_cmd_mdtm(ftp_data_t *ftp) {
 		ftp_send(ftp, "501 No file name\r\n");
 	}
 
-	if (!path_build(ftp->path, fname)) {
-		ftp_send(ftp, "500 Command line too long\r\n");
+	// get file system state
+	ftp_xfer_t *xfer = ftp_xfer_get(ftp, 0);
+	if (xfer == NULL)
+		return;
+
+	if (!path_build_param(ftp, ftp->path, fname)) {
 		return;
 	}
 
-	if (ftps_f_stat(ftp->path, &ftp->finfo) != FR_OK) {
+	if (ftps_f_stat(ftp->path, &xfer->finfo) != FR_OK) {
 		// go up a level again
 		path_up_a_level(ftp->path);
 
@@ -1303,21 +2383,23 @@ static void ftp_cmd_mdtm(ftp_data_t *ftp) {
 		return;
 	}
 
-	// go up a level again
-	path_up_a_level(ftp->path);
-
 	if (!gettime) {
 		char date_str[64];
-		ftp_send(ftp, "213 %s\r\n", data_time_to_str(date_str, ftp->finfo.fdate, ftp->finfo.ftime));
-		return;
+		ftp_send(ftp, "213 %s\r\n", data_time_to_str(date_str, xfer->finfo.fdate, xfer->finfo.ftime));
+	} else {
+		// the time goes to the file, before the name leaves the path
+		xfer->finfo.fdate = date;
+		xfer->finfo.ftime = time;
+		if (ftps_f_utime(ftp->path, &xfer->finfo) == FR_OK) {
+			FTP_JOURNAL_ADD(FTP_JOURNAL_MDTM, ftp->path, NULL);
+			ftp_send(ftp, "200 Ok\r\n");
+		} else {
+			ftp_send(ftp, "550 Unable to modify time\r\n");
+		}
 	}
 
-	ftp->finfo.fdate = date;
-	ftp->finfo.ftime = time;
-	if (ftps_f_utime(ftp->path, &ftp->finfo) == FR_OK)
-		ftp_send(ftp, "200 Ok\r\n");
-	else
-		ftp_send(ftp, "550 Unable to modify time\r\n");
+	// go up a level again
+	path_up_a_level(ftp->path);
 }
 
 static void ftp_cmd_size(ftp_data_t *ftp) {
@@ -1330,35 +2412,399 @@ static void ftp_cmd_size(ftp_data_t *ftp) {
 		return;
 	}
 
-	if (!path_build(ftp->path, ftp->parameters)) {
-		ftp_send(ftp, "500 Command line too long\r\n");
+	// get file system state
+	ftp_xfer_t *xfer = ftp_xfer_get(ftp, 0);
+	if (xfer == NULL)
+		return;
+
+	if (!path_build_param(ftp, ftp->path, ftp->parameters)) {
 		return;
 	}
 
-	if (ftps_f_stat(ftp->path, &ftp->finfo) != FR_OK || (ftp->finfo.fattrib & AM_DIR)) {
+	if (ftps_f_stat(ftp->path, &xfer->finfo) != FR_OK || (xfer->finfo.fattrib & AM_DIR)) {
 		// send error to client
 		ftp_send(ftp, "550 No such file\r\n");
 	}
 	else {
-		ftp_send(ftp, "213 %lu\r\n", ftp->finfo.fsize);
-		ftps_f_close(&ftp->file);
+		ftp_send(ftp, "213 %lu\r\n", xfer->finfo.fsize);
+	}
+
+	// go up a level again
+	path_up_a_level(ftp->path);
+}
+
+#if FTP_CACHE == 1
+// SITE PREFETCH <file>, read a file into the RAM cache
+static void ftp_site_prefetch(ftp_data_t *ftp, char *fname) {
+	uint32_t len;
+	FRESULT res;
+
+	// get file system state
+	ftp_xfer_t *xfer = ftp_xfer_get(ftp, 1);
+	if (xfer == NULL)
+		return;
+
+	// can we create a valid path from the parameter?
+	if (!path_build_param(ftp, ftp->path, fname)) {
+		return;
+	}
+
+	// is it a file?
+	if (ftps_f_stat(ftp->path, &xfer->finfo) != FR_OK || (xfer->finfo.fattrib & AM_DIR)) {
+		path_up_a_level(ftp->path);
+		ftp_send(ftp, "550 File %s not found\r\n", fname);
+		return;
+	}
+
+	// can we open the file?
+	if (data_file_open(ftp, xfer) != FR_OK) {
+		path_up_a_level(ftp->path);
+		ftp_send(ftp, "450 Can't open %s\r\n", fname);
+		return;
+	}
+
+	if (xfer->cache_hit) {
+		// nothing to do
+		ftp_send(ftp, "200 %s is cached\r\n", fname);
+	} else if (xfer->cache == NULL) {
+		// too large or all room in use
+		ftp_send(ftp, "552 No room for %s in the cache\r\n", fname);
+	} else {
+		// read it all, the reads fill the cache
+		do {
+			res = data_file_read(ftp, xfer, xfer->buf[0], FTP_DATA_BUF_SIZE, &len);
+		} while (res == FR_OK && len > 0);
+
+		if (res == FR_OK && xfer->cache_fill == xfer->cache->size)
+			ftp_send(ftp, "200 Cached %s, %lu bytes\r\n", fname, (unsigned long) xfer->cache_fill);
+		else
+			ftp_send(ftp, "451 Can't read %s\r\n", fname);
 	}
 
+	// close file, this makes the copy visible
+	data_file_close(ftp, xfer, 1);
+
 	// go up a level again
 	path_up_a_level(ftp->path);
 }
 
+// SITE CACHE, what the RAM cache holds and how well it does
+static void ftp_site_cache(ftp_data_t *ftp) {
+	ftp_cache_stats_t stats;
+	ftp_cache_get_stats(&stats);
+
+	uint32_t lookups = stats.hits + stats.misses;
+	ftp_send(ftp, "211-Cache %u files, %lu of %lu bytes\r\n", stats.entries, (unsigned long) stats.bytes_used, (unsigned long) FTP_CACHE_BYTES);
+	ftp_send(ftp, " hits %lu misses %lu, %lu%% hit rate, %lu bytes from RAM\r\n", (unsigned long) stats.hits, (unsigned long) stats.misses,
+			(unsigned long) (lookups ? (uint64_t) stats.hits * 100 / lookups : 0), (unsigned long) stats.bytes_served);
+	ftp_send(ftp, "211 %lu added, %lu evicted, %lu invalidated\r\n", (unsigned long) stats.fills, (unsigned long) stats.evictions,
+			(unsigned long) stats.invalidations);
+}
+#endif
+
+#if FTP_SPACE == 1
+// SITE FREE from the counters in RAM, the volumes are not touched. The
+// usage of the directories below the roots follows.
+static void ftp_site_free(ftp_data_t *ftp) {
+	ftp_space_volume_t vol;
+	ftp_space_dir_t dir;
+
+	ftp_send(ftp, "211-Free space%s\r\n", ftp_space_scanning() ? ", scan running" : "");
+	for (uint8_t i = 0; ftp_space_get(i, &vol) == 0; i++) {
+#if FTP_FS_BACKENDS == 1
+		const ftp_fs_t *fs;
+		const char *prefix = ftp_fs_mount_get(i, &fs);
+		const char *name = fs->name;
+#else
+		const char *prefix = "/";
+		const char *name = "fatfs";
+#endif
+		if (vol.valid)
+			ftp_send(ftp, " %s (%s) %lu MB free of %lu MB capacity\r\n", prefix, name, (unsigned long) (vol.free >> 20),
+					(unsigned long) (vol.total >> 20));
+		else
+			ftp_send(ftp, " %s (%s) not known yet\r\n", prefix, name);
+	}
+	for (uint8_t i = 0; ftp_space_dir_get(i, &dir) == 0; i++)
+		if (dir.path[0] != 0)
+			ftp_send(ftp, " %s %lu KB used\r\n", dir.path, (unsigned long) (dir.bytes >> 10));
+	ftp_send(ftp, "211 End\r\n");
+}
+#else
+// SITE FREE, free space of the volume or of every mount
+static void ftp_site_free(ftp_data_t *ftp) {
+	uint64_t free, total;
+	uint32_t unit;
+
+#if FTP_FS_BACKENDS == 1
+	const ftp_fs_t *fs;
+	const char *prefix;
+
+	ftp_send(ftp, "211-Free space\r\n");
+	for (uint8_t i = 0; (prefix = ftp_fs_mount_get(i, &fs)) != NULL; i++) {
+		if (ftps_f_getfree(prefix, &free, &total, &unit) == FR_OK)
+			ftp_send(ftp, " %s (%s) %lu MB free of %lu MB capacity\r\n", prefix, fs->name, (unsigned long) (free >> 20),
+					(unsigned long) (total >> 20));
+		else
+			ftp_send(ftp, " %s (%s) not available\r\n", prefix, fs->name);
+	}
+	ftp_send(ftp, "211 End\r\n");
+#else
+	if (ftps_f_getfree("/", &free, &total, &unit) == FR_OK)
+		ftp_send(ftp, "211 %lu MB free of %lu MB capacity\r\n", (unsigned long) (free >> 20), (unsigned long) (total >> 20));
+	else
+		ftp_send(ftp, "550 Can't get free space\r\n");
+#endif
+}
+#endif
+
+#if FTP_JOURNAL == 1
+// SITE CHANGES [<token>], what changed since the token. Without one
+// only the token of now is sent. The last line holds the token to ask
+// with next time, the epoch and the sequence number with a '.' between.
+static void ftp_site_changes(ftp_data_t *ftp, char *token) {
+	ftp_journal_token_t after, now;
+	char *end;
+	int res = -1;
+
+	after.epoch = strtoul(token, &end, 10);
+
+	// no token, the client starts from here
+	if (end == token) {
+		ftp_journal_token(&now);
+		ftp_send(ftp, "211 Token %lu.%lu\r\n", (unsigned long) now.epoch, (unsigned long) now.seq);
+		return;
+	}
+
+	ftp_journal_entry_t *entry = pvPortMalloc(sizeof(ftp_journal_entry_t));
+	if (entry == NULL) {
+		ftp_send(ftp, "451 Out of memory\r\n");
+		return;
+	}
+
+	// a token without an epoch can't be trusted
+	if (*end == '.') {
+		after.seq = strtoul(end + 1, NULL, 10);
+		res = ftp_journal_next(&after, entry);
+	}
+
+	if (res < 0) {
+		// changes were dropped, the client has to list everything again
+		ftp_journal_token(&now);
+		ftp_send(ftp, "211-Resync required\r\n211 Token %lu.%lu\r\n", (unsigned long) now.epoch, (unsigned long) now.seq);
+	} else {
+		ftp_send(ftp, "211-Changes since %lu.%lu\r\n", (unsigned long) after.epoch, (unsigned long) after.seq);
+		for (uint16_t n = 0; res > 0 && n < FTP_JOURNAL_REPLY_MAX; n++) {
+			if (entry->op == FTP_JOURNAL_RENAME) {
+				// the old and the new path of a rename
+				ftp_send(ftp, " Seq=%lu;Op=RNFR; %s\r\n", (unsigned long) entry->seq, entry->path);
+				ftp_send(ftp, " Seq=%lu;Op=RNTO; %s\r\n", (unsigned long) entry->seq, entry->path + strlen(entry->path) + 1);
+			} else {
+				ftp_send(ftp, " Seq=%lu;Op=%s; %s\r\n", (unsigned long) entry->seq, ftp_journal_op_name(entry->op), entry->path);
+			}
+
+			after.seq = entry->seq;
+			res = ftp_journal_next(&after, entry);
+		}
+		ftp_send(ftp, "211 Token %lu.%lu\r\n", (unsigned long) after.epoch, (unsigned long) after.seq);
+	}
+
+	vPortFree(entry);
+}
+#endif
+
+#if FTP_TREE == 1
+// SITE CPTO, copy what SITE CPFR named on the device
+static void ftp_site_cpto(ftp_data_t *ftp, char *name) {
+	ftp_tree_reply_t reply;
+	ftp_tree_stats_t stats;
+
+	// is the origin known?
+	if (ftp->path_rename == NULL) {
+		ftp_send(ftp, "503 Need CPFR before CPTO\r\n");
+		return;
+	}
+
+	// can we build a path with the specified name?
+	if (!path_build_param(ftp, ftp->path, name)) {
+		return;
+	}
+
+	// feedback
+	DEBUG_PRINT(ftp, "Copying %s to %s\r\n", ftp->path_rename, ftp->path);
+
+	// copy at the priority of a transfer
+	ftp_tree_reply_init(ftp, &reply, "Copied");
+	data_con_bulk(ftp, 1);
+	FRESULT res = ftp_tree_copy(ftp->path_rename, ftp->path, ftp_tree_progress, &reply, &stats);
+	data_con_bulk(ftp, 0);
+	ftp_tree_done(&reply, res, &stats);
+
+#if FTP_JOURNAL == 1
+	// a failed copy leaves what was copied so far
+	if (stats.files > 0 || stats.dirs > 0)
+		ftp_journal_add(FTP_JOURNAL_COPY, ftp->path, NULL);
+#endif
+
+	// copy is done, free the origin path
+	ftp_rename_release(ftp);
+
+	// remove the name from the path
+	path_up_a_level(ftp->path);
+}
+
+// SITE RMDIR, remove a directory with everything in it
+static void ftp_site_rmdir(ftp_data_t *ftp, char *name) {
+	ftp_tree_reply_t reply;
+	ftp_tree_stats_t stats;
+
+	// can we build a path with the specified name?
+	if (!path_build_param(ftp, ftp->path, name)) {
+		return;
+	}
+
+	// feedback
+	DEBUG_PRINT(ftp, "Removing %s\r\n", ftp->path);
+
+	ftp_tree_reply_init(ftp, &reply, "Removed");
+	data_con_bulk(ftp, 1);
+	FRESULT res = ftp_tree_remove(ftp->path, ftp_tree_progress, &reply, &stats);
+	data_con_bulk(ftp, 0);
+	ftp_tree_done(&reply, res, &stats);
+
+#if FTP_JOURNAL == 1
+	// a failed removal leaves what was not removed yet
+	if (stats.files > 0 || stats.dirs > 0)
+		ftp_journal_add(FTP_JOURNAL_RMTREE, ftp->path, NULL);
+#endif
+
+	// remove the name from the path
+	path_up_a_level(ftp->path);
+}
+#endif
+
+#if FTP_STATS == 1
+static void ftp_site_stats(ftp_data_t *ftp);
+#endif
+
 static void ftp_cmd_site(ftp_data_t *ftp) {
 	// are we not yet logged in?
 	if (!FTP_IS_LOGGED_IN(ftp))
 		return;
 
 	if (!strcmp(ftp->parameters, "FREE")) {
-		FATFS * fs;
-		uint32_t free_clust;
-		ftps_f_getfree("0:", &free_clust, &fs);
-		ftp_send(ftp, "211 %lu MB free of %lu MB capacity\r\n", free_clust * fs->csize >> 11, (fs->n_fatent - 2) * fs->csize >> 11);
+		ftp_site_free(ftp);
+	}
+#if FTP_SPACE == 1
+	// SITE FREE RESCAN, count the free space again in the background
+	else if (!strcmp(ftp->parameters, "FREE RESCAN")) {
+		ftp_space_rescan();
+		ftp_send(ftp, "200 Rescan started\r\n");
+	}
+#endif
+#if FTP_JOURNAL == 1
+	// SITE CHANGES [<token>]
+	else if (!strncmp(ftp->parameters, "CHANGES", 7) && (ftp->parameters[7] == 0 || ftp->parameters[7] == ' ')) {
+		ftp_site_changes(ftp, ftp->parameters + 7);
+	}
+#endif
+#if FTP_TREE == 1
+	// SITE CPFR <path>, origin of a copy on the device, kept like RNFR
+	else if (!strncmp(ftp->parameters, "CPFR ", 5)) {
+		if (ftp_origin_set(ftp, ftp->parameters + 5))
+			ftp_send(ftp, "350 CPFR accepted - file exists, ready for destination\r\n");
+	}
+	// SITE CPTO <path>
+	else if (!strncmp(ftp->parameters, "CPTO ", 5)) {
+		ftp_site_cpto(ftp, ftp->parameters + 5);
+	}
+	// SITE RMDIR <path>, recursive
+	else if (!strncmp(ftp->parameters, "RMDIR ", 6)) {
+		ftp_site_rmdir(ftp, ftp->parameters + 6);
+	}
+#endif
+#if FTP_RATE_LIMIT == 1
+	// SITE RATE [<session bytes/s>], a session can only slow itself down.
+	// The global rate and the default are set by the application.
+	else if (!strncmp(ftp->parameters, "RATE", 4) && (ftp->parameters[4] == 0 || ftp->parameters[4] == ' ')) {
+		char *p = ftp->parameters + 4;
+		char *end;
+
+		// new session rate given?
+		uint32_t rate = strtoul(p, &end, 10);
+		if (end != p) {
+			// not above the default, 0 is unlimited
+			uint32_t max = ftp_rate_get_session_default();
+			if (max > 0 && (rate == 0 || rate > max))
+				rate = max;
+			ftp_rate_set(&ftp->rate, rate);
+		}
+
+		// report the limits, 0 is unlimited
+		ftp_send(ftp, "200 Rate %lu B/s for this session, %lu B/s global\r\n", (unsigned long) ftp->rate.rate,
+				(unsigned long) ftp_rate_get_global());
+	}
+#endif
+#if FTP_STATS == 1
+	else if (!strcmp(ftp->parameters, "STATS")) {
+		ftp_site_stats(ftp);
+	}
+#endif
+#if FTP_CACHE == 1
+	else if (!strncmp(ftp->parameters, "PREFETCH ", 9)) {
+		ftp_site_prefetch(ftp, ftp->parameters + 9);
+	}
+	else if (!strcmp(ftp->parameters, "CACHE")) {
+		ftp_site_cache(ftp);
+	}
+#endif
+#if FTP_DINDEX == 1
+	// SITE DINDEX, how many stat calls the directory indexes answered
+	else if (!strcmp(ftp->parameters, "DINDEX")) {
+		ftp_dindex_stats_t stats;
+		ftp_dindex_get_stats(&stats);
+		ftp_send(ftp, "211 %u directories in %lu of %lu bytes, %lu of %lu lookups from RAM, %lu read, %lu dropped\r\n", stats.dirs,
+				(unsigned long) stats.bytes_used, (unsigned long) FTP_DINDEX_BYTES, (unsigned long) stats.hits,
+				(unsigned long) (stats.hits + stats.misses), (unsigned long) stats.builds, (unsigned long) stats.drops);
+	}
+#endif
+#if FTP_BCACHE == 1
+	// SITE BCACHE, how many device reads the sector cache saved
+	else if (!strcmp(ftp->parameters, "BCACHE")) {
+		ftp_bcache_stats_t stats;
+		ftp_bcache_get_stats(&stats);
+		ftp_send(ftp, "211 %lu of %lu reads from cache, %lu of %lu sectors, %lu device reads, %lu read ahead, %u FAT/dir sectors\r\n",
+				(unsigned long) stats.hits, (unsigned long) stats.reads, (unsigned long) stats.sectors_hit, (unsigned long) stats.sectors,
+				(unsigned long) stats.device_reads, (unsigned long) stats.readaheads, stats.meta_blocks);
+	}
+#endif
+#if FTP_SHARE == 1
+	// SITE SHARE, how much reading the shared streams saved
+	else if (!strcmp(ftp->parameters, "SHARE")) {
+		ftp_share_stats_t stats;
+		ftp_share_get_stats(&stats);
+		ftp_send(ftp, "211 %lu streams, %lu joins, %lu fell behind, %lu chunks read for %lu sent\r\n", (unsigned long) stats.streams,
+				(unsigned long) stats.joins, (unsigned long) stats.detaches, (unsigned long) stats.chunks_read, (unsigned long) stats.chunks_served);
+	}
+#endif
+#if FTP_SPAN_TRACE == 1
+	// SITE TRACE <file>, write the recorded spans as a Chrome trace
+	else if (!strncmp(ftp->parameters, "TRACE ", 6)) {
+		// the file name is relative to the working directory
+		char *fname = ftp->parameters + 6;
+		if (!path_build_param(ftp, ftp->path, fname)) {
+			return;
+		}
+
+		if (ftp_span_dump_file(ftp->path) == 0)
+			ftp_send(ftp, "200 Trace written to %s\r\n", fname);
+		else
+			ftp_send(ftp, "550 Can't write %s\r\n", fname);
+
+		// go up a level again
+		path_up_a_level(ftp->path);
 	}
+#endif
 	else {
 		ftp_send(ftp, "550 Unknown SITE command %s\r\n", ftp->parameters);
 	}
@@ -1449,28 +2895,202 @@ static ftp_cmd_t ftpd_commands[] = { //
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//			process a command
+//			statistics
 //
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static uint8_t ftp_process_command(ftp_data_t *ftp) {
-	// quit command given?
-	if (!strcmp(ftp->command, "QUIT"))
-		return 0;
+#if FTP_STATS == 1
+// Print the non empty buckets of a histogram as one reply line
+static void ftp_send_hist(ftp_data_t *ftp, const char *name, const ftp_hist_t *hist) {
+	char line[FTP_BUF_SIZE];
+	int len = snprintf(line, sizeof(line), " %s us", name);
+
+	for (uint8_t i = 0; i < FTP_STATS_BUCKETS && len < (int) sizeof(line); i++) {
+		// skip empty buckets
+		if (hist->bucket[i] == 0)
+			continue;
+
+		// last bucket has no upper limit
+		if (ftp_stats_hist_limit(i) == 0)
+			len += snprintf(line + len, sizeof(line) - len, " >=%lu:%lu", (unsigned long) ftp_stats_hist_limit(i - 1), (unsigned long) hist->bucket[i]);
+		else
+			len += snprintf(line + len, sizeof(line) - len, " <%lu:%lu", (unsigned long) ftp_stats_hist_limit(i), (unsigned long) hist->bucket[i]);
+	}
+
+	ftp_send(ftp, "%s\r\n", line);
+}
+
+// Heap, stack and lwIP pool use as SITE STATS lines
+static void ftp_site_resources(ftp_data_t *ftp) {
+	ftp_resources_t res;
+	ftp_get_resources(&res);
+
+	ftp_send(ftp, " heap free %lu min %lu, %d sessions\r\n", (unsigned long) res.heap_free, (unsigned long) res.heap_min_free, res.sessions);
+	for (uint8_t i = 0; i < FTP_NBR_CLIENTS; i++)
+		ftp_send(ftp, " stack ftp_task_%d min free %lu of %d words\r\n", i, (unsigned long) res.stack_min_free[i], FTP_TASK_STACK_SIZE);
+
+	// stack size for the commands seen so far
+	uint32_t worst;
+	uint32_t recommend = ftp_stats_stack_recommend(&worst);
+	if (recommend > 0)
+		ftp_send(ftp, " stack worst command %lu words, recommended FTP_TASK_STACK_SIZE %lu%s\r\n", (unsigned long) worst,
+				(unsigned long) recommend, FTP_STATS_STACK_PAINT ? "" : " (high-water, build with FTP_STATS_STACK_PAINT to calibrate)");
+
+#if LWIP_STATS && MEMP_STATS
+	// pools that are in use or ran out
+	for (uint16_t i = 0; i < MEMP_MAX; i++) {
+		const struct stats_mem *memp = lwip_stats.memp[i];
+		if (memp == NULL || (memp->max == 0 && memp->err == 0))
+			continue;
+		ftp_send(ftp, " memp %s used %u max %u of %u err %u\r\n", memp->name, memp->used, memp->max, memp->avail, memp->err);
+	}
+#endif
+}
+
+// SITE STATS, totals of all sessions, the counters of each running
+// session and latency per command
+static void ftp_site_stats(ftp_data_t *ftp) {
+	ftp_stats_t stats;
+	ftp_cmd_stats_t cmd_stats;
+	ftp_admission_stats_t adm;
+
+	// collect
+	ftp_stats_get(&stats);
+	ftp_get_admission_stats(&adm);
+
+	// totals
+	ftp_send(ftp, "211-FTP statistics\r\n");
+	ftp_send(ftp, " clients admitted %lu queued %lu evicted %lu rejected %lu\r\n", (unsigned long) adm.admitted, (unsigned long) adm.queued,
+			(unsigned long) adm.evicted, (unsigned long) adm.rejected);
+	ftp_send(ftp, " out %lu transfers %lu bytes %lu KB/s\r\n", (unsigned long) stats.xfers_out, (unsigned long) stats.bytes_out,
+			stats.xfer_out_us ? (unsigned long) (stats.bytes_out * 1000 / stats.xfer_out_us) : 0);
+	ftp_send(ftp, " in %lu transfers %lu bytes %lu KB/s\r\n", (unsigned long) stats.xfers_in, (unsigned long) stats.bytes_in,
+			stats.xfer_in_us ? (unsigned long) (stats.bytes_in * 1000 / stats.xfer_in_us) : 0);
+
+	// memory
+	ftp_site_resources(ftp);
+
+	// latency
+	ftp_send_hist(ftp, "fs_read", &stats.fs_read);
+	ftp_send_hist(ftp, "fs_write", &stats.fs_write);
+	ftp_send_hist(ftp, "net_write", &stats.net_write);
+
+	// running sessions, this reuses stats
+	for (uint8_t i = 0; i < FTP_NBR_CLIENTS; i++) {
+		if (ftp_stats_get_session(i, &stats) != 0)
+			continue;
+		ftp_send(ftp, " session %d%s out %lu transfers %lu bytes, in %lu transfers %lu bytes\r\n", i, i == ftp->ftp_con_num ? " (this)" : "",
+				(unsigned long) stats.xfers_out, (unsigned long) stats.bytes_out, (unsigned long) stats.xfers_in, (unsigned long) stats.bytes_in);
+	}
+
+	// per command, only those that were used
+	for (uint8_t i = 0; ftpd_commands[i].cmd != NULL && i < FTP_STATS_COMMANDS - 1; i++) {
+		ftp_stats_get_command(i, &cmd_stats);
+		if (cmd_stats.count == 0)
+			continue;
+		ftp_send(ftp, " %s count %lu avg %lu us max %lu us stack %lu words\r\n", ftpd_commands[i].cmd, (unsigned long) cmd_stats.count,
+				(unsigned long) (cmd_stats.total_us / cmd_stats.count), (unsigned long) cmd_stats.max_us, (unsigned long) cmd_stats.stack_max);
+		ftp_send_hist(ftp, ftpd_commands[i].cmd, &cmd_stats.hist);
+	}
+
+	ftp_send(ftp, "211 End\r\n");
+}
+#endif
+
+#if FTP_STATS == 1
+// the value FreeRTOS fills a new stack with
+#define FTP_STACK_FILL		0xa5a5a5a5
+
+// words left alone below the current frame when painting, the painter's
+// own frame and an exception frame must fit
+#define FTP_STACK_PAINT_MARGIN	64
+
+// Paint the free stack of the session, so ftp_stack_used sees how deep
+// the next command goes
+static void ftp_stack_paint(ftp_data_t *ftp) {
+#if FTP_STATS_STACK_PAINT == 1 && portSTACK_GROWTH < 0
+	StackType_t here;
+	StackType_t *top = &here - FTP_STACK_PAINT_MARGIN;
+
+	// not on the session stack?
+	if (top <= ftp->stack || top >= ftp->stack + FTP_TASK_STACK_SIZE)
+		return;
+
+	// the stack grows down, the free part is at the start of the array
+	for (StackType_t *p = ftp->stack; p < top; p++)
+		*p = FTP_STACK_FILL;
+#else
+	(void) ftp;
+#endif
+}
+
+// Stack words the session used, since the last paint or since it started
+static uint32_t ftp_stack_used(ftp_data_t *ftp) {
+#if FTP_STATS_STACK_PAINT == 1 && portSTACK_GROWTH < 0
+	// first word the paint is gone from
+	uint32_t i = 0;
+	while (i < FTP_TASK_STACK_SIZE && ftp->stack[i] == FTP_STACK_FILL)
+		i++;
+	return FTP_TASK_STACK_SIZE - i;
+#else
+	(void) ftp;
+	return FTP_TASK_STACK_SIZE - uxTaskGetStackHighWaterMark(NULL);
+#endif
+}
+#endif
+
+int ftp_get_command_stats(const char *cmd, ftp_cmd_stats_t *stats) {
+	for (uint8_t i = 0; ftpd_commands[i].cmd != NULL; i++) {
+		if (!strcmp(ftpd_commands[i].cmd, cmd)) {
+			ftp_stats_get_command(i, stats);
+			return 0;
+		}
+	}
+	return -1;
+}
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//			process a command
+//
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Find a command in the table, the end of the table if it is unknown
+static ftp_cmd_t *ftp_find_command(const char *command) {
 	// command pointer
 	ftp_cmd_t *cmd = ftpd_commands;
 
 	// loop through all known commands
 	while (cmd->cmd != NULL && cmd->func != NULL) {
-		// is this the expected command?
-		if (!strcmp(cmd->cmd, ftp->command))
+		// is this the expected command? the first character rules
+		// out most of the table without a call
+		if (cmd->cmd[0] == command[0] && !strcmp(cmd->cmd, command))
 			break;
 
 		// increment
 		cmd++;
 	}
 
+	return cmd;
+}
+
+static uint8_t ftp_process_command(ftp_data_t *ftp) {
+	// quit command given?
+	if (!strcmp(ftp->command, "QUIT"))
+		return 0;
+
+	// look up the command
+	ftp_cmd_t *cmd = ftp_find_command(ftp->command);
+
+#if FTP_STATS == 1
+	// measure how deep this command goes
+	ftp_stack_paint(ftp);
+#endif
+
+	// time the command
+	uint32_t start = ftp_time_us();
+	FTP_SPAN_BEGIN(span);
+
 	// did we find a command?
 	if (cmd->cmd != NULL && cmd->func != NULL)
 		cmd->func(ftp);
@@ -1478,6 +3098,23 @@ static uint8_t ftp_process_command(ftp_data_t *ftp) {
 	else
 		ftp_send(ftp, "500 Unknown command\r\n");
 
+#if FTP_SPAN_TRACE == 1
+	// the command characters, as they are in memory
+	uint32_t cmd_word;
+	memcpy(&cmd_word, ftp->command, sizeof(cmd_word));
+	FTP_SPAN_END(span, FTP_SPAN_COMMAND, cmd_word);
+#endif
+
+#if FTP_STATS == 1
+	// count the latency and stack, unknown commands end up in the last entry
+	ftp_stats_command(cmd - ftpd_commands, ftp_time_us() - start, ftp_stack_used(ftp));
+#else
+	(void) start;
+#endif
+
+	// the command is done with its files, free the file system state
+	ftp_xfer_release(ftp);
+
 	// ftp is still running
 	return 1;
 }
@@ -1494,19 +3131,25 @@ void ftp_service(struct netconn *ctrlcn, ftp_data_t *ftp) {
 
 	// reset the working directory to root
 	strncpy(ftp->path, "/", FTP_CWD_SIZE);
-	memset(ftp->path_rename, 0, FTP_CWD_SIZE);
 
 	// variables initialization
 	ftp->ctrlconn = ctrlcn;
+	ftp->xfer = NULL;
+	ftp->path_rename = NULL;
+	ftp->at_prompt = 0;
 	ftp->listdataconn = NULL;
 	ftp->dataconn = NULL;
 	ftp->data_port = 0;
+	ftp->pasv_port = 0;
+#if FTP_STATS == 1
+	ftp_stats_session_begin(ftp->ftp_con_num, &ftp->stats);
+#endif
+#if FTP_RATE_LIMIT == 1
+	ftp_rate_set(&ftp->rate, ftp_rate_get_session_default());
+#endif
 	ftp->data_conn_mode = DCM_NOT_SET;
 	ftp->user = FTP_USER_NONE;
 
-	// bugfix which works around ports which are already in use (from a previous connection)
-	ftp->data_port_incremented = (ftp->data_port_incremented + 1) % PORT_INCREMENT_OFFSET;
-
 	//  Get the local and peer IP
 	netconn_addr(ftp->ctrlconn, &ftp->ipserver, &dummy);
 	netconn_peer(ftp->ctrlconn, &ippeer, &dummy);
@@ -1515,11 +3158,15 @@ void ftp_service(struct netconn *ctrlcn, ftp_data_t *ftp) {
 	ftp_send(ftp, "220 -> CMS FTP Server, FTP Version %s\r\n", FTP_VERSION);
 
 	// feedback
-	DEBUG_PRINT(ftp, "Client connected!\r\n");
+	FTP_TRACE_INFO(ftp->ftp_con_num, FTP_EV_CONNECT, ippeer.addr, 0);
 
 	// Set disconnection timeout to one second
 	netconn_set_recvtimeout(ftp->ctrlconn, 1000);
 
+	// replies are complete messages, send them right away
+	if (ftp_ctrl_nodelay)
+		pcb_call(ftp->ctrlconn, pcb_set_nodelay);
+
 	// loop until quit command
 	while (1) {
 		// Was there an error while receiving?
@@ -1546,8 +3193,17 @@ void ftp_service(struct netconn *ctrlcn, ftp_data_t *ftp) {
 	// Close the connections (to be sure)
 	data_con_close(ftp);
 
+	// free the memory that is only allocated on demand
+	ftp_xfer_release(ftp);
+	ftp_rename_release(ftp);
+
+#if FTP_STATS == 1
+	// keep the counters of this session in the totals
+	ftp_stats_session_end(&ftp->stats);
+#endif
+
 	// feedback
-	DEBUG_PRINT(ftp, "Client disconnected\r\n");
+	FTP_TRACE_INFO(ftp->ftp_con_num, FTP_EV_DISCONNECT, 0, 0);
 }
 
 void ftp_set_username(const char *name) {
@@ -1561,3 +3217,7 @@ void ftp_set_password(const char *pass) {
 		return;
 	ftp_user_pass = pass;
 }
+
+void ftp_set_ctrl_nodelay(uint8_t on) {
+	ftp_ctrl_nodelay = on;
+}
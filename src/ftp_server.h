@@ -9,7 +9,19 @@
 #define _FTP_SERVER_H_
 
 #include "ftp_file.h"
-#include "lwip.h"
+#include "ftp_rate.h"
+#include "ftp_stats.h"
+#include "ftp_log.h"
+#include "ftp_span.h"
+#include "ftp_cache.h"
+#include "ftp_share.h"
+#include "ftp_bcache.h"
+#include "ftp_space.h"
+#include "ftp_tree.h"
+#include "ftp_walk.h"
+#include "ftp_journal.h"
+#include "ftp_dindex.h"
+#include "ftp_port.h"
 
 // version number
 #define FTP_VERSION				"2020-08-20"
@@ -33,12 +45,24 @@
 // size of file buffer for reading a file
 #define FTP_BUF_SIZE			512
 
+// LIST -R and MLSD -R list a whole tree in one data connection, 0
+// compiles it out
+#ifndef FTP_LIST_RECURSIVE
+#define FTP_LIST_RECURSIVE		0
+#endif
+
+// size of each of the two data connection buffers, a multiple of the
+// sector size lets FatFs transfer whole sectors straight to the buffer
+#define FTP_DATA_BUF_SIZE		1024
+
+// disable Nagle on the control connection, so a reply is not held
+// back until the previous one is acknowledged. Default of
+// ftp_set_ctrl_nodelay.
+#define FTP_CTRL_NODELAY		1
+
 // Use passive mode or not
 #define USE_PASSIVE_MODE		1
 
-// used for a bugfix which works around ports which are already in use (from a previous connection)
-#define PORT_INCREMENT_OFFSET	25
-
 // Data Connection mode enumeration typedef
 typedef enum {
 	DCM_NOT_SET,
@@ -53,52 +77,115 @@ typedef enum {
 	FTP_USER_USER_LOGGED_IN
 } ftp_user_t;
 
+/**
+ * File system state that is only needed while a command works on a
+ * file or directory. It is allocated on demand by the command handlers
+ * and released as soon as the command returns, so a session that sits
+ * idle at the prompt does not carry the FatFs sector buffer around.
+ */
+typedef struct {
+	ftp_file_t file;
+	ftp_dir_t dir;
+	FILINFO finfo;
+
+	// data connection buffers, two so the disk can be read while
+	// TCP is still sending the previous block. Only commands that use
+	// the data connection get them, right after this structure.
+	uint8_t *buf[2];
+
+	// bytes queued in buf[0] for listings
+	uint16_t fill;
+
+#if FTP_CACHE == 1
+	// cached copy the file is sent from, or that is filled while the
+	// file is read, and the bytes filled so far
+	ftp_cache_entry_t *cache;
+	uint8_t cache_hit;
+	uint32_t cache_fill;
+#endif
+
+#if FTP_SHARE == 1
+	// reader of a large file, shares a stream with other sessions
+	ftp_share_reader_t share;
+#endif
+} ftp_xfer_t;
+
 /**
  * Structure that contains all variables used in FTP connection.
  * This is not nicely done since code is ported from C++ to C. The
  * C++ private object variables are listed inside this structure.
+ *
+ * The members are ordered by how often they are touched: the fields
+ * used for every command come first, the data connection state next
+ * and the large path buffers last.
  */
 typedef struct {
-	// sockets
-	struct netconn *listdataconn;
-	struct netconn *dataconn;
+	// control connection, used for every command
 	struct netconn *ctrlconn;
 	struct netbuf *inbuf;
 
+	// connection number
+	uint8_t ftp_con_num;
+
+	// state which tells which user is logged in (ftp_user_t)
+	uint8_t user;
+
+	// data connection mode state (dcm_type)
+	uint8_t data_conn_mode;
+
+	// set while waiting at the prompt for the next command
+	volatile uint8_t at_prompt;
+
+	// set by the server to reclaim this connection for a waiting client
+	volatile uint8_t evict;
+
+	// tick at which the session last went back to the prompt
+	TickType_t last_activity;
+
+	// buffer for command sent by client
+	char command[FTP_CMD_SIZE];
+
+	// data connection sockets
+	struct netconn *listdataconn;
+	struct netconn *dataconn;
+
+	// port of the data connection and of our passive listener
+	uint16_t data_port;
+	uint16_t pasv_port;
+
 	// ip addresses
 	ip4_addr_t ipclient;
 	ip4_addr_t ipserver;
 
-	// port
-	uint16_t data_port;
-	uint8_t data_port_incremented;
+#if FTP_RATE_LIMIT == 1
+	// bandwidth limit of this session
+	ftp_bucket_t rate;
+#endif
 
-	// file variables, not created on stack but static on boot
-	// to avoid overflow and ensure alignment in memory
-	FIL file;
-	FILINFO finfo;
-	char lfn[_MAX_LFN + 1];
+	// work done since the transfer last gave the CPU away
+	uint32_t budget_bytes;
+	TickType_t budget_start;
 
-	// buffer for command sent by client
-	char command[FTP_CMD_SIZE];
+#if FTP_STATS == 1
+	// transfer counters and latency of this session
+	ftp_stats_t stats;
+#endif
+#if FTP_STATS_STACK_PAINT == 1
+	// stack of the session task, for painting
+	StackType_t *stack;
+#endif
+
+	// file system state, only allocated while a command needs it
+	ftp_xfer_t *xfer;
+
+	// origin path for Rename command, only allocated between RNFR and RNTO
+	char *path_rename;
 
 	// buffer for parameters sent by client
 	char parameters[FTP_PARAM_SIZE];
 
-	// buffer for origin path for Rename command
-	char path_rename[FTP_CWD_SIZE];
-
 	// buffer for path that is currently used
 	char path[FTP_CWD_SIZE];
-
-	// connection mode (not set, active or passive)
-	uint8_t ftp_con_num;
-
-	// state which tells which user is logged in
-	ftp_user_t user;
-
-	// data connection mode state
-	dcm_type data_conn_mode;
 } ftp_data_t;
 
 // structure for ftp commands
@@ -115,10 +202,27 @@ typedef struct {
  */
 extern void ftp_service(struct netconn *ctrlcn, ftp_data_t *ftp);
 
+/**
+ * Get the latency statistics of a command.
+ *
+ * @param cmd Name of the command, e.g. "RETR"
+ * @param stats Structure the statistics are copied to
+ * @return 0 if the command is known, -1 if not
+ */
+extern int ftp_get_command_stats(const char *cmd, ftp_cmd_stats_t *stats);
+
 /**
  * Setter functions for username and password
  */
 extern void ftp_set_username(const char *name);
 extern void ftp_set_password(const char *pass);
 
+/**
+ * Disable Nagle on the control connection of new sessions, or leave it
+ * on. FTP_CTRL_NODELAY is the default.
+ *
+ * @param on 1 to send replies right away
+ */
+extern void ftp_set_ctrl_nodelay(uint8_t on);
+
 #endif /* ETH_FTP_FTP_SERVER_H_ */
@@ -0,0 +1,303 @@
+/*
+ * ftp_share.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ftp.h"
+#include "ftp_share.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include <string.h>
+
+#if FTP_SHARE == 1
+
+#if FTP_SHARE_CHUNK_SIZE != FTP_DATA_BUF_SIZE
+#error "FTP_SHARE_CHUNK_SIZE must be FTP_DATA_BUF_SIZE"
+#endif
+
+// results of reading through a stream
+#define FTP_SHARE_OK				0
+#define FTP_SHARE_BEHIND			1
+#define FTP_SHARE_ERROR				-1
+
+// registered readers and open streams, NULL is a free slot. The tables
+// are only touched with the scheduler suspended.
+static ftp_share_reader_t *ftp_share_readers[FTP_NBR_CLIENTS];
+static ftp_share_t *ftp_share_streams[FTP_SHARE_STREAMS];
+static uint8_t ftp_share_count = 0;
+
+// counters
+static ftp_share_stats_t ftp_share_stats;
+
+// does a reader read this file?
+static uint8_t ftp_share_same(const ftp_share_reader_t *reader, const char *path, uint32_t fsize, uint16_t fdate, uint16_t ftime) {
+	return reader->fsize == fsize && reader->fdate == fdate && reader->ftime == ftime && !strcmp(reader->path, path);
+}
+
+// can a stream hand out a chunk? The chunks in memory and the next one.
+static uint8_t ftp_share_covers(const ftp_share_t *share, uint32_t chunk) {
+	uint32_t low = share->next > share->first + FTP_SHARE_CHUNKS ? share->next - FTP_SHARE_CHUNKS : share->first;
+	return chunk >= low && chunk <= share->next;
+}
+
+// join a stream of the file that covers the chunk of the reader, call
+// with the scheduler suspended
+static void ftp_share_join(ftp_share_reader_t *reader) {
+	for (uint8_t i = 0; i < FTP_SHARE_STREAMS; i++) {
+		ftp_share_t *share = ftp_share_streams[i];
+		if (share != NULL && ftp_share_same(reader, share->path, share->fsize, share->fdate, share->ftime)
+				&& ftp_share_covers(share, reader->chunk)) {
+			share->readers++;
+			reader->share = share;
+			ftp_share_stats.joins++;
+			return;
+		}
+	}
+}
+
+// another reader of the file reading on its own, no more than
+// FTP_SHARE_CHUNKS away? Call with the scheduler suspended.
+static ftp_share_reader_t *ftp_share_near(const ftp_share_reader_t *reader) {
+	for (uint8_t i = 0; i < FTP_NBR_CLIENTS; i++) {
+		ftp_share_reader_t *other = ftp_share_readers[i];
+		if (other == NULL || other == reader || other->share != NULL
+				|| !ftp_share_same(reader, other->path, other->fsize, other->fdate, other->ftime))
+			continue;
+		if (other->chunk + FTP_SHARE_CHUNKS >= reader->chunk && reader->chunk + FTP_SHARE_CHUNKS >= other->chunk)
+			return other;
+	}
+	return NULL;
+}
+
+// close a stream nobody reads
+static void ftp_share_free(ftp_share_t *share) {
+	ftps_f_close(&share->file);
+	vSemaphoreDelete(share->lock);
+	vPortFree(share);
+}
+
+// open a stream at the chunk of the reader and join it
+static void ftp_share_open(ftp_share_reader_t *reader) {
+	ftp_share_t *share;
+	size_t path_len = strlen(reader->path) + 1;
+
+	// the stream, with the path behind it
+	share = pvPortMalloc(sizeof(ftp_share_t) + path_len);
+	if (share == NULL)
+		return;
+
+	share->lock = xSemaphoreCreateMutex();
+	if (share->lock == NULL) {
+		vPortFree(share);
+		return;
+	}
+
+	if (ftps_f_open(&share->file, reader->path, FA_READ) != FR_OK) {
+		vSemaphoreDelete(share->lock);
+		vPortFree(share);
+		return;
+	}
+
+	if (ftps_f_lseek(&share->file, (FSIZE_t) reader->chunk * FTP_SHARE_CHUNK_SIZE) != FR_OK) {
+		ftp_share_free(share);
+		return;
+	}
+
+	share->path = (char *) (share + 1);
+	memcpy(share->path, reader->path, path_len);
+	share->fsize = reader->fsize;
+	share->fdate = reader->fdate;
+	share->ftime = reader->ftime;
+	share->readers = 1;
+	share->first = reader->chunk;
+	share->next = reader->chunk;
+
+	// publish it, unless another session was quicker or all streams
+	// are in use
+	int slot = -1;
+	vTaskSuspendAll();
+	ftp_share_join(reader);
+	for (uint8_t i = 0; reader->share == NULL && slot < 0 && i < FTP_SHARE_STREAMS; i++) {
+		if (ftp_share_streams[i] == NULL)
+			slot = i;
+	}
+	if (slot >= 0) {
+		ftp_share_streams[slot] = share;
+		reader->share = share;
+		ftp_share_stats.streams++;
+	}
+	xTaskResumeAll();
+
+	// not used
+	if (slot < 0)
+		ftp_share_free(share);
+}
+
+// leave the stream, the last reader closes it
+static void ftp_share_leave(ftp_share_reader_t *reader) {
+	ftp_share_t *share = reader->share;
+	uint8_t last = 0;
+
+	vTaskSuspendAll();
+	reader->share = NULL;
+	if (--share->readers == 0) {
+		// nobody can join any more
+		for (uint8_t i = 0; i < FTP_SHARE_STREAMS; i++) {
+			if (ftp_share_streams[i] == share)
+				ftp_share_streams[i] = NULL;
+		}
+		last = 1;
+	}
+	xTaskResumeAll();
+
+	if (last)
+		ftp_share_free(share);
+
+	// the own file goes on where the stream was
+	reader->moved = 1;
+}
+
+// get a chunk out of a stream
+static int ftp_share_take(ftp_share_t *share, uint32_t chunk, void *buf, uint32_t *len) {
+	int ret = FTP_SHARE_OK;
+	uint32_t slot = chunk % FTP_SHARE_CHUNKS;
+
+	xSemaphoreTake(share->lock, portMAX_DELAY);
+
+	if (chunk == share->next) {
+		// first reader here, get it from the disk
+		if (ftps_f_read(&share->file, share->data[slot], FTP_SHARE_CHUNK_SIZE, &share->len[slot]) == FR_OK) {
+			share->next++;
+			ftp_share_stats.chunks_read++;
+		} else
+			ret = FTP_SHARE_ERROR;
+	} else if (!ftp_share_covers(share, chunk)) {
+		// replaced already
+		ftp_share_stats.detaches++;
+		ret = FTP_SHARE_BEHIND;
+	}
+
+	// hand out a copy
+	if (ret == FTP_SHARE_OK) {
+		*len = share->len[slot];
+		memcpy(buf, share->data[slot], *len);
+		ftp_share_stats.chunks_served++;
+	}
+
+	xSemaphoreGive(share->lock);
+
+	return ret;
+}
+
+uint8_t ftp_share_begin(ftp_share_reader_t *reader, const char *path, const FILINFO *nfo) {
+	reader->path = NULL;
+	reader->share = NULL;
+
+	// worth it?
+	if (nfo->fsize < FTP_SHARE_FILE_MIN)
+		return 0;
+
+	reader->fsize = nfo->fsize;
+	reader->fdate = nfo->fdate;
+	reader->ftime = nfo->ftime;
+	reader->chunk = 0;
+	reader->moved = 0;
+
+	vTaskSuspendAll();
+	for (uint8_t i = 0; i < FTP_NBR_CLIENTS; i++) {
+		if (ftp_share_readers[i] == NULL) {
+			reader->path = path;
+			ftp_share_readers[i] = reader;
+			ftp_share_count++;
+			break;
+		}
+	}
+	xTaskResumeAll();
+
+	return reader->path != NULL;
+}
+
+void ftp_share_end(ftp_share_reader_t *reader) {
+	if (reader->path == NULL)
+		return;
+
+	if (reader->share != NULL)
+		ftp_share_leave(reader);
+
+	vTaskSuspendAll();
+	for (uint8_t i = 0; i < FTP_NBR_CLIENTS; i++) {
+		if (ftp_share_readers[i] == reader) {
+			ftp_share_readers[i] = NULL;
+			ftp_share_count--;
+		}
+	}
+	xTaskResumeAll();
+
+	reader->path = NULL;
+}
+
+FRESULT ftp_share_read(ftp_share_reader_t *reader, ftp_file_t *file, void *buf, uint32_t *len) {
+	FRESULT res;
+	uint8_t open = 0;
+
+	// reading alone, is there company now? Nothing to look at while we
+	// are the only reader of a large file.
+	if (reader->share == NULL && ftp_share_count > 1) {
+		ftp_share_reader_t *other;
+
+		vTaskSuspendAll();
+		ftp_share_join(reader);
+		other = reader->share == NULL ? ftp_share_near(reader) : NULL;
+
+		// the one further ahead opens the stream, the other one joins
+		// when it gets there
+		open = other != NULL && reader->chunk >= other->chunk;
+		xTaskResumeAll();
+
+		if (open)
+			ftp_share_open(reader);
+	}
+
+	if (reader->share != NULL) {
+		if (ftp_share_take(reader->share, reader->chunk, buf, len) == FTP_SHARE_OK) {
+			reader->chunk++;
+
+			// the others left, read on our own unless one is close
+			if (reader->share->readers == 1) {
+				vTaskSuspendAll();
+				open = ftp_share_near(reader) != NULL;
+				xTaskResumeAll();
+				if (!open)
+					ftp_share_leave(reader);
+			}
+			return FR_OK;
+		}
+
+		// fell behind or the stream failed, go on with our own file
+		ftp_share_leave(reader);
+	}
+
+	if (reader->moved) {
+		res = ftps_f_lseek(file, (FSIZE_t) reader->chunk * FTP_SHARE_CHUNK_SIZE);
+		if (res != FR_OK)
+			return res;
+		reader->moved = 0;
+	}
+
+	res = ftps_f_read(file, buf, FTP_SHARE_CHUNK_SIZE, len);
+	if (res == FR_OK)
+		reader->chunk++;
+	return res;
+}
+
+void ftp_share_get_stats(ftp_share_stats_t *stats) {
+	vTaskSuspendAll();
+	*stats = ftp_share_stats;
+	xTaskResumeAll();
+}
+
+#endif
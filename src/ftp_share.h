@@ -0,0 +1,140 @@
+/*
+ * ftp_share.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_SHARE_H_
+#define _FTP_SHARE_H_
+
+#include <stdint.h>
+#include "ftp_port.h"
+#include "ftp_file.h"
+
+// let RETRs of the same file share one read stream, 0 compiles it out
+#ifndef FTP_SHARE
+#define FTP_SHARE					0
+#endif
+
+// streams open at the same time, each holds a file and the chunks
+#define FTP_SHARE_STREAMS			2
+
+// chunks a stream keeps. Readers of a file that are this close share a
+// stream, one that falls further behind goes on reading on its own.
+#define FTP_SHARE_CHUNKS			8
+
+// size of a chunk, the same as the data connection buffers
+#define FTP_SHARE_CHUNK_SIZE		1024
+
+// smaller files are read on their own, the RAM cache suits them better
+#define FTP_SHARE_FILE_MIN			16384
+
+/**
+ * Read stream of one file. Chunk n of the file is read from the disk
+ * once, by the first reader that needs it, and copied out to every
+ * reader until chunk n + FTP_SHARE_CHUNKS replaces it.
+ */
+typedef struct {
+	// full path and file information, the key of the stream. The path
+	// is stored behind the structure.
+	char *path;
+	uint32_t fsize;
+	uint16_t fdate;
+	uint16_t ftime;
+
+	// readers attached
+	uint8_t readers;
+
+	// held while a chunk is read or copied
+	SemaphoreHandle_t lock;
+
+	// the file, read front to back
+	ftp_file_t file;
+
+	// chunk the stream started at and the next chunk to read, chunks
+	// next - FTP_SHARE_CHUNKS up to next - 1 are in memory, first and
+	// later
+	uint32_t first;
+	uint32_t next;
+
+	// length of each chunk
+	uint32_t len[FTP_SHARE_CHUNKS];
+
+	// chunk n is kept in data[n % FTP_SHARE_CHUNKS]
+	uint8_t data[FTP_SHARE_CHUNKS][FTP_SHARE_CHUNK_SIZE];
+} ftp_share_t;
+
+// stream counters
+typedef struct {
+	// streams opened, attaches to a running stream, readers that fell
+	// behind
+	uint32_t streams;
+	uint32_t joins;
+	uint32_t detaches;
+
+	// chunks read from the disk and chunks copied to readers
+	uint32_t chunks_read;
+	uint32_t chunks_served;
+} ftp_share_stats_t;
+
+/**
+ * A RETR of a large file. It reads its own file while it is alone and
+ * goes through a stream while another reader of the file is close.
+ */
+typedef struct {
+	// key of the file, the path is the session's and stays put while
+	// reading. NULL when the reader is not registered.
+	const char *path;
+	uint32_t fsize;
+	uint16_t fdate;
+	uint16_t ftime;
+
+	// next chunk to hand out
+	uint32_t chunk;
+
+	// stream read through, NULL while reading the own file
+	ftp_share_t *share;
+
+	// the own file is not at chunk any more
+	uint8_t moved;
+} ftp_share_reader_t;
+
+/**
+ * Register a reader of a file. Nothing is allocated until a second
+ * reader of the file comes close.
+ *
+ * @param reader The reader
+ * @param path Full path of the file
+ * @param nfo File information
+ * @return 1 if registered, 0 if the file is too small or all readers
+ *         are in use, read the file directly then
+ */
+extern uint8_t ftp_share_begin(ftp_share_reader_t *reader, const char *path, const FILINFO *nfo);
+
+/**
+ * Unregister a reader, the last reader of a stream closes it.
+ *
+ * @param reader The reader
+ */
+extern void ftp_share_end(ftp_share_reader_t *reader);
+
+/**
+ * Get the next chunk of the file, from a stream or from the own file.
+ * Readers join a stream at its current window, not only at the start.
+ *
+ * @param reader The reader
+ * @param file Own file of the reader, open for reading
+ * @param buf Buffer of FTP_SHARE_CHUNK_SIZE bytes
+ * @param len Bytes in the chunk, 0 at the end of the file
+ * @return Result of the file system
+ */
+extern FRESULT ftp_share_read(ftp_share_reader_t *reader, ftp_file_t *file, void *buf, uint32_t *len);
+
+/**
+ * Get a copy of the stream counters.
+ *
+ * @param stats Structure the counters are copied to
+ */
+extern void ftp_share_get_stats(ftp_share_stats_t *stats);
+
+#endif /* _FTP_SHARE_H_ */
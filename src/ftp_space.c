@@ -0,0 +1,343 @@
+/*
+ * ftp_space.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ftp.h"
+#include "ftp_space.h"
+#include "ftp_walk.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <string.h>
+
+#if FTP_SPACE == 1
+
+// counters of the volumes
+static ftp_space_volume_t ftp_space_volumes[FTP_SPACE_VOLUMES];
+
+// usage of the directories right below the volume roots
+static ftp_space_dir_t ftp_space_dirs[FTP_SPACE_DIRS];
+
+// slots the running scan came across
+static uint8_t ftp_space_seen[FTP_SPACE_DIRS];
+
+// the scan task and whether it is busy
+static TaskHandle_t ftp_space_task_handle = NULL;
+static volatile uint8_t ftp_space_busy = 0;
+
+// The counters are only touched with the scheduler suspended, like the
+// RAM cache. Updates are a few additions and string compares.
+
+// state of the scan of a volume
+typedef struct {
+	uint8_t volume;
+
+	// slot of the directory below the root the walk is in, -1 if none
+	int slot;
+
+	// its files so far
+	uint64_t bytes;
+} ftp_space_scan_t;
+
+// volume of a path, -1 if none
+static int ftp_space_volume(const char *path) {
+#if FTP_FS_BACKENDS == 1
+	return ftp_fs_mount_index(path);
+#else
+	(void) path;
+	return 0;
+#endif
+}
+
+// root of a volume, NULL if there is no such volume
+static const char *ftp_space_root(uint8_t volume) {
+#if FTP_FS_BACKENDS == 1
+	return ftp_fs_mount_get(volume, NULL);
+#else
+	return volume == 0 ? "/" : NULL;
+#endif
+}
+
+// is the path right below the root of the volume?
+static uint8_t ftp_space_top(const char *path, uint8_t volume) {
+	const char *root = ftp_space_root(volume);
+	size_t len = strcmp(root, "/") ? strlen(root) : 0;
+
+	return path[len] == '/' && path[len + 1] != 0 && strchr(path + len + 1, '/') == NULL;
+}
+
+// bytes a file of this size takes on the volume
+static uint64_t ftp_space_units(FSIZE_t size, uint32_t unit) {
+	return unit > 0 ? ((uint64_t) size + unit - 1) / unit * unit : size;
+}
+
+// change the free space, call with the scheduler suspended
+static void ftp_space_adjust(ftp_space_volume_t *vol, int64_t change) {
+	int64_t free = (int64_t) vol->free + change;
+
+	// keep in range, the counters are an estimate until the next scan
+	if (free < 0)
+		free = 0;
+	else if ((uint64_t) free > vol->total)
+		free = vol->total;
+
+	vol->free = free;
+	vol->updates++;
+}
+
+// same first len characters? ASCII letters in any case like FatFs does,
+// a shorter string differs at its end.
+static uint8_t ftp_space_same(const char *a, const char *b, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		char ca = a[i], cb = b[i];
+		if (ca >= 'A' && ca <= 'Z')
+			ca += 'a' - 'A';
+		if (cb >= 'A' && cb <= 'Z')
+			cb += 'a' - 'A';
+		if (ca != cb)
+			return 0;
+	}
+	return 1;
+}
+
+// slot of the directory a path is in, -1 if none. Call with the
+// scheduler suspended.
+static int ftp_space_slot(const char *path) {
+	for (uint8_t i = 0; i < FTP_SPACE_DIRS; i++) {
+		size_t len = strlen(ftp_space_dirs[i].path);
+		if (len > 0 && ftp_space_same(path, ftp_space_dirs[i].path, len) && (path[len] == 0 || path[len] == '/'))
+			return i;
+	}
+	return -1;
+}
+
+// slot of a directory, a new one if it has none, -1 if it doesn't fit.
+// Call with the scheduler suspended.
+static int ftp_space_slot_add(const char *path, uint8_t volume) {
+	int free_slot = -1;
+
+	size_t len = strlen(path);
+	if (len >= FTP_SPACE_DIR_PATH)
+		return -1;
+
+	for (uint8_t i = 0; i < FTP_SPACE_DIRS; i++) {
+		if (ftp_space_same(ftp_space_dirs[i].path, path, len + 1))
+			return i;
+		if (ftp_space_dirs[i].path[0] == 0 && free_slot < 0)
+			free_slot = i;
+	}
+
+	if (free_slot >= 0) {
+		strcpy(ftp_space_dirs[free_slot].path, path);
+		ftp_space_dirs[free_slot].volume = volume;
+		ftp_space_dirs[free_slot].bytes = 0;
+	}
+	return free_slot;
+}
+
+// called by the walk for every entry of a volume
+static int ftp_space_scan_entry(void *arg, const char *path, const FILINFO *nfo, uint8_t depth) {
+	ftp_space_scan_t *scan = arg;
+
+#if FTP_FS_BACKENDS == 1
+	// another volume mounted inside this one
+	if (nfo != NULL && (nfo->fattrib & AM_DIR) && ftp_space_volume(path) != scan->volume)
+		return FTP_WALK_SKIP;
+#endif
+
+	if (depth == 0 && nfo != NULL && (nfo->fattrib & AM_DIR)) {
+		// entering a directory below the root
+		vTaskSuspendAll();
+		scan->slot = ftp_space_slot_add(path, scan->volume);
+		if (scan->slot >= 0)
+			ftp_space_seen[scan->slot] = 1;
+		xTaskResumeAll();
+		scan->bytes = 0;
+	} else if (depth == 0 && nfo == NULL) {
+		// leaving it, publish what it holds if it is still there
+		vTaskSuspendAll();
+		if (scan->slot >= 0 && ftp_space_same(ftp_space_dirs[scan->slot].path, path, strlen(path) + 1))
+			ftp_space_dirs[scan->slot].bytes = scan->bytes;
+		xTaskResumeAll();
+		scan->slot = -1;
+	} else if (nfo != NULL && !(nfo->fattrib & AM_DIR) && scan->slot >= 0) {
+		// a file somewhere below
+		scan->bytes += nfo->fsize;
+	}
+
+	return FTP_WALK_CONTINUE;
+}
+
+// get the free space of a volume and the usage of its directories
+static void ftp_space_scan(uint8_t volume, const char *root) {
+	ftp_space_scan_t scan = { volume, -1, 0 };
+	uint64_t free, total;
+	uint32_t unit;
+
+	// the one call that may scan the whole FAT
+	if (ftps_f_getfree(root, &free, &total, &unit) == FR_OK) {
+		vTaskSuspendAll();
+		ftp_space_volume_t *vol = &ftp_space_volumes[volume];
+		vol->free = free;
+		vol->total = total;
+		vol->unit = unit;
+		vol->updates = 0;
+		vol->valid = 1;
+		xTaskResumeAll();
+	}
+
+	memset(ftp_space_seen, 0, sizeof(ftp_space_seen));
+
+	// a directory that is gone is only noticed by a complete walk
+	if (ftp_walk(root, ftp_space_scan_entry, &scan) != FTP_WALK_DONE)
+		return;
+
+	vTaskSuspendAll();
+	for (uint8_t i = 0; i < FTP_SPACE_DIRS; i++)
+		if (ftp_space_dirs[i].volume == volume && !ftp_space_seen[i])
+			ftp_space_dirs[i].path[0] = 0;
+	xTaskResumeAll();
+}
+
+static void ftp_space_task(void *arg) {
+	const char *root;
+
+	(void) arg;
+
+	while (1) {
+		ftp_space_busy = 1;
+		for (uint8_t i = 0; i < FTP_SPACE_VOLUMES && (root = ftp_space_root(i)) != NULL; i++)
+			ftp_space_scan(i, root);
+		ftp_space_busy = 0;
+
+		// wait for a rescan
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	}
+}
+
+void ftp_space_start(void) {
+	if (ftp_space_task_handle != NULL)
+		return;
+
+	if (xTaskCreate(ftp_space_task, "ftp_space", FTP_SPACE_STACK_SIZE, NULL, FTP_SPACE_PRIORITY, &ftp_space_task_handle) != pdPASS) {
+		ftp_space_task_handle = NULL;
+		log_print("ftp_space not started\r\n");
+	}
+}
+
+void ftp_space_rescan(void) {
+	if (ftp_space_task_handle != NULL)
+		xTaskNotifyGive(ftp_space_task_handle);
+}
+
+uint8_t ftp_space_scanning(void) {
+	return ftp_space_busy;
+}
+
+int ftp_space_get(uint8_t volume, ftp_space_volume_t *vol) {
+	if (volume >= FTP_SPACE_VOLUMES || ftp_space_root(volume) == NULL)
+		return -1;
+
+	vTaskSuspendAll();
+	*vol = ftp_space_volumes[volume];
+	xTaskResumeAll();
+	return 0;
+}
+
+int ftp_space_dir_get(uint8_t index, ftp_space_dir_t *dir) {
+	if (index >= FTP_SPACE_DIRS)
+		return -1;
+
+	vTaskSuspendAll();
+	*dir = ftp_space_dirs[index];
+	xTaskResumeAll();
+	return 0;
+}
+
+void ftp_space_file(const char *path, FSIZE_t old_size, FSIZE_t new_size) {
+	int volume = ftp_space_volume(path);
+	if (volume < 0)
+		return;
+
+	vTaskSuspendAll();
+
+	// the volume loses or gains whole units
+	ftp_space_volume_t *vol = &ftp_space_volumes[volume];
+	if (vol->valid)
+		ftp_space_adjust(vol, (int64_t) ftp_space_units(old_size, vol->unit) - (int64_t) ftp_space_units(new_size, vol->unit));
+
+	// the directory the exact sizes
+	int slot = ftp_space_slot(path);
+	if (slot >= 0) {
+		int64_t bytes = (int64_t) ftp_space_dirs[slot].bytes + new_size - old_size;
+		ftp_space_dirs[slot].bytes = bytes > 0 ? bytes : 0;
+	}
+
+	xTaskResumeAll();
+}
+
+void ftp_space_dir(const char *path, int8_t change) {
+	int volume = ftp_space_volume(path);
+	if (volume < 0)
+		return;
+
+	vTaskSuspendAll();
+
+	ftp_space_volume_t *vol = &ftp_space_volumes[volume];
+	if (vol->valid)
+		ftp_space_adjust(vol, -(int64_t) change * vol->unit);
+
+	// directories right below the root get a slot of their own
+	if (ftp_space_top(path, volume)) {
+		if (change > 0)
+			ftp_space_slot_add(path, volume);
+		else {
+			int slot = ftp_space_slot(path);
+			if (slot >= 0 && ftp_space_same(ftp_space_dirs[slot].path, path, strlen(path) + 1))
+				ftp_space_dirs[slot].path[0] = 0;
+		}
+	}
+
+	xTaskResumeAll();
+}
+
+void ftp_space_rename(const char *from, const char *to, const FILINFO *nfo) {
+	uint8_t rescan = 0;
+
+	vTaskSuspendAll();
+
+	int from_slot = ftp_space_slot(from);
+	int to_slot = ftp_space_slot(to);
+
+	if (!(nfo->fattrib & AM_DIR)) {
+		// a file takes its size along, the volume stays the same
+		if (from_slot != to_slot) {
+			if (from_slot >= 0)
+				ftp_space_dirs[from_slot].bytes -= nfo->fsize < ftp_space_dirs[from_slot].bytes ? nfo->fsize : ftp_space_dirs[from_slot].bytes;
+			if (to_slot >= 0)
+				ftp_space_dirs[to_slot].bytes += nfo->fsize;
+		}
+	} else if (from_slot >= 0 && ftp_space_same(ftp_space_dirs[from_slot].path, from, strlen(from) + 1)) {
+		// a directory with a slot keeps it while it stays below the root
+		int volume = ftp_space_volume(to);
+		if (volume == ftp_space_dirs[from_slot].volume && ftp_space_top(to, volume) && strlen(to) < FTP_SPACE_DIR_PATH)
+			strcpy(ftp_space_dirs[from_slot].path, to);
+		else {
+			ftp_space_dirs[from_slot].path[0] = 0;
+			rescan = 1;
+		}
+	} else if (from_slot != to_slot) {
+		// a directory moved between slots, its size is not known
+		rescan = 1;
+	}
+
+	xTaskResumeAll();
+
+	if (rescan)
+		ftp_space_rescan();
+}
+
+#endif
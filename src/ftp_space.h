@@ -0,0 +1,139 @@
+/*
+ * ftp_space.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_SPACE_H_
+#define _FTP_SPACE_H_
+
+#include <stdint.h>
+#include "ftp_port.h"
+#include "ftp_file.h"
+
+// keep the free space of the volumes in RAM, 0 compiles it out. Without
+// a valid FSINFO FatFs scans the whole FAT for the free space, which
+// takes seconds on a large card. With this the scan runs once in the
+// background and SITE FREE only reads the counters.
+#ifndef FTP_SPACE
+#define FTP_SPACE					0
+#endif
+
+// directories right below the root of a volume whose usage is kept
+#define FTP_SPACE_DIRS				16
+
+// longer paths of these directories are not kept
+#define FTP_SPACE_DIR_PATH			48
+
+// stack and priority of the task that scans the volumes
+#define FTP_SPACE_STACK_SIZE		512
+#define FTP_SPACE_PRIORITY			FTP_TASK_PRIORITY_BULK
+
+// every mount is a volume of its own
+#if FTP_FS_BACKENDS == 1
+#define FTP_SPACE_VOLUMES			FTP_FS_MOUNTS
+#else
+#define FTP_SPACE_VOLUMES			1
+#endif
+
+// free space of a volume
+typedef struct {
+	// the scan has been done, the counters hold
+	uint8_t valid;
+
+	// bytes free and in all
+	uint64_t free;
+	uint64_t total;
+
+	// allocation unit, a file takes whole units (bytes)
+	uint32_t unit;
+
+	// changes counted since the scan
+	uint32_t updates;
+} ftp_space_volume_t;
+
+// usage of a directory
+typedef struct {
+	// full path, empty for a free slot
+	char path[FTP_SPACE_DIR_PATH];
+
+	// volume it is on
+	uint8_t volume;
+
+	// size of the files below it (bytes)
+	uint64_t bytes;
+} ftp_space_dir_t;
+
+#if FTP_SPACE == 1
+#define FTP_SPACE_FILE(path, old_size, new_size)	ftp_space_file((path), (old_size), (new_size))
+#define FTP_SPACE_DIR(path, change)					ftp_space_dir((path), (change))
+#else
+#define FTP_SPACE_FILE(path, old_size, new_size)
+#define FTP_SPACE_DIR(path, change)
+#endif
+
+/**
+ * Start the task that scans the volumes. It gets the free space of every
+ * volume and adds up the files in the directories right below its root,
+ * then waits for ftp_space_rescan.
+ */
+void ftp_space_start(void);
+
+/**
+ * Scan the volumes again, e.g. after the card was written by something
+ * other than the server. The counters stay valid during the scan.
+ */
+void ftp_space_rescan(void);
+
+/**
+ * Is a scan running?
+ */
+uint8_t ftp_space_scanning(void);
+
+/**
+ * Get the free space of a volume. This never touches the volume.
+ *
+ * @param volume Index of the volume, the mount with backends
+ * @param vol Structure the counters are copied to
+ * @return 0 on success, -1 if there is no such volume
+ */
+int ftp_space_get(uint8_t volume, ftp_space_volume_t *vol);
+
+/**
+ * Get the usage of a directory.
+ *
+ * @param index Slot, from 0
+ * @param dir Structure the usage is copied to, path is empty for a
+ * free slot
+ * @return 0 on success, -1 if index is past the last slot
+ */
+int ftp_space_dir_get(uint8_t index, ftp_space_dir_t *dir);
+
+/**
+ * A file was written, truncated or deleted. Sizes of 0 stand for a new
+ * or a deleted file.
+ *
+ * @param path Full path of the file
+ * @param old_size Size before
+ * @param new_size Size after
+ */
+void ftp_space_file(const char *path, FSIZE_t old_size, FSIZE_t new_size);
+
+/**
+ * A directory was made (1) or removed (-1). It takes one unit.
+ *
+ * @param path Full path of the directory
+ * @param change 1 or -1
+ */
+void ftp_space_dir(const char *path, int8_t change);
+
+/**
+ * Something was renamed or moved.
+ *
+ * @param from Old full path
+ * @param to New full path
+ * @param nfo File information from before the rename
+ */
+void ftp_space_rename(const char *from, const char *to, const FILINFO *nfo);
+
+#endif // _FTP_SPACE_H_
@@ -0,0 +1,182 @@
+/*
+ * ftp_span.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ftp.h"
+#include "ftp_span.h"
+#include "ftp_file.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(FTP_HOST)
+#include <time.h>
+#endif
+
+#if FTP_SPAN_TRACE == 1
+
+// recorded span
+typedef struct {
+	uint32_t begin;
+	uint32_t duration;
+	uint32_t arg;
+	uint32_t task;
+	uint16_t id;
+} ftp_span_t;
+
+// ring of spans, shared by all tasks
+static ftp_span_t ftp_spans[FTP_SPAN_RING_SIZE];
+static uint32_t ftp_span_next = 0;
+
+// set while dumping, the dump itself uses the file functions
+static volatile uint8_t ftp_span_paused = 0;
+
+// names shown in the viewer
+static const char * const ftp_span_names[FTP_SPAN_COUNT] = {
+		[FTP_SPAN_COMMAND] = "command",
+		[FTP_SPAN_PATH_BUILD] = "path_build",
+		[FTP_SPAN_STAT] = "f_stat",
+		[FTP_SPAN_OPEN] = "f_open",
+		[FTP_SPAN_CLOSE] = "f_close",
+		[FTP_SPAN_READ] = "f_read",
+		[FTP_SPAN_WRITE] = "f_write",
+		[FTP_SPAN_OPENDIR] = "f_opendir",
+		[FTP_SPAN_READDIR] = "f_readdir",
+		[FTP_SPAN_DATA_ACCEPT] = "data_accept",
+		[FTP_SPAN_DATA_CONNECT] = "data_connect",
+		[FTP_SPAN_NET_WRITE] = "netconn_write",
+		[FTP_SPAN_DATA_CLOSE] = "data_close", };
+
+#endif
+
+#if !defined(FTP_HOST) && (defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__))
+// DWT cycle counter registers
+#define FTP_DEMCR				(*(volatile uint32_t *) 0xE000EDFC)
+#define FTP_DWT_CTRL			(*(volatile uint32_t *) 0xE0001000)
+#define FTP_DWT_CYCCNT			(*(volatile uint32_t *) 0xE0001004)
+
+uint32_t ftp_span_now(void) {
+	static uint32_t last = 0;
+	static uint64_t cycles = 0;
+	uint32_t now;
+
+	// start the counter on first use
+	if (!(FTP_DWT_CTRL & 1)) {
+		FTP_DEMCR |= (1 << 24);
+		FTP_DWT_CYCCNT = 0;
+		FTP_DWT_CTRL |= 1;
+	}
+
+	// extend to 64 bits, the counter wraps within a minute
+	taskENTER_CRITICAL();
+	now = FTP_DWT_CYCCNT;
+	cycles += (uint32_t) (now - last);
+	last = now;
+	uint64_t total = cycles;
+	taskEXIT_CRITICAL();
+
+	return (uint32_t) (total / (configCPU_CLOCK_HZ / 1000000));
+}
+#elif defined(FTP_HOST)
+uint32_t ftp_span_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t) ((uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+#else
+uint32_t ftp_span_now(void) {
+	return ftp_time_us();
+}
+#endif
+
+#if FTP_SPAN_TRACE == 1
+
+void ftp_span_record(ftp_span_id_t id, uint32_t arg, uint32_t begin) {
+	uint32_t end = ftp_span_now();
+	ftp_span_t *span;
+
+	// dumping?
+	if (ftp_span_paused)
+		return;
+
+	// claim a place in the ring
+	taskENTER_CRITICAL();
+	span = &ftp_spans[ftp_span_next++ & (FTP_SPAN_RING_SIZE - 1)];
+	span->begin = begin;
+	span->duration = end - begin;
+	span->arg = arg;
+	span->task = (uint32_t) (uintptr_t) xTaskGetCurrentTaskHandle();
+	span->id = id;
+	taskEXIT_CRITICAL();
+}
+
+void ftp_span_dump(ftp_span_writer_t write, void *ctx) {
+	char line[160];
+	uint32_t first, last;
+	int len;
+
+	// no new spans while we read the ring
+	ftp_span_paused = 1;
+
+	// oldest to newest
+	last = ftp_span_next;
+	first = last > FTP_SPAN_RING_SIZE ? last - FTP_SPAN_RING_SIZE : 0;
+
+	write(ctx, "{\"traceEvents\":[\n", 17);
+	for (uint32_t i = first; i < last; i++) {
+		const ftp_span_t *span = &ftp_spans[i & (FTP_SPAN_RING_SIZE - 1)];
+		len = snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%lu,\"dur\":%lu,\"args\":{\"arg\":%lu}}%s\n",
+				span->id < FTP_SPAN_COUNT ? ftp_span_names[span->id] : "?", (unsigned long) span->task, (unsigned long) span->begin,
+				(unsigned long) span->duration, (unsigned long) span->arg, i + 1 < last ? "," : "");
+		write(ctx, line, len);
+	}
+	write(ctx, "],\"displayTimeUnit\":\"ns\"}\n", 26);
+
+	// record again
+	ftp_span_paused = 0;
+}
+
+#if defined(FTP_HOST)
+// write to a host file
+static void ftp_span_write_file(void *ctx, const char *data, size_t len) {
+	fwrite(data, 1, len, (FILE *) ctx);
+}
+
+int ftp_span_dump_file(const char *path) {
+	FILE *f = fopen(path, "w");
+	if (f == NULL)
+		return -1;
+	ftp_span_dump(ftp_span_write_file, f);
+	fclose(f);
+	return 0;
+}
+#else
+// write to a file on the card
+static void ftp_span_write_file(void *ctx, const char *data, size_t len) {
+	uint32_t written;
+	ftps_f_write((ftp_file_t *) ctx, data, len, &written);
+}
+
+int ftp_span_dump_file(const char *path) {
+	ftp_file_t *file = pvPortMalloc(sizeof(ftp_file_t));
+	if (file == NULL)
+		return -1;
+
+	if (ftps_f_open(file, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+		vPortFree(file);
+		return -1;
+	}
+
+	ftp_span_dump(ftp_span_write_file, file);
+	ftps_f_close(file);
+	vPortFree(file);
+	return 0;
+}
+#endif
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * ftp_span.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_SPAN_H_
+#define _FTP_SPAN_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// timestamped spans for a trace viewer, 0 compiles them out
+#ifndef FTP_SPAN_TRACE
+#define FTP_SPAN_TRACE			0
+#endif
+
+// spans kept in memory, the oldest are overwritten, power of two
+#define FTP_SPAN_RING_SIZE		256
+
+// span identifiers
+typedef enum {
+	FTP_SPAN_COMMAND,		// command handler, arg is the command characters
+	FTP_SPAN_PATH_BUILD,
+	FTP_SPAN_STAT,
+	FTP_SPAN_OPEN,
+	FTP_SPAN_CLOSE,
+	FTP_SPAN_READ,			// arg is the length
+	FTP_SPAN_WRITE,			// arg is the length
+	FTP_SPAN_OPENDIR,
+	FTP_SPAN_READDIR,
+	FTP_SPAN_DATA_ACCEPT,
+	FTP_SPAN_DATA_CONNECT,
+	FTP_SPAN_NET_WRITE,		// arg is the length
+	FTP_SPAN_DATA_CLOSE,
+	FTP_SPAN_COUNT
+} ftp_span_id_t;
+
+// receives the trace file in pieces
+typedef void (*ftp_span_writer_t)(void *ctx, const char *data, size_t len);
+
+#if FTP_SPAN_TRACE == 1
+#define FTP_SPAN_BEGIN(var)				uint32_t var = ftp_span_now()
+#define FTP_SPAN_END(var, id, arg)		ftp_span_record((id), (uint32_t) (arg), var)
+#else
+#define FTP_SPAN_BEGIN(var)
+#define FTP_SPAN_END(var, id, arg)
+#endif
+
+/**
+ * Timestamp in microseconds. Uses the DWT cycle counter on Cortex-M3
+ * and up, clock_gettime on the host build and ftp_time_us otherwise.
+ */
+extern uint32_t ftp_span_now(void);
+
+/**
+ * Record a span which started at begin and ends now.
+ *
+ * @param id The span identifier
+ * @param arg Argument shown with the span
+ * @param begin Timestamp of ftp_span_now when the span started
+ */
+extern void ftp_span_record(ftp_span_id_t id, uint32_t arg, uint32_t begin);
+
+/**
+ * Write the recorded spans as a Chrome trace (JSON), which opens in
+ * chrome://tracing or ui.perfetto.dev. Recording is paused meanwhile.
+ *
+ * @param write Receives the trace in pieces
+ * @param ctx Passed to write
+ */
+extern void ftp_span_dump(ftp_span_writer_t write, void *ctx);
+
+/**
+ * Write the recorded spans as a Chrome trace to a file.
+ *
+ * @param path File name
+ * @return 0 on success, -1 if the file could not be written
+ */
+extern int ftp_span_dump_file(const char *path);
+
+#endif /* _FTP_SPAN_H_ */
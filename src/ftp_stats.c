@@ -0,0 +1,173 @@
+/*
+ * ftp_stats.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ftp.h"
+#include "ftp_stats.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <string.h>
+
+// totals of the sessions that ended
+static ftp_stats_t ftp_stats_retired;
+
+// counters of the running sessions by session number, each only written
+// by its own task
+static ftp_stats_t *ftp_stats_live[FTP_NBR_CLIENTS];
+
+// latency per command, shared by all sessions
+static ftp_cmd_stats_t ftp_stats_cmd[FTP_STATS_COMMANDS];
+
+// add the counters of one session to a total
+static void ftp_stats_sum(ftp_stats_t *total, const ftp_stats_t *add) {
+	total->bytes_out += add->bytes_out;
+	total->bytes_in += add->bytes_in;
+	total->xfers_out += add->xfers_out;
+	total->xfers_in += add->xfers_in;
+	total->xfer_out_us += add->xfer_out_us;
+	total->xfer_in_us += add->xfer_in_us;
+
+	for (uint8_t i = 0; i < FTP_STATS_BUCKETS; i++) {
+		total->fs_read.bucket[i] += add->fs_read.bucket[i];
+		total->fs_write.bucket[i] += add->fs_write.bucket[i];
+		total->net_write.bucket[i] += add->net_write.bucket[i];
+	}
+}
+
+void ftp_stats_hist_add(ftp_hist_t *hist, uint32_t us) {
+	uint8_t i = 0;
+
+	// find the bucket, one shift per doubling
+	us /= FTP_STATS_HIST_BASE_US;
+	while (us > 0 && i < FTP_STATS_BUCKETS - 1) {
+		us >>= 1;
+		i++;
+	}
+
+	hist->bucket[i]++;
+}
+
+uint32_t ftp_stats_hist_limit(uint8_t bucket) {
+	if (bucket >= FTP_STATS_BUCKETS - 1)
+		return 0;
+	return (uint32_t) FTP_STATS_HIST_BASE_US << bucket;
+}
+
+void ftp_stats_session_begin(uint8_t session, ftp_stats_t *stats) {
+	// fresh counters
+	memset(stats, 0, sizeof(ftp_stats_t));
+
+	if (session >= FTP_NBR_CLIENTS)
+		return;
+
+	// register
+	taskENTER_CRITICAL();
+	ftp_stats_live[session] = stats;
+	taskEXIT_CRITICAL();
+}
+
+void ftp_stats_session_end(ftp_stats_t *stats) {
+	// fold into the totals and unregister in one go, so a reader
+	// never counts the session twice or not at all
+	taskENTER_CRITICAL();
+	ftp_stats_sum(&ftp_stats_retired, stats);
+	for (uint8_t i = 0; i < FTP_NBR_CLIENTS; i++) {
+		if (ftp_stats_live[i] == stats)
+			ftp_stats_live[i] = NULL;
+	}
+	taskEXIT_CRITICAL();
+}
+
+void ftp_stats_command(uint8_t index, uint32_t us, uint32_t stack) {
+	// unknown commands share the last entry
+	if (index >= FTP_STATS_COMMANDS)
+		index = FTP_STATS_COMMANDS - 1;
+
+	ftp_cmd_stats_t *cmd = &ftp_stats_cmd[index];
+
+	taskENTER_CRITICAL();
+	cmd->count++;
+	cmd->total_us += us;
+	if (us > cmd->max_us)
+		cmd->max_us = us;
+	ftp_stats_hist_add(&cmd->hist, us);
+	if (stack > cmd->stack_max)
+		cmd->stack_max = stack;
+	taskEXIT_CRITICAL();
+}
+
+void ftp_stats_get(ftp_stats_t *stats) {
+	// the sessions keep counting while we sum, so the result is a
+	// snapshot which can be a few samples behind
+	vTaskSuspendAll();
+	*stats = ftp_stats_retired;
+	for (uint8_t i = 0; i < FTP_NBR_CLIENTS; i++) {
+		if (ftp_stats_live[i] != NULL)
+			ftp_stats_sum(stats, ftp_stats_live[i]);
+	}
+	xTaskResumeAll();
+}
+
+int ftp_stats_get_session(uint8_t session, ftp_stats_t *stats) {
+	int ret = -1;
+
+	if (session >= FTP_NBR_CLIENTS)
+		return -1;
+
+	// the session can't end while the scheduler is suspended
+	vTaskSuspendAll();
+	if (ftp_stats_live[session] != NULL) {
+		*stats = *ftp_stats_live[session];
+		ret = 0;
+	}
+	xTaskResumeAll();
+
+	return ret;
+}
+
+void ftp_stats_get_command(uint8_t index, ftp_cmd_stats_t *stats) {
+	if (index >= FTP_STATS_COMMANDS) {
+		memset(stats, 0, sizeof(ftp_cmd_stats_t));
+		return;
+	}
+
+	taskENTER_CRITICAL();
+	*stats = ftp_stats_cmd[index];
+	taskEXIT_CRITICAL();
+}
+
+uint32_t ftp_stats_stack_recommend(uint32_t *worst) {
+	uint32_t max = 0;
+
+	// deepest command
+	taskENTER_CRITICAL();
+	for (uint8_t i = 0; i < FTP_STATS_COMMANDS; i++) {
+		if (ftp_stats_cmd[i].stack_max > max)
+			max = ftp_stats_cmd[i].stack_max;
+	}
+	taskEXIT_CRITICAL();
+
+	if (worst != NULL)
+		*worst = max;
+	if (max == 0)
+		return 0;
+
+	// add the margin and round up to 64 words
+	max += max * FTP_STATS_STACK_MARGIN_PCT / 100 + FTP_STATS_STACK_MARGIN_WORDS;
+	return (max + 63) & ~63u;
+}
+
+void ftp_stats_reset(void) {
+	vTaskSuspendAll();
+	memset(&ftp_stats_retired, 0, sizeof(ftp_stats_retired));
+	memset(ftp_stats_cmd, 0, sizeof(ftp_stats_cmd));
+	for (uint8_t i = 0; i < FTP_NBR_CLIENTS; i++) {
+		if (ftp_stats_live[i] != NULL)
+			memset(ftp_stats_live[i], 0, sizeof(ftp_stats_t));
+	}
+	xTaskResumeAll();
+}
@@ -0,0 +1,156 @@
+/*
+ * ftp_stats.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_STATS_H_
+#define _FTP_STATS_H_
+
+#include <stdint.h>
+
+// transfer and latency statistics, 0 compiles them out
+#ifndef FTP_STATS
+#define FTP_STATS				1
+#endif
+
+// number of histogram buckets. Bucket 0 counts everything below
+// FTP_STATS_HIST_BASE_US, every next bucket doubles the limit and the
+// last bucket counts everything above.
+#define FTP_STATS_BUCKETS		16
+#define FTP_STATS_HIST_BASE_US	32
+
+// number of commands that get their own latency statistics, the
+// last one collects unknown commands
+#define FTP_STATS_COMMANDS		32
+
+// measure the stack each command uses by painting the free stack of the
+// session before the command and looking how far the paint is gone
+// after it. This is exact but costs a pass over the free stack per
+// command, use it to calibrate FTP_TASK_STACK_SIZE. 0 reads the
+// high-water mark of the task instead, which only charges a command
+// when it goes deeper than all commands before. Needs FTP_TASK_STATIC.
+#ifndef FTP_STATS_STACK_PAINT
+#define FTP_STATS_STACK_PAINT	0
+#endif
+
+// words kept free by the recommended stack size: a share of the worst
+// use measured, plus an exception frame with FPU state
+#define FTP_STATS_STACK_MARGIN_PCT	25
+#define FTP_STATS_STACK_MARGIN_WORDS	32
+
+// latency histogram
+typedef struct {
+	uint32_t bucket[FTP_STATS_BUCKETS];
+} ftp_hist_t;
+
+// transfer counters, kept per session and summed up on read
+typedef struct {
+	// bytes sent and received on data connections
+	uint64_t bytes_out;
+	uint64_t bytes_in;
+
+	// completed RETR and STOR commands
+	uint32_t xfers_out;
+	uint32_t xfers_in;
+
+	// time spent in RETR and STOR, for throughput
+	uint64_t xfer_out_us;
+	uint64_t xfer_in_us;
+
+	// latency of ftps_f_read, ftps_f_write and blocking netconn_write
+	ftp_hist_t fs_read;
+	ftp_hist_t fs_write;
+	ftp_hist_t net_write;
+} ftp_stats_t;
+
+// latency statistics of one command
+typedef struct {
+	uint32_t count;
+	uint32_t max_us;
+	uint64_t total_us;
+	ftp_hist_t hist;
+
+	// most stack a session used while running the command (words)
+	uint32_t stack_max;
+} ftp_cmd_stats_t;
+
+#if FTP_STATS == 1
+#define FTP_STATS_HIST(hist, us)	ftp_stats_hist_add((hist), (us))
+#else
+#define FTP_STATS_HIST(hist, us)
+#endif
+
+/**
+ * Count a latency sample in a histogram.
+ *
+ * @param hist The histogram
+ * @param us Latency in microseconds
+ */
+extern void ftp_stats_hist_add(ftp_hist_t *hist, uint32_t us);
+
+/**
+ * Upper limit of a histogram bucket in microseconds, 0 for the last
+ * bucket which has no limit.
+ */
+extern uint32_t ftp_stats_hist_limit(uint8_t bucket);
+
+/**
+ * Register the counters of a session when it starts, and fold them
+ * into the totals when it ends.
+ *
+ * @param session Number of the session, below FTP_NBR_CLIENTS
+ * @param stats Counters of the session
+ */
+extern void ftp_stats_session_begin(uint8_t session, ftp_stats_t *stats);
+extern void ftp_stats_session_end(ftp_stats_t *stats);
+
+/**
+ * Count the latency and stack use of a command.
+ *
+ * @param index Index of the command, FTP_STATS_COMMANDS - 1 for unknown commands
+ * @param us Time the command took in microseconds
+ * @param stack Stack words the session used
+ */
+extern void ftp_stats_command(uint8_t index, uint32_t us, uint32_t stack);
+
+/**
+ * Get the totals of all sessions, finished and running.
+ *
+ * @param stats Structure the totals are copied to
+ */
+extern void ftp_stats_get(ftp_stats_t *stats);
+
+/**
+ * Get the counters of a running session.
+ *
+ * @param session Number of the session
+ * @param stats Structure the counters are copied to
+ * @return 0 on success, -1 if the session is not running
+ */
+extern int ftp_stats_get_session(uint8_t session, ftp_stats_t *stats);
+
+/**
+ * Get the latency statistics of a command.
+ *
+ * @param index Index of the command
+ * @param stats Structure the statistics are copied to
+ */
+extern void ftp_stats_get_command(uint8_t index, ftp_cmd_stats_t *stats);
+
+/**
+ * Recommend a session stack size from the stack use measured so far.
+ * Only as good as the commands that ran, so exercise all of them, and
+ * build with FTP_STATS_STACK_PAINT for exact figures.
+ *
+ * @param worst Most stack words any command used, may be NULL
+ * @return Recommended FTP_TASK_STACK_SIZE in words, 0 if nothing ran
+ */
+extern uint32_t ftp_stats_stack_recommend(uint32_t *worst);
+
+/**
+ * Clear all statistics.
+ */
+extern void ftp_stats_reset(void);
+
+#endif /* _FTP_STATS_H_ */
@@ -0,0 +1,325 @@
+/*
+ * ftp_tree.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ftp.h"
+#include "ftp_tree.h"
+#include "ftp_walk.h"
+
+#include "FreeRTOS.h"
+
+#include <string.h>
+
+#if FTP_TREE == 1
+
+// state of an operation, on the heap with the copy buffer
+typedef struct {
+	// roots of a copy, from_len is 0 for "/"
+	size_t from_len;
+	const char *to;
+
+	// path of the copy of the entry at hand
+	char path[FTP_CWD_SIZE];
+
+	ftp_file_t src;
+	ftp_file_t dst;
+	FILINFO nfo;
+
+	ftp_tree_progress_t progress;
+	void *arg;
+	ftp_tree_stats_t *stats;
+
+	// first error
+	FRESULT res;
+
+	uint8_t buf[FTP_TREE_BUF_SIZE];
+} ftp_tree_t;
+
+static ftp_tree_t *ftp_tree_alloc(ftp_tree_progress_t progress, void *arg, ftp_tree_stats_t *stats) {
+	ftp_tree_t *t = pvPortMalloc(sizeof(ftp_tree_t));
+	if (t == NULL)
+		return NULL;
+
+	t->progress = progress;
+	t->arg = arg;
+	t->stats = stats;
+	t->res = FR_OK;
+	return t;
+}
+
+static void ftp_tree_report(ftp_tree_t *t, uint32_t bytes) {
+	if (t->progress != NULL)
+		t->progress(t->arg, t->stats, bytes);
+}
+
+// length of a root to cut from the paths below it
+static size_t ftp_tree_root_len(const char *path) {
+	return strcmp(path, "/") ? strlen(path) : 0;
+}
+
+// do the paths start alike, ASCII letters in any case? Bytes of other
+// characters are compared as they are.
+static uint8_t ftp_tree_same(const char *a, const char *b, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		char ca = a[i], cb = b[i];
+		if (ca >= 'A' && ca <= 'Z')
+			ca += 'a' - 'A';
+		if (cb >= 'A' && cb <= 'Z')
+			cb += 'a' - 'A';
+		if (ca != cb)
+			return 0;
+		if (ca == 0)
+			break;
+	}
+	return 1;
+}
+
+// is a volume mounted at or below the path?
+static uint8_t ftp_tree_mounted(const char *path) {
+#if FTP_FS_BACKENDS == 1
+	size_t len = ftp_tree_root_len(path);
+	const char *prefix;
+
+	for (uint8_t i = 0; (prefix = ftp_fs_mount_get(i, NULL)) != NULL; i++)
+		if (!strcmp(prefix, path) || (strncmp(prefix, path, len) == 0 && prefix[len] == '/'))
+			return 1;
+	return 0;
+#else
+	return !strcmp(path, "/");
+#endif
+}
+
+// copy one file in blocks of the large buffer, a failed copy is removed
+static FRESULT ftp_tree_copy_file(ftp_tree_t *t, const char *from, const char *to, const FILINFO *nfo) {
+	FSIZE_t size = 0;
+	uint32_t got, put;
+
+	FRESULT res = ftps_f_open(&t->src, from, FA_READ);
+	if (res != FR_OK)
+		return res;
+
+	res = ftps_f_open(&t->dst, to, FA_CREATE_NEW | FA_WRITE);
+	if (res != FR_OK) {
+		ftps_f_close(&t->src);
+		return res;
+	}
+
+	while ((res = ftps_f_read(&t->src, t->buf, sizeof(t->buf), &got)) == FR_OK && got > 0) {
+		res = ftps_f_write(&t->dst, t->buf, got, &put);
+
+		// a short write means the volume is full
+		if (res == FR_OK && put < got)
+			res = FR_DENIED;
+		if (res != FR_OK)
+			break;
+
+		size += put;
+		t->stats->bytes += put;
+		ftp_tree_report(t, put);
+	}
+
+	ftps_f_close(&t->src);
+	FRESULT close_res = ftps_f_close(&t->dst);
+	if (res == FR_OK)
+		res = close_res;
+
+	// don't leave half a file behind
+	if (res != FR_OK) {
+		ftps_f_unlink(to);
+		return res;
+	}
+
+	// the copy keeps the time stamp of the origin
+	ftps_f_utime(to, nfo);
+
+	FTP_SPACE_FILE(to, 0, size);
+	t->stats->files++;
+	return FR_OK;
+}
+
+// called by the walk for every entry below the origin of a copy
+static int ftp_tree_copy_entry(void *arg, const char *path, const FILINFO *nfo, uint8_t depth) {
+	ftp_tree_t *t = arg;
+	(void) depth;
+
+	// nothing to do when a directory is left
+	if (nfo == NULL)
+		return FTP_WALK_CONTINUE;
+
+	// the same path below the root of the copy
+	const char *rel = path + t->from_len;
+	size_t to_len = strlen(t->to);
+	if (to_len + strlen(rel) >= sizeof(t->path)) {
+		t->res = FR_INVALID_NAME;
+		return FTP_WALK_STOP;
+	}
+	memcpy(t->path, t->to, to_len);
+	strcpy(t->path + to_len, rel);
+
+	if (nfo->fattrib & AM_DIR) {
+		t->res = ftps_f_mkdir(t->path);
+		if (t->res == FR_OK) {
+			FTP_SPACE_DIR(t->path, 1);
+			t->stats->dirs++;
+		}
+	} else {
+		t->res = ftp_tree_copy_file(t, path, t->path, nfo);
+	}
+
+	if (t->res != FR_OK)
+		return FTP_WALK_STOP;
+
+	ftp_tree_report(t, 0);
+	return FTP_WALK_CONTINUE;
+}
+
+// called by the walk for every entry below a directory that is removed
+static int ftp_tree_remove_entry(void *arg, const char *path, const FILINFO *nfo, uint8_t depth) {
+	ftp_tree_t *t = arg;
+	(void) depth;
+
+	// a directory goes when it is left, after its entries
+	if (nfo != NULL && (nfo->fattrib & AM_DIR))
+		return FTP_WALK_CONTINUE;
+
+	t->res = ftps_f_unlink(path);
+	if (t->res != FR_OK)
+		return FTP_WALK_STOP;
+
+	if (nfo == NULL) {
+		FTP_SPACE_DIR(path, -1);
+		t->stats->dirs++;
+	} else {
+		FTP_SPACE_FILE(path, nfo->fsize, 0);
+		t->stats->files++;
+	}
+
+	ftp_tree_report(t, 0);
+	return FTP_WALK_CONTINUE;
+}
+
+// run a walk, the result is the first error of the callback or of the walk
+static FRESULT ftp_tree_walk(ftp_tree_t *t, const char *root, ftp_walk_cb_t cb) {
+	int walk = ftp_walk(root, cb, t);
+
+	if (t->res != FR_OK)
+		return t->res;
+
+	// a directory could not be read, the tree is too deep or no memory
+	return walk == FTP_WALK_DONE ? FR_OK : FR_INT_ERR;
+}
+
+FRESULT ftp_tree_copy(const char *from, const char *to, ftp_tree_progress_t progress, void *arg, ftp_tree_stats_t *stats) {
+	FRESULT res;
+
+	memset(stats, 0, sizeof(ftp_tree_stats_t));
+
+	// a copy into the origin would copy itself, FatFs names match in any
+	// case
+	size_t from_len = ftp_tree_root_len(from);
+	if (ftp_tree_same(to, from, from_len) && (to[from_len] == 0 || to[from_len] == '/'))
+		return FR_DENIED;
+
+	ftp_tree_t *t = ftp_tree_alloc(progress, arg, stats);
+	if (t == NULL)
+		return FR_NOT_ENOUGH_CORE;
+
+	if (ftps_f_stat(to, &t->nfo) == FR_OK)
+		res = FR_EXIST;
+	else if (ftps_f_stat(from, &t->nfo) != FR_OK)
+		res = FR_NO_FILE;
+	else if (!(t->nfo.fattrib & AM_DIR))
+		res = ftp_tree_copy_file(t, from, to, &t->nfo);
+	else if ((res = ftps_f_mkdir(to)) == FR_OK) {
+		FTP_SPACE_DIR(to, 1);
+		stats->dirs++;
+
+		// everything below it
+		t->from_len = from_len;
+		t->to = to;
+		res = ftp_tree_walk(t, from, ftp_tree_copy_entry);
+	}
+
+	vPortFree(t);
+	return res;
+}
+
+FRESULT ftp_tree_remove(const char *path, ftp_tree_progress_t progress, void *arg, ftp_tree_stats_t *stats) {
+	FRESULT res;
+
+	memset(stats, 0, sizeof(ftp_tree_stats_t));
+
+	// the root or a mount point can't go, nor a volume with the tree
+	if (ftp_tree_mounted(path))
+		return FR_DENIED;
+
+	ftp_tree_t *t = ftp_tree_alloc(progress, arg, stats);
+	if (t == NULL)
+		return FR_NOT_ENOUGH_CORE;
+
+	if (ftps_f_stat(path, &t->nfo) != FR_OK) {
+		res = FR_NO_FILE;
+	} else if (!(t->nfo.fattrib & AM_DIR)) {
+		res = ftps_f_unlink(path);
+		if (res == FR_OK) {
+			FTP_SPACE_FILE(path, t->nfo.fsize, 0);
+			stats->files++;
+		}
+	} else if ((res = ftp_tree_walk(t, path, ftp_tree_remove_entry)) == FR_OK) {
+		// empty now
+		res = ftps_f_unlink(path);
+		if (res == FR_OK) {
+			FTP_SPACE_DIR(path, -1);
+			stats->dirs++;
+		}
+	}
+
+	vPortFree(t);
+	return res;
+}
+
+FRESULT ftp_tree_move(const char *from, const char *to, ftp_tree_progress_t progress, void *arg, ftp_tree_stats_t *stats) {
+	FRESULT res;
+
+	// only a copy between volumes reports progress
+	(void) progress;
+	(void) arg;
+
+	memset(stats, 0, sizeof(ftp_tree_stats_t));
+
+#if FTP_FS_BACKENDS == 1
+	// no rename between two volumes, copy and remove the origin
+	if (ftp_fs_mount_index(from) != ftp_fs_mount_index(to)) {
+		ftp_tree_stats_t removed;
+
+		// the origin has to go afterwards, find out now if it can't
+		if (ftp_tree_mounted(from))
+			return FR_DENIED;
+
+		res = ftp_tree_copy(from, to, progress, arg, stats);
+		if (res == FR_OK)
+			res = ftp_tree_remove(from, progress, arg, &removed);
+		return res;
+	}
+#endif
+
+#if FTP_SPACE == 1
+	// what is moved, the directory usage follows it
+	FILINFO nfo;
+	if (ftps_f_stat(from, &nfo) != FR_OK)
+		nfo.fattrib = AM_DIR;
+#endif
+
+	res = ftps_f_rename(from, to);
+
+#if FTP_SPACE == 1
+	if (res == FR_OK)
+		ftp_space_rename(from, to, &nfo);
+#endif
+
+	return res;
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * ftp_tree.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_TREE_H_
+#define _FTP_TREE_H_
+
+#include <stdint.h>
+#include "ftp_port.h"
+
+// copy, remove and move whole trees on the device, 0 compiles it out
+#ifndef FTP_TREE
+#define FTP_TREE					0
+#endif
+
+// buffer of a copy from the heap. Larger buffers make fewer and longer
+// card requests, FTP_DATA_BUF_SIZE is what a transfer uses (bytes).
+#define FTP_TREE_BUF_SIZE			8192
+
+// time between two progress lines to the client (ms)
+#define FTP_TREE_PROGRESS_MS		2000
+
+// what an operation did so far
+typedef struct {
+	uint32_t files;
+	uint32_t dirs;
+	uint64_t bytes;
+} ftp_tree_stats_t;
+
+/**
+ * Called after every entry and every block that is copied, to give the
+ * CPU away and to report progress.
+ *
+ * @param arg Argument given to the operation
+ * @param stats What was done so far
+ * @param bytes Bytes copied since the last call
+ */
+typedef void (*ftp_tree_progress_t)(void *arg, const ftp_tree_stats_t *stats, uint32_t bytes);
+
+/**
+ * Copy a file or a directory with everything below it. Files keep their
+ * time stamp.
+ *
+ * @param from Full path of the origin
+ * @param to Full path of the copy, must not exist
+ * @param progress Called as the copy goes, may be NULL
+ * @param arg Passed to progress
+ * @param stats Counters, cleared first
+ * @return FR_OK, FR_NO_FILE if from doesn't exist, FR_EXIST if to does,
+ * FR_DENIED if to is inside from, FR_NOT_ENOUGH_CORE or the error of the
+ * file system. A failed copy leaves what was copied so far.
+ */
+FRESULT ftp_tree_copy(const char *from, const char *to, ftp_tree_progress_t progress, void *arg, ftp_tree_stats_t *stats);
+
+/**
+ * Remove a file or a directory with everything below it.
+ *
+ * @param path Full path
+ * @param progress Called as the removal goes, may be NULL
+ * @param arg Passed to progress
+ * @param stats Counters, cleared first
+ * @return FR_OK, FR_NO_FILE if path doesn't exist, FR_DENIED if another
+ * volume is mounted below path or the error of the file system
+ */
+FRESULT ftp_tree_remove(const char *path, ftp_tree_progress_t progress, void *arg, ftp_tree_stats_t *stats);
+
+/**
+ * Rename a file or a directory. Between two volumes it is copied and
+ * the origin removed.
+ *
+ * @param from Full path of the origin
+ * @param to Full new path, must not exist
+ * @param progress Called while copying, may be NULL
+ * @param arg Passed to progress
+ * @param stats Counters, cleared first
+ * @return FR_OK or an error like ftp_tree_copy
+ */
+FRESULT ftp_tree_move(const char *from, const char *to, ftp_tree_progress_t progress, void *arg, ftp_tree_stats_t *stats);
+
+#endif // _FTP_TREE_H_
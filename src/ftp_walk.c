@@ -0,0 +1,125 @@
+/*
+ * ftp_walk.c
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include "ftp.h"
+#include "ftp_walk.h"
+#include "ftp_file.h"
+
+#include "FreeRTOS.h"
+
+#include <string.h>
+
+// state of a walk
+typedef struct {
+	// path of the entry at hand
+	char path[FTP_CWD_SIZE];
+
+	// length of the path of each open directory
+	uint16_t len[FTP_WALK_DEPTH];
+
+	// open directories, [0] is the root
+	ftp_dir_t dir[FTP_WALK_DEPTH];
+
+	FILINFO nfo;
+} ftp_walk_t;
+
+// append a name to the path, 0 if it doesn't fit
+static uint8_t ftp_walk_append(ftp_walk_t *w, uint16_t len, const char *name) {
+	uint16_t sep = len > 0 && w->path[len - 1] == '/' ? 0 : 1;
+	size_t name_len = strlen(name);
+
+	// room for separator, name and terminator?
+	if (len + sep + name_len + 1 > sizeof(w->path))
+		return 0;
+
+	if (sep)
+		w->path[len++] = '/';
+	memcpy(w->path + len, name, name_len + 1);
+	return 1;
+}
+
+int ftp_walk(const char *root, ftp_walk_cb_t cb, void *arg) {
+	int level = 0;
+	int ret = FTP_WALK_DONE;
+
+	// root too long?
+	if (strlen(root) >= FTP_CWD_SIZE)
+		return FTP_WALK_ERROR;
+
+	ftp_walk_t *w = pvPortMalloc(sizeof(ftp_walk_t));
+	if (w == NULL)
+		return FTP_WALK_ERROR;
+
+	strcpy(w->path, root);
+	w->len[0] = strlen(root);
+
+	if (ftps_f_opendir(&w->dir[0], w->path) != FR_OK) {
+		vPortFree(w);
+		return FTP_WALK_ERROR;
+	}
+
+	while (level >= 0) {
+		// read error, close what is open
+		if (ftps_f_readdir(&w->dir[level], &w->nfo) != FR_OK) {
+			ret = FTP_WALK_ERROR;
+			break;
+		}
+
+		// end of this directory, back to its parent
+		if (w->nfo.fname[0] == 0) {
+			ftps_f_closedir(&w->dir[level]);
+			w->path[w->len[level]] = 0;
+
+			// tell the callback the directory is left
+			if (level-- > 0 && cb(arg, w->path, NULL, level) == FTP_WALK_STOP)
+				ret = FTP_WALK_STOPPED;
+
+			// back to the path of the parent
+			if (level >= 0)
+				w->path[w->len[level]] = 0;
+
+			if (ret != FTP_WALK_DONE)
+				break;
+			continue;
+		}
+
+		// the directory itself and its parent
+		if (!strcmp(w->nfo.fname, ".") || !strcmp(w->nfo.fname, ".."))
+			continue;
+
+		if (!ftp_walk_append(w, w->len[level], w->nfo.fname)) {
+			ret = FTP_WALK_ERROR;
+			break;
+		}
+
+		int next = cb(arg, w->path, &w->nfo, level);
+		if (next == FTP_WALK_STOP) {
+			ret = FTP_WALK_STOPPED;
+			break;
+		}
+
+		// go down into a directory
+		if ((w->nfo.fattrib & AM_DIR) && next == FTP_WALK_CONTINUE) {
+			if (level + 1 >= FTP_WALK_DEPTH || ftps_f_opendir(&w->dir[level + 1], w->path) != FR_OK) {
+				ret = FTP_WALK_ERROR;
+				break;
+			}
+			level++;
+			w->len[level] = strlen(w->path);
+			continue;
+		}
+
+		// next entry of the same directory
+		w->path[w->len[level]] = 0;
+	}
+
+	// walk ended early, close the directories that are still open
+	while (level >= 0)
+		ftps_f_closedir(&w->dir[level--]);
+
+	vPortFree(w);
+	return ret;
+}
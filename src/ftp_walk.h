@@ -0,0 +1,53 @@
+/*
+ * ftp_walk.h
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _FTP_WALK_H_
+#define _FTP_WALK_H_
+
+#include <stdint.h>
+#include "ftp_port.h"
+
+// directory levels a walk goes down, every level keeps a directory open
+#define FTP_WALK_DEPTH				8
+
+// what the callback tells the walk
+#define FTP_WALK_CONTINUE			0
+#define FTP_WALK_SKIP				1
+#define FTP_WALK_STOP				2
+
+// result of a walk
+#define FTP_WALK_DONE				0
+#define FTP_WALK_STOPPED			1
+#define FTP_WALK_ERROR				-1
+
+/**
+ * Called for every entry below the root of a walk. A directory is
+ * reported twice, nfo is NULL the second time, after its entries and
+ * after it was closed, so it can be removed then.
+ *
+ * @param arg Argument given to ftp_walk
+ * @param path Full path of the entry, only valid during the call
+ * @param nfo File information, NULL when a directory is left
+ * @param depth 0 for entries of the root, 1 below, and so on
+ * @return FTP_WALK_CONTINUE, FTP_WALK_SKIP to not enter a directory or
+ * FTP_WALK_STOP to end the walk
+ */
+typedef int (*ftp_walk_cb_t)(void *arg, const char *path, const FILINFO *nfo, uint8_t depth);
+
+/**
+ * Walk a tree depth first. The state lives on the heap, the stack of
+ * the calling task only holds the callback.
+ *
+ * @param root Directory to walk, it is not reported itself
+ * @param cb Callback for every entry
+ * @param arg Passed to the callback
+ * @return FTP_WALK_DONE, FTP_WALK_STOPPED if the callback stopped the
+ * walk, FTP_WALK_ERROR if a directory could not be read, the tree is
+ * deeper than FTP_WALK_DEPTH, a path gets too long or there's no memory
+ */
+int ftp_walk(const char *root, ftp_walk_cb_t cb, void *arg);
+
+#endif // _FTP_WALK_H_